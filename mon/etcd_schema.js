@@ -198,6 +198,11 @@ const etcd_tree = {
                 primary_affinity_tags?: 'nvme' | [ 'nvme', ... ],
                 // scrub interval
                 scrub_interval?: '30d',
+                // total I/O limits of the pool on every primary OSD
+                qos_iops?: 0,
+                qos_bps?: 0,
+                qos_burst_iops?: 0,
+                qos_burst_bps?: 0,
             },
             ...
         }, */
@@ -226,6 +231,11 @@ const etcd_tree = {
                     parent_pool?: <pool_id>,
                     parent_id?: <inode_t>,
                     readonly?: boolean,
+                    // IOPS and bandwidth limits enforced by every primary OSD and client
+                    qos_iops?: uint64_t,
+                    qos_bps?: uint64_t,
+                    qos_burst_iops?: uint64_t,
+                    qos_burst_bps?: uint64_t,
                 }
             }
         }, */
@@ -259,6 +269,19 @@ const etcd_tree = {
                     degraded: { count: uint64_t, bytes: uint64_t },
                     misplaced: { count: uint64_t, bytes: uint64_t },
                 },
+                flush_stats: {
+                    count: uint64_t, versions: uint64_t, rewrites: uint64_t, delayed: uint64_t,
+                    trimmed_bytes: uint64_t, versions_per_flush: number, trimmed_per_flush: uint64_t,
+                    meta_writes: uint64_t, entries_per_meta_write: number,
+                },
+                // latency histograms since the previous report, only non-empty ones are reported
+                // buckets: [ [ lowest latency in the bucket (usec), count ], ... ]
+                latency: {
+                    op: { <string>: { count: uint64_t, usec: uint64_t, buckets: [ [ uint64_t, uint64_t ] ] } },
+                    subop: { <string>: { count: uint64_t, usec: uint64_t, buckets: [ [ uint64_t, uint64_t ] ] } },
+                    // queue_<op>: blockstore queue wait, journal: journal writes, sync: blockstore syncs
+                    blockstore: { <string>: { count: uint64_t, usec: uint64_t, buckets: [ [ uint64_t, uint64_t ] ] } },
+                },
             }, */
         },
         inodestats: {
@@ -267,6 +290,7 @@ const etcd_tree = {
                     read: { count: uint64_t, usec: uint64_t, bytes: uint64_t },
                     write: { count: uint64_t, usec: uint64_t, bytes: uint64_t },
                     delete: { count: uint64_t, usec: uint64_t, bytes: uint64_t },
+                    qos: { count: uint64_t, usec: uint64_t }, // ops delayed by QoS limits
                 },
             }, */
         },
@@ -328,6 +352,7 @@ const etcd_tree = {
                     read: { count: uint64_t, usec: uint64_t, bytes: uint64_t, bps: uint64_t, iops: uint64_t, lat: uint64_t },
                     write: { count: uint64_t, usec: uint64_t, bytes: uint64_t, bps: uint64_t, iops: uint64_t, lat: uint64_t },
                     delete: { count: uint64_t, usec: uint64_t, bytes: uint64_t, bps: uint64_t, iops: uint64_t, lat: uint64_t },
+                    qos: { count: uint64_t, usec: uint64_t },
                 },
             }, */
         },
@@ -152,6 +152,7 @@ function sum_inode_stats(state, prev_stats)
         read: { count: 0n, usec: 0n, bytes: 0n, bps: 0n, iops: 0n, lat: 0n },
         write: { count: 0n, usec: 0n, bytes: 0n, bps: 0n, iops: 0n, lat: 0n },
         delete: { count: 0n, usec: 0n, bytes: 0n, bps: 0n, iops: 0n, lat: 0n },
+        qos: { count: 0n, usec: 0n },
     });
     const seen_pools = {};
     for (const pool_id in state.config.pools)
@@ -207,6 +208,12 @@ function sum_inode_stats(state, prev_stats)
                     inode_stats[pool_id][inode_num][op].usec += BigInt(ist[pool_id][inode_num][op].usec||0);
                     inode_stats[pool_id][inode_num][op].bytes += BigInt(ist[pool_id][inode_num][op].bytes||0);
                 }
+                if (ist[pool_id][inode_num].qos)
+                {
+                    // Operations delayed by QoS limits and total delay
+                    inode_stats[pool_id][inode_num].qos.count += BigInt(ist[pool_id][inode_num].qos.count||0);
+                    inode_stats[pool_id][inode_num].qos.usec += BigInt(ist[pool_id][inode_num].qos.usec||0);
+                }
             }
         }
     }
@@ -48,6 +48,11 @@ int blockstore_t::read_bitmap(object_id oid, uint64_t target_version, void *bitm
     return impl->read_bitmap(oid, target_version, bitmap, result_version);
 }
 
+uint64_t blockstore_t::read_stable_version(object_id oid)
+{
+    return impl->read_stable_version(oid);
+}
+
 std::map<uint64_t, uint64_t> & blockstore_t::get_inode_space_stats()
 {
     return impl->inode_space_stats;
@@ -58,6 +63,16 @@ void blockstore_t::dump_diagnostics()
     return impl->dump_diagnostics();
 }
 
+const blockstore_flush_stats_t & blockstore_t::get_flush_stats()
+{
+    return impl->get_flush_stats();
+}
+
+blockstore_latency_stats_t & blockstore_t::get_latency_stats()
+{
+    return impl->latency_stats;
+}
+
 uint32_t blockstore_t::get_block_size()
 {
     return impl->get_block_size();
@@ -14,8 +14,10 @@
 #include <functional>
 
 #include "object_id.h"
+#include "mem_pool.h"
 #include "ringloop.h"
 #include "timerfd_manager.h"
+#include "latency_hist.h"
 
 // Memory alignment for direct I/O (usually 512 bytes)
 #ifndef DIRECT_IO_ALIGNMENT
@@ -176,10 +178,45 @@ struct blockstore_op_t
     int retval;
 
     uint8_t private_data[BS_OP_PRIVATE_DATA_SIZE];
+
+    MEM_POOL_OPERATORS
 };
 
 typedef std::map<std::string, std::string> blockstore_config_t;
 
+// Journal flusher statistics, all counters are cumulative
+struct blockstore_flush_stats_t
+{
+    // Objects flushed and dirty versions merged into these flushes
+    uint64_t flushed_objects, flushed_versions;
+    // Newer versions queued for flushing while the previous one was still waiting
+    uint64_t queued_rewrites;
+    // Flushes delayed because the object was still being rewritten
+    uint64_t delayed;
+    // Journal space freed by trimming
+    uint64_t trimmed_bytes;
+    // Metadata block writes and metadata entries updated by them
+    uint64_t meta_writes, meta_write_entries;
+};
+
+struct blockstore_latency_stats_t
+{
+    // Time from enqueue_op() to the first submission of an operation, by opcode
+    latency_hist_t queue[BS_OP_MAX+1];
+    // Duration of journal writes (sectors and small write data)
+    latency_hist_t journal;
+    // Total duration of BS_OP_SYNC
+    latency_hist_t sync;
+
+    void reset()
+    {
+        for (int i = 0; i <= BS_OP_MAX; i++)
+            queue[i].reset();
+        journal.reset();
+        sync.reset();
+    }
+};
+
 class blockstore_impl_t;
 
 class blockstore_t
@@ -213,6 +250,9 @@ public:
     // Simplified synchronous operation: get object bitmap & current version
     int read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version = NULL);
 
+    // Simplified synchronous operation: get the last stable version of an object, 0 if it's deleted or missing
+    uint64_t read_stable_version(object_id oid);
+
     // Get per-inode space usage statistics
     std::map<uint64_t, uint64_t> & get_inode_space_stats();
 
@@ -222,6 +262,12 @@ public:
     // Print diagnostics to stdout
     void dump_diagnostics();
 
+    // Get journal flusher statistics
+    const blockstore_flush_stats_t & get_flush_stats();
+
+    // Latency histograms, the caller may reset them
+    blockstore_latency_stats_t & get_latency_stats();
+
     uint32_t get_block_size();
     uint64_t get_block_count();
     uint64_t get_free_block_count();
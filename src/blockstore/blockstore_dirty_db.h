@@ -0,0 +1,186 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdlib.h>
+
+#include <map>
+#include <unordered_map>
+
+#include "object_id.h"
+#include "malloc_or_die.h"
+
+// Free-list allocator for node-based containers (std::map, std::unordered_map).
+// Nodes are carved from 64 KB slabs and returned to a per-thread free list, so
+// inserting or removing a dirty entry doesn't go through malloc/free. Slabs are
+// never released, the pool just stays at its high watermark.
+template<size_t item_size> struct node_pool_t
+{
+    static const size_t slab_size = 64*1024;
+    void *free_list = NULL;
+    uint8_t *slab = NULL;
+    size_t slab_pos = slab_size;
+    uint64_t allocated = 0;
+
+    void *alloc()
+    {
+        allocated++;
+        if (free_list)
+        {
+            void *r = free_list;
+            free_list = *(void**)r;
+            return r;
+        }
+        if (slab_pos + item_size > slab_size)
+        {
+            slab = (uint8_t*)malloc_or_die(slab_size);
+            slab_pos = 0;
+        }
+        void *r = slab + slab_pos;
+        slab_pos += item_size;
+        return r;
+    }
+
+    void free(void *p)
+    {
+        allocated--;
+        *(void**)p = free_list;
+        free_list = p;
+    }
+};
+
+template<class T> struct node_pool_allocator_t
+{
+    typedef T value_type;
+    // Round up to pointer size so that every slab item is aligned
+    static const size_t item_size = (sizeof(T) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+
+    node_pool_allocator_t() {}
+    template<class U> node_pool_allocator_t(const node_pool_allocator_t<U> & other) {}
+
+    static node_pool_t<item_size> & pool()
+    {
+        static thread_local node_pool_t<item_size> p;
+        return p;
+    }
+
+    T *allocate(size_t n)
+    {
+        // Only single nodes are pooled, hash bucket arrays use malloc
+        if (n != 1)
+            return (T*)malloc_or_die(n*sizeof(T));
+        return (T*)pool().alloc();
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n != 1)
+            ::free(p);
+        else
+            pool().free(p);
+    }
+};
+
+template<class T, class U> inline bool operator == (const node_pool_allocator_t<T> &, const node_pool_allocator_t<U> &)
+{
+    return true;
+}
+
+template<class T, class U> inline bool operator != (const node_pool_allocator_t<T> &, const node_pool_allocator_t<U> &)
+{
+    return false;
+}
+
+// Ordered obj_ver_id => V map with an additional object_id => latest version hash index.
+//
+// Almost every operation starts by looking up the latest version of an object
+// (upper_bound({ oid, UINT64_MAX }) and then --) which is a full tree walk with
+// a cache miss on every level. find_last() does the same with one hash lookup.
+// The ordered map is kept because listings and flushes walk ranges of versions
+// and objects, and because iterators must stay valid while other entries are
+// added and removed (the flusher and cancel_all_writes() hold them across erases).
+template<class V> class obj_ver_map_t
+{
+public:
+    typedef std::map<obj_ver_id, V, std::less<obj_ver_id>,
+        node_pool_allocator_t<std::pair<const obj_ver_id, V>>> map_t;
+    typedef typename map_t::iterator iterator;
+    typedef typename map_t::const_iterator const_iterator;
+    typedef typename map_t::value_type value_type;
+
+private:
+    map_t map;
+    std::unordered_map<object_id, iterator, std::hash<object_id>, std::equal_to<object_id>,
+        node_pool_allocator_t<std::pair<const object_id, iterator>>> last;
+
+public:
+    iterator begin() { return map.begin(); }
+    iterator end() { return map.end(); }
+    const_iterator begin() const { return map.begin(); }
+    const_iterator end() const { return map.end(); }
+    size_t size() const { return map.size(); }
+    bool empty() const { return map.empty(); }
+    // Number of distinct objects
+    size_t object_count() const { return last.size(); }
+
+    iterator find(const obj_ver_id & ov) { return map.find(ov); }
+    iterator lower_bound(const obj_ver_id & ov) { return map.lower_bound(ov); }
+    iterator upper_bound(const obj_ver_id & ov) { return map.upper_bound(ov); }
+    V & at(const obj_ver_id & ov) { return map.at(ov); }
+
+    V & operator[](const obj_ver_id & ov)
+    {
+        return emplace(ov, V()).first->second;
+    }
+
+    // Latest version of object <oid> or end()
+    iterator find_last(const object_id & oid)
+    {
+        auto li = last.find(oid);
+        return li == last.end() ? map.end() : li->second;
+    }
+
+    std::pair<iterator, bool> emplace(const obj_ver_id & ov, const V & v)
+    {
+        auto li = last.find(ov.oid);
+        if (li != last.end() && li->second->first.version < ov.version)
+        {
+            // New versions are almost always appended right after the latest one,
+            // so insert with a hint, it's amortized O(1) instead of a tree walk
+            auto it = map.emplace_hint(std::next(li->second), ov, v);
+            li->second = it;
+            return std::make_pair(it, true);
+        }
+        auto r = map.emplace(ov, v);
+        if (r.second && li == last.end())
+            last.emplace(ov.oid, r.first);
+        return r;
+    }
+
+    void erase(iterator it)
+    {
+        auto li = last.find(it->first.oid);
+        if (li->second == it)
+        {
+            // Removing the latest version: move the index to the previous one
+            if (it != map.begin() && std::prev(it)->first.oid == it->first.oid)
+                li->second = std::prev(it);
+            else
+                last.erase(li);
+        }
+        map.erase(it);
+    }
+
+    void erase(iterator from, iterator to)
+    {
+        while (from != to)
+            erase(from++);
+    }
+
+    void clear()
+    {
+        map.clear();
+        last.clear();
+    }
+};
@@ -1,6 +1,7 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+#include <limits.h>
 #include "blockstore_impl.h"
 
 #define META_BLOCK_UNREAD 0
@@ -58,6 +59,11 @@ journal_flusher_co::journal_flusher_co()
 
 journal_flusher_t::~journal_flusher_t()
 {
+    if (hot_timer_id >= 0)
+    {
+        bs->tfd->clear_timer(hot_timer_id);
+        hot_timer_id = -1;
+    }
     if (!bs->journal.inmemory)
         free(journal_superblock);
     delete[] co;
@@ -90,6 +96,14 @@ void journal_flusher_t::loop()
         co[0].try_trim = true;
     for (int i = 0; (active_flushers > 0 || dequeuing || trim_wanted > 0) && i < cur_flusher_count; i++)
         co[i].loop();
+    submit_meta_writes();
+}
+
+static uint64_t flusher_now_us()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec*1000000 + tv.tv_nsec/1000;
 }
 
 void journal_flusher_t::enqueue_flush(obj_ver_id ov)
@@ -100,12 +114,17 @@ void journal_flusher_t::enqueue_flush(obj_ver_id ov)
     auto it = flush_versions.find(ov.oid);
     if (it != flush_versions.end())
     {
-        if (it->second < ov.version)
-            it->second = ov.version;
+        if (it->second.version < ov.version)
+        {
+            // The object is rewritten before being flushed, both versions will be flushed at once
+            it->second.version = ov.version;
+            it->second.rewrite_us = flusher_now_us();
+            stats.queued_rewrites++;
+        }
     }
     else
     {
-        flush_versions[ov.oid] = ov.version;
+        flush_versions[ov.oid] = (flusher_queue_item_t){ .version = ov.version };
         flush_queue.push_back(ov.oid);
     }
     if (!dequeuing && (flush_queue.size() >= flusher_start_threshold || trim_wanted > 0))
@@ -123,17 +142,24 @@ void journal_flusher_t::unshift_flush(obj_ver_id ov, bool force)
     auto it = flush_versions.find(ov.oid);
     if (it != flush_versions.end())
     {
-        if (it->second < ov.version)
-            it->second = ov.version;
+        if (it->second.version < ov.version)
+            it->second.version = ov.version;
     }
     else
     {
-        flush_versions[ov.oid] = ov.version;
+        flush_versions[ov.oid] = (flusher_queue_item_t){ .version = ov.version };
         if (!force)
+        {
             flush_queue.push_front(ov.oid);
+            // Unshifted objects are flushed first, so they're not regrouped
+            grouped_count++;
+        }
     }
     if (force)
+    {
         flush_queue.push_front(ov.oid);
+        grouped_count++;
+    }
     if (force || !dequeuing && (flush_queue.size() >= flusher_start_threshold || trim_wanted > 0))
     {
         dequeuing = true;
@@ -154,6 +180,8 @@ void journal_flusher_t::remove_flush(object_id oid)
         {
             if (*q_it == oid)
             {
+                if ((uint64_t)(q_it-flush_queue.begin()) < grouped_count)
+                    grouped_count--;
                 flush_queue.erase(q_it);
                 break;
             }
@@ -173,6 +201,105 @@ bool journal_flusher_t::is_mutated(uint64_t clean_loc)
     return false;
 }
 
+// New location of the object on the data device: the location of its last big write or the current one
+uint64_t journal_flusher_t::get_flush_location(object_id oid)
+{
+    auto v_it = flush_versions.find(oid);
+    if (v_it != flush_versions.end())
+    {
+        auto dirty_it = bs->dirty_db.find((obj_ver_id){ .oid = oid, .version = v_it->second.version });
+        while (dirty_it != bs->dirty_db.end() && dirty_it->first.oid == oid && !IS_DELETE(dirty_it->second.state))
+        {
+            if (IS_BIG_WRITE(dirty_it->second.state))
+                return dirty_it->second.location;
+            if (dirty_it == bs->dirty_db.begin())
+                break;
+            dirty_it--;
+        }
+    }
+    auto & clean_db = bs->clean_db_shard(oid);
+    auto clean_it = clean_db.find(oid);
+    return clean_it != clean_db.end() ? clean_it->second.location : UINT64_MAX;
+}
+
+// Objects are flushed in journal order, but in batches of flusher_start_threshold objects
+// sorted by their location. Metadata entries are placed in the order of data blocks, so
+// coroutines flushing a batch at the same time update the same metadata blocks and share
+// their writes, and data writes go to close locations
+void journal_flusher_t::group_flush_queue()
+{
+    uint64_t n = flusher_start_threshold > cur_flusher_count ? flusher_start_threshold : cur_flusher_count;
+    if (n > flush_queue.size())
+        n = flush_queue.size();
+    std::vector<std::pair<uint64_t, object_id>> batch;
+    batch.reserve(n);
+    for (uint64_t i = 0; i < n; i++)
+        batch.push_back({ get_flush_location(flush_queue[i]), flush_queue[i] });
+    std::stable_sort(batch.begin(), batch.end(), [](const std::pair<uint64_t, object_id> & a, const std::pair<uint64_t, object_id> & b)
+    {
+        return a.first < b.first;
+    });
+    for (uint64_t i = 0; i < n; i++)
+        flush_queue[i] = batch[i].second;
+    grouped_count = n;
+}
+
+void journal_flusher_t::pop_flush_queue()
+{
+    flush_queue.pop_front();
+    if (grouped_count > 0)
+        grouped_count--;
+}
+
+// Journal is more than half full or someone waits for free journal space
+bool journal_flusher_t::is_journal_pressure()
+{
+    if (trim_wanted > 0)
+        return true;
+    uint64_t used = bs->journal.next_free >= bs->journal.used_start
+        ? bs->journal.next_free - bs->journal.used_start
+        : bs->journal.len - bs->journal.block_size - (bs->journal.used_start - bs->journal.next_free);
+    return used >= (bs->journal.len - bs->journal.block_size) / 2;
+}
+
+// Objects which are still being rewritten are flushed later to merge more versions in one flush.
+// An object is parked until flusher_hot_delay_us after the rewrite, at most once per queueing,
+// and only while the journal has enough free space
+bool journal_flusher_t::delay_hot_flush(flusher_queue_item_t & item)
+{
+    if (!bs->tfd || !bs->flusher_hot_delay_us || !item.rewrite_us || is_journal_pressure())
+    {
+        return false;
+    }
+    uint64_t now = flusher_now_us();
+    if (!item.delay_until_us)
+    {
+        if (now >= item.rewrite_us + bs->flusher_hot_delay_us)
+        {
+            return false;
+        }
+        item.delay_until_us = item.rewrite_us + bs->flusher_hot_delay_us;
+        stats.delayed++;
+    }
+    return now < item.delay_until_us;
+}
+
+// All queued objects are parked, so flushers stop and restart when the first one is due
+void journal_flusher_t::wake_after_hot_delay(uint64_t due_us)
+{
+    if (hot_timer_id >= 0)
+    {
+        bs->tfd->clear_timer(hot_timer_id);
+    }
+    uint64_t now = flusher_now_us();
+    hot_timer_id = bs->tfd->set_timer_us(due_us > now ? due_us-now : 1, false, [this](int timer_id)
+    {
+        hot_timer_id = -1;
+        dequeuing = true;
+        bs->ringloop->wakeup();
+    });
+}
+
 void journal_flusher_t::request_trim()
 {
     dequeuing = true;
@@ -202,7 +329,7 @@ void journal_flusher_t::dump_diagnostics()
     // Try to find out if there is a flushable object for information
     for (object_id cur_oid: flush_queue)
     {
-        obj_ver_id cur = { .oid = cur_oid, .version = flush_versions[cur_oid] };
+        obj_ver_id cur = { .oid = cur_oid, .version = flush_versions[cur_oid].version };
         auto dirty_end = bs->dirty_db.find(cur);
         if (dirty_end == bs->dirty_db.end())
         {
@@ -274,8 +401,8 @@ bool journal_flusher_t::try_find_other(std::map<obj_ver_id, dirty_entry>::iterat
     while (search_left > 0)
     {
         cur.oid = flush_queue.front();
-        cur.version = flush_versions[cur.oid];
-        flush_queue.pop_front();
+        cur.version = flush_versions[cur.oid].version;
+        pop_flush_queue();
         flush_versions.erase(cur.oid);
         dirty_end = bs->dirty_db.find(cur);
         if (dirty_end != bs->dirty_db.end())
@@ -328,6 +455,8 @@ bool journal_flusher_t::try_find_other(std::map<obj_ver_id, dirty_entry>::iterat
 bool journal_flusher_co::loop()
 {
     int wait_base = 0;
+    // Parked objects seen in a row and the earliest time when one of them is due
+    uint64_t parked = 0, parked_until = 0;
     // This is much better than implementing the whole function as an FSM
     // Maybe I should consider a coroutine library like https://github.com/hnes/libaco ...
     // Or just C++ coroutines, but they require some wrappers
@@ -378,9 +507,31 @@ stop_flusher:
         return true;
     }
     try_trim = true;
+    if (!flusher->grouped_count)
+        flusher->group_flush_queue();
     cur.oid = flusher->flush_queue.front();
-    cur.version = flusher->flush_versions[cur.oid];
-    flusher->flush_queue.pop_front();
+    flusher->pop_flush_queue();
+    {
+        auto & item = flusher->flush_versions[cur.oid];
+        if (flusher->delay_hot_flush(item))
+        {
+            // Park the object at the end of the queue until it's due
+            flusher->flush_queue.push_back(cur.oid);
+            if (!parked_until || parked_until > item.delay_until_us)
+                parked_until = item.delay_until_us;
+            if (++parked >= flusher->flush_queue.size())
+            {
+                // Everything is parked, don't spin
+                flusher->wake_after_hot_delay(parked_until);
+                goto stop_flusher;
+            }
+            wait_state = 0;
+            goto resume_0;
+        }
+        // Not parked, so the next parked object starts a new series
+        parked = parked_until = 0;
+        cur.version = item.version;
+    }
     flusher->flush_versions.erase(cur.oid);
     dirty_end = bs->dirty_db.find(cur);
     if (dirty_end != bs->dirty_db.end())
@@ -504,19 +655,34 @@ resume_2:
                 uo_it->second.was_changed = true;
             }
         }
-        // Submit data writes
-        for (it = v.begin(); it != v.end(); it++)
+        // Submit data writes, adjacent pieces are merged into one vectored write
+        data_iov.clear();
+        data_iov.reserve(v.size());
+        for (it = v.begin(); it != v.end(); )
         {
             if (it->copy_flags == COPY_BUF_JOURNAL || it->copy_flags == (COPY_BUF_JOURNAL|COPY_BUF_COALESCED))
             {
                 await_sqe(14);
-                data->iov = (struct iovec){ it->buf, (size_t)it->len };
-                data->callback = simple_callback_w;
-                my_uring_prep_writev(
-                    sqe, bs->dsk.data_fd, &data->iov, 1, bs->dsk.data_offset + clean_loc + it->offset
-                );
-                wait_count++;
+                {
+                    int iov_start = data_iov.size();
+                    uint64_t write_offset = it->offset, write_len = 0;
+                    do
+                    {
+                        data_iov.push_back((struct iovec){ it->buf, (size_t)it->len });
+                        write_len += it->len;
+                        it++;
+                    } while (it != v.end() && data_iov.size()-iov_start < IOV_MAX &&
+                        (it->copy_flags == COPY_BUF_JOURNAL || it->copy_flags == (COPY_BUF_JOURNAL|COPY_BUF_COALESCED)) &&
+                        it->offset == write_offset+write_len);
+                    data->iov.iov_len = write_len; // to check it in the callback
+                    data->callback = simple_callback_w;
+                    bs->prep_writev(sqe, bs->dsk.data_fd, data_iov.data()+iov_start, data_iov.size()-iov_start,
+                        bs->dsk.data_offset + clean_loc + write_offset);
+                    wait_count++;
+                }
             }
+            else
+                it++;
         }
         // Wait for data writes and metadata reads
     resume_15:
@@ -549,12 +715,11 @@ resume_2:
             }
             memset((uint8_t*)meta_old.buf + meta_old.pos*bs->dsk.clean_entry_size, 0, bs->dsk.clean_entry_size);
     resume_20:
-            if (meta_old.sector != meta_new.sector && !write_meta_block(meta_old, 20))
-                return false;
+            if (meta_old.sector != meta_new.sector)
+                write_meta_block(meta_old);
         }
     resume_21:
-        if (!write_meta_block(meta_new, 21))
-            return false;
+        write_meta_block(meta_new);
     resume_22:
         if (wait_count > 0)
         {
@@ -572,6 +737,9 @@ resume_2:
         // Free the data block only when metadata is synced
         free_data_blocks();
         // Erase dirty_db entries
+        flusher->stats.flushed_objects++;
+        for (dirty_it = dirty_start; dirty_it != std::next(dirty_end); dirty_it++)
+            flusher->stats.flushed_versions++;
         bs->erase_dirty(dirty_start, std::next(dirty_end), clean_loc);
 #ifdef BLOCKSTORE_DEBUG
         printf("Flushed %jx:%jx v%ju (%d copies, wr:%d, del:%d), %jd left\n", cur.oid.inode, cur.oid.stripe, cur.version,
@@ -703,24 +871,49 @@ void journal_flusher_co::free_buffers()
         if (it->buf && (it->copy_flags == COPY_BUF_JOURNAL || (it->copy_flags & COPY_BUF_CSUM_FILL)) &&
             (!bs->journal.inmemory || it->buf < bs->journal.buffer || it->buf >= (uint8_t*)bs->journal.buffer + bs->journal.len))
         {
-            free(it->buf);
+            bs->free_io_buffer(it->buf);
         }
     }
     v.clear();
 }
 
-bool journal_flusher_co::write_meta_block(flusher_meta_write_t & meta_block, int wait_base)
+// Metadata blocks are written by journal_flusher_t::submit_meta_writes() after all coroutines
+// are run, so coroutines which modify entries in the same block in one loop iteration (for
+// example, after the same fsync batch) share one write of that block
+void journal_flusher_co::write_meta_block(flusher_meta_write_t & meta_block)
 {
-    if (wait_state == wait_base)
-        goto resume_0;
-    await_sqe(0);
-    data->iov = (struct iovec){ meta_block.buf, (size_t)bs->dsk.meta_block_size };
-    data->callback = simple_callback_w;
-    my_uring_prep_writev(
-        sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bs->dsk.meta_block_size + meta_block.sector
-    );
+    auto & wr = flusher->meta_writes[meta_block.sector];
+    wr.buf = meta_block.buf;
+    wr.waiters.push_back(this);
     wait_count++;
-    return true;
+}
+
+void journal_flusher_t::submit_meta_writes()
+{
+    while (meta_writes.size())
+    {
+        auto wr_it = meta_writes.begin();
+        io_uring_sqe *sqe = bs->get_sqe();
+        if (!sqe)
+        {
+            // Retry in the next loop iteration, waiting coroutines keep the flusher active
+            return;
+        }
+        ring_data_t *data = ((ring_data_t*)sqe->user_data);
+        data->iov = (struct iovec){ wr_it->second.buf, (size_t)bs->dsk.meta_block_size };
+        stats.meta_writes++;
+        stats.meta_write_entries += wr_it->second.waiters.size();
+        data->callback = [this, waiters = std::move(wr_it->second.waiters)](ring_data_t *data)
+        {
+            bs->live = true;
+            if (data->res != data->iov.iov_len)
+                bs->disk_error_abort("write operation during flush", data->res, data->iov.iov_len);
+            for (auto co: waiters)
+                co->wait_count--;
+        };
+        bs->prep_rw(sqe, true, bs->dsk.meta_fd, &data->iov, bs->dsk.meta_offset + bs->dsk.meta_block_size + wr_it->first);
+        meta_writes.erase(wr_it);
+    }
 }
 
 // Punch holes in incomplete checksum blocks
@@ -838,8 +1031,7 @@ bool journal_flusher_co::clear_incomplete_csum_block_bits(int wait_base)
         }
         // Write and fsync the modified metadata entry
     resume_3:
-        if (!write_meta_block(meta_new, wait_base+3))
-            return false;
+        write_meta_block(meta_new);
     resume_4:
         if (wait_count > 0)
         {
@@ -1087,12 +1279,10 @@ bool journal_flusher_co::read_dirty(int wait_base)
         await_sqe(0);
         auto & vi = v[v.size()-i];
         assert(vi.len != 0);
-        vi.buf = memalign_or_die(MEM_ALIGNMENT, vi.len);
+        vi.buf = bs->alloc_io_buffer(vi.len);
         data->iov = (struct iovec){ vi.buf, (size_t)vi.len };
         data->callback = simple_callback_r;
-        my_uring_prep_readv(
-            sqe, bs->dsk.data_fd, &data->iov, 1, bs->dsk.data_offset + old_clean_loc + vi.offset
-        );
+        bs->prep_rw(sqe, false, bs->dsk.data_fd, &data->iov, bs->dsk.data_offset + old_clean_loc + vi.offset);
         wait_count++;
         bs->find_holes(v, vi.offset, vi.offset+vi.len, [this, buf = (uint8_t*)vi.buf-vi.offset](int pos, bool alloc, uint32_t cur_start, uint32_t cur_end)
         {
@@ -1118,13 +1308,11 @@ bool journal_flusher_co::read_dirty(int wait_base)
             {
                 // Read journal data from disk
                 if (!v[i].buf)
-                    v[i].buf = memalign_or_die(MEM_ALIGNMENT, v[i].len);
+                    v[i].buf = bs->alloc_io_buffer(v[i].len);
                 await_sqe(1);
                 data->iov = (struct iovec){ v[i].buf, (size_t)v[i].len };
                 data->callback = simple_callback_rj;
-                my_uring_prep_readv(
-                    sqe, bs->dsk.journal_fd, &data->iov, 1, bs->journal.offset + v[i].disk_offset
-                );
+                bs->prep_rw(sqe, false, bs->dsk.journal_fd, &data->iov, bs->journal.offset + v[i].disk_offset);
                 wait_journal_count++;
             }
         }
@@ -1215,9 +1403,7 @@ bool journal_flusher_co::modify_meta_read(uint64_t meta_loc, flusher_meta_write_
         data->iov = (struct iovec){ wr.it->second.buf, (size_t)bs->dsk.meta_block_size };
         data->callback = simple_callback_r;
         wr.submitted = true;
-        my_uring_prep_readv(
-            sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bs->dsk.meta_block_size + wr.sector
-        );
+        bs->prep_rw(sqe, false, bs->dsk.meta_fd, &data->iov, bs->dsk.meta_offset + bs->dsk.meta_block_size + wr.sector);
         wait_count++;
     }
     else
@@ -1383,7 +1569,7 @@ bool journal_flusher_co::trim_journal(int wait_base)
             ((journal_entry_start*)flusher->journal_superblock)->crc32 = je_crc32((journal_entry*)flusher->journal_superblock);
             data->iov = (struct iovec){ flusher->journal_superblock, (size_t)bs->dsk.journal_block_size };
             data->callback = simple_callback_w;
-            my_uring_prep_writev(sqe, bs->dsk.journal_fd, &data->iov, 1, bs->journal.offset);
+            bs->prep_rw(sqe, true, bs->dsk.journal_fd, &data->iov, bs->journal.offset);
             wait_count++;
         resume_2:
             if (wait_count > 0)
@@ -1411,6 +1597,9 @@ bool journal_flusher_co::trim_journal(int wait_base)
             {
                 bs->journal.dirty_start = new_trim_pos;
             }
+            flusher->stats.trimmed_bytes += new_trim_pos >= bs->journal.used_start
+                ? new_trim_pos - bs->journal.used_start
+                : bs->journal.len - bs->journal.block_size - (bs->journal.used_start - new_trim_pos);
             bs->journal.used_start = new_trim_pos;
 #ifdef BLOCKSTORE_DEBUG
             printf("Journal trimmed to %08jx (next_free=%08jx dirty_start=%08jx)\n", bs->journal.used_start, bs->journal.next_free, bs->journal.dirty_start);
@@ -43,6 +43,23 @@ struct flusher_meta_write_t
 };
 
 class journal_flusher_t;
+class journal_flusher_co;
+
+struct flusher_queue_item_t
+{
+    uint64_t version;
+    // Time when a newer version was queued while the object was waiting, 0 if it wasn't
+    uint64_t rewrite_us;
+    // The object is parked in the queue until this time after a rewrite, 0 if it wasn't delayed
+    uint64_t delay_until_us;
+};
+
+// Write of one metadata block shared by all coroutines which modified it
+struct flusher_meta_block_write_t
+{
+    void *buf;
+    std::vector<journal_flusher_co*> waiters;
+};
 
 // Journal flusher coroutine
 class journal_flusher_co
@@ -56,7 +73,7 @@ class journal_flusher_co
     std::list<flusher_sync_t>::iterator cur_sync;
 
     obj_ver_id cur;
-    std::map<obj_ver_id, dirty_entry>::iterator dirty_it, dirty_start, dirty_end;
+    blockstore_dirty_db_t::iterator dirty_it, dirty_start, dirty_end;
     std::map<object_id, uint64_t>::iterator repeat_it;
     std::function<void(ring_data_t*)> simple_callback_r, simple_callback_rj, simple_callback_w;
 
@@ -64,6 +81,7 @@ class journal_flusher_co
     bool skip_copy, has_delete, has_writes;
     std::vector<copy_buffer_t> v;
     std::vector<copy_buffer_t>::iterator it;
+    std::vector<iovec> data_iov;
     int i;
     bool fill_incomplete, cleared_incomplete;
     int read_to_fill_incomplete;
@@ -86,7 +104,7 @@ class journal_flusher_co
     bool clear_incomplete_csum_block_bits(int wait_base);
     void calc_block_checksums(uint32_t *new_data_csums, bool skip_overwrites);
     void update_metadata_entry();
-    bool write_meta_block(flusher_meta_write_t & meta_block, int wait_base);
+    void write_meta_block(flusher_meta_write_t & meta_block);
     void update_clean_db();
     void free_data_blocks();
     bool fsync_batch(bool fsync_meta, int wait_base);
@@ -118,11 +136,23 @@ class journal_flusher_t
     std::map<object_id, uint64_t> sync_to_repeat;
 
     std::map<uint64_t, meta_sector_t> meta_sectors;
+    std::map<uint64_t, flusher_meta_block_write_t> meta_writes;
     std::deque<object_id> flush_queue;
-    std::map<object_id, uint64_t> flush_versions; // FIXME: consider unordered_map?
+    // Number of objects in the beginning of flush_queue already sorted by location
+    uint64_t grouped_count = 0;
+    std::map<object_id, flusher_queue_item_t> flush_versions; // FIXME: consider unordered_map?
+    blockstore_flush_stats_t stats = {};
+    int hot_timer_id = -1;
 
     bool try_find_older(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur);
     bool try_find_other(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur);
+    uint64_t get_flush_location(object_id oid);
+    void group_flush_queue();
+    void pop_flush_queue();
+    void submit_meta_writes();
+    bool is_journal_pressure();
+    bool delay_hot_flush(flusher_queue_item_t & item);
+    void wake_after_hot_delay(uint64_t due_us);
 
 public:
     journal_flusher_t(blockstore_impl_t *bs);
@@ -138,4 +168,5 @@ public:
     void remove_flush(object_id oid);
     void dump_diagnostics();
     bool is_mutated(uint64_t clean_loc);
+    const blockstore_flush_stats_t & get_stats() { return stats; }
 };
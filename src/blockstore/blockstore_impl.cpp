@@ -21,6 +21,7 @@ blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *
         dsk.open_journal();
         calc_lengths();
         data_alloc = new allocator(dsk.block_count);
+        register_fixed_io();
     }
     catch (std::exception & e)
     {
@@ -36,6 +37,7 @@ blockstore_impl_t::~blockstore_impl_t()
     delete flusher;
     free(zero_object);
     ringloop->unregister_consumer(&ring_consumer);
+    unregister_fixed_io();
     dsk.close_all();
     if (metadata_buffer)
         free(metadata_buffer);
@@ -133,6 +135,8 @@ void blockstore_impl_t::loop()
                 }
             }
             unsigned prev_sqe_pos = ringloop->save();
+            const uint64_t opcode = op->opcode, enqueue_us = PRIV(op)->enqueue_us;
+            const bool dequeued = PRIV(op)->dequeue_us != 0;
             // 0 = can't submit
             // 1 = in progress
             // 2 = can be removed from queue
@@ -182,6 +186,15 @@ void blockstore_impl_t::loop()
                 process_list(op);
                 wr_st = 2;
             }
+            if (wr_st != 0 && !dequeued)
+            {
+                // Operation is submitted for the first time, measure its queue wait
+                // (the operation may already be freed if wr_st == 2)
+                uint64_t now = latency_now_us();
+                latency_stats.queue[opcode].add(now - enqueue_us);
+                if (wr_st == 1)
+                    PRIV(op)->dequeue_us = now;
+            }
             if (wr_st == 2)
             {
                 submit_queue[op_idx] = NULL;
@@ -396,6 +409,8 @@ void blockstore_impl_t::init_op(blockstore_op_t *op)
     PRIV(op)->wait_for = 0;
     PRIV(op)->op_state = 0;
     PRIV(op)->pending_ops = 0;
+    PRIV(op)->enqueue_us = latency_now_us();
+    PRIV(op)->dequeue_us = 0;
 }
 
 static bool replace_stable(object_id oid, uint64_t version, int search_start, int search_end, obj_ver_id* list)
@@ -721,6 +736,11 @@ void blockstore_impl_t::dump_diagnostics()
     flusher->dump_diagnostics();
 }
 
+const blockstore_flush_stats_t & blockstore_impl_t::get_flush_stats()
+{
+    return flusher->get_stats();
+}
+
 void blockstore_impl_t::disk_error_abort(const char *op, int retval, int expected)
 {
     if (retval == -EAGAIN)
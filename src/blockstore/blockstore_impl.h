@@ -22,8 +22,11 @@
 
 #include "cpp-btree/btree_map.h"
 
+#include "blockstore_dirty_db.h"
+
 #include "malloc_or_die.h"
 #include "allocator.h"
+#include "worker_pool.h"
 
 //#define BLOCKSTORE_DEBUG
 
@@ -189,7 +192,7 @@ struct used_clean_obj_t
 // https://github.com/greg7mdp/sparsepp/ was used previously, but it was TERRIBLY slow after resizing
 // with sparsepp, random reads dropped to ~700 iops very fast with just as much as ~32k objects in the DB
 typedef btree::btree_map<object_id, clean_entry> blockstore_clean_db_t;
-typedef std::map<obj_ver_id, dirty_entry> blockstore_dirty_db_t;
+typedef obj_ver_map_t<dirty_entry> blockstore_dirty_db_t;
 
 #include "blockstore_init.h"
 
@@ -219,6 +222,9 @@ struct blockstore_op_private_t
     uint64_t real_version;
     timespec tv_begin;
 
+    // Latency statistics
+    uint64_t enqueue_us, dequeue_us;
+
     // Sync
     std::vector<obj_ver_id> sync_big_writes, sync_small_writes;
 };
@@ -254,6 +260,8 @@ class blockstore_impl_t
     // Maximum and minimum flusher count
     unsigned max_flusher_count, min_flusher_count;
     unsigned journal_trim_interval;
+    // Delay flushes of objects rewritten during the last <flusher_hot_delay_us> while the journal is less than half full
+    uint64_t flusher_hot_delay_us = 100000;
     // Maximum queue depth
     unsigned max_write_iodepth = 128;
     // Enable small (journaled) write throttling, useful for the SSD+HDD case
@@ -266,6 +274,12 @@ class blockstore_impl_t
     int throttle_threshold_us = 50;
     // Maximum writes between automatically added fsync operations
     uint64_t autosync_writes = 128;
+    // Use registered buffers and files for io_uring operations
+    bool use_fixed_io = false;
+    // Size of the registered flusher buffer pool
+    uint64_t fixed_io_pool_size = 0;
+    // Threads checking and sorting metadata entries during startup, 0 = parse in the event loop
+    int meta_load_threads = 0;
     /******* END OF OPTIONS *******/
 
     struct ring_consumer_t ring_consumer;
@@ -285,6 +299,12 @@ class blockstore_impl_t
 
     void *metadata_buffer = NULL;
 
+    // Registered buffers and files
+    std::vector<iovec> fixed_bufs;
+    std::vector<int> fixed_fds;
+    uint8_t *fixed_pool = NULL;
+    std::vector<void*> fixed_pool_free;
+
     struct journal_t journal;
     journal_flusher_t *flusher;
     int big_to_flush = 0;
@@ -312,6 +332,15 @@ class blockstore_impl_t
     friend class journal_flusher_co;
 
     void calc_lengths();
+    void register_fixed_io();
+    void unregister_fixed_io();
+    int find_fixed_buffer(void *buf, size_t len);
+    void use_fixed_file(io_uring_sqe *sqe);
+    void prep_rw(io_uring_sqe *sqe, bool write, int fd, iovec *iov, uint64_t offset);
+    void prep_readv(io_uring_sqe *sqe, int fd, iovec *iov, int iovcnt, uint64_t offset);
+    void prep_writev(io_uring_sqe *sqe, int fd, iovec *iov, int iovcnt, uint64_t offset);
+    void *alloc_io_buffer(uint64_t len);
+    void free_io_buffer(void *buf);
     void open_data();
     void open_meta();
     void open_journal();
@@ -323,7 +352,7 @@ class blockstore_impl_t
 
     // Journaling
     void prepare_journal_sector_write(int sector, blockstore_op_t *op);
-    void handle_journal_write(ring_data_t *data, uint64_t flush_id);
+    void handle_journal_write(ring_data_t *data, uint64_t flush_id, uint64_t submit_us);
     void disk_error_abort(const char *op, int retval, int expected);
 
     // Asynchronous init
@@ -424,6 +453,9 @@ public:
     // Simplified synchronous operation: get object bitmap & current version
     int read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version = NULL);
 
+    // Simplified synchronous operation: get the last stable version of an object, 0 if it's deleted or missing
+    uint64_t read_stable_version(object_id oid);
+
     // Unstable writes are added here (map of object_id -> version)
     std::unordered_map<object_id, uint64_t> unstable_writes;
 
@@ -436,6 +468,11 @@ public:
     // Print diagnostics to stdout
     void dump_diagnostics();
 
+    // Journal flusher statistics
+    const blockstore_flush_stats_t & get_flush_stats();
+    // Queue wait, journal write and sync latency histograms
+    blockstore_latency_stats_t latency_stats;
+
     inline uint32_t get_block_size() { return dsk.data_block_size; }
     inline uint64_t get_block_count() { return dsk.block_count; }
     inline uint64_t get_free_block_count() { return dsk.block_count - used_blocks; }
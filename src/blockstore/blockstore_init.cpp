@@ -7,6 +7,8 @@
 #define INIT_META_READING 1
 #define INIT_META_READ_DONE 2
 #define INIT_META_WRITING 3
+#define INIT_META_PARSING 4
+#define INIT_META_PARSED 5
 
 #define GET_SQE() \
     sqe = bs->get_sqe();\
@@ -25,6 +27,21 @@ static bool iszero(uint64_t *buf, int len)
 blockstore_init_meta::blockstore_init_meta(blockstore_impl_t *bs)
 {
     this->bs = bs;
+    if (bs->meta_load_threads > 0 && bs->tfd)
+    {
+        parse_pool = new worker_pool_t(bs->meta_load_threads, bs->tfd->set_fd_handler);
+    }
+    // Keep enough reads in flight to load all parser threads
+    bufs.resize(bs->meta_load_threads > 0 ? 2*bs->meta_load_threads+2 : 2);
+}
+
+blockstore_init_meta::~blockstore_init_meta()
+{
+    if (parse_pool)
+    {
+        delete parse_pool;
+        parse_pool = NULL;
+    }
 }
 
 void blockstore_init_meta::handle_event(ring_data_t *data, int buf_num)
@@ -58,7 +75,7 @@ int blockstore_init_meta::loop()
     if (bs->inmemory_meta)
         metadata_buffer = bs->metadata_buffer;
     else
-        metadata_buffer = memalign(MEM_ALIGNMENT, 2*bs->metadata_buf_size);
+        metadata_buffer = memalign(MEM_ALIGNMENT, bufs.size()*bs->metadata_buf_size);
     if (!metadata_buffer)
         throw std::runtime_error("Failed to allocate metadata read buffer");
     // Read superblock
@@ -181,62 +198,77 @@ resume_1:
     // Skip superblock
     md_offset = bs->dsk.meta_block_size;
     next_offset = md_offset;
+    apply_offset = md_offset;
     entries_per_block = bs->dsk.meta_block_size / bs->dsk.clean_entry_size;
-    // Read the rest of the metadata
+    // Read the rest of the metadata. Buffers are read in parallel, then checked and sorted
+    // in parser threads, then applied to clean_db in the order of their offsets
 resume_2:
-    if (next_offset < bs->dsk.meta_len && submitted == 0)
+    for (i = 0; i < bufs.size() && next_offset < bs->dsk.meta_len; i++)
     {
-        // Submit one read
-        for (int i = 0; i < 2; i++)
+        if (bufs[i].state == INIT_META_EMPTY)
         {
-            if (!bufs[i].state)
+            bufs[i].buf = (uint8_t*)metadata_buffer + (bs->inmemory_meta
+                ? next_offset-md_offset
+                : i*bs->metadata_buf_size);
+            bufs[i].offset = next_offset;
+            bufs[i].size = bs->dsk.meta_len-next_offset > bs->metadata_buf_size
+                ? bs->metadata_buf_size : bs->dsk.meta_len-next_offset;
+            bufs[i].state = INIT_META_READING;
+            submitted++;
+            next_offset += bufs[i].size;
+            GET_SQE();
+            assert(bufs[i].size <= 0x7fffffff);
+            data->iov = { bufs[i].buf, (size_t)bufs[i].size };
+            data->callback = [this, buf_num = i](ring_data_t *data) { handle_event(data, buf_num); };
+            if (!zero_on_init)
+                my_uring_prep_readv(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
+            else
             {
-                bufs[i].buf = (uint8_t*)metadata_buffer + (bs->inmemory_meta
-                    ? next_offset-md_offset
-                    : i*bs->metadata_buf_size);
-                bufs[i].offset = next_offset;
-                bufs[i].size = bs->dsk.meta_len-next_offset > bs->metadata_buf_size
-                    ? bs->metadata_buf_size : bs->dsk.meta_len-next_offset;
-                bufs[i].state = INIT_META_READING;
-                submitted++;
-                next_offset += bufs[i].size;
-                GET_SQE();
-                assert(bufs[i].size <= 0x7fffffff);
-                data->iov = { bufs[i].buf, (size_t)bufs[i].size };
-                data->callback = [this, i](ring_data_t *data) { handle_event(data, i); };
-                if (!zero_on_init)
-                    my_uring_prep_readv(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
-                else
-                {
-                    // Fill metadata with zeroes
-                    memset(data->iov.iov_base, 0, data->iov.iov_len);
-                    my_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
-                }
-                bs->ringloop->submit();
-                break;
+                // Fill metadata with zeroes
+                memset(data->iov.iov_base, 0, data->iov.iov_len);
+                my_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
             }
         }
     }
-    for (int i = 0; i < 2; i++)
+    bs->ringloop->submit();
+    for (i = 0; i < bufs.size(); i++)
     {
         if (bufs[i].state == INIT_META_READ_DONE)
         {
-            // Handle result
-            bool changed = false;
-            for (uint64_t sector = 0; sector < bufs[i].size; sector += bs->dsk.meta_block_size)
+            if (parse_pool)
             {
-                // handle <count> entries
-                if (handle_meta_block(bufs[i].buf + sector, entries_per_block,
-                    ((bufs[i].offset + sector - md_offset) / bs->dsk.meta_block_size) * entries_per_block))
-                    changed = true;
+                bufs[i].state = INIT_META_PARSING;
+                parsing++;
+                parse_pool->submit([this, buf_num = i]()
+                {
+                    parse_meta_buf(bufs[buf_num]);
+                }, [this, buf_num = i]()
+                {
+                    bufs[buf_num].state = INIT_META_PARSED;
+                    parsing--;
+                    bs->ringloop->wakeup();
+                });
             }
-            if (changed && !bs->inmemory_meta && !bs->readonly)
+            else
+            {
+                parse_meta_buf(bufs[i]);
+                bufs[i].state = INIT_META_PARSED;
+            }
+        }
+    }
+    for (i = 0; i < bufs.size(); i++)
+    {
+        if (bufs[i].state == INIT_META_PARSED && bufs[i].offset == apply_offset)
+        {
+            // Handle result
+            apply_offset += bufs[i].size;
+            if (apply_meta_buf(bufs[i]) && !bs->inmemory_meta && !bs->readonly)
             {
                 // write the modified buffer back
                 GET_SQE();
                 assert(bufs[i].size <= 0x7fffffff);
                 data->iov = { bufs[i].buf, (size_t)bufs[i].size };
-                data->callback = [this, i](ring_data_t *data) { handle_event(data, i); };
+                data->callback = [this, buf_num = i](ring_data_t *data) { handle_event(data, buf_num); };
                 my_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
                 bs->ringloop->submit();
                 bufs[i].state = INIT_META_WRITING;
@@ -244,19 +276,27 @@ resume_2:
             }
             else
             {
-                bufs[i].state = 0;
+                bufs[i].state = INIT_META_EMPTY;
             }
             bs->ringloop->wakeup();
+            // Restart the scan, the next buffer may be before this one
+            i = -1;
         }
     }
-    if (submitted > 0)
+    if (submitted > 0 || parsing > 0 || apply_offset < bs->dsk.meta_len)
     {
         wait_state = 2;
         return 1;
     }
+    if (parse_pool)
+    {
+        delete parse_pool;
+        parse_pool = NULL;
+    }
     if (entries_to_zero.size() && !bs->inmemory_meta && !bs->readonly)
     {
         // we have to zero out additional entries
+        std::sort(entries_to_zero.begin(), entries_to_zero.end());
         for (i = 0; i < entries_to_zero.size(); )
         {
             next_offset = entries_to_zero[i]/entries_per_block;
@@ -320,94 +360,131 @@ resume_6:
     return 0;
 }
 
-bool blockstore_init_meta::handle_meta_block(uint8_t *buf, uint64_t entries_per_block, uint64_t done_cnt)
+// Runs in parser threads: check entry checksums, copy bitmaps and collect valid entries sorted by object ID.
+// Buffers cover different metadata blocks so parsers never touch the same memory
+void blockstore_init_meta::parse_meta_buf(blockstore_init_meta_buf & mb)
 {
-    bool updated = false;
-    uint64_t max_i = entries_per_block;
-    if (max_i > bs->dsk.block_count-done_cnt)
-        max_i = bs->dsk.block_count-done_cnt;
-    for (uint64_t i = 0; i < max_i; i++)
+    mb.entries.clear();
+    for (uint64_t sector = 0; sector < mb.size; sector += bs->dsk.meta_block_size)
     {
-        clean_disk_entry *entry = (clean_disk_entry*)(buf + i*bs->dsk.clean_entry_size);
-        if (entry->oid.inode > 0)
+        uint8_t *buf = mb.buf + sector;
+        uint64_t done_cnt = ((mb.offset + sector - md_offset) / bs->dsk.meta_block_size) * entries_per_block;
+        uint64_t max_i = entries_per_block;
+        if (max_i > bs->dsk.block_count-done_cnt)
+            max_i = bs->dsk.block_count-done_cnt;
+        for (uint64_t i = 0; i < max_i; i++)
         {
-            if (bs->dsk.meta_format >= BLOCKSTORE_META_FORMAT_V2)
+            clean_disk_entry *entry = (clean_disk_entry*)(buf + i*bs->dsk.clean_entry_size);
+            if (entry->oid.inode > 0)
             {
-                // Check entry crc32
-                uint32_t *entry_csum = (uint32_t*)((uint8_t*)entry + bs->dsk.clean_entry_size - 4);
-                if (*entry_csum != crc32c(0, entry, bs->dsk.clean_entry_size - 4))
+                if (bs->dsk.meta_format >= BLOCKSTORE_META_FORMAT_V2)
                 {
-                    printf("Metadata entry %ju is corrupt (checksum mismatch), skipping\n", done_cnt+i);
-                    continue;
+                    // Check entry crc32
+                    uint32_t *entry_csum = (uint32_t*)((uint8_t*)entry + bs->dsk.clean_entry_size - 4);
+                    if (*entry_csum != crc32c(0, entry, bs->dsk.clean_entry_size - 4))
+                    {
+                        printf("Metadata entry %ju is corrupt (checksum mismatch), skipping\n", done_cnt+i);
+                        continue;
+                    }
                 }
+                if (!bs->inmemory_meta && bs->dsk.clean_entry_bitmap_size)
+                {
+                    memcpy(bs->clean_bitmaps + (done_cnt+i) * 2 * bs->dsk.clean_entry_bitmap_size, &entry->bitmap, 2 * bs->dsk.clean_entry_bitmap_size);
+                }
+                mb.entries.push_back((blockstore_init_meta_entry){
+                    .oid = entry->oid,
+                    .version = entry->version,
+                    .block_num = done_cnt+i,
+                });
             }
-            if (!bs->inmemory_meta && bs->dsk.clean_entry_bitmap_size)
-            {
-                memcpy(bs->clean_bitmaps + (done_cnt+i) * 2 * bs->dsk.clean_entry_bitmap_size, &entry->bitmap, 2 * bs->dsk.clean_entry_bitmap_size);
-            }
-            auto & clean_db = bs->clean_db_shard(entry->oid);
-            auto clean_it = clean_db.find(entry->oid);
-            if (clean_it == clean_db.end() || clean_it->second.version < entry->version)
+        }
+    }
+    // Sorted runs are inserted into clean_db faster. Entries of the same object keep
+    // their on-disk order, and only entries of the same object affect each other
+    std::stable_sort(mb.entries.begin(), mb.entries.end(), [](const blockstore_init_meta_entry & a, const blockstore_init_meta_entry & b)
+    {
+        return a.oid < b.oid;
+    });
+}
+
+bool blockstore_init_meta::apply_meta_buf(blockstore_init_meta_buf & mb)
+{
+    bool updated = false;
+    uint64_t done_cnt = ((mb.offset - md_offset) / bs->dsk.meta_block_size) * entries_per_block;
+    for (auto & e: mb.entries)
+    {
+        auto & clean_db = bs->clean_db_shard(e.oid);
+        auto clean_it = clean_db.lower_bound(e.oid);
+        bool found = clean_it != clean_db.end() && clean_it->first == e.oid;
+        if (!found || clean_it->second.version < e.version)
+        {
+            if (found)
             {
-                if (clean_it != clean_db.end())
+                // free the previous block
+                // here we have to zero out the previous entry because otherwise we'll hit
+                // "tried to overwrite non-zero metadata entry" later
+                uint64_t old_clean_loc = clean_it->second.location >> bs->dsk.block_order;
+                if (bs->inmemory_meta)
                 {
-                    // free the previous block
-                    // here we have to zero out the previous entry because otherwise we'll hit
-                    // "tried to overwrite non-zero metadata entry" later
-                    uint64_t old_clean_loc = clean_it->second.location >> bs->dsk.block_order;
-                    if (bs->inmemory_meta)
-                    {
-                        uint64_t sector = (old_clean_loc / entries_per_block) * bs->dsk.meta_block_size;
-                        uint64_t pos = (old_clean_loc % entries_per_block);
-                        clean_disk_entry *old_entry = (clean_disk_entry*)((uint8_t*)bs->metadata_buffer + sector + pos*bs->dsk.clean_entry_size);
-                        memset(old_entry, 0, bs->dsk.clean_entry_size);
-                    }
-                    else if (old_clean_loc >= done_cnt)
-                    {
-                        updated = true;
-                        uint64_t sector = ((old_clean_loc - done_cnt) / entries_per_block) * bs->dsk.meta_block_size;
-                        uint64_t pos = (old_clean_loc % entries_per_block);
-                        clean_disk_entry *old_entry = (clean_disk_entry*)(buf + sector + pos*bs->dsk.clean_entry_size);
-                        memset(old_entry, 0, bs->dsk.clean_entry_size);
-                    }
-                    else
-                    {
-                        entries_to_zero.push_back(clean_it->second.location >> bs->dsk.block_order);
-                    }
-#ifdef BLOCKSTORE_DEBUG
-                    printf("Free block %ju from %jx:%jx v%ju (new location is %ju)\n",
-                        old_clean_loc,
-                        clean_it->first.inode, clean_it->first.stripe, clean_it->second.version,
-                        done_cnt+i);
-#endif
-                    bs->data_alloc->set(old_clean_loc, false);
+                    uint64_t sector = (old_clean_loc / entries_per_block) * bs->dsk.meta_block_size;
+                    uint64_t pos = (old_clean_loc % entries_per_block);
+                    clean_disk_entry *old_entry = (clean_disk_entry*)((uint8_t*)bs->metadata_buffer + sector + pos*bs->dsk.clean_entry_size);
+                    memset(old_entry, 0, bs->dsk.clean_entry_size);
+                }
+                else if (old_clean_loc >= done_cnt)
+                {
+                    updated = true;
+                    uint64_t sector = ((old_clean_loc - done_cnt) / entries_per_block) * bs->dsk.meta_block_size;
+                    uint64_t pos = (old_clean_loc % entries_per_block);
+                    clean_disk_entry *old_entry = (clean_disk_entry*)(mb.buf + sector + pos*bs->dsk.clean_entry_size);
+                    memset(old_entry, 0, bs->dsk.clean_entry_size);
                 }
                 else
                 {
-                    bs->inode_space_stats[entry->oid.inode] += bs->dsk.data_block_size;
-                    bs->used_blocks++;
+                    entries_to_zero.push_back(clean_it->second.location >> bs->dsk.block_order);
                 }
-                entries_loaded++;
 #ifdef BLOCKSTORE_DEBUG
-                printf("Allocate block (clean entry) %ju: %jx:%jx v%ju\n", done_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
+                printf("Free block %ju from %jx:%jx v%ju (new location is %ju)\n",
+                    old_clean_loc,
+                    clean_it->first.inode, clean_it->first.stripe, clean_it->second.version,
+                    e.block_num);
 #endif
-                bs->data_alloc->set(done_cnt+i, true);
-                clean_db[entry->oid] = (struct clean_entry){
-                    .version = entry->version,
-                    .location = (done_cnt+i) << bs->dsk.block_order,
-                };
+                bs->data_alloc->set(old_clean_loc, false);
             }
             else
             {
-                // here we also have to zero out the entry
-                updated = true;
-                memset(entry, 0, bs->dsk.clean_entry_size);
+                bs->inode_space_stats[e.oid.inode] += bs->dsk.data_block_size;
+                bs->used_blocks++;
+            }
+            entries_loaded++;
 #ifdef BLOCKSTORE_DEBUG
-                printf("Old clean entry %ju: %jx:%jx v%ju\n", done_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
+            printf("Allocate block (clean entry) %ju: %jx:%jx v%ju\n", e.block_num, e.oid.inode, e.oid.stripe, e.version);
+#endif
+            bs->data_alloc->set(e.block_num, true);
+            if (found)
+                clean_it->second = (struct clean_entry){
+                    .version = e.version,
+                    .location = e.block_num << bs->dsk.block_order,
+                };
+            else
+                clean_db.insert(clean_it, std::make_pair(e.oid, (struct clean_entry){
+                    .version = e.version,
+                    .location = e.block_num << bs->dsk.block_order,
+                }));
+        }
+        else
+        {
+            // here we also have to zero out the entry
+            updated = true;
+            uint64_t sector = ((e.block_num - done_cnt) / entries_per_block) * bs->dsk.meta_block_size;
+            uint64_t pos = (e.block_num % entries_per_block);
+            memset(mb.buf + sector + pos*bs->dsk.clean_entry_size, 0, bs->dsk.clean_entry_size);
+#ifdef BLOCKSTORE_DEBUG
+            printf("Old clean entry %ju: %jx:%jx v%ju\n", e.block_num, e.oid.inode, e.oid.stripe, e.version);
 #endif
-            }
         }
     }
+    mb.entries.clear();
     return updated;
 }
 
@@ -986,15 +1063,10 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                     je->big_write.oid.inode, je->big_write.oid.stripe, je->big_write.version, je->big_write.location >> bs->dsk.block_order
                 );
 #endif
-                auto dirty_it = bs->dirty_db.upper_bound((obj_ver_id){
-                    .oid = je->big_write.oid,
-                    .version = UINT64_MAX,
-                });
-                if (dirty_it != bs->dirty_db.begin() && bs->dirty_db.size() > 0)
+                auto dirty_it = bs->dirty_db.find_last(je->big_write.oid);
+                if (dirty_it != bs->dirty_db.end())
                 {
-                    dirty_it--;
-                    if (dirty_it->first.oid == je->big_write.oid &&
-                        dirty_it->first.version >= je->big_write.version &&
+                    if (dirty_it->first.version >= je->big_write.version &&
                         (dirty_it->second.state & BS_ST_TYPE_MASK) == BS_ST_DELETE)
                     {
                         // It is allowed to overwrite a deleted object with a
@@ -1109,16 +1181,8 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
 #ifdef BLOCKSTORE_DEBUG
                 printf("je_delete oid=%jx:%jx ver=%ju\n", je->del.oid.inode, je->del.oid.stripe, je->del.version);
 #endif
-                bool dirty_exists = false;
-                auto dirty_it = bs->dirty_db.upper_bound((obj_ver_id){
-                    .oid = je->del.oid,
-                    .version = UINT64_MAX,
-                });
-                if (dirty_it != bs->dirty_db.begin())
-                {
-                    dirty_it--;
-                    dirty_exists = dirty_it->first.oid == je->del.oid;
-                }
+                auto dirty_it = bs->dirty_db.find_last(je->del.oid);
+                bool dirty_exists = dirty_it != bs->dirty_db.end();
                 auto & clean_db = bs->clean_db_shard(je->del.oid);
                 auto clean_it = clean_db.find(je->del.oid);
                 bool clean_exists = (clean_it != clean_db.end() &&
@@ -3,12 +3,22 @@
 
 #pragma once
 
+// Valid metadata entry found by a parser thread
+struct blockstore_init_meta_entry
+{
+    object_id oid;
+    uint64_t version;
+    uint64_t block_num;
+};
+
 struct blockstore_init_meta_buf
 {
     uint8_t *buf = NULL;
     uint64_t size = 0;
     uint64_t offset = 0;
     int state = 0;
+    // Entries of the buffer sorted by object ID
+    std::vector<blockstore_init_meta_entry> entries;
 };
 
 class blockstore_init_meta
@@ -17,21 +27,25 @@ class blockstore_init_meta
     int wait_state = 0;
     bool zero_on_init = false;
     void *metadata_buffer = NULL;
-    blockstore_init_meta_buf bufs[2] = {};
-    int submitted = 0;
+    std::vector<blockstore_init_meta_buf> bufs;
+    worker_pool_t *parse_pool = NULL;
+    int submitted = 0, parsing = 0;
     struct io_uring_sqe *sqe;
     struct ring_data_t *data;
     uint64_t md_offset = 0;
     uint64_t next_offset = 0;
+    uint64_t apply_offset = 0;
     uint64_t last_read_offset = 0;
     uint64_t entries_loaded = 0;
     unsigned entries_per_block = 0;
     int i = 0, j = 0;
     std::vector<uint64_t> entries_to_zero;
-    bool handle_meta_block(uint8_t *buf, uint64_t count, uint64_t done_cnt);
+    void parse_meta_buf(blockstore_init_meta_buf & mb);
+    bool apply_meta_buf(blockstore_init_meta_buf & mb);
     void handle_event(ring_data_t *data, int buf_num);
 public:
     blockstore_init_meta(blockstore_impl_t *bs);
+    ~blockstore_init_meta();
     int loop();
 };
 
@@ -186,10 +186,11 @@ void blockstore_impl_t::prepare_journal_sector_write(int cur_sector, blockstore_
                 : (uint8_t*)journal.sector_buf + journal.block_size*cur_sector),
             (size_t)journal.block_size
         };
-        data->callback = [this, flush_id = journal.submit_id](ring_data_t *data) { handle_journal_write(data, flush_id); };
-        my_uring_prep_writev(
-            sqe, dsk.journal_fd, &data->iov, 1, journal.offset + journal.sector_info[cur_sector].offset
-        );
+        data->callback = [this, flush_id = journal.submit_id, submit_us = latency_now_us()](ring_data_t *data)
+        {
+            handle_journal_write(data, flush_id, submit_us);
+        };
+        prep_rw(sqe, true, dsk.journal_fd, &data->iov, journal.offset + journal.sector_info[cur_sector].offset);
     }
     journal.sector_info[cur_sector].dirty = false;
     // But always remember that this operation has to wait until this exact journal write is finished
@@ -206,9 +207,10 @@ void blockstore_impl_t::prepare_journal_sector_write(int cur_sector, blockstore_
     priv->max_flushed_journal_sector = 1+cur_sector;
 }
 
-void blockstore_impl_t::handle_journal_write(ring_data_t *data, uint64_t flush_id)
+void blockstore_impl_t::handle_journal_write(ring_data_t *data, uint64_t flush_id, uint64_t submit_us)
 {
     live = true;
+    latency_stats.journal.add(latency_now_us() - submit_us);
     if (data->res != data->iov.iov_len)
     {
         // FIXME: our state becomes corrupted after a write error. maybe do something better than just die
@@ -3,6 +3,7 @@
 
 #include <sys/file.h>
 #include "blockstore_impl.h"
+#include "str_util.h"
 
 void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
 {
@@ -24,6 +25,10 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     {
         autosync_writes = strtoull(config["autosync_writes"].c_str(), NULL, 10);
     }
+    if (config["flusher_hot_delay_us"] != "")
+    {
+        flusher_hot_delay_us = strtoull(config["flusher_hot_delay_us"].c_str(), NULL, 10);
+    }
     if (!max_flusher_count)
     {
         max_flusher_count = 256;
@@ -94,6 +99,10 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
         immediate_commit = IMMEDIATE_SMALL;
     }
     metadata_buf_size = strtoull(config["meta_buf_size"].c_str(), NULL, 10);
+    if (config["meta_load_threads"] != "")
+    {
+        meta_load_threads = strtoull(config["meta_load_threads"].c_str(), NULL, 10);
+    }
     inmemory_meta = config["inmemory_metadata"] != "false" && config["inmemory_metadata"] != "0" &&
         config["inmemory_metadata"] != "no";
     journal.sector_count = strtoull(config["journal_sector_buffer_count"].c_str(), NULL, 10);
@@ -101,6 +110,8 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
         config["journal_no_same_sector_overwrites"] == "1" || config["journal_no_same_sector_overwrites"] == "yes";
     journal.inmemory = config["inmemory_journal"] != "false" && config["inmemory_journal"] != "0" &&
         config["inmemory_journal"] != "no";
+    use_fixed_io = config["use_fixed_io"] == "true" || config["use_fixed_io"] == "1" || config["use_fixed_io"] == "yes";
+    fixed_io_pool_size = parse_size(config["fixed_io_pool_size"]);
     // Validate
     if (journal.sector_count < 2)
     {
@@ -110,6 +121,10 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     {
         metadata_buf_size = 4*1024*1024;
     }
+    if (!fixed_io_pool_size)
+    {
+        fixed_io_pool_size = 32*1024*1024;
+    }
     if (dsk.meta_device == dsk.data_device)
     {
         disable_meta_fsync = disable_data_fsync;
@@ -126,6 +141,14 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     {
         throw std::runtime_error("immediate_commit=all requires disable_journal_fsync and disable_data_fsync");
     }
+    if (ringloop->is_iopoll())
+    {
+        // Polled rings only support O_DIRECT reads and writes
+        if (!disable_data_fsync || !disable_meta_fsync || !disable_journal_fsync)
+            throw std::runtime_error("ring_iopoll requires disable_data_fsync, disable_meta_fsync and disable_journal_fsync");
+        if (dsk.data_io == "cached" || dsk.meta_io == "cached" || dsk.journal_io == "cached")
+            throw std::runtime_error("ring_iopoll requires direct data_io, meta_io and journal_io");
+    }
     // init some fields
     journal.block_size = dsk.journal_block_size;
     journal.next_free = dsk.journal_block_size;
@@ -175,3 +198,160 @@ void blockstore_impl_t::calc_lengths()
         throw std::bad_alloc();
     }
 }
+
+// Register journal, metadata and flusher buffers and device FDs in io_uring
+// to skip page pinning and fd lookup on every I/O
+void blockstore_impl_t::register_fixed_io()
+{
+    if (!use_fixed_io)
+    {
+        return;
+    }
+    // Registered buffers are limited to 1 GB each, so split large ones
+    auto add_buf = [this](void *buf, uint64_t len)
+    {
+        const uint64_t max_len = 1024*1024*1024;
+        for (uint64_t pos = 0; pos < len; pos += max_len)
+        {
+            fixed_bufs.push_back((iovec){ (uint8_t*)buf + pos, (size_t)(len-pos < max_len ? len-pos : max_len) });
+        }
+    };
+    if (journal.inmemory)
+        add_buf(journal.buffer, journal.len);
+    else
+        add_buf(journal.sector_buf, journal.sector_count * dsk.journal_block_size);
+    if (inmemory_meta)
+        add_buf(metadata_buffer, dsk.meta_len);
+    // Pool of data block buffers for the flusher
+    uint64_t pool_count = fixed_io_pool_size / dsk.data_block_size;
+    fixed_io_pool_size = pool_count * dsk.data_block_size;
+    if (pool_count > 0)
+    {
+        fixed_pool = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, fixed_io_pool_size);
+        add_buf(fixed_pool, fixed_io_pool_size);
+        for (uint64_t i = pool_count; i > 0; i--)
+        {
+            fixed_pool_free.push_back(fixed_pool + (i-1)*dsk.data_block_size);
+        }
+    }
+    int r = ringloop->register_buffers(fixed_bufs);
+    if (r < 0)
+    {
+        fprintf(stderr, "Failed to register io_uring buffers, continuing without them: %s\n", strerror(-r));
+        fixed_bufs.clear();
+    }
+    fixed_fds.push_back(dsk.data_fd);
+    if (dsk.meta_fd != dsk.data_fd)
+        fixed_fds.push_back(dsk.meta_fd);
+    if (dsk.journal_fd != dsk.data_fd && dsk.journal_fd != dsk.meta_fd)
+        fixed_fds.push_back(dsk.journal_fd);
+    r = ringloop->register_files(fixed_fds);
+    if (r < 0)
+    {
+        fprintf(stderr, "Failed to register io_uring files, continuing without them: %s\n", strerror(-r));
+        fixed_fds.clear();
+    }
+}
+
+void blockstore_impl_t::unregister_fixed_io()
+{
+    if (fixed_bufs.size())
+    {
+        ringloop->unregister_buffers();
+        fixed_bufs.clear();
+    }
+    if (fixed_fds.size())
+    {
+        ringloop->unregister_files();
+        fixed_fds.clear();
+    }
+    if (fixed_pool)
+    {
+        free(fixed_pool);
+        fixed_pool = NULL;
+        fixed_pool_free.clear();
+    }
+}
+
+int blockstore_impl_t::find_fixed_buffer(void *buf, size_t len)
+{
+    for (int i = 0; i < fixed_bufs.size(); i++)
+    {
+        if (buf >= fixed_bufs[i].iov_base &&
+            (uint8_t*)buf+len <= (uint8_t*)fixed_bufs[i].iov_base+fixed_bufs[i].iov_len)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void blockstore_impl_t::use_fixed_file(io_uring_sqe *sqe)
+{
+    for (int i = 0; i < fixed_fds.size(); i++)
+    {
+        if (sqe->fd == fixed_fds[i])
+        {
+            sqe->fd = i;
+            sqe->flags |= IOSQE_FIXED_FILE;
+            return;
+        }
+    }
+}
+
+// Single-buffer read or write, fixed if the buffer is registered
+void blockstore_impl_t::prep_rw(io_uring_sqe *sqe, bool write, int fd, iovec *iov, uint64_t offset)
+{
+    int buf_index = find_fixed_buffer(iov->iov_base, iov->iov_len);
+    if (buf_index >= 0 && write)
+        my_uring_prep_write_fixed(sqe, fd, iov->iov_base, iov->iov_len, offset, buf_index);
+    else if (buf_index >= 0)
+        my_uring_prep_read_fixed(sqe, fd, iov->iov_base, iov->iov_len, offset, buf_index);
+    else if (write)
+        my_uring_prep_writev(sqe, fd, iov, 1, offset);
+    else
+        my_uring_prep_readv(sqe, fd, iov, 1, offset);
+    use_fixed_file(sqe);
+}
+
+void blockstore_impl_t::prep_readv(io_uring_sqe *sqe, int fd, iovec *iov, int iovcnt, uint64_t offset)
+{
+    if (iovcnt == 1)
+    {
+        prep_rw(sqe, false, fd, iov, offset);
+        return;
+    }
+    my_uring_prep_readv(sqe, fd, iov, iovcnt, offset);
+    use_fixed_file(sqe);
+}
+
+void blockstore_impl_t::prep_writev(io_uring_sqe *sqe, int fd, iovec *iov, int iovcnt, uint64_t offset)
+{
+    if (iovcnt == 1)
+    {
+        prep_rw(sqe, true, fd, iov, offset);
+        return;
+    }
+    my_uring_prep_writev(sqe, fd, iov, iovcnt, offset);
+    use_fixed_file(sqe);
+}
+
+// Flusher data buffers are taken from the registered pool when possible
+void *blockstore_impl_t::alloc_io_buffer(uint64_t len)
+{
+    if (len <= dsk.data_block_size && fixed_pool_free.size())
+    {
+        void *buf = fixed_pool_free.back();
+        fixed_pool_free.pop_back();
+        return buf;
+    }
+    return memalign_or_die(MEM_ALIGNMENT, len);
+}
+
+void blockstore_impl_t::free_io_buffer(void *buf)
+{
+    if (fixed_pool && buf >= fixed_pool && buf < fixed_pool + fixed_io_pool_size)
+        fixed_pool_free.push_back(buf);
+    else
+        free(buf);
+}
@@ -27,10 +27,10 @@ int blockstore_impl_t::fulfill_read_push(blockstore_op_t *op, void *buf, uint64_
     BS_SUBMIT_GET_SQE(sqe, data);
     data->iov = (struct iovec){ buf, (size_t)len };
     PRIV(op)->pending_ops++;
-    my_uring_prep_readv(
-        sqe,
+    prep_rw(
+        sqe, false,
         IS_JOURNAL(item_state) ? dsk.journal_fd : dsk.data_fd,
-        &data->iov, 1,
+        &data->iov,
         (IS_JOURNAL(item_state) ? dsk.journal_offset : dsk.data_offset) + offset
     );
     data->callback = [this, op](ring_data_t *data) { handle_read_event(data, op); };
@@ -356,7 +356,7 @@ bool blockstore_impl_t::read_checksum_block(blockstore_op_t *op, int rv_pos, uin
         int n_cur = n_iov-n_pos < IOV_MAX ? n_iov-n_pos : IOV_MAX;
         BS_SUBMIT_GET_SQE(sqe, data);
         PRIV(op)->pending_ops++;
-        my_uring_prep_readv(sqe, submit_fd, iov + n_pos, n_cur, submit_offset + clean_loc + item_start + d_pos);
+        prep_readv(sqe, submit_fd, iov + n_pos, n_cur, submit_offset + clean_loc + item_start + d_pos);
         data->callback = [this, op](ring_data_t *data) { handle_read_event(data, op); };
         if (n_pos > 0 || n_pos + IOV_MAX < n_iov)
         {
@@ -382,14 +382,9 @@ int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
 {
     auto & clean_db = clean_db_shard(read_op->oid);
     auto clean_it = clean_db.find(read_op->oid);
-    auto dirty_it = dirty_db.upper_bound((obj_ver_id){
-        .oid = read_op->oid,
-        .version = UINT64_MAX,
-    });
-    if (dirty_it != dirty_db.begin())
-        dirty_it--;
+    auto dirty_it = dirty_db.find_last(read_op->oid);
     bool clean_found = clean_it != clean_db.end();
-    bool dirty_found = (dirty_it != dirty_db.end() && dirty_it->first.oid == read_op->oid);
+    bool dirty_found = dirty_it != dirty_db.end();
     if (!clean_found && !dirty_found)
     {
         read_op->version = 0;
@@ -702,7 +697,7 @@ uint8_t* blockstore_impl_t::read_clean_meta_block(blockstore_op_t *op, uint64_t
     BS_SUBMIT_GET_SQE(sqe, data);
     data->iov = (struct iovec){ buf, (size_t)dsk.meta_block_size };
     PRIV(op)->pending_ops++;
-    my_uring_prep_readv(sqe, dsk.meta_fd, &data->iov, 1, dsk.meta_offset + dsk.meta_block_size + sector);
+    prep_rw(sqe, false, dsk.meta_fd, &data->iov, dsk.meta_offset + dsk.meta_block_size + sector);
     data->callback = [this, op](ring_data_t *data) { handle_read_event(data, op); };
     // return pointer to checksums + bitmap
     return buf + pos + sizeof(clean_disk_entry);
@@ -983,18 +978,22 @@ void blockstore_impl_t::handle_read_event(ring_data_t *data, blockstore_op_t *op
 
 int blockstore_impl_t::read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version)
 {
-    auto dirty_it = dirty_db.upper_bound((obj_ver_id){
-        .oid = oid,
-        .version = UINT64_MAX,
-    });
-    if (dirty_it != dirty_db.begin())
-        dirty_it--;
+    auto dirty_it = dirty_db.find_last(oid);
     if (dirty_it != dirty_db.end())
     {
         while (dirty_it->first.oid == oid)
         {
             if (target_version >= dirty_it->first.version)
             {
+                if (IS_DELETE(dirty_it->second.state))
+                {
+                    // Report unflushed deletes the same way as flushed ones
+                    if (result_version)
+                        *result_version = 0;
+                    if (bitmap)
+                        memset(bitmap, 0, dsk.clean_entry_bitmap_size);
+                    return -ENOENT;
+                }
                 if (result_version)
                     *result_version = dirty_it->first.version;
                 if (bitmap)
@@ -1029,3 +1028,25 @@ int blockstore_impl_t::read_bitmap(object_id oid, uint64_t target_version, void
         memset(bitmap, 0, dsk.clean_entry_bitmap_size);
     return -ENOENT;
 }
+
+uint64_t blockstore_impl_t::read_stable_version(object_id oid)
+{
+    auto dirty_it = dirty_db.find_last(oid);
+    if (dirty_it != dirty_db.end())
+    {
+        while (dirty_it->first.oid == oid)
+        {
+            // Deletions are always stable, like in BS_OP_LIST
+            if (IS_DELETE(dirty_it->second.state))
+                return 0;
+            if (IS_STABLE(dirty_it->second.state) || (dirty_it->second.state & BS_ST_INSTANT))
+                return dirty_it->first.version;
+            if (dirty_it == dirty_db.begin())
+                break;
+            dirty_it--;
+        }
+    }
+    auto & clean_db = clean_db_shard(oid);
+    auto clean_it = clean_db.find(oid);
+    return clean_it != clean_db.end() ? clean_it->second.version : 0;
+}
@@ -13,44 +13,32 @@ int blockstore_impl_t::dequeue_rollback(blockstore_op_t *op)
     {
         // Check that there are some versions greater than v->version (which may be zero),
         // check that they're unstable, synced, and not currently written to
-        auto dirty_it = dirty_db.lower_bound((obj_ver_id){
-            .oid = ov.oid,
-            .version = UINT64_MAX,
-        });
-        if (dirty_it == dirty_db.begin())
+        auto dirty_it = dirty_db.find_last(ov.oid);
+        if (dirty_it == dirty_db.end() || dirty_it->first.version < ov.version)
         {
             // Already rolled back, skip this object version
             return STAB_SPLIT_DONE;
         }
-        else
+        while (dirty_it->first.oid == ov.oid && dirty_it->first.version > ov.version)
         {
-            dirty_it--;
-            if (dirty_it->first.oid != ov.oid || dirty_it->first.version < ov.version)
+            if (IS_IN_FLIGHT(dirty_it->second.state))
             {
-                // Already rolled back, skip this object version
-                return STAB_SPLIT_DONE;
+                // Object write is still in progress. Wait until the write request completes
+                return STAB_SPLIT_WAIT;
             }
-            while (dirty_it->first.oid == ov.oid && dirty_it->first.version > ov.version)
+            else if (!IS_SYNCED(dirty_it->second.state) ||
+                IS_STABLE(dirty_it->second.state))
             {
-                if (IS_IN_FLIGHT(dirty_it->second.state))
-                {
-                    // Object write is still in progress. Wait until the write request completes
-                    return STAB_SPLIT_WAIT;
-                }
-                else if (!IS_SYNCED(dirty_it->second.state) ||
-                    IS_STABLE(dirty_it->second.state))
-                {
-                    // Sync the object
-                    return STAB_SPLIT_SYNC;
-                }
-                if (dirty_it == dirty_db.begin())
-                {
-                    break;
-                }
-                dirty_it--;
+                // Sync the object
+                return STAB_SPLIT_SYNC;
+            }
+            if (dirty_it == dirty_db.begin())
+            {
+                break;
             }
-            return STAB_SPLIT_TODO;
+            dirty_it--;
         }
+        return STAB_SPLIT_TODO;
     });
     if (r != 1)
     {
@@ -124,16 +112,12 @@ resume_4:
 
 void blockstore_impl_t::mark_rolled_back(const obj_ver_id & ov)
 {
-    auto it = dirty_db.lower_bound((obj_ver_id){
-        .oid = ov.oid,
-        .version = UINT64_MAX,
-    });
-    if (it != dirty_db.begin())
+    auto it = dirty_db.find_last(ov.oid);
+    if (it != dirty_db.end())
     {
         uint64_t max_unstable = 0;
-        auto rm_start = it;
-        auto rm_end = it;
-        it--;
+        auto rm_end = std::next(it);
+        auto rm_start = rm_end;
         while (1)
         {
             if (it->first.oid != ov.oid)
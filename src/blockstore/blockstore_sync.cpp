@@ -17,6 +17,7 @@ int blockstore_impl_t::continue_sync(blockstore_op_t *op)
     if (immediate_commit == IMMEDIATE_ALL)
     {
         // We can return immediately because sync is only dequeued after all previous writes
+        latency_stats.sync.add(latency_now_us() - PRIV(op)->enqueue_us);
         op->retval = 0;
         FINISH_OP(op);
         return 2;
@@ -228,6 +229,7 @@ void blockstore_impl_t::ack_sync(blockstore_op_t *op)
             }
         }
     }
+    latency_stats.sync.add(latency_now_us() - PRIV(op)->enqueue_us);
     op->retval = 0;
     FINISH_OP(op);
 }
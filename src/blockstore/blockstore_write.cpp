@@ -23,29 +23,22 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
     }
     uint8_t *dyn_ptr = (alloc_dyn_data ? (uint8_t*)dyn+sizeof(int) : (uint8_t*)&dyn);
     uint64_t version = 1;
-    if (dirty_db.size() > 0)
+    auto dirty_it = dirty_db.find_last(op->oid);
+    if (dirty_it != dirty_db.end())
     {
-        auto dirty_it = dirty_db.upper_bound((obj_ver_id){
-            .oid = op->oid,
-            .version = UINT64_MAX,
-        });
-        dirty_it--; // segfaults when dirty_db is empty
-        if (dirty_it != dirty_db.end() && dirty_it->first.oid == op->oid)
-        {
-            found = true;
-            version = dirty_it->first.version + 1;
-            deleted = IS_DELETE(dirty_it->second.state);
-            unsynced = !IS_SYNCED(dirty_it->second.state);
-            wait_del = ((dirty_it->second.state & BS_ST_WORKFLOW_MASK) == BS_ST_WAIT_DEL);
-            wait_big = (dirty_it->second.state & BS_ST_TYPE_MASK) == BS_ST_BIG_WRITE
-                ? !IS_SYNCED(dirty_it->second.state)
-                : ((dirty_it->second.state & BS_ST_WORKFLOW_MASK) == BS_ST_WAIT_BIG);
-            if (!is_del && !deleted)
-            {
-                void *dyn_from = alloc_dyn_data
-                    ? (uint8_t*)dirty_it->second.dyn_data + sizeof(int) : (uint8_t*)&dirty_it->second.dyn_data;
-                memcpy(dyn_ptr, dyn_from, dsk.clean_entry_bitmap_size);
-            }
+        found = true;
+        version = dirty_it->first.version + 1;
+        deleted = IS_DELETE(dirty_it->second.state);
+        unsynced = !IS_SYNCED(dirty_it->second.state);
+        wait_del = ((dirty_it->second.state & BS_ST_WORKFLOW_MASK) == BS_ST_WAIT_DEL);
+        wait_big = (dirty_it->second.state & BS_ST_TYPE_MASK) == BS_ST_BIG_WRITE
+            ? !IS_SYNCED(dirty_it->second.state)
+            : ((dirty_it->second.state & BS_ST_WORKFLOW_MASK) == BS_ST_WAIT_BIG);
+        if (!is_del && !deleted)
+        {
+            void *dyn_from = alloc_dyn_data
+                ? (uint8_t*)dirty_it->second.dyn_data + sizeof(int) : (uint8_t*)&dirty_it->second.dyn_data;
+            memcpy(dyn_ptr, dyn_from, dsk.clean_entry_bitmap_size);
         }
     }
     if (!found)
@@ -384,7 +377,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         }
         data->iov.iov_len = op->len + stripe_offset + stripe_end; // to check it in the callback
         data->callback = [this, op](ring_data_t *data) { handle_write_event(data, op); };
-        my_uring_prep_writev(
+        prep_writev(
             sqe, dsk.data_fd, PRIV(op)->iov_zerofill, vcnt, dsk.data_offset + (loc << dsk.block_order) + op->offset - stripe_offset
         );
         PRIV(op)->pending_ops = 1;
@@ -510,10 +503,11 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
                 .sector = -1,
                 .op = op,
             });
-            data2->callback = [this, flush_id = journal.submit_id](ring_data_t *data) { handle_journal_write(data, flush_id); };
-            my_uring_prep_writev(
-                sqe2, dsk.journal_fd, &data2->iov, 1, journal.offset + journal.next_free
-            );
+            data2->callback = [this, flush_id = journal.submit_id, submit_us = latency_now_us()](ring_data_t *data)
+            {
+                handle_journal_write(data, flush_id, submit_us);
+            };
+            prep_rw(sqe2, true, dsk.journal_fd, &data2->iov, journal.offset + journal.next_free);
             PRIV(op)->pending_ops++;
         }
         else
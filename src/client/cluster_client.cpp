@@ -9,6 +9,9 @@
 cluster_client_t::cluster_client_t(ring_loop_t *ringloop, timerfd_manager_t *tfd, json11::Json config)
 {
     wb = new writeback_cache_t();
+    rc = new read_cache_t();
+    ra = new readahead_t();
+    cc = new chain_cache_t();
 
     cli_config = config.object_items();
     file_config = osd_messenger_t::read_config(config);
@@ -74,6 +77,17 @@ cluster_client_t::~cluster_client_t()
     free(scrap_buffer);
     delete wb;
     wb = NULL;
+    delete rc;
+    rc = NULL;
+    delete ra;
+    ra = NULL;
+    delete cc;
+    cc = NULL;
+    if (qos_timer_id >= 0)
+    {
+        tfd->clear_timer(qos_timer_id);
+        qos_timer_id = -1;
+    }
 }
 
 cluster_op_t::~cluster_op_t()
@@ -228,6 +242,19 @@ void cluster_client_t::erase_op(cluster_op_t *op)
     if (op_queue_tail == op)
         op_queue_tail = op->prev;
     op->next = op->prev = NULL;
+    if (opcode == OSD_OP_WRITE)
+    {
+        rc->invalidate(op->inode, op->offset, op->len);
+        ra->invalidate(op->inode, op->offset, op->len);
+    }
+    else if (flags & OP_READ_CACHE_FILL)
+    {
+        uint64_t meta_rev = 0;
+        uint32_t bitmap_granularity = 0;
+        if (!get_read_cache_params(op->inode, meta_rev, bitmap_granularity))
+            bitmap_granularity = 0;
+        rc->finish_read(op, meta_rev, bitmap_granularity);
+    }
     if (flags & OP_FLUSH_BUFFER)
     {
         // Completed flushes change writeback buffer states,
@@ -374,6 +401,28 @@ void cluster_client_t::on_load_config_hook(json11::Json::object & etcd_global_co
     {
         client_max_writeback_iodepth = DEFAULT_CLIENT_MAX_WRITEBACK_IODEPTH;
     }
+    // client_read_cache_size, client_read_cache_exclusive
+    client_read_cache_size = config["client_read_cache_size"].uint64_value();
+    rc->resize(client_read_cache_size);
+    client_read_cache_exclusive = json_is_true(config["client_read_cache_exclusive"]);
+    // client_readahead_min, client_readahead_max
+    uint64_t readahead_max = config["client_readahead_max"].uint64_value();
+    uint64_t readahead_min = config["client_readahead_min"].is_null()
+        ? DEFAULT_CLIENT_READAHEAD_MIN : config["client_readahead_min"].uint64_value();
+    if (readahead_min > readahead_max)
+    {
+        readahead_min = readahead_max;
+    }
+    if (ra->min_window != readahead_min || ra->max_window != readahead_max)
+    {
+        ra->clear();
+        ra->min_window = readahead_min;
+        ra->max_window = readahead_max;
+    }
+    // client_chain_cache_size
+    client_chain_cache_size = config["client_chain_cache_size"].is_null()
+        ? DEFAULT_CLIENT_CHAIN_CACHE_SIZE : config["client_chain_cache_size"].uint64_value();
+    cc->resize(client_chain_cache_size);
     // client_retry_interval
     client_retry_interval = config["client_retry_interval"].uint64_value();
     if (!client_retry_interval)
@@ -512,7 +561,7 @@ bool cluster_client_t::flush()
             };
             execute(sync);
         }
-        return op_queue_head == NULL;
+        return op_queue_head == NULL && !qos_queued_ops && !qos_syncs.size();
     }
     bool sync_done = false;
     cluster_op_t *sync = new cluster_op_t;
@@ -572,9 +621,124 @@ void cluster_client_t::execute(cluster_op_t *op)
         return;
     }
     op->flags = op->flags & OSD_OP_IGNORE_READONLY; // the only allowed flag
+    if (qos_throttle(op))
+    {
+        // Delayed by image I/O limits
+        return;
+    }
     execute_internal(op);
 }
 
+// Client-side part of image I/O limits. OSDs only see parts of requests, so the client
+// also limits the total of its own requests to every image. Delayed requests of an image
+// are executed in order, syncs wait until all requests delayed before them are executed.
+bool cluster_client_t::qos_throttle(cluster_op_t *op)
+{
+    if (op->opcode == OSD_OP_SYNC)
+    {
+        if (!qos_queued_ops)
+        {
+            return false;
+        }
+        op->qos_seq = ++qos_seq;
+        qos_syncs.push_back(op);
+        return true;
+    }
+    if (op->opcode != OSD_OP_READ && op->opcode != OSD_OP_WRITE)
+    {
+        return false;
+    }
+    auto ino_it = st_cli.inode_config.find(op->inode);
+    bool limited = ino_it != st_cli.inode_config.end() && ino_it->second.qos.is_set();
+    auto q_it = qos_queues.find(op->inode);
+    if (limited && q_it == qos_queues.end())
+    {
+        q_it = qos_queues.emplace(op->inode, cluster_qos_queue_t()).first;
+    }
+    if (q_it == qos_queues.end())
+    {
+        return false;
+    }
+    uint64_t now = qos_now_us();
+    auto & q = q_it->second;
+    q.bucket.set_limits(limited ? ino_it->second.qos : qos_limits_t(), now);
+    if (!q.ops.size())
+    {
+        uint64_t wait_us = q.bucket.take(op->len, now);
+        if (!wait_us)
+        {
+            return false;
+        }
+        schedule_qos_timer(now+wait_us, now);
+    }
+    op->qos_seq = ++qos_seq;
+    q.ops.push_back(op);
+    qos_queued_ops++;
+    return true;
+}
+
+void cluster_client_t::run_qos_queues()
+{
+    uint64_t now = qos_now_us();
+    uint64_t next_us = 0, min_seq = UINT64_MAX;
+    for (auto q_it = qos_queues.begin(); q_it != qos_queues.end(); )
+    {
+        auto ino_it = st_cli.inode_config.find(q_it->first);
+        bool limited = ino_it != st_cli.inode_config.end() && ino_it->second.qos.is_set();
+        auto & q = q_it->second;
+        q.bucket.set_limits(limited ? ino_it->second.qos : qos_limits_t(), now);
+        while (q.ops.size())
+        {
+            cluster_op_t *op = q.ops.front();
+            uint64_t wait_us = q.bucket.take(op->len, now);
+            if (wait_us)
+            {
+                if (!next_us || next_us > now+wait_us)
+                    next_us = now+wait_us;
+                if (min_seq > op->qos_seq)
+                    min_seq = op->qos_seq;
+                break;
+            }
+            q.ops.pop_front();
+            qos_queued_ops--;
+            execute_internal(op);
+        }
+        if (!q.ops.size() && !limited)
+            qos_queues.erase(q_it++);
+        else
+            q_it++;
+    }
+    while (qos_syncs.size() && qos_syncs.front()->qos_seq < min_seq)
+    {
+        cluster_op_t *sync = qos_syncs.front();
+        qos_syncs.pop_front();
+        execute_internal(sync);
+    }
+    if (next_us)
+    {
+        schedule_qos_timer(next_us, now);
+    }
+}
+
+void cluster_client_t::schedule_qos_timer(uint64_t at_us, uint64_t now)
+{
+    if (qos_timer_id >= 0)
+    {
+        if (qos_timer_us <= at_us)
+        {
+            return;
+        }
+        tfd->clear_timer(qos_timer_id);
+    }
+    qos_timer_us = at_us;
+    qos_timer_id = tfd->set_timer_us(at_us > now ? at_us-now : 1, false, [this](int)
+    {
+        qos_timer_id = -1;
+        qos_timer_us = 0;
+        run_qos_queues();
+    });
+}
+
 void cluster_client_t::execute_internal(cluster_op_t *op)
 {
     op->cur_inode = op->inode;
@@ -592,6 +756,40 @@ void cluster_client_t::execute_internal(cluster_op_t *op)
     {
         return;
     }
+    if (op->opcode == OSD_OP_WRITE)
+    {
+        // Own writes invalidate the read cache both when they start and when they finish
+        rc->invalidate(op->inode, op->offset, op->len);
+        ra->invalidate(op->inode, op->offset, op->len);
+    }
+    else if (op->opcode == OSD_OP_READ)
+    {
+        uint64_t meta_rev = 0;
+        uint32_t bitmap_granularity = 0;
+        bool cacheable = get_read_cache_params(op->inode, meta_rev, bitmap_granularity);
+        if (cacheable && rc->read(op, meta_rev, bitmap_granularity))
+        {
+            op->retval = op->len;
+            auto cb = std::move(op->callback);
+            cb(op);
+            return;
+        }
+        if (ra->handle_read(this, op))
+        {
+            // Served from readahead buffers
+            return;
+        }
+        // Reads filling the read cache go the usual way
+        if (!cacheable && cc->handle_read(this, op))
+        {
+            // Sent directly to the owning layers
+            return;
+        }
+        if (cacheable)
+        {
+            rc->start_read(op);
+        }
+    }
     if (op->opcode == OSD_OP_WRITE && enable_writeback && !(op->flags & OP_FLUSH_BUFFER) &&
         !op->version /* no CAS writeback */)
     {
@@ -721,6 +919,46 @@ bool cluster_client_t::check_rw(cluster_op_t *op)
     return true;
 }
 
+// Data of an image may be cached or prefetched only if nobody else can change it:
+// readonly images (snapshots) always and other images opened by this client if
+// it's allowed to assume exclusive access. Cached data is bound to the inode
+// metadata revision so that any change of the inode config drops it.
+bool cluster_client_t::is_inode_private(uint64_t inode, uint64_t & meta_rev)
+{
+    auto ino_it = st_cli.inode_config.find(inode);
+    if (ino_it != st_cli.inode_config.end() && ino_it->second.readonly)
+    {
+        meta_rev = ino_it->second.mod_revision;
+        return true;
+    }
+    if (!client_read_cache_exclusive)
+    {
+        return false;
+    }
+    meta_rev = ino_it != st_cli.inode_config.end() ? ino_it->second.mod_revision : 0;
+    return true;
+}
+
+bool cluster_client_t::get_read_cache_params(uint64_t inode, uint64_t & meta_rev, uint32_t & bitmap_granularity)
+{
+    if (!rc->max_blocks)
+    {
+        return false;
+    }
+    auto pool_it = st_cli.pool_config.find(INODE_POOL(inode));
+    if (pool_it == st_cli.pool_config.end())
+    {
+        return false;
+    }
+    bitmap_granularity = pool_it->second.bitmap_granularity;
+    if (!bitmap_granularity || (READ_CACHE_BLOCK_SIZE % bitmap_granularity) || READ_CACHE_BLOCK_SIZE/bitmap_granularity > 8)
+    {
+        // Block bitmap must fit into 8 bits
+        return false;
+    }
+    return is_inode_private(inode, meta_rev);
+}
+
 void cluster_client_t::execute_raw(osd_num_t osd_num, osd_op_t *op)
 {
     auto fd_it = msgr.osd_peer_fds.find(osd_num);
@@ -806,7 +1044,7 @@ resume_2:
         // Finished successfully
         // Even if the PG count has changed in meanwhile we treat it as success
         // because if some operations were invalid for the new PG count we'd get errors
-        if (op->opcode == OSD_OP_READ || op->opcode == OSD_OP_READ_CHAIN_BITMAP)
+        if ((op->opcode == OSD_OP_READ || op->opcode == OSD_OP_READ_CHAIN_BITMAP) && !(op->flags & OP_NO_CHAIN))
         {
             // Check parent inode
             auto ino_it = st_cli.inode_config.find(op->cur_inode);
@@ -1077,7 +1315,8 @@ bool cluster_client_t::try_send(cluster_op_t *op, int i)
                 pool_cfg.scheme == POOL_SCHEME_REPLICATED ? 1 : pool_cfg.pg_size-pool_cfg.parity_chunks
             );
             uint64_t meta_rev = 0;
-            if (op->opcode != OSD_OP_READ_BITMAP && op->opcode != OSD_OP_READ_CHAIN_BITMAP && op->opcode != OSD_OP_DELETE)
+            if (op->opcode != OSD_OP_READ_BITMAP && op->opcode != OSD_OP_READ_CHAIN_BITMAP && op->opcode != OSD_OP_DELETE &&
+                !(op->flags & OP_NO_CHAIN))
             {
                 auto ino_it = st_cli.inode_config.find(op->inode);
                 if (ino_it != st_cli.inode_config.end())
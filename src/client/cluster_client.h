@@ -11,6 +11,8 @@
 #define DEFAULT_CLIENT_MAX_BUFFERED_BYTES 32*1024*1024
 #define DEFAULT_CLIENT_MAX_BUFFERED_OPS 1024
 #define DEFAULT_CLIENT_MAX_WRITEBACK_IODEPTH 256
+#define DEFAULT_CLIENT_READAHEAD_MIN 128*1024
+#define DEFAULT_CLIENT_CHAIN_CACHE_SIZE 16*1024*1024
 #define INODE_LIST_DONE 1
 #define INODE_LIST_HAS_UNSTABLE 2
 #define OSD_OP_READ_BITMAP OSD_OP_SEC_READ_BMP
@@ -65,13 +67,28 @@ protected:
     cluster_op_t *prev = NULL, *next = NULL;
     int prev_wait = 0;
     uint64_t flush_id = 0;
+    uint64_t read_cache_seq = 0;
+    uint64_t qos_seq = 0;
     friend class cluster_client_t;
     friend class writeback_cache_t;
+    friend class read_cache_t;
+    friend class readahead_t;
+    friend class chain_cache_t;
+};
+
+// Operations of one image waiting for QoS tokens
+struct cluster_qos_queue_t
+{
+    qos_bucket_t bucket;
+    std::deque<cluster_op_t*> ops;
 };
 
 struct inode_list_t;
 struct inode_list_osd_t;
 class writeback_cache_t;
+class read_cache_t;
+class readahead_t;
+class chain_cache_t;
 
 // FIXME: Split into public and private interfaces
 class cluster_client_t
@@ -90,6 +107,11 @@ class cluster_client_t
     uint64_t client_max_buffered_bytes = 0;
     uint64_t client_max_buffered_ops = 0;
     uint64_t client_max_writeback_iodepth = 0;
+    // clean read cache for images which only this client may change
+    uint64_t client_read_cache_size = 0;
+    bool client_read_cache_exclusive = false;
+    // granule ownership cache for readonly parent layers
+    uint64_t client_chain_cache_size = 0;
 
     int log_level = 0;
     int client_retry_interval = 50; // ms
@@ -101,8 +123,17 @@ class cluster_client_t
     std::vector<cluster_op_t*> offline_ops;
     cluster_op_t *op_queue_head = NULL, *op_queue_tail = NULL;
     writeback_cache_t *wb = NULL;
+    read_cache_t *rc = NULL;
+    readahead_t *ra = NULL;
+    chain_cache_t *cc = NULL;
     std::set<osd_num_t> dirty_osds;
     uint64_t dirty_bytes = 0, dirty_ops = 0;
+    // per-image I/O limits: the total of all requests of this client, however many OSDs they touch
+    std::map<inode_t, cluster_qos_queue_t> qos_queues;
+    std::deque<cluster_op_t*> qos_syncs;
+    uint64_t qos_seq = 0, qos_queued_ops = 0;
+    int qos_timer_id = -1;
+    uint64_t qos_timer_us = 0;
 
     void *scrap_buffer = NULL;
     unsigned scrap_buffer_size = 0;
@@ -153,9 +184,14 @@ protected:
     void on_change_pg_state_hook(pool_id_t pool_id, pg_num_t pg_num, osd_num_t prev_primary);
     void on_change_osd_state_hook(uint64_t peer_osd);
     void execute_internal(cluster_op_t *op);
+    bool qos_throttle(cluster_op_t *op);
+    void run_qos_queues();
+    void schedule_qos_timer(uint64_t at_us, uint64_t now);
     void unshift_op(cluster_op_t *op);
     int continue_rw(cluster_op_t *op);
     bool check_rw(cluster_op_t *op);
+    bool is_inode_private(uint64_t inode, uint64_t & meta_rev);
+    bool get_read_cache_params(uint64_t inode, uint64_t & meta_rev, uint32_t & bitmap_granularity);
     void slice_rw(cluster_op_t *op);
     void reset_retry_timer(int new_duration);
     bool try_send(cluster_op_t *op, int i);
@@ -172,4 +208,6 @@ protected:
     void continue_raw_ops(osd_num_t peer_osd);
 
     friend class writeback_cache_t;
+    friend class readahead_t;
+    friend class chain_cache_t;
 };
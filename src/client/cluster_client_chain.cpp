@@ -0,0 +1,386 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include <cassert>
+
+#include "cluster_client_impl.h"
+
+// Per-entry overhead of the index and block descriptor, roughly
+#define CHAIN_CACHE_ENTRY_OVERHEAD 64
+
+chain_cache_t::~chain_cache_t()
+{
+    clear();
+}
+
+void chain_cache_t::resize(uint64_t new_max_bytes)
+{
+    if (new_max_bytes != max_bytes)
+    {
+        clear();
+        max_bytes = new_max_bytes;
+    }
+}
+
+void chain_cache_t::clear()
+{
+    for (auto & b: blocks)
+    {
+        free(b.owners);
+    }
+    blocks.clear();
+    free_blocks.clear();
+    index.clear();
+    clock_hand = 0;
+    used_bytes = 0;
+}
+
+// Get the chain of readonly layers starting with <top>. Layers of a readonly chain never
+// change, and any change of their metadata increases the maximum mod_revision of the chain
+bool chain_cache_t::get_chain(cluster_client_t *cli, inode_t top, std::vector<inode_t> & chain, uint64_t & chain_rev,
+    uint64_t & block_size, uint32_t & bitmap_granularity)
+{
+    chain.clear();
+    chain_rev = 0;
+    inode_t cur = top;
+    while (cur)
+    {
+        auto ino_it = cli->st_cli.inode_config.find(cur);
+        if (ino_it == cli->st_cli.inode_config.end() || !ino_it->second.readonly ||
+            chain.size() >= CHAIN_CACHE_MAX_LAYERS)
+        {
+            return false;
+        }
+        auto pool_it = cli->st_cli.pool_config.find(INODE_POOL(cur));
+        if (pool_it == cli->st_cli.pool_config.end())
+        {
+            return false;
+        }
+        auto & pool_cfg = pool_it->second;
+        if (!chain.size())
+        {
+            block_size = pool_cfg.data_block_size * (pool_cfg.scheme == POOL_SCHEME_REPLICATED
+                ? 1 : pool_cfg.pg_size-pool_cfg.parity_chunks);
+            bitmap_granularity = pool_cfg.bitmap_granularity;
+        }
+        else if (pool_cfg.bitmap_granularity != bitmap_granularity)
+        {
+            // Layer bitmaps must be comparable
+            return false;
+        }
+        chain.push_back(cur);
+        if (chain_rev < ino_it->second.mod_revision)
+            chain_rev = ino_it->second.mod_revision;
+        cur = ino_it->second.parent_id;
+    }
+    return block_size > 0 && bitmap_granularity > 0;
+}
+
+bool chain_cache_t::handle_read(cluster_client_t *cli, cluster_op_t *op)
+{
+    if (!max_bytes || (op->flags & (OP_NO_CHAIN | OP_NO_CHAIN_CACHE)) || !op->len)
+    {
+        return false;
+    }
+    auto ino_it = cli->st_cli.inode_config.find(op->inode);
+    if (ino_it == cli->st_cli.inode_config.end() || !ino_it->second.parent_id)
+    {
+        return false;
+    }
+    std::vector<inode_t> chain;
+    uint64_t chain_rev = 0, block_size = 0;
+    uint32_t bitmap_granularity = 0;
+    if (!get_chain(cli, ino_it->second.parent_id, chain, chain_rev, block_size, bitmap_granularity) ||
+        cli->st_cli.pool_config.at(INODE_POOL(op->inode)).bitmap_granularity != bitmap_granularity)
+    {
+        return false;
+    }
+    // Only serve the read if ownership of all its blocks is known, start filling missing ones
+    uint64_t first = op->offset - op->offset % block_size;
+    uint64_t end = op->offset + op->len;
+    bool hit = true;
+    for (uint64_t block = first; block < end; block += block_size)
+    {
+        object_id key = { .inode = chain[0], .stripe = block };
+        auto idx_it = index.find(key);
+        if (idx_it == index.end() || blocks[idx_it->second].chain_rev != chain_rev)
+        {
+            hit = false;
+            if (filling.size() < CHAIN_CACHE_MAX_FILLS && filling.find(key) == filling.end())
+            {
+                fill(cli, chain, chain_rev, block, block_size, bitmap_granularity);
+            }
+        }
+    }
+    if (!hit)
+    {
+        return false;
+    }
+    chain_cache_read_t *rd = new chain_cache_read_t;
+    rd->op = op;
+    rd->chain_top = chain[0];
+    rd->block_size = block_size;
+    rd->bitmap_granularity = bitmap_granularity;
+    rd->buf = (uint8_t*)malloc_or_die(op->len);
+    rd->owned = (uint8_t*)calloc_or_die(1, (op->len/bitmap_granularity + 7) / 8);
+    // Protect from completing the read before all parts are submitted
+    rd->todo = 1;
+    // Read the layer itself without parents
+    cluster_op_t *own = new cluster_op_t;
+    own->opcode = OSD_OP_READ;
+    own->flags = OP_NO_CHAIN | OP_NO_READAHEAD;
+    own->inode = op->inode;
+    own->offset = op->offset;
+    own->len = op->len;
+    for (int i = 0; i < op->iov.count; i++)
+    {
+        own->iov.push_back(op->iov.buf[i].iov_base, op->iov.buf[i].iov_len);
+    }
+    own->callback = [this, cli, rd](cluster_op_t *own)
+    {
+        if (own->retval != own->len)
+            rd->failed = true;
+        rd->own_read = own;
+        if (!--rd->todo)
+            complete_read(cli, rd);
+    };
+    rd->todo++;
+    cli->execute_internal(own);
+    // Read runs of granules owned by parent layers in parallel, directly from these layers
+    uint64_t run_start = op->offset;
+    uint8_t run_owner = CHAIN_CACHE_NO_OWNER;
+    for (uint64_t cur = op->offset; cur <= end; cur += bitmap_granularity)
+    {
+        uint8_t owner = CHAIN_CACHE_NO_OWNER;
+        if (cur < end)
+        {
+            auto & b = blocks[index.at((object_id){ .inode = chain[0], .stripe = cur - cur % block_size })];
+            b.referenced = true;
+            owner = b.owners[(cur % block_size) / bitmap_granularity];
+        }
+        if (owner == run_owner)
+        {
+            continue;
+        }
+        if (run_owner != CHAIN_CACHE_NO_OWNER)
+        {
+            cluster_op_t *sub = new cluster_op_t;
+            sub->opcode = OSD_OP_READ;
+            sub->flags = OP_NO_CHAIN | OP_NO_READAHEAD;
+            sub->inode = chain[run_owner];
+            sub->offset = run_start;
+            sub->len = cur - run_start;
+            sub->iov.push_back(rd->buf + run_start - op->offset, sub->len);
+            sub->callback = [this, cli, rd](cluster_op_t *sub)
+            {
+                if (sub->retval != sub->len)
+                    rd->failed = true;
+                else
+                {
+                    // Layer data may be rewritten or deleted before metadata changes (for example,
+                    // by layer merge in vitastor-cli rm), so check that the owner still has the data
+                    uint8_t *bitmap = (uint8_t*)sub->bitmap_buf;
+                    uint32_t granules = sub->len / rd->bitmap_granularity;
+                    for (uint32_t i = 0; i < granules; i++)
+                    {
+                        if (!(bitmap[i/8] & (1 << (i%8))))
+                        {
+                            rd->failed = rd->stale = true;
+                            break;
+                        }
+                    }
+                }
+                delete sub;
+                if (!--rd->todo)
+                    complete_read(cli, rd);
+            };
+            for (uint64_t pos = run_start; pos < cur; pos += bitmap_granularity)
+            {
+                unsigned bit = (pos - op->offset) / bitmap_granularity;
+                rd->owned[bit/8] |= (1 << (bit%8));
+            }
+            rd->todo++;
+            cli->execute_internal(sub);
+        }
+        run_start = cur;
+        run_owner = owner;
+    }
+    if (!--rd->todo)
+    {
+        complete_read(cli, rd);
+    }
+    return true;
+}
+
+void chain_cache_t::complete_read(cluster_client_t *cli, chain_cache_read_t *rd)
+{
+    cluster_op_t *op = rd->op;
+    cluster_op_t *own = rd->own_read;
+    if (rd->failed)
+    {
+        if (rd->stale)
+        {
+            evict_range(rd->chain_top, rd->block_size, op->offset, op->len);
+        }
+        free(rd->buf);
+        free(rd->owned);
+        delete own;
+        delete rd;
+        // Read the data as usual
+        op->flags |= OP_NO_CHAIN_CACHE | OP_NO_READAHEAD;
+        cli->execute_internal(op);
+        return;
+    }
+    // Take the bitmap of the layer itself and add parent data where the layer has no data
+    std::swap(op->bitmap_buf, own->bitmap_buf);
+    std::swap(op->bitmap_buf_size, own->bitmap_buf_size);
+    op->version = own->version;
+    delete own;
+    uint32_t granules = op->len / rd->bitmap_granularity;
+    uint8_t *bitmap = (uint8_t*)op->bitmap_buf;
+    for (uint32_t i = 0; i < granules; )
+    {
+        if (!(rd->owned[i/8] & (1 << (i%8))) || (bitmap[i/8] & (1 << (i%8))))
+        {
+            i++;
+            continue;
+        }
+        uint32_t j = i;
+        while (j < granules && (rd->owned[j/8] & (1 << (j%8))) && !(bitmap[j/8] & (1 << (j%8))))
+        {
+            bitmap[j/8] |= (1 << (j%8));
+            j++;
+        }
+        copy_op_iov(op, (uint64_t)i*rd->bitmap_granularity, rd->buf + (uint64_t)i*rd->bitmap_granularity,
+            (uint64_t)(j-i)*rd->bitmap_granularity, true);
+        i = j;
+    }
+    free(rd->buf);
+    free(rd->owned);
+    delete rd;
+    op->retval = op->len;
+    auto cb = std::move(op->callback);
+    cb(op);
+}
+
+// Find owners of all granules of a block by reading bitmaps of all layers of the chain
+void chain_cache_t::fill(cluster_client_t *cli, const std::vector<inode_t> & chain, uint64_t chain_rev,
+    uint64_t block, uint64_t block_size, uint32_t bitmap_granularity)
+{
+    chain_cache_fill_t *f = new chain_cache_fill_t;
+    f->key = (object_id){ .inode = chain[0], .stripe = block };
+    f->chain_rev = chain_rev;
+    f->granules = block_size / bitmap_granularity;
+    f->owners = (uint8_t*)malloc_or_die(f->granules);
+    memset(f->owners, CHAIN_CACHE_NO_OWNER, f->granules);
+    f->todo = 1;
+    f->failed = false;
+    filling.insert(f->key);
+    for (int i = 0; i < chain.size(); i++)
+    {
+        cluster_op_t *op = new cluster_op_t;
+        op->opcode = OSD_OP_READ_BITMAP;
+        op->inode = chain[i];
+        op->offset = block;
+        op->len = block_size;
+        op->callback = [this, f, i](cluster_op_t *op)
+        {
+            if (op->retval < 0)
+            {
+                f->failed = true;
+            }
+            else
+            {
+                // The topmost layer having data owns the granule
+                uint8_t *bitmap = (uint8_t*)op->bitmap_buf;
+                for (uint32_t g = 0; g < f->granules; g++)
+                {
+                    if ((bitmap[g/8] & (1 << (g%8))) && (f->owners[g] == CHAIN_CACHE_NO_OWNER || f->owners[g] > i))
+                        f->owners[g] = i;
+                }
+            }
+            delete op;
+            if (!--f->todo)
+                finish_fill(f);
+        };
+        f->todo++;
+        cli->execute_internal(op);
+    }
+    if (!--f->todo)
+    {
+        finish_fill(f);
+    }
+}
+
+void chain_cache_t::finish_fill(chain_cache_fill_t *f)
+{
+    filling.erase(f->key);
+    uint64_t entry_size = f->granules + CHAIN_CACHE_ENTRY_OVERHEAD;
+    if (f->failed || entry_size > max_bytes)
+    {
+        free(f->owners);
+        delete f;
+        return;
+    }
+    auto idx_it = index.find(f->key);
+    if (idx_it != index.end())
+    {
+        evict_block(idx_it->second);
+    }
+    // CLOCK: evict blocks which weren't used since the last pass until the new one fits
+    while (used_bytes + entry_size > max_bytes)
+    {
+        assert(blocks.size() > 0);
+        if (clock_hand >= blocks.size())
+            clock_hand = 0;
+        auto & b = blocks[clock_hand];
+        if (b.key.inode && !b.referenced)
+            evict_block(clock_hand);
+        else
+            b.referenced = false;
+        clock_hand++;
+    }
+    uint32_t pos;
+    if (free_blocks.size())
+    {
+        pos = free_blocks.back();
+        free_blocks.pop_back();
+    }
+    else
+    {
+        blocks.push_back((chain_cache_block_t){});
+        pos = blocks.size()-1;
+    }
+    blocks[pos] = (chain_cache_block_t){
+        .key = f->key,
+        .chain_rev = f->chain_rev,
+        .granules = f->granules,
+        .owners = f->owners,
+        .referenced = false,
+    };
+    index[f->key] = pos;
+    used_bytes += entry_size;
+    delete f;
+}
+
+void chain_cache_t::evict_block(uint32_t pos)
+{
+    auto & b = blocks[pos];
+    index.erase(b.key);
+    used_bytes -= b.granules + CHAIN_CACHE_ENTRY_OVERHEAD;
+    free(b.owners);
+    b = (chain_cache_block_t){};
+    free_blocks.push_back(pos);
+}
+
+void chain_cache_t::evict_range(inode_t chain_top, uint64_t block_size, uint64_t offset, uint64_t len)
+{
+    for (uint64_t block = offset - offset % block_size; block < offset+len; block += block_size)
+    {
+        auto idx_it = index.find((object_id){ .inode = chain_top, .stripe = block });
+        if (idx_it != index.end())
+        {
+            evict_block(idx_it->second);
+        }
+    }
+}
@@ -16,6 +16,21 @@
 #define CACHE_REPEATING 4
 #define OP_FLUSH_BUFFER 0x02
 #define OP_IMMEDIATE_COMMIT 0x04
+#define OP_READ_CACHE_FILL 0x10
+#define READ_CACHE_BLOCK_SIZE 4096
+// Larger reads are neither cached nor served from the read cache, so that
+// sequential scans (backups, image copies) don't wash out hot blocks
+#define READ_CACHE_MAX_OP_SIZE 256*1024
+#define OP_NO_READAHEAD 0x20
+#define READAHEAD_MAX_STREAMS 16
+// Readahead starts after this number of consecutive sequential reads
+#define READAHEAD_MIN_SEQ_READS 2
+// Internal reads of a single layer without its parents
+#define OP_NO_CHAIN 0x40
+#define OP_NO_CHAIN_CACHE 0x80
+#define CHAIN_CACHE_NO_OWNER 0xFF
+#define CHAIN_CACHE_MAX_LAYERS 254
+#define CHAIN_CACHE_MAX_FILLS 64
 
 struct cluster_buffer_t
 {
@@ -56,3 +71,182 @@ public:
     void fsync_error();
     void fsync_ok();
 };
+
+struct read_cache_block_t
+{
+    // inode == 0 means the slot is free
+    object_id key;
+    uint64_t meta_rev;
+    uint8_t *buf;
+    // object bitmap bits of the block, one per bitmap_granularity
+    uint8_t bitmap;
+    bool referenced;
+};
+
+struct read_cache_inval_t
+{
+    uint64_t seq, inode, offset, len;
+};
+
+// Clean read cache of (inode, 4 KB block) => data, bounded by CLOCK eviction
+// Only used for images which can't be changed by other clients: readonly ones
+// (snapshots) and, with client_read_cache_exclusive, all images opened by this client.
+class read_cache_t
+{
+public:
+    uint64_t max_blocks = 0;
+
+    std::vector<read_cache_block_t> blocks;
+    std::vector<uint32_t> free_blocks;
+    std::unordered_map<object_id, uint32_t> index;
+    uint32_t clock_hand = 0;
+
+    // Invalidations which happened while reads were in flight: such reads
+    // may return old data, so their results must not be put into the cache
+    uint64_t inval_seq = 0, fill_barrier = 0;
+    int reads_in_flight = 0;
+    std::vector<read_cache_inval_t> recent_invals;
+
+    ~read_cache_t();
+    void resize(uint64_t max_bytes);
+    void clear();
+    bool read(cluster_op_t *op, uint64_t meta_rev, uint32_t bitmap_granularity);
+    void start_read(cluster_op_t *op);
+    void finish_read(cluster_op_t *op, uint64_t meta_rev, uint32_t bitmap_granularity);
+    void invalidate(uint64_t inode, uint64_t offset, uint64_t len);
+protected:
+    uint32_t alloc_block();
+};
+
+struct readahead_buf_t
+{
+    uint64_t inode, offset, len;
+    // inode metadata revision at the moment of the prefetch
+    uint64_t meta_rev;
+    uint32_t bitmap_granularity;
+    uint8_t *buf = NULL;
+    // object bitmap of the prefetched range, one bit per bitmap_granularity
+    uint8_t *bitmap = NULL;
+    bool done = false;
+    int retval = 0;
+    // held by the stream, by the prefetch operation and by every waiting read
+    int refs = 0;
+};
+
+struct readahead_stream_t
+{
+    uint64_t inode = 0;
+    // buffers are dropped when inode metadata changes
+    uint64_t meta_rev = 0;
+    uint64_t next_offset = 0;
+    int seq_reads = 0;
+    uint64_t window = 0;
+    uint64_t last_used = 0;
+    // sorted by offset
+    std::vector<readahead_buf_t*> bufs;
+};
+
+struct readahead_wait_t
+{
+    cluster_op_t *op;
+    std::vector<readahead_buf_t*> bufs;
+};
+
+// Sequential read detection and prefetch of whole stripes ahead of the reader.
+// Reads covered by prefetched (or being prefetched) data are served from it.
+// Like the read cache, only used for images nobody else can change.
+class readahead_t
+{
+public:
+    uint64_t min_window = 0, max_window = 0;
+    uint64_t buffered_bytes = 0;
+    uint64_t use_counter = 0;
+    std::vector<readahead_stream_t> streams;
+    std::vector<readahead_wait_t> waiters;
+
+    readahead_t();
+    ~readahead_t();
+    bool handle_read(cluster_client_t *cli, cluster_op_t *op);
+    void invalidate(uint64_t inode, uint64_t offset, uint64_t len);
+    void clear();
+protected:
+    readahead_stream_t *get_stream(uint64_t inode);
+    void reset_stream(readahead_stream_t *st);
+    void prefetch(cluster_client_t *cli, readahead_stream_t *st, int pos, uint64_t offset, uint64_t len,
+        uint32_t bitmap_granularity, uint64_t meta_rev);
+    void release(readahead_buf_t *b);
+    bool try_complete(cluster_client_t *cli, readahead_wait_t & w);
+    void handle_prefetch(cluster_client_t *cli, readahead_buf_t *b, cluster_op_t *op);
+};
+
+struct chain_cache_block_t
+{
+    // inode == 0 means the slot is free
+    // inode is the top layer of the readonly chain, stripe is the block offset
+    object_id key;
+    // maximum mod_revision of all layers of the chain
+    uint64_t chain_rev;
+    uint32_t granules;
+    // owning layer number in the chain for every granule, CHAIN_CACHE_NO_OWNER if none
+    uint8_t *owners;
+    bool referenced;
+};
+
+struct chain_cache_fill_t
+{
+    object_id key;
+    uint64_t chain_rev;
+    uint32_t granules;
+    uint8_t *owners;
+    int todo;
+    bool failed;
+};
+
+struct chain_cache_read_t
+{
+    cluster_op_t *op;
+    // data of parent layers, <op->len> bytes
+    uint8_t *buf = NULL;
+    // granules of the operation owned by parent layers
+    uint8_t *owned = NULL;
+    // result of the read of the layer itself
+    cluster_op_t *own_read = NULL;
+    inode_t chain_top;
+    uint64_t block_size;
+    uint32_t bitmap_granularity;
+    int todo = 0;
+    bool failed = false;
+    // the owning layer didn't have some of the granules, cached ownership is outdated
+    bool stale = false;
+};
+
+// Cache of granule ownership in chains of readonly layers (snapshots) which never change.
+// Reads of an image with readonly parents are then sent directly to the owning layers,
+// in parallel with the read of the image itself, instead of walking the chain layer by layer.
+class chain_cache_t
+{
+public:
+    uint64_t max_bytes = 0, used_bytes = 0;
+
+    std::vector<chain_cache_block_t> blocks;
+    std::vector<uint32_t> free_blocks;
+    std::unordered_map<object_id, uint32_t> index;
+    uint32_t clock_hand = 0;
+    std::set<object_id> filling;
+
+    ~chain_cache_t();
+    void resize(uint64_t new_max_bytes);
+    void clear();
+    bool handle_read(cluster_client_t *cli, cluster_op_t *op);
+protected:
+    bool get_chain(cluster_client_t *cli, inode_t top, std::vector<inode_t> & chain, uint64_t & chain_rev,
+        uint64_t & block_size, uint32_t & bitmap_granularity);
+    void fill(cluster_client_t *cli, const std::vector<inode_t> & chain, uint64_t chain_rev,
+        uint64_t block, uint64_t block_size, uint32_t bitmap_granularity);
+    void finish_fill(chain_cache_fill_t *f);
+    void evict_block(uint32_t pos);
+    void evict_range(inode_t chain_top, uint64_t block_size, uint64_t offset, uint64_t len);
+    void complete_read(cluster_client_t *cli, chain_cache_read_t *rd);
+};
+
+void copy_op_iov(cluster_op_t *op, uint64_t pos, uint8_t *buf, uint64_t len, bool to_op);
@@ -0,0 +1,230 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include <cassert>
+
+#include "cluster_client_impl.h"
+
+read_cache_t::~read_cache_t()
+{
+    clear();
+}
+
+void read_cache_t::resize(uint64_t max_bytes)
+{
+    uint64_t new_max_blocks = max_bytes / READ_CACHE_BLOCK_SIZE;
+    if (new_max_blocks != max_blocks)
+    {
+        clear();
+        max_blocks = new_max_blocks;
+    }
+}
+
+void read_cache_t::clear()
+{
+    for (auto & b: blocks)
+    {
+        free(b.buf);
+    }
+    blocks.clear();
+    free_blocks.clear();
+    index.clear();
+    clock_hand = 0;
+}
+
+// Copy <len> bytes between <buf> and the op's iovecs at offset <pos> relative to the op
+void copy_op_iov(cluster_op_t *op, uint64_t pos, uint8_t *buf, uint64_t len, bool to_op)
+{
+    int iov_idx = 0;
+    uint64_t cur = 0;
+    while (iov_idx < op->iov.count && cur+op->iov.buf[iov_idx].iov_len <= pos)
+    {
+        cur += op->iov.buf[iov_idx].iov_len;
+        iov_idx++;
+    }
+    while (iov_idx < op->iov.count && cur < pos+len)
+    {
+        auto & v = op->iov.buf[iov_idx];
+        uint64_t begin = (cur < pos ? pos : cur);
+        uint64_t end = (cur+v.iov_len > pos+len ? pos+len : cur+v.iov_len);
+        if (to_op)
+            memcpy((uint8_t*)v.iov_base + begin - cur, buf + begin - pos, end - begin);
+        else
+            memcpy(buf + begin - pos, (uint8_t*)v.iov_base + begin - cur, end - begin);
+        cur += v.iov_len;
+        iov_idx++;
+    }
+}
+
+bool read_cache_t::read(cluster_op_t *op, uint64_t meta_rev, uint32_t bitmap_granularity)
+{
+    if (!index.size() || !op->len || op->len > READ_CACHE_MAX_OP_SIZE)
+    {
+        return false;
+    }
+    uint64_t first = op->offset - op->offset % READ_CACHE_BLOCK_SIZE;
+    uint64_t end = op->offset + op->len;
+    // Only complete hits are served, partial ones go to OSDs as usual
+    for (uint64_t block = first; block < end; block += READ_CACHE_BLOCK_SIZE)
+    {
+        auto idx_it = index.find((object_id){ .inode = op->inode, .stripe = block });
+        if (idx_it == index.end() || blocks[idx_it->second].meta_rev != meta_rev)
+        {
+            return false;
+        }
+    }
+    unsigned bitmap_size = ((op->len / bitmap_granularity + 7) / 8);
+    bitmap_size = (bitmap_size < 8 ? 8 : bitmap_size);
+    if (!op->bitmap_buf || op->bitmap_buf_size < bitmap_size)
+    {
+        op->bitmap_buf = realloc_or_die(op->bitmap_buf, bitmap_size);
+        op->bitmap_buf_size = bitmap_size;
+    }
+    memset(op->bitmap_buf, 0, bitmap_size);
+    for (uint64_t block = first; block < end; block += READ_CACHE_BLOCK_SIZE)
+    {
+        auto & b = blocks[index.at((object_id){ .inode = op->inode, .stripe = block })];
+        b.referenced = true;
+        uint64_t begin = (block < op->offset ? op->offset : block);
+        uint64_t block_end = (block+READ_CACHE_BLOCK_SIZE > end ? end : block+READ_CACHE_BLOCK_SIZE);
+        copy_op_iov(op, begin - op->offset, b.buf + begin - block, block_end - begin, true);
+        for (uint64_t cur = begin; cur < block_end; cur += bitmap_granularity)
+        {
+            if (b.bitmap & (1 << ((cur - block) / bitmap_granularity)))
+            {
+                unsigned bit = (cur - op->offset) / bitmap_granularity;
+                ((uint8_t*)op->bitmap_buf)[bit/8] |= (1 << (bit%8));
+            }
+        }
+    }
+    return true;
+}
+
+void read_cache_t::start_read(cluster_op_t *op)
+{
+    op->flags |= OP_READ_CACHE_FILL;
+    op->read_cache_seq = inval_seq;
+    reads_in_flight++;
+}
+
+void read_cache_t::finish_read(cluster_op_t *op, uint64_t meta_rev, uint32_t bitmap_granularity)
+{
+    op->flags &= ~OP_READ_CACHE_FILL;
+    reads_in_flight--;
+    bool fill = max_blocks > 0 && bitmap_granularity > 0 && op->retval == op->len && op->len <= READ_CACHE_MAX_OP_SIZE &&
+        op->read_cache_seq >= fill_barrier;
+    for (auto & inv: recent_invals)
+    {
+        if (!fill)
+            break;
+        if (inv.seq > op->read_cache_seq && inv.inode == op->inode &&
+            inv.offset < op->offset+op->len && inv.offset+inv.len > op->offset)
+        {
+            // The range was overwritten while the read was in flight
+            fill = false;
+        }
+    }
+    if (!reads_in_flight)
+    {
+        recent_invals.clear();
+    }
+    if (!fill)
+    {
+        return;
+    }
+    uint64_t first = (op->offset + READ_CACHE_BLOCK_SIZE - 1) / READ_CACHE_BLOCK_SIZE * READ_CACHE_BLOCK_SIZE;
+    for (uint64_t block = first; block + READ_CACHE_BLOCK_SIZE <= op->offset+op->len; block += READ_CACHE_BLOCK_SIZE)
+    {
+        object_id key = { .inode = op->inode, .stripe = block };
+        auto idx_it = index.find(key);
+        uint32_t pos;
+        if (idx_it != index.end())
+        {
+            pos = idx_it->second;
+        }
+        else
+        {
+            pos = alloc_block();
+            index[key] = pos;
+        }
+        auto & b = blocks[pos];
+        b.key = key;
+        b.meta_rev = meta_rev;
+        b.referenced = false;
+        b.bitmap = 0;
+        copy_op_iov(op, block - op->offset, b.buf, READ_CACHE_BLOCK_SIZE, false);
+        for (unsigned i = 0; i < READ_CACHE_BLOCK_SIZE/bitmap_granularity; i++)
+        {
+            unsigned bit = (block - op->offset)/bitmap_granularity + i;
+            if (((uint8_t*)op->bitmap_buf)[bit/8] & (1 << (bit%8)))
+                b.bitmap |= (1 << i);
+        }
+    }
+}
+
+uint32_t read_cache_t::alloc_block()
+{
+    if (free_blocks.size())
+    {
+        uint32_t pos = free_blocks.back();
+        free_blocks.pop_back();
+        return pos;
+    }
+    if (blocks.size() < max_blocks)
+    {
+        blocks.push_back((read_cache_block_t){ .buf = (uint8_t*)malloc_or_die(READ_CACHE_BLOCK_SIZE) });
+        return blocks.size()-1;
+    }
+    // CLOCK: evict the first block which wasn't hit since the last pass
+    assert(blocks.size() > 0);
+    while (true)
+    {
+        if (clock_hand >= blocks.size())
+            clock_hand = 0;
+        auto & b = blocks[clock_hand];
+        if (!b.referenced)
+        {
+            index.erase(b.key);
+            b.key = {};
+            return clock_hand++;
+        }
+        b.referenced = false;
+        clock_hand++;
+    }
+}
+
+void read_cache_t::invalidate(uint64_t inode, uint64_t offset, uint64_t len)
+{
+    if (!max_blocks)
+    {
+        return;
+    }
+    inval_seq++;
+    if (reads_in_flight > 0)
+    {
+        if (recent_invals.size() >= 256)
+        {
+            // Don't track too many ranges, just drop all results of currently running reads
+            fill_barrier = inval_seq;
+            recent_invals.clear();
+        }
+        else
+            recent_invals.push_back((read_cache_inval_t){ .seq = inval_seq, .inode = inode, .offset = offset, .len = len });
+    }
+    if (!index.size())
+    {
+        return;
+    }
+    uint64_t first = offset - offset % READ_CACHE_BLOCK_SIZE;
+    for (uint64_t block = first; block < offset+len; block += READ_CACHE_BLOCK_SIZE)
+    {
+        auto idx_it = index.find((object_id){ .inode = inode, .stripe = block });
+        if (idx_it != index.end())
+        {
+            blocks[idx_it->second].key = {};
+            blocks[idx_it->second].referenced = false;
+            free_blocks.push_back(idx_it->second);
+            index.erase(idx_it);
+        }
+    }
+}
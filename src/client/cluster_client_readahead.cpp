@@ -0,0 +1,321 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include <cassert>
+#include <algorithm>
+
+#include "cluster_client_impl.h"
+
+readahead_t::readahead_t()
+{
+    // Stream pointers must stay valid while prefetches are submitted
+    streams.reserve(READAHEAD_MAX_STREAMS);
+}
+
+readahead_t::~readahead_t()
+{
+    clear();
+}
+
+void readahead_t::clear()
+{
+    for (auto & st: streams)
+    {
+        reset_stream(&st);
+    }
+    streams.clear();
+}
+
+void readahead_t::release(readahead_buf_t *b)
+{
+    if (!--b->refs)
+    {
+        buffered_bytes -= b->len;
+        free(b->buf);
+        if (b->bitmap)
+            free(b->bitmap);
+        delete b;
+    }
+}
+
+void readahead_t::reset_stream(readahead_stream_t *st)
+{
+    for (auto b: st->bufs)
+    {
+        release(b);
+    }
+    st->bufs.clear();
+    st->seq_reads = 0;
+    st->window = min_window;
+}
+
+readahead_stream_t *readahead_t::get_stream(uint64_t inode)
+{
+    readahead_stream_t *lru = NULL;
+    for (auto & st: streams)
+    {
+        if (st.inode == inode)
+            return &st;
+        if (!lru || lru->last_used > st.last_used)
+            lru = &st;
+    }
+    if (streams.size() < READAHEAD_MAX_STREAMS)
+    {
+        streams.push_back((readahead_stream_t){ .inode = inode, .window = min_window });
+        return &streams.back();
+    }
+    reset_stream(lru);
+    lru->inode = inode;
+    lru->next_offset = 0;
+    return lru;
+}
+
+bool readahead_t::handle_read(cluster_client_t *cli, cluster_op_t *op)
+{
+    uint64_t meta_rev = 0;
+    if (!max_window || (op->flags & OP_NO_READAHEAD) || !op->len || !cli->is_inode_private(op->inode, meta_rev))
+    {
+        return false;
+    }
+    auto st = get_stream(op->inode);
+    st->last_used = ++use_counter;
+    if (st->meta_rev != meta_rev)
+    {
+        // Image metadata changed (for example, its parent), prefetched data may be stale
+        reset_stream(st);
+        st->meta_rev = meta_rev;
+    }
+    else if (op->offset != st->next_offset)
+    {
+        // Not a sequential read, start over
+        reset_stream(st);
+    }
+    else
+        st->seq_reads++;
+    st->next_offset = op->offset + op->len;
+    // Forget data the reader has already passed
+    int consumed = 0;
+    while (consumed < st->bufs.size() && st->bufs[consumed]->offset + st->bufs[consumed]->len <= op->offset)
+    {
+        release(st->bufs[consumed++]);
+    }
+    if (consumed > 0)
+    {
+        st->bufs.erase(st->bufs.begin(), st->bufs.begin()+consumed);
+    }
+    if (st->seq_reads < READAHEAD_MIN_SEQ_READS)
+    {
+        return false;
+    }
+    // Prefetch whole stripes up to <window> bytes ahead of the reader
+    auto & pool_cfg = cli->st_cli.pool_config.at(INODE_POOL(op->inode));
+    uint64_t stripe = pool_cfg.data_block_size * (pool_cfg.scheme == POOL_SCHEME_REPLICATED
+        ? 1 : pool_cfg.pg_size-pool_cfg.parity_chunks);
+    uint64_t ra_target = op->offset + op->len + st->window;
+    auto ino_it = cli->st_cli.inode_config.find(op->inode);
+    if (ino_it != cli->st_cli.inode_config.end() && ino_it->second.size && ra_target > ino_it->second.size)
+    {
+        ra_target = ino_it->second.size;
+    }
+    // Stripes which are missing in the window, including ones whose prefetch failed, are prefetched again
+    uint64_t ra_offset = (op->offset + op->len) / stripe * stripe;
+    int pos = 0;
+    while (ra_offset < ra_target && buffered_bytes + stripe <= max_window*READAHEAD_MAX_STREAMS)
+    {
+        while (pos < st->bufs.size() && st->bufs[pos]->offset + st->bufs[pos]->len <= ra_offset)
+            pos++;
+        if (pos >= st->bufs.size() || st->bufs[pos]->offset >= ra_offset + stripe)
+        {
+            prefetch(cli, st, pos, ra_offset, stripe, pool_cfg.bitmap_granularity, meta_rev);
+        }
+        ra_offset += stripe;
+    }
+    st->window = (st->window*2 > max_window ? max_window : st->window*2);
+    // Serve the read if it's fully covered by prefetched data
+    readahead_wait_t w = { .op = op };
+    uint64_t cur = op->offset, end = op->offset + op->len;
+    for (auto b: st->bufs)
+    {
+        if (b->offset > cur)
+            break;
+        if (b->offset + b->len > cur)
+        {
+            w.bufs.push_back(b);
+            cur = b->offset + b->len;
+            if (cur >= end)
+                break;
+        }
+    }
+    if (cur < end)
+    {
+        return false;
+    }
+    for (auto b: w.bufs)
+    {
+        b->refs++;
+    }
+    if (!try_complete(cli, w))
+    {
+        waiters.push_back(w);
+    }
+    return true;
+}
+
+void readahead_t::prefetch(cluster_client_t *cli, readahead_stream_t *st, int pos, uint64_t offset, uint64_t len,
+    uint32_t bitmap_granularity, uint64_t meta_rev)
+{
+    auto b = new readahead_buf_t;
+    b->inode = st->inode;
+    b->meta_rev = meta_rev;
+    b->offset = offset;
+    b->len = len;
+    b->bitmap_granularity = bitmap_granularity;
+    b->buf = (uint8_t*)malloc_or_die(len);
+    // One reference for the stream and one for the prefetch operation
+    b->refs = 2;
+    buffered_bytes += len;
+    st->bufs.insert(st->bufs.begin()+pos, b);
+    cluster_op_t *op = new cluster_op_t;
+    op->opcode = OSD_OP_READ;
+    op->flags = OP_NO_READAHEAD;
+    op->inode = st->inode;
+    op->offset = offset;
+    op->len = len;
+    op->iov.push_back(b->buf, len);
+    op->callback = [this, cli, b](cluster_op_t *op)
+    {
+        handle_prefetch(cli, b, op);
+    };
+    cli->execute_internal(op);
+}
+
+void readahead_t::handle_prefetch(cluster_client_t *cli, readahead_buf_t *b, cluster_op_t *op)
+{
+    b->done = true;
+    b->retval = op->retval;
+    if (op->retval == op->len)
+    {
+        // Take the object bitmap from the operation
+        b->bitmap = (uint8_t*)op->bitmap_buf;
+        op->bitmap_buf = NULL;
+    }
+    else
+    {
+        // Don't keep failed data in the stream, so the next sequential read retries the prefetch
+        for (auto & st: streams)
+        {
+            auto b_it = std::find(st.bufs.begin(), st.bufs.end(), b);
+            if (b_it != st.bufs.end())
+            {
+                st.bufs.erase(b_it);
+                release(b);
+                break;
+            }
+        }
+    }
+    delete op;
+    // Callbacks may submit new reads and change <waiters>, so take ready reads out first
+    std::vector<readahead_wait_t> ready;
+    for (int i = 0; i < waiters.size(); )
+    {
+        bool all_done = true;
+        for (auto wb: waiters[i].bufs)
+        {
+            if (!wb->done)
+            {
+                all_done = false;
+                break;
+            }
+        }
+        if (all_done)
+        {
+            ready.push_back(std::move(waiters[i]));
+            waiters.erase(waiters.begin()+i);
+        }
+        else
+            i++;
+    }
+    release(b);
+    for (auto & w: ready)
+    {
+        try_complete(cli, w);
+    }
+}
+
+bool readahead_t::try_complete(cluster_client_t *cli, readahead_wait_t & w)
+{
+    bool ok = true;
+    for (auto b: w.bufs)
+    {
+        if (!b->done)
+            return false;
+        if (b->retval != b->len)
+            ok = false;
+    }
+    cluster_op_t *op = w.op;
+    if (ok)
+    {
+        uint32_t bitmap_granularity = w.bufs[0]->bitmap_granularity;
+        unsigned bitmap_size = ((op->len / bitmap_granularity + 7) / 8);
+        bitmap_size = (bitmap_size < 8 ? 8 : bitmap_size);
+        if (!op->bitmap_buf || op->bitmap_buf_size < bitmap_size)
+        {
+            op->bitmap_buf = realloc_or_die(op->bitmap_buf, bitmap_size);
+            op->bitmap_buf_size = bitmap_size;
+        }
+        memset(op->bitmap_buf, 0, bitmap_size);
+        for (auto b: w.bufs)
+        {
+            uint64_t begin = (b->offset < op->offset ? op->offset : b->offset);
+            uint64_t end = (b->offset+b->len > op->offset+op->len ? op->offset+op->len : b->offset+b->len);
+            copy_op_iov(op, begin - op->offset, b->buf + begin - b->offset, end - begin, true);
+            for (uint64_t cur = begin; b->bitmap && cur < end; cur += bitmap_granularity)
+            {
+                unsigned src = (cur - b->offset) / bitmap_granularity;
+                if (b->bitmap[src/8] & (1 << (src%8)))
+                {
+                    unsigned bit = (cur - op->offset) / bitmap_granularity;
+                    ((uint8_t*)op->bitmap_buf)[bit/8] |= (1 << (bit%8));
+                }
+            }
+        }
+    }
+    for (auto b: w.bufs)
+    {
+        release(b);
+    }
+    w.bufs.clear();
+    if (!ok)
+    {
+        // Prefetch failed, read the data as usual
+        op->flags |= OP_NO_READAHEAD;
+        cli->execute_internal(op);
+        return true;
+    }
+    op->retval = op->len;
+    auto cb = std::move(op->callback);
+    cb(op);
+    return true;
+}
+
+void readahead_t::invalidate(uint64_t inode, uint64_t offset, uint64_t len)
+{
+    // Reads waiting for removed buffers were submitted before the write, so they
+    // still get the old data, but new reads won't find these buffers anymore
+    for (auto & st: streams)
+    {
+        if (st.inode != inode)
+            continue;
+        for (int i = 0; i < st.bufs.size(); )
+        {
+            auto b = st.bufs[i];
+            if (b->offset < offset+len && b->offset+b->len > offset)
+            {
+                release(b);
+                st.bufs.erase(st.bufs.begin()+i);
+            }
+            else
+                i++;
+        }
+    }
+}
@@ -865,6 +865,8 @@ void etcd_state_client_t::parse_state(const etcd_kv_t & kv)
                 pc.scrub_interval = 0;
             // Mark pool as VitastorFS pool (disable per-inode stats and block volume creation)
             pc.used_for_fs = pool_item.second["used_for_fs"].as_string();
+            // QoS limits
+            pc.qos = qos_limits_t::parse(pool_item.second);
             // Immediate Commit Mode
             pc.immediate_commit = pool_item.second["immediate_commit"].is_string()
                 ? parse_immediate_commit(pool_item.second["immediate_commit"].string_value())
@@ -1169,6 +1171,7 @@ void etcd_state_client_t::parse_state(const etcd_kv_t & kv)
                     .readonly = value["readonly"].bool_value(),
                     .meta = value["meta"],
                     .mod_revision = kv.mod_revision,
+                    .qos = qos_limits_t::parse(value),
                 });
             }
         }
@@ -1258,6 +1261,14 @@ json11::Json::object etcd_state_client_t::serialize_inode_cfg(inode_config_t *cf
     {
         new_cfg["meta"] = cfg->meta;
     }
+    if (cfg->qos.iops)
+        new_cfg["qos_iops"] = cfg->qos.iops;
+    if (cfg->qos.bps)
+        new_cfg["qos_bps"] = cfg->qos.bps;
+    if (cfg->qos.burst_iops)
+        new_cfg["qos_burst_iops"] = cfg->qos.burst_iops;
+    if (cfg->qos.burst_bps)
+        new_cfg["qos_burst_bps"] = cfg->qos.burst_bps;
     return new_cfg;
 }
 
@@ -7,6 +7,7 @@
 
 #include "json11/json11.hpp"
 #include "osd_id.h"
+#include "qos.h"
 #include "timerfd_manager.h"
 
 #define ETCD_CONFIG_WATCH_ID 1
@@ -63,6 +64,8 @@ struct pool_config_t
     std::map<pg_num_t, pg_config_t> pg_config;
     uint64_t scrub_interval;
     std::string used_for_fs;
+    // Total limits of all client I/O in the pool on every primary OSD
+    qos_limits_t qos;
 };
 
 struct inode_config_t
@@ -76,6 +79,8 @@ struct inode_config_t
     json11::Json meta;
     // Change revision of the metadata in etcd
     uint64_t mod_revision = 0;
+    // I/O limits of the image
+    qos_limits_t qos;
 };
 
 struct inode_watch_t
@@ -14,6 +14,7 @@
 
 #include "malloc_or_die.h"
 #include "json11/json11.hpp"
+#include "latency_hist.h"
 #include "msgr_op.h"
 #include "timerfd_manager.h"
 #include <ringloop.h>
@@ -111,6 +112,14 @@ struct osd_op_stats_t
     uint64_t subop_stat_count[OSD_OP_MAX+1] = { 0 };
 };
 
+struct osd_latency_hists_t
+{
+    // Execution latency of operations received by this OSD
+    latency_hist_t op[OSD_OP_MAX+1];
+    // Replication wait: latency of operations sent to other OSDs
+    latency_hist_t subop[OSD_OP_MAX+1];
+};
+
 struct osd_messenger_t
 {
 protected:
@@ -123,6 +132,8 @@ protected:
     int osd_ping_timeout = 0;
     int log_level = 0;
     bool use_sync_send_recv = false;
+    bool use_zerocopy_send = false;
+    uint64_t min_zerocopy_send_size = 0;
 
 #ifdef WITH_RDMA
     bool use_rdma = true;
@@ -150,6 +161,8 @@ public:
     std::map<uint64_t, int> osd_peer_fds;
     // op statistics
     osd_op_stats_t stats, recovery_stats;
+    // latency histograms, only collected when set (by the OSD)
+    osd_latency_hists_t *latency_hists = NULL;
 
     void init();
     void parse_config(const json11::Json & config);
@@ -175,7 +188,7 @@ public:
     bool connect_rdma(int peer_fd, std::string rdma_address, uint64_t client_max_msg);
 #endif
 
-    void inc_op_stats(osd_op_stats_t & stats, uint64_t opcode, timespec & tv_begin, timespec & tv_end, uint64_t len);
+    uint64_t inc_op_stats(osd_op_stats_t & stats, uint64_t opcode, timespec & tv_begin, timespec & tv_end, uint64_t len);
     void measure_exec(osd_op_t *cur_op);
 
 protected:
@@ -190,6 +203,9 @@ protected:
 
     bool try_send(osd_client_t *cl);
     void handle_send(int result, osd_client_t *cl);
+    void handle_send_zc(ring_data_t *data, osd_client_t *cl, std::vector<osd_op_t*> *zc_ops);
+    void release_zc_ops(osd_client_t *cl, std::vector<osd_op_t*> *zc_ops);
+    void finish_zc_deferred(osd_op_t *op);
 
     bool handle_read(int result, osd_client_t *cl);
     bool handle_read_buffer(osd_client_t *cl, void *curbuf, int remain);
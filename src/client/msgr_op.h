@@ -10,6 +10,7 @@
 #include <stdlib.h>
 
 #include "osd_ops.h"
+#include "mem_pool.h"
 
 #define OSD_OP_IN 0
 #define OSD_OP_OUT 1
@@ -172,6 +173,14 @@ struct osd_op_t
 
     osd_op_buf_list_t iov;
 
+    // Number of zero-copy sends which may still reference buffers of this operation.
+    // Deleting a sent reply or completing a request is deferred until it drops to 0
+    int zc_refs = 0;
+    bool zc_deferred = false;
+
+    // Ops and subop arrays are recycled through a per-thread pool instead of malloc
+    MEM_POOL_OPERATORS
+
     ~osd_op_t();
 
     bool is_recovery_related();
@@ -210,7 +210,8 @@ bool osd_messenger_t::handle_finished_read(osd_client_t *cl)
 void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
 {
     osd_op_t *cur_op = cl->read_op;
-    if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ)
+    if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST)
     {
         cl->read_remaining = 0;
     }
@@ -242,6 +243,15 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
         }
         cl->read_remaining = cur_op->req.sec_stab.len;
     }
+    else if (cur_op->req.hdr.opcode == OSD_OP_MERGE)
+    {
+        if (cur_op->req.merge.len > 0)
+        {
+            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.merge.len);
+            cl->recv_list.push_back(cur_op->buf, cur_op->req.merge.len);
+        }
+        cl->read_remaining = cur_op->req.merge.len;
+    }
     else if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ_BMP)
     {
         if (cur_op->req.sec_read_bmp.len > 0)
@@ -304,11 +314,13 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
     osd_op_t *op = req_it->second;
     memcpy(op->reply.buf, cl->read_op->req.buf, OSD_PACKET_SIZE);
     cl->sent_ops.erase(req_it);
-    if (op->reply.hdr.opcode == OSD_OP_SEC_READ || op->reply.hdr.opcode == OSD_OP_READ)
+    if (op->reply.hdr.opcode == OSD_OP_SEC_READ || op->reply.hdr.opcode == OSD_OP_READ ||
+        op->reply.hdr.opcode == OSD_OP_SEC_READ_DIGEST)
     {
         // Read data. In this case we assume that the buffer is preallocated by the caller (!)
-        unsigned bmp_len = (op->reply.hdr.opcode == OSD_OP_SEC_READ ? op->reply.sec_rw.attr_len : op->reply.rw.bitmap_len);
-        unsigned expected_size = (op->reply.hdr.opcode == OSD_OP_SEC_READ ? op->req.sec_rw.len : op->req.rw.len);
+        unsigned bmp_len = (op->reply.hdr.opcode == OSD_OP_READ ? op->reply.rw.bitmap_len : op->reply.sec_rw.attr_len);
+        unsigned expected_size = (op->reply.hdr.opcode == OSD_OP_SEC_READ ? op->req.sec_rw.len
+            : (op->reply.hdr.opcode == OSD_OP_SEC_READ_DIGEST ? op->req.sec_rw.len/OSD_DIGEST_LANES : op->req.rw.len));
         if (op->reply.hdr.retval >= 0 && (op->reply.hdr.retval != expected_size || bmp_len > op->bitmap_len))
         {
             // Check reply length to not overflow the buffer
@@ -402,10 +414,22 @@ void osd_messenger_t::handle_reply_ready(osd_op_t *op)
         stats.subop_stat_count[op->req.hdr.opcode]++;
         stats.subop_stat_sum[op->req.hdr.opcode] = 0;
     }
-    stats.subop_stat_sum[op->req.hdr.opcode] += (
+    uint64_t usecs = (
         (tv_end.tv_sec - op->tv_begin.tv_sec)*1000000 +
         (tv_end.tv_nsec - op->tv_begin.tv_nsec)/1000
     );
+    stats.subop_stat_sum[op->req.hdr.opcode] += usecs;
+    if (latency_hists)
+    {
+        latency_hists->subop[op->req.hdr.opcode].add(usecs);
+    }
+    if (op->zc_refs > 0)
+    {
+        // Request buffers are still referenced by a zero-copy send,
+        // complete the operation when the kernel releases them
+        op->zc_deferred = true;
+        return;
+    }
     set_immediate.push_back([op]()
     {
         // Copy lambda to be unaffected by `delete op`
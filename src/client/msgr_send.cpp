@@ -50,7 +50,7 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
     to_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = MSGR_SENDP_HDR });
     // Bitmap
     if (cur_op->op_type == OSD_OP_IN &&
-        cur_op->req.hdr.opcode == OSD_OP_SEC_READ &&
+        (cur_op->req.hdr.opcode == OSD_OP_SEC_READ || cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST) &&
         cur_op->reply.sec_rw.attr_len > 0)
     {
         to_send_list.push_back((iovec){
@@ -73,6 +73,7 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
     if ((cur_op->op_type == OSD_OP_IN
         ? (cur_op->req.hdr.opcode == OSD_OP_READ ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_LIST ||
         cur_op->req.hdr.opcode == OSD_OP_SHOW_CONFIG ||
         cur_op->req.hdr.opcode == OSD_OP_DESCRIBE)
@@ -81,7 +82,8 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_STABILIZE ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_ROLLBACK ||
-        cur_op->req.hdr.opcode == OSD_OP_SHOW_CONFIG)) && cur_op->iov.count > 0)
+        cur_op->req.hdr.opcode == OSD_OP_SHOW_CONFIG ||
+        cur_op->req.hdr.opcode == OSD_OP_MERGE)) && cur_op->iov.count > 0)
     {
         for (int i = 0; i < cur_op->iov.count; i++)
         {
@@ -131,7 +133,7 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
     }
 }
 
-void osd_messenger_t::inc_op_stats(osd_op_stats_t & stats, uint64_t opcode, timespec & tv_begin, timespec & tv_end, uint64_t len)
+uint64_t osd_messenger_t::inc_op_stats(osd_op_stats_t & stats, uint64_t opcode, timespec & tv_begin, timespec & tv_end, uint64_t len)
 {
     uint64_t usecs = (
         (tv_end.tv_sec - tv_begin.tv_sec)*1000000 +
@@ -146,6 +148,7 @@ void osd_messenger_t::inc_op_stats(osd_op_stats_t & stats, uint64_t opcode, time
     }
     stats.op_stat_sum[opcode] += usecs;
     stats.op_stat_bytes[opcode] += len;
+    return usecs;
 }
 
 void osd_messenger_t::measure_exec(osd_op_t *cur_op)
@@ -168,12 +171,17 @@ void osd_messenger_t::measure_exec(osd_op_t *cur_op)
         len = cur_op->req.rw.len;
     }
     else if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE)
     {
         len = cur_op->req.sec_rw.len;
     }
-    inc_op_stats(stats, cur_op->req.hdr.opcode, cur_op->tv_begin, cur_op->tv_end, len);
+    uint64_t usecs = inc_op_stats(stats, cur_op->req.hdr.opcode, cur_op->tv_begin, cur_op->tv_end, len);
+    if (latency_hists)
+    {
+        latency_hists->op[cur_op->req.hdr.opcode].add(usecs);
+    }
     if (cur_op->is_recovery_related())
     {
         inc_op_stats(recovery_stats, cur_op->req.hdr.opcode, cur_op->tv_begin, cur_op->tv_end, len);
@@ -198,8 +206,39 @@ bool osd_messenger_t::try_send(osd_client_t *cl)
         cl->write_msg.msg_iovlen = cl->send_list.size() < IOV_MAX ? cl->send_list.size() : IOV_MAX;
         cl->refs++;
         ring_data_t* data = ((ring_data_t*)sqe->user_data);
-        data->callback = [this, cl](ring_data_t *data) { handle_send(data->res, cl); };
-        my_uring_prep_sendmsg(sqe, peer_fd, &cl->write_msg, 0);
+#ifdef IORING_CQE_F_NOTIF
+        uint64_t send_size = 0;
+        if (use_zerocopy_send)
+        {
+            for (int i = 0; i < cl->write_msg.msg_iovlen && send_size < min_zerocopy_send_size; i++)
+                send_size += cl->send_list[i].iov_len;
+        }
+        if (use_zerocopy_send && send_size >= min_zerocopy_send_size)
+        {
+            // One more reference is held until the notification
+            cl->refs++;
+            // Pin all operations whose buffers are sent: the kernel may read them
+            // until the notification, even after the reply to a request arrives
+            auto zc_ops = new std::vector<osd_op_t*>;
+            for (int i = 0; i < cl->write_msg.msg_iovlen; i++)
+            {
+                osd_op_t *op = cl->outbox[i].op;
+                if (!zc_ops->size() || zc_ops->back() != op)
+                {
+                    op->zc_refs++;
+                    zc_ops->push_back(op);
+                }
+            }
+            data->callback = [this, cl, zc_ops](ring_data_t *data) { handle_send_zc(data, cl, zc_ops); };
+            my_uring_prep_sendmsg_zc(sqe, peer_fd, &cl->write_msg, 0);
+        }
+        else
+#endif
+        {
+            // Small (header-only) sends are cheaper to copy
+            data->callback = [this, cl](ring_data_t *data) { handle_send(data->res, cl); };
+            my_uring_prep_sendmsg(sqe, peer_fd, &cl->write_msg, 0);
+        }
     }
     else
     {
@@ -231,6 +270,71 @@ void osd_messenger_t::send_replies()
     write_ready_clients.clear();
 }
 
+#ifdef IORING_CQE_F_NOTIF
+void osd_messenger_t::handle_send_zc(ring_data_t *data, osd_client_t *cl, std::vector<osd_op_t*> *zc_ops)
+{
+    if (data->flags & IORING_CQE_F_NOTIF)
+    {
+        // The kernel doesn't reference sent buffers anymore
+        release_zc_ops(cl, zc_ops);
+        return;
+    }
+    int result = data->res;
+    if (result == -EINVAL || result == -EOPNOTSUPP)
+    {
+        // Kernel is too old or the socket doesn't support zero-copy. Fall back to copying
+        fprintf(stderr, "Zero-copy send is not supported (%s), disabling it\n", strerror(-result));
+        use_zerocopy_send = false;
+        result = -EAGAIN;
+    }
+    handle_send(result, cl);
+    if (!(data->flags & IORING_CQE_F_MORE))
+    {
+        // Send failed, there will be no notification
+        release_zc_ops(cl, zc_ops);
+    }
+}
+#endif
+
+void osd_messenger_t::release_zc_ops(osd_client_t *cl, std::vector<osd_op_t*> *zc_ops)
+{
+    std::vector<osd_op_t*> finished;
+    for (auto op: *zc_ops)
+    {
+        op->zc_refs--;
+        if (!op->zc_refs && op->zc_deferred)
+        {
+            finished.push_back(op);
+        }
+    }
+    delete zc_ops;
+    for (auto op: finished)
+    {
+        finish_zc_deferred(op);
+    }
+    cl->refs--;
+    if (cl->peer_state == PEER_STOPPED && cl->refs <= 0)
+    {
+        delete cl;
+    }
+}
+
+void osd_messenger_t::finish_zc_deferred(osd_op_t *op)
+{
+    op->zc_deferred = false;
+    if (op->op_type == OSD_OP_IN)
+    {
+        // Fully sent reply
+        delete op;
+    }
+    else
+    {
+        // Request which got a reply or was cancelled while its buffers were pinned
+        // Copy lambda to be unaffected by `delete op`
+        std::function<void(osd_op_t*)>(op->callback)(op);
+    }
+}
+
 void osd_messenger_t::handle_send(int result, osd_client_t *cl)
 {
     cl->write_msg.msg_iovlen = 0;
@@ -260,8 +364,12 @@ void osd_messenger_t::handle_send(int result, osd_client_t *cl)
             {
                 if (cl->outbox[done].flags & MSGR_SENDP_FREE)
                 {
-                    // Reply fully sent
-                    delete cl->outbox[done].op;
+                    // Reply fully sent. If a zero-copy send still references it,
+                    // it's freed only when the kernel releases the buffers
+                    if (cl->outbox[done].op->zc_refs > 0)
+                        cl->outbox[done].op->zc_deferred = true;
+                    else
+                        delete cl->outbox[done].op;
                 }
                 result -= iov.iov_len;
                 done++;
@@ -34,13 +34,22 @@ void osd_messenger_t::cancel_op(osd_op_t *op)
         op->reply.hdr.id = op->req.hdr.id;
         op->reply.hdr.opcode = op->req.hdr.opcode;
         op->reply.hdr.retval = -EPIPE;
+        if (op->zc_refs > 0)
+        {
+            // Buffers are still referenced by a zero-copy send
+            op->zc_deferred = true;
+            return;
+        }
         // Copy lambda to be unaffected by `delete op`
         std::function<void(osd_op_t*)>(op->callback)(op);
     }
     else
     {
         // This function is only called in stop_client(), so it's fine to destroy the operation
-        delete op;
+        if (op->zc_refs > 0)
+            op->zc_deferred = true;
+        else
+            delete op;
     }
 }
 
@@ -31,10 +31,18 @@
 #define OSD_OP_SEC_READ_BMP         16
 #define OSD_OP_SCRUB                17
 #define OSD_OP_DESCRIBE             18
-#define OSD_OP_MAX                  18
+#define OSD_OP_SEC_READ_DIGEST      19
+#define OSD_OP_MERGE                20
+#define OSD_OP_MAX                  20
 #define OSD_RW_MAX                  64*1024*1024
 #define OSD_PROTOCOL_VERSION        1
 #define OSD_OP_RECOVERY_RELATED     (uint32_t)1
+// OSD_OP_SEC_READ_DIGEST returns a 1/OSD_DIGEST_LANES-sized digest of the data instead of the data itself,
+// digests of every OSD_DIGEST_BLOCK are concatenated so differing blocks can be found
+#define OSD_DIGEST_LANES            128
+#define OSD_DIGEST_BLOCK            4096
+// OSD_OP_MERGE flag: use CAS writes based on the version of the source object (when source = target)
+#define OSD_MERGE_CAS               (uint32_t)1
 
 // Memory alignment for direct I/O (usually 512 bytes)
 #ifndef DIRECT_IO_ALIGNMENT
@@ -160,11 +168,16 @@ struct __attribute__((__packed__)) osd_op_sec_read_bmp_t
     osd_op_header_t header;
     // obj_ver_id array length in bytes
     uint64_t len;
+    // OSD_SEC_READ_BMP_STABLE: also return the last stable version of each object
+    uint64_t flags;
 };
 
+#define OSD_SEC_READ_BMP_STABLE 1
+
 struct __attribute__((__packed__)) osd_reply_sec_read_bmp_t
 {
-    // retval is payload length in bytes. payload is {version,bitmap}[]
+    // retval is payload length in bytes. payload is {version,bitmap}[],
+    // or {version,stable_version,bitmap}[] with OSD_SEC_READ_BMP_STABLE
     osd_reply_header_t header;
 };
 
@@ -279,6 +292,35 @@ struct __attribute__((__packed__)) osd_reply_describe_item_t
     osd_num_t osd_num;  // OSD number
 };
 
+// merge data of an inode and its parents into one of the layers, executed by the primary OSD of a PG
+struct __attribute__((__packed__)) osd_op_merge_t
+{
+    osd_op_header_t header;
+    // inode to read data from, together with its parents from the same pool
+    uint64_t source_inode;
+    // inode to write data to
+    uint64_t target_inode;
+    // source inode metadata revision
+    uint64_t meta_revision;
+    // offset array length in bytes. offsets of objects to merge come after the header
+    uint64_t len;
+    // pool and PG, all offsets must belong to it
+    uint32_t pool_id;
+    uint32_t pg_num;
+    // OSD_MERGE_CAS or 0
+    uint32_t flags;
+    uint32_t pad0;
+};
+
+struct __attribute__((__packed__)) osd_reply_merge_t
+{
+    osd_reply_header_t header;
+    // offset of the first failed object if retval < 0
+    uint64_t error_offset;
+    // number of bytes written to the target inode
+    uint64_t written_bytes;
+};
+
 // FIXME it would be interesting to try to unify blockstore_op and osd_op formats
 union osd_any_op_t
 {
@@ -293,6 +335,7 @@ union osd_any_op_t
     osd_op_rw_t rw;
     osd_op_sync_t sync;
     osd_op_describe_t describe;
+    osd_op_merge_t merge;
     uint8_t buf[OSD_PACKET_SIZE];
 };
 
@@ -309,6 +352,7 @@ union osd_any_reply_t
     osd_reply_rw_t rw;
     osd_reply_sync_t sync;
     osd_reply_describe_t describe;
+    osd_reply_merge_t merge;
     uint8_t buf[OSD_PACKET_SIZE];
 };
 
@@ -164,20 +164,23 @@ int vitastor_c_uring_register_eventfd(vitastor_c *client)
 
 vitastor_c *vitastor_c_create_uring_json(const char **options, int options_len)
 {
+    json11::Json::object cfg;
+    for (int i = 0; i < options_len-1; i += 2)
+    {
+        cfg[options[i]] = std::string(options[i+1]);
+    }
     ring_loop_t *ringloop = NULL;
     try
     {
-        ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE);
+        // Only SQPOLL makes sense for the client, it doesn't access block devices
+        unsigned flags = cfg["ring_sqpoll"] == "true" || cfg["ring_sqpoll"] == "1" ? IORING_SETUP_SQPOLL : 0;
+        int sq_cpu = cfg["ring_sqpoll_cpu"].string_value() != "" ? cfg["ring_sqpoll_cpu"].int64_value() : -1;
+        ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE, flags, sq_cpu, cfg["ring_sqpoll_idle"].uint64_value());
     }
     catch (std::exception & e)
     {
         return NULL;
     }
-    json11::Json::object cfg;
-    for (int i = 0; i < options_len-1; i += 2)
-    {
-        cfg[options[i]] = std::string(options[i+1]);
-    }
     json11::Json cfg_json(cfg);
     vitastor_c *self = new vitastor_c;
     self->ringloop = ringloop;
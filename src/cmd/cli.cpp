@@ -47,11 +47,14 @@ static const char* help_text =
     "  Create a snapshot of image <name>. May be used live if only a single writer is active.\n"
     "\n"
     "vitastor-cli modify <name> [--rename <new-name>] [--resize <size>] [--readonly | --readwrite] [-f|--force] [--down-ok]\n"
-    "  Rename, resize image or change its readonly status. Images with children can't be made read-write.\n"
+    "  [--qos_iops <n>] [--qos_bps <size>] [--qos_burst_iops <n>] [--qos_burst_bps <size>]\n"
+    "  Rename, resize image, change its readonly status or I/O limits. Images with children can't be made read-write.\n"
     "  If the new size is smaller than the old size, extra data will be purged.\n"
     "  You should resize file system in the image, if present, before shrinking it.\n"
     "  -f|--force  Proceed with shrinking or setting readwrite flag even if the image has children.\n"
     "  --down-ok   Proceed with shrinking even if some data will be left on unavailable OSDs.\n"
+    "  --qos_iops, --qos_bps  Limit image IOPS and bandwidth (bytes per second), 0 removes the limit.\n"
+    "  --qos_burst_iops, --qos_burst_bps  Allow bursts of this size after idle periods (default 1 second of the limit).\n"
     "\n"
     "vitastor-cli rm <from> [<to>] [--writers-stopped] [--down-ok]\n"
     "  Remove <from> or all layers between <from> and <to> (<to> must be a child of <from>),\n"
@@ -76,6 +79,18 @@ static const char* help_text =
     "  <to> must be a child of <from> and <target> may be one of the layers between\n"
     "  <from> and <to>, including <from> and <to>.\n"
     "\n"
+    "vitastor-cli export-diff <image> [--from-snap <snap>] [--to-snap <snap>] [--output <file>] [--resume]\n"
+    "  Export data changed in <image>@<to-snap> (or <image> itself) since <image>@<from-snap>\n"
+    "  (or since image creation) as a checksummed diff stream. Only changed granules are exported.\n"
+    "  --output <file>  Write the diff to <file> instead of STDOUT.\n"
+    "  --resume         Continue an interrupted export into <file> after the last complete record.\n"
+    "\n"
+    "vitastor-cli import-diff <file> [<image>] [-f|--force]\n"
+    "  Apply a diff created by export-diff to <image> (default is the image name from the diff)\n"
+    "  and create snapshot <image>@<to-snap>. Use - as <file> to read the diff from STDIN.\n"
+    "  Image must already have snapshot <image>@<from-snap> unless --force is specified.\n"
+    "  An interrupted import may be safely repeated with the same diff.\n"
+    "\n"
     "vitastor-cli describe [OPTIONS]\n"
     "  Describe unclean object locations in the cluster. Options:\n"
     "  --osds <osds>\n"
@@ -144,6 +159,8 @@ static const char* help_text =
     "    --used_for_fs <name>          Mark pool as used for VitastorFS with metadata in image <name>\n"
     "    --pg_stripe_size <number>     Increase object grouping stripe\n"
     "    --max_osd_combinations 10000  Maximum number of random combinations for LP solver input\n"
+    "    --qos_iops, --qos_bps <n>     Limit total IOPS and bandwidth of the pool on every primary OSD\n"
+    "    --qos_burst_iops, --qos_burst_bps <n>  Allow bursts of this size after idle periods\n"
     "    --wait                        Wait for the new pool to come online\n"
     "    -f|--force                    Do not check that cluster has enough OSDs to create the pool\n"
     "  Examples:\n"
@@ -156,6 +173,7 @@ static const char* help_text =
     "    [--failure_domain <level>] [--root_node <node>] [--osd_tags <tags>] [--used_for_fs <name>]\n"
     "    [--max_osd_combinations <number>] [--primary_affinity_tags <tags>] [--scrub_interval <time>]\n"
     "    [--level_placement <rules>] [--raw_placement <rules>]\n"
+    "    [--qos_iops <n>] [--qos_bps <size>] [--qos_burst_iops <n>] [--qos_burst_bps <size>]\n"
     "  Non-modifiable parameters (changing them WILL lead to data loss):\n"
     "    [--block_size <size>] [--bitmap_granularity <size>]\n"
     "    [--immediate_commit <all|small|none>] [--pg_stripe_size <size>]\n"
@@ -185,6 +203,8 @@ static const char* help_text =
     "  --parallel_osds M   Work with M osds in parallel when possible (default 4)\n"
     "  --progress 1|0      Report progress (default 1)\n"
     "  --cas 1|0           Use CAS writes for flatten, merge, rm (default is decide automatically)\n"
+    "  --server_merge 1|0  Merge layers inside OSDs for flatten, merge, rm when all layers are\n"
+    "                      in the same pool (default 0, requires OSDs which support it)\n"
     "  --color 1|0         Enable/disable colored output and CR symbols (default 1 if stdout is a terminal)\n"
     "  --json              JSON output\n"
 ;
@@ -234,6 +254,7 @@ static json11::Json::object parse_args(int narg, const char *args[])
                 !strcmp(opt, "no-color") || !strcmp(opt, "no_color") ||
                 !strcmp(opt, "readonly") || !strcmp(opt, "readwrite") ||
                 !strcmp(opt, "force") || !strcmp(opt, "reverse") ||
+                !strcmp(opt, "resume") ||
                 !strcmp(opt, "allow-data-loss") || !strcmp(opt, "allow_data_loss") ||
                 !strcmp(opt, "down-ok") || !strcmp(opt, "down_ok") ||
                 !strcmp(opt, "dry-run") || !strcmp(opt, "dry_run") ||
@@ -360,6 +381,26 @@ static int run(cli_tool_t *p, json11::Json::object cfg)
         }
         action_cb = p->start_merge(cfg);
     }
+    else if (cmd[0] == "export-diff")
+    {
+        // Export changes between snapshots
+        if (cmd.size() > 1)
+        {
+            cfg["image"] = cmd[1];
+        }
+        action_cb = p->start_export_diff(cfg);
+    }
+    else if (cmd[0] == "import-diff")
+    {
+        // Apply exported changes to an image
+        if (cmd.size() > 1)
+        {
+            cfg["input"] = cmd[1];
+            if (cmd.size() > 2)
+                cfg["image"] = cmd[2];
+        }
+        action_cb = p->start_import_diff(cfg);
+    }
     else if (cmd[0] == "flatten")
     {
         // Merge layer data without affecting metadata
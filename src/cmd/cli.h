@@ -33,6 +33,7 @@ public:
     uint64_t iodepth = 4, parallel_osds = 32;
     bool progress = false;
     bool list_first = false;
+    bool server_merge = false;
     bool json_output = false;
     int log_level = 0;
     bool is_command_line = false;
@@ -50,6 +51,7 @@ public:
     json11::Json parse_tags(std::string tags);
 
     void change_parent(inode_t cur, inode_t new_parent, cli_result_t *result);
+    void bump_inode_revision(inode_t cur, cli_result_t *result);
     inode_config_t* get_inode_cfg(const std::string & name);
 
     friend struct rm_inode_t;
@@ -60,8 +62,10 @@ public:
     std::function<bool(cli_result_t &)> start_alloc_osd(json11::Json);
     std::function<bool(cli_result_t &)> start_create(json11::Json);
     std::function<bool(cli_result_t &)> start_describe(json11::Json);
+    std::function<bool(cli_result_t &)> start_export_diff(json11::Json);
     std::function<bool(cli_result_t &)> start_fix(json11::Json);
     std::function<bool(cli_result_t &)> start_flatten(json11::Json);
+    std::function<bool(cli_result_t &)> start_import_diff(json11::Json);
     std::function<bool(cli_result_t &)> start_ls(json11::Json);
     std::function<bool(cli_result_t &)> start_merge(json11::Json);
     std::function<bool(cli_result_t &)> start_modify(json11::Json);
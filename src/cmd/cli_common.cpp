@@ -74,6 +74,62 @@ void cli_tool_t::change_parent(inode_t cur, inode_t new_parent, cli_result_t *re
     });
 }
 
+// Rewrite inode metadata without changes just to increase its mod_revision. Clients cache
+// granule ownership in readonly chains until the maximum mod_revision of the chain changes,
+// so it must be done before removing data which such cached entries may rely on
+void cli_tool_t::bump_inode_revision(inode_t cur, cli_result_t *result)
+{
+    auto cur_cfg_it = cli->st_cli.inode_config.find(cur);
+    if (cur_cfg_it == cli->st_cli.inode_config.end())
+    {
+        char buf[128];
+        snprintf(buf, 128, "Inode 0x%jx disappeared", cur);
+        *result = (cli_result_t){ .err = EIO, .text = buf };
+        return;
+    }
+    inode_config_t cur_cfg = cur_cfg_it->second;
+    std::string cur_name = cur_cfg.name;
+    std::string cur_cfg_key = base64_encode(cli->st_cli.etcd_prefix+
+        "/config/inode/"+std::to_string(INODE_POOL(cur))+
+        "/"+std::to_string(INODE_NO_POOL(cur)));
+    json11::Json::object cur_cfg_json = cli->st_cli.serialize_inode_cfg(&cur_cfg);
+    waiting++;
+    cli->st_cli.etcd_txn_slow(json11::Json::object {
+        { "compare", json11::Json::array {
+            json11::Json::object {
+                { "target", "MOD" },
+                { "key", cur_cfg_key },
+                { "result", "LESS" },
+                { "mod_revision", cur_cfg.mod_revision+1 },
+            },
+        } },
+        { "success", json11::Json::array {
+            json11::Json::object {
+                { "request_put", json11::Json::object {
+                    { "key", cur_cfg_key },
+                    { "value", base64_encode(json11::Json(cur_cfg_json).dump()) },
+                } }
+            },
+        } },
+    }, [this, result, cur_name](std::string err, json11::Json res)
+    {
+        if (err != "")
+        {
+            *result = (cli_result_t){ .err = EIO, .text = "Error updating "+cur_name+": "+err };
+        }
+        else if (!res["succeeded"].bool_value())
+        {
+            *result = (cli_result_t){ .err = EAGAIN, .text = "Image "+cur_name+" was modified during change" };
+        }
+        else
+        {
+            *result = (cli_result_t){ .text = "Metadata revision of layer "+cur_name+" increased" };
+        }
+        waiting--;
+        ringloop->wakeup();
+    });
+}
+
 void cli_tool_t::etcd_txn(json11::Json txn)
 {
     waiting++;
@@ -130,6 +186,7 @@ void cli_tool_t::parse_config(json11::Json::object & cfg)
     log_level = cfg["log_level"].int64_value();
     progress = cfg["progress"].uint64_value() ? true : false;
     list_first = cfg["wait_list"].uint64_value() ? true : false;
+    server_merge = cfg["server_merge"].uint64_value() ? true : false;
 }
 
 struct cli_result_looper_t
@@ -32,6 +32,8 @@ struct image_creator_t
 
     pool_id_t old_pool_id = 0;
     inode_t new_parent_id = 0;
+    // I/O limits stay with the image when a snapshot is created
+    qos_limits_t new_qos;
     inode_t new_id = 0, old_id = 0;
     uint64_t max_id_mod_rev = 0, cfg_mod_rev = 0, idx_mod_rev = 0;
     inode_config_t new_cfg;
@@ -406,6 +408,7 @@ resume_3:
                 {
                     new_parent_id = INODE_WITH_POOL(parent_pool_id ? parent_pool_id : old_pool_id, new_parent_id);
                 }
+                new_qos = qos_limits_t::parse(kv.value);
                 cfg_mod_rev = kv.mod_revision;
             }
         }
@@ -420,6 +423,7 @@ resume_3:
             .parent_id = (new_snap != "" ? INODE_WITH_POOL(old_pool_id, old_id) : new_parent_id),
             .readonly = false,
             .meta = new_meta,
+            .qos = new_qos,
         };
         json11::Json::array checks = json11::Json::array {
             json11::Json::object {
@@ -0,0 +1,84 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// Incremental image diff stream format used by export-diff and import-diff
+//
+// The stream starts with a header followed by <json_len> bytes of JSON with image
+// parameters: { image, from, to, size, block_size, bitmap_granularity }.
+// Then come records sorted by offset, one per changed block. Every record is followed
+// by the bitmap of changed granules and data of these granules in the same order.
+// The stream ends with a record with offset = UINT64_MAX.
+// Records are checksummed separately so a broken or truncated stream is detected
+// and an interrupted export may be resumed from the last complete record.
+
+#pragma once
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+
+#define VITASTOR_DIFF_MAGIC 0x3146464944415456ul // "VTADIFF1"
+#define VITASTOR_DIFF_VERSION 1
+#define VITASTOR_DIFF_END UINT64_MAX
+
+struct __attribute__((__packed__)) vitastor_diff_header_t
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t json_len;
+    // crc32c of the header with crc32c=0 and JSON
+    uint32_t crc32c;
+    uint32_t pad0;
+};
+
+struct __attribute__((__packed__)) vitastor_diff_record_t
+{
+    // block offset in the image
+    uint64_t offset;
+    uint32_t bitmap_len;
+    uint32_t data_len;
+    // crc32c of the record with crc32c=0, bitmap and data
+    uint32_t crc32c;
+    uint32_t pad0;
+};
+
+static inline uint32_t diff_record_crc(vitastor_diff_record_t rec, const void *bitmap, const void *data)
+{
+    rec.crc32c = 0;
+    uint32_t crc = crc32c(0, &rec, sizeof(rec));
+    crc = crc32c(crc, bitmap, rec.bitmap_len);
+    return crc32c(crc, data, rec.data_len);
+}
+
+// Read exactly <len> bytes. Returns the number of bytes read (less on EOF) or -errno
+static inline ssize_t diff_read(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = read(fd, (uint8_t*)buf + done, len - done);
+        if (r < 0 && errno != EINTR && errno != EAGAIN)
+            return -errno;
+        if (r == 0)
+            break;
+        if (r > 0)
+            done += r;
+    }
+    return done;
+}
+
+// Write exactly <len> bytes. Returns 0 or -errno
+static inline int diff_write(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = write(fd, (const uint8_t*)buf + done, len - done);
+        if (r < 0 && errno != EINTR && errno != EAGAIN)
+            return -errno;
+        if (r > 0)
+            done += r;
+    }
+    return 0;
+}
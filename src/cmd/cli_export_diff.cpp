@@ -0,0 +1,559 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <fcntl.h>
+#include "cli.h"
+#include "cli_diff.h"
+#include "cluster_client.h"
+#include "http_client.h" // json_is_true
+#include "cpp-btree/btree_map.h"
+
+struct diff_block_t
+{
+    uint64_t offset;
+    int todo = 0;
+    int error_code = 0;
+    bool done = false;
+    // changed granules
+    uint8_t *bitmap = NULL;
+    // data of granules from <read_start> to <read_end>
+    uint8_t *data = NULL;
+    uint32_t read_start = 0, read_end = 0;
+};
+
+// Export changes between two snapshots of an image as a diff stream:
+// only granules written in layers above <from> and up to <to> are exported
+struct snap_diff_exporter_t
+{
+    cli_tool_t *parent;
+
+    // -- CONFIGURATION --
+    std::string image_name, from_snap, to_snap;
+    // output file, stdout if empty
+    std::string output_file;
+    // continue an interrupted export into <output_file>
+    bool resume = false;
+
+    // -- STATE --
+    inode_t to_inode = 0;
+    // layers with changes, top to bottom
+    std::vector<inode_t> diff_layers;
+    uint64_t block_size = 0, image_size = 0;
+    uint32_t bitmap_granularity = 0, bitmap_size = 0;
+    int out_fd = -1;
+    int state = 0;
+    int lists_todo = 0;
+    // offset => mask of layers having objects at it. bit 63 means "any layer starting from 63"
+    btree::btree_map<uint64_t, uint64_t> block_layers;
+    btree::btree_map<uint64_t, uint64_t>::iterator bit;
+    // blocks in flight, emitted in the order of offsets
+    std::map<uint64_t, diff_block_t*> pending;
+    uint64_t resume_offset = 0;
+    uint64_t processed = 0, to_process = 0;
+    uint64_t exported_blocks = 0, exported_bytes = 0;
+    std::string error;
+
+    cli_result_t result;
+
+    ~snap_diff_exporter_t()
+    {
+        if (out_fd > 1)
+        {
+            close(out_fd);
+        }
+    }
+
+    bool is_done()
+    {
+        return state == 100;
+    }
+
+    void get_diff_layers()
+    {
+        std::string to_name = to_snap != "" ? image_name+"@"+to_snap : image_name;
+        std::string from_name = from_snap != "" ? image_name+"@"+from_snap : "";
+        inode_config_t *to_cfg = parent->get_inode_cfg(to_name);
+        if (!to_cfg)
+        {
+            result = (cli_result_t){ .err = ENOENT, .text = "Layer "+to_name+" not found" };
+            state = 100;
+            return;
+        }
+        inode_config_t *from_cfg = NULL;
+        if (from_name != "")
+        {
+            from_cfg = parent->get_inode_cfg(from_name);
+            if (!from_cfg)
+            {
+                result = (cli_result_t){ .err = ENOENT, .text = "Layer "+from_name+" not found" };
+                state = 100;
+                return;
+            }
+        }
+        to_inode = to_cfg->num;
+        image_size = to_cfg->size;
+        block_size = get_block_size(to_inode, &bitmap_granularity);
+        bitmap_size = (block_size/bitmap_granularity + 7) / 8;
+        inode_config_t *cur = to_cfg;
+        while (true)
+        {
+            uint32_t gran = 0;
+            get_block_size(cur->num, &gran);
+            if (gran != bitmap_granularity)
+            {
+                result = (cli_result_t){ .err = EINVAL, .text = "Layers "+to_cfg->name+" and "+cur->name+
+                    " have different bitmap granularity, diff between them is not supported" };
+                state = 100;
+                return;
+            }
+            diff_layers.push_back(cur->num);
+            if (!cur->parent_id || from_cfg && cur->parent_id == from_cfg->num)
+            {
+                break;
+            }
+            auto it = parent->cli->st_cli.inode_config.find(cur->parent_id);
+            if (it == parent->cli->st_cli.inode_config.end() || diff_layers.size() > parent->cli->st_cli.inode_config.size())
+            {
+                result = (cli_result_t){ .err = ENOENT, .text = "Parent of layer "+cur->name+" not found or has a loop" };
+                state = 100;
+                return;
+            }
+            cur = &it->second;
+        }
+        if (from_cfg && cur->parent_id != from_cfg->num)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Layer "+from_name+" is not a parent of "+to_name };
+            state = 100;
+            return;
+        }
+    }
+
+    uint64_t get_block_size(inode_t inode, uint32_t *bitmap_granularity)
+    {
+        auto & pool_cfg = parent->cli->st_cli.pool_config.at(INODE_POOL(inode));
+        uint64_t pg_data_size = (pool_cfg.scheme == POOL_SCHEME_REPLICATED ? 1 : pool_cfg.pg_size-pool_cfg.parity_chunks);
+        *bitmap_granularity = pool_cfg.bitmap_granularity;
+        return pool_cfg.data_block_size * pg_data_size;
+    }
+
+    json11::Json header_json()
+    {
+        return json11::Json::object {
+            { "image", image_name },
+            { "from", from_snap },
+            { "to", to_snap },
+            { "size", image_size },
+            { "block_size", block_size },
+            { "bitmap_granularity", (uint64_t)bitmap_granularity },
+        };
+    }
+
+    // Open output, write the header or find the position to resume from
+    void open_output()
+    {
+        std::string hdr_json = header_json().dump();
+        if (output_file == "" || output_file == "-")
+        {
+            out_fd = 1;
+        }
+        else
+        {
+            out_fd = open(output_file.c_str(), O_RDWR|O_CREAT|(resume ? 0 : O_TRUNC), 0644);
+            if (out_fd < 0)
+            {
+                result = (cli_result_t){ .err = errno, .text = "Failed to open "+output_file+": "+strerror(errno) };
+                state = 100;
+                return;
+            }
+            if (resume && check_resume(hdr_json))
+            {
+                return;
+            }
+        }
+        vitastor_diff_header_t hdr = {
+            .magic = VITASTOR_DIFF_MAGIC,
+            .version = VITASTOR_DIFF_VERSION,
+            .json_len = (uint32_t)hdr_json.size(),
+        };
+        hdr.crc32c = crc32c(crc32c(0, &hdr, sizeof(hdr)), hdr_json.data(), hdr_json.size());
+        if (diff_write(out_fd, &hdr, sizeof(hdr)) < 0 || diff_write(out_fd, hdr_json.data(), hdr_json.size()) < 0)
+        {
+            result = (cli_result_t){ .err = errno, .text = std::string("Failed to write diff header: ")+strerror(errno) };
+            state = 100;
+        }
+    }
+
+    // Validate already exported records and truncate the file after the last valid one
+    bool check_resume(const std::string & hdr_json)
+    {
+        vitastor_diff_header_t hdr;
+        if (diff_read(out_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        {
+            // Empty or truncated file, start from the beginning
+            ftruncate(out_fd, 0);
+            lseek(out_fd, 0, SEEK_SET);
+            return false;
+        }
+        std::string json(hdr.json_len, 0);
+        if (hdr.magic != VITASTOR_DIFF_MAGIC || hdr.json_len != hdr_json.size() ||
+            diff_read(out_fd, (void*)json.data(), hdr.json_len) != hdr.json_len || json != hdr_json)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = output_file+" contains a different diff, can't resume" };
+            state = 100;
+            return true;
+        }
+        uint64_t pos = sizeof(hdr) + hdr.json_len;
+        uint8_t *buf = (uint8_t*)malloc_or_die(bitmap_size + block_size);
+        while (true)
+        {
+            vitastor_diff_record_t rec;
+            if (diff_read(out_fd, &rec, sizeof(rec)) != sizeof(rec) ||
+                rec.offset != VITASTOR_DIFF_END && (rec.bitmap_len != bitmap_size || rec.data_len > block_size) ||
+                diff_read(out_fd, buf, rec.bitmap_len + rec.data_len) != rec.bitmap_len + rec.data_len ||
+                diff_record_crc(rec, buf, buf + rec.bitmap_len) != rec.crc32c)
+            {
+                break;
+            }
+            if (rec.offset == VITASTOR_DIFF_END)
+            {
+                free(buf);
+                result = (cli_result_t){ .text = output_file+" is already complete" };
+                state = 100;
+                return true;
+            }
+            pos += sizeof(rec) + rec.bitmap_len + rec.data_len;
+            resume_offset = rec.offset + block_size;
+        }
+        free(buf);
+        if (ftruncate(out_fd, pos) < 0 || lseek(out_fd, pos, SEEK_SET) < 0)
+        {
+            result = (cli_result_t){ .err = errno, .text = "Failed to truncate "+output_file+": "+strerror(errno) };
+            state = 100;
+            return true;
+        }
+        if (parent->progress)
+        {
+            fprintf(stderr, "Resuming export from offset 0x%jx\n", resume_offset);
+        }
+        return true;
+    }
+
+    void loop()
+    {
+        if (state == 1)
+            goto resume_1;
+        else if (state == 2)
+            goto resume_2;
+        else if (state == 100)
+            return;
+        get_diff_layers();
+        if (state == 100)
+            return;
+        open_output();
+        if (state == 100)
+            return;
+        // List changed layers
+        list_layers();
+        state = 1;
+    resume_1:
+        if (lists_todo > 0)
+        {
+            return;
+        }
+        bit = block_layers.lower_bound(resume_offset);
+        to_process = block_layers.size();
+        processed = to_process - std::distance(bit, block_layers.end());
+        state = 2;
+    resume_2:
+        // Read changed blocks in parallel and write them in the order of offsets
+        while (pending.size() < parent->iodepth*parent->parallel_osds &&
+            bit != block_layers.end() && !error.size())
+        {
+            start_block(bit->first, bit->second);
+            bit++;
+        }
+        emit_blocks();
+        if (pending.size() > 0 || bit != block_layers.end() && !error.size())
+        {
+            return;
+        }
+        if (error.size())
+        {
+            result = (cli_result_t){ .err = EIO, .text = error };
+            state = 100;
+            return;
+        }
+        {
+            vitastor_diff_record_t rec = { .offset = VITASTOR_DIFF_END };
+            rec.crc32c = diff_record_crc(rec, NULL, NULL);
+            if (diff_write(out_fd, &rec, sizeof(rec)) < 0 || out_fd > 1 && fsync(out_fd) < 0)
+            {
+                result = (cli_result_t){ .err = errno, .text = std::string("Failed to write diff: ")+strerror(errno) };
+                state = 100;
+                return;
+            }
+        }
+        if (parent->progress)
+        {
+            fprintf(stderr, parent->color ? "\rExporting blocks: %ju/%ju\n" : "Exporting blocks: %ju/%ju\n", to_process, to_process);
+        }
+        result = (cli_result_t){
+            // Don't mix the message with the diff written to stdout
+            .text = out_fd == 1 ? "" : "Exported "+std::to_string(exported_blocks)+" changed blocks ("+std::to_string(exported_bytes)+" bytes)",
+            .data = json11::Json::object {
+                { "image", image_name },
+                { "from", from_snap },
+                { "to", to_snap },
+                { "blocks", exported_blocks },
+                { "bytes", exported_bytes },
+            },
+        };
+        state = 100;
+    }
+
+    void list_layers()
+    {
+        for (int i = 0; i < diff_layers.size(); i++)
+        {
+            inode_t src = diff_layers[i];
+            uint64_t layer_mask = 1ul << (i < 63 ? i : 63);
+            uint32_t gran = 0;
+            uint64_t layer_block = get_block_size(src, &gran);
+            lists_todo++;
+            inode_list_t* lst = parent->cli->list_inode_start(src, [this, src, layer_mask, layer_block](
+                inode_list_t *lst, std::set<object_id>&& objects, pg_num_t pg_num, osd_num_t primary_osd, int status)
+            {
+                for (object_id obj: objects)
+                {
+                    uint64_t start = obj.stripe - obj.stripe % block_size;
+                    for (uint64_t i = 0; i < layer_block || !i; i += block_size)
+                    {
+                        if (start+i < image_size)
+                        {
+                            block_layers[start+i] |= layer_mask;
+                        }
+                    }
+                }
+                if (status & INODE_LIST_DONE)
+                {
+                    lists_todo--;
+                    parent->ringloop->wakeup();
+                }
+                else
+                {
+                    parent->cli->list_inode_next(lst, 1);
+                }
+            });
+            parent->cli->list_inode_next(lst, parent->parallel_osds);
+        }
+    }
+
+    void start_block(uint64_t offset, uint64_t layer_mask)
+    {
+        diff_block_t *blk = new diff_block_t;
+        blk->offset = offset;
+        blk->bitmap = (uint8_t*)calloc_or_die(1, bitmap_size);
+        pending[offset] = blk;
+        // Changed granules are granules written in any of the changed layers
+        blk->todo = 1;
+        for (int i = 0; i < diff_layers.size(); i++)
+        {
+            if (!(layer_mask & (1ul << (i < 63 ? i : 63))))
+            {
+                continue;
+            }
+            cluster_op_t *op = new cluster_op_t;
+            op->opcode = OSD_OP_READ_BITMAP;
+            op->inode = diff_layers[i];
+            op->offset = offset;
+            op->len = block_size;
+            op->callback = [this, blk](cluster_op_t *op)
+            {
+                if (op->retval < 0)
+                {
+                    blk->error_code = op->retval;
+                }
+                else
+                {
+                    for (uint32_t j = 0; j < bitmap_size; j++)
+                    {
+                        blk->bitmap[j] |= ((uint8_t*)op->bitmap_buf)[j];
+                    }
+                }
+                delete op;
+                finish_bitmap_read(blk);
+            };
+            blk->todo++;
+            parent->cli->execute(op);
+        }
+        finish_bitmap_read(blk);
+    }
+
+    void finish_bitmap_read(diff_block_t *blk)
+    {
+        blk->todo--;
+        if (blk->todo > 0)
+        {
+            return;
+        }
+        if (blk->error_code)
+        {
+            finish_block(blk);
+            return;
+        }
+        // Read the span between the first and the last changed granule
+        uint32_t bits = block_size/bitmap_granularity;
+        uint32_t start = 0, end = bits;
+        while (start < bits && !(blk->bitmap[start >> 3] & (1 << (start & 7))))
+            start++;
+        while (end > start && !(blk->bitmap[(end-1) >> 3] & (1 << ((end-1) & 7))))
+            end--;
+        if (offset_end(blk->offset, end) > image_size)
+        {
+            // The last granule may be partial, it's exported as a whole, padded with the data beyond the end
+            end = (image_size - blk->offset + bitmap_granularity - 1) / bitmap_granularity;
+        }
+        blk->read_start = start;
+        blk->read_end = end;
+        if (start >= end)
+        {
+            finish_block(blk);
+            return;
+        }
+        blk->data = (uint8_t*)malloc_or_die((end-start)*bitmap_granularity);
+        cluster_op_t *op = new cluster_op_t;
+        op->opcode = OSD_OP_READ;
+        op->inode = to_inode;
+        op->offset = blk->offset + start*bitmap_granularity;
+        op->len = (end-start)*bitmap_granularity;
+        op->iov.push_back(blk->data, op->len);
+        op->callback = [this, blk](cluster_op_t *op)
+        {
+            if (op->retval != op->len)
+            {
+                blk->error_code = op->retval < 0 ? op->retval : -EIO;
+            }
+            delete op;
+            finish_block(blk);
+        };
+        parent->cli->execute(op);
+    }
+
+    uint64_t offset_end(uint64_t offset, uint32_t granule)
+    {
+        return offset + (uint64_t)granule*bitmap_granularity;
+    }
+
+    void finish_block(diff_block_t *blk)
+    {
+        blk->done = true;
+        if (blk->error_code && !error.size())
+        {
+            char buf[1024];
+            snprintf(buf, 1024, "Error reading image at offset %jx: %s", blk->offset, strerror(-blk->error_code));
+            error = std::string(buf);
+        }
+        parent->ringloop->wakeup();
+    }
+
+    // Write completed blocks to the output in the order of offsets
+    void emit_blocks()
+    {
+        while (pending.size() && pending.begin()->second->done)
+        {
+            diff_block_t *blk = pending.begin()->second;
+            pending.erase(pending.begin());
+            if (!blk->error_code && !error.size() && blk->read_end > blk->read_start)
+            {
+                write_block(blk);
+            }
+            free(blk->bitmap);
+            free(blk->data);
+            delete blk;
+            processed++;
+            if (parent->progress && !(processed % 128))
+            {
+                fprintf(stderr, parent->color
+                    ? "\rExporting blocks: %ju/%ju"
+                    : "Exporting blocks: %ju/%ju\n", processed, to_process);
+            }
+        }
+    }
+
+    void write_block(diff_block_t *blk)
+    {
+        // Move changed granules to the beginning of the buffer
+        uint32_t data_len = 0;
+        for (uint32_t i = blk->read_start; i < blk->read_end; i++)
+        {
+            if (blk->bitmap[i >> 3] & (1 << (i & 7)))
+            {
+                if (data_len != (i-blk->read_start)*bitmap_granularity)
+                {
+                    memmove(blk->data + data_len, blk->data + (i-blk->read_start)*bitmap_granularity, bitmap_granularity);
+                }
+                data_len += bitmap_granularity;
+            }
+        }
+        // Granules beyond the end of the image are not exported
+        for (uint32_t i = blk->read_end; i < block_size/bitmap_granularity; i++)
+        {
+            blk->bitmap[i >> 3] &= ~(1 << (i & 7));
+        }
+        vitastor_diff_record_t rec = {
+            .offset = blk->offset,
+            .bitmap_len = bitmap_size,
+            .data_len = data_len,
+        };
+        rec.crc32c = diff_record_crc(rec, blk->bitmap, blk->data);
+        if (diff_write(out_fd, &rec, sizeof(rec)) < 0 ||
+            diff_write(out_fd, blk->bitmap, bitmap_size) < 0 ||
+            diff_write(out_fd, blk->data, data_len) < 0)
+        {
+            error = std::string("Failed to write diff: ")+strerror(errno);
+            return;
+        }
+        exported_blocks++;
+        exported_bytes += data_len;
+    }
+};
+
+std::function<bool(cli_result_t &)> cli_tool_t::start_export_diff(json11::Json cfg)
+{
+    auto exporter = new snap_diff_exporter_t();
+    exporter->parent = this;
+    exporter->image_name = cfg["image"].string_value();
+    exporter->from_snap = (cfg["from_snap"].is_null() ? cfg["from-snap"] : cfg["from_snap"]).string_value();
+    exporter->to_snap = (cfg["to_snap"].is_null() ? cfg["to-snap"] : cfg["to_snap"]).string_value();
+    exporter->output_file = cfg["output"].string_value();
+    exporter->resume = json_is_true(cfg["resume"]);
+    if (exporter->image_name == "")
+    {
+        delete exporter;
+        return [](cli_result_t & result)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Image name is missing" };
+            return true;
+        };
+    }
+    if (exporter->resume && (exporter->output_file == "" || exporter->output_file == "-"))
+    {
+        delete exporter;
+        return [](cli_result_t & result)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "--resume requires an output file" };
+            return true;
+        };
+    }
+    return [exporter](cli_result_t & result)
+    {
+        exporter->loop();
+        if (exporter->is_done())
+        {
+            result = exporter->result;
+            delete exporter;
+            return true;
+        }
+        return false;
+    };
+}
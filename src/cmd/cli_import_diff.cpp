@@ -0,0 +1,386 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <fcntl.h>
+#include "cli.h"
+#include "cli_diff.h"
+#include "cluster_client.h"
+#include "http_client.h" // json_is_true
+
+struct diff_import_rec_t
+{
+    uint64_t offset;
+    int inflight = 0;
+    uint8_t *buf = NULL;
+};
+
+// Apply a diff stream created by export-diff to an image and create the <to> snapshot.
+// Records are applied as is, so importing the same stream again is safe
+struct snap_diff_importer_t
+{
+    cli_tool_t *parent;
+
+    // -- CONFIGURATION --
+    std::string input_file;
+    std::string image_name;
+    // apply the diff even if the image doesn't have the <from> snapshot
+    bool force = false;
+
+    // -- STATE --
+    int in_fd = -1;
+    inode_t target_inode = 0;
+    std::string from_snap, to_snap;
+    uint64_t diff_size = 0, block_size = 0;
+    uint32_t bitmap_granularity = 0, bitmap_size = 0;
+    bool eof = false;
+    int state = 0;
+    int inflight = 0;
+    uint64_t imported_blocks = 0, imported_bytes = 0;
+    std::string error;
+    std::function<bool(cli_result_t &)> create_cb;
+
+    cli_result_t result;
+
+    ~snap_diff_importer_t()
+    {
+        if (in_fd > 0)
+        {
+            close(in_fd);
+        }
+    }
+
+    bool is_done()
+    {
+        return state == 100;
+    }
+
+    void read_header()
+    {
+        if (input_file == "" || input_file == "-")
+        {
+            in_fd = 0;
+        }
+        else
+        {
+            in_fd = open(input_file.c_str(), O_RDONLY);
+            if (in_fd < 0)
+            {
+                result = (cli_result_t){ .err = errno, .text = "Failed to open "+input_file+": "+strerror(errno) };
+                state = 100;
+                return;
+            }
+        }
+        vitastor_diff_header_t hdr;
+        std::string json_text;
+        if (diff_read(in_fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+            hdr.magic == VITASTOR_DIFF_MAGIC && hdr.json_len < 65536)
+        {
+            json_text.resize(hdr.json_len);
+            if (diff_read(in_fd, (void*)json_text.data(), hdr.json_len) != hdr.json_len)
+                json_text = "";
+        }
+        uint32_t hdr_crc = hdr.crc32c;
+        hdr.crc32c = 0;
+        if (json_text == "" || crc32c(crc32c(0, &hdr, sizeof(hdr)), json_text.data(), json_text.size()) != hdr_crc)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Input is not a valid Vitastor diff" };
+            state = 100;
+            return;
+        }
+        if (hdr.version != VITASTOR_DIFF_VERSION)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Unsupported diff version "+std::to_string(hdr.version) };
+            state = 100;
+            return;
+        }
+        std::string json_err;
+        json11::Json params = json11::Json::parse(json_text, json_err);
+        from_snap = params["from"].string_value();
+        to_snap = params["to"].string_value();
+        diff_size = params["size"].uint64_value();
+        block_size = params["block_size"].uint64_value();
+        bitmap_granularity = params["bitmap_granularity"].uint64_value();
+        if (!bitmap_granularity || !block_size || (block_size % bitmap_granularity))
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Diff header has invalid block size or bitmap granularity" };
+            state = 100;
+            return;
+        }
+        bitmap_size = (block_size/bitmap_granularity + 7) / 8;
+        if (image_name == "")
+        {
+            image_name = params["image"].string_value();
+        }
+    }
+
+    void check_target()
+    {
+        inode_config_t *cfg = parent->get_inode_cfg(image_name);
+        if (!cfg)
+        {
+            result = (cli_result_t){ .err = ENOENT, .text = "Image "+image_name+" does not exist" };
+            state = 100;
+            return;
+        }
+        target_inode = cfg->num;
+        if (cfg->readonly)
+        {
+            result = (cli_result_t){ .err = EROFS, .text = "Image "+image_name+" is read-only" };
+            state = 100;
+            return;
+        }
+        if (cfg->size < diff_size)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Image "+image_name+" is smaller than the diff, resize it first" };
+            state = 100;
+            return;
+        }
+        auto & pool_cfg = parent->cli->st_cli.pool_config.at(INODE_POOL(target_inode));
+        if (bitmap_granularity % pool_cfg.bitmap_granularity)
+        {
+            result = (cli_result_t){ .err = EINVAL, .text = "Diff bitmap granularity is not a multiple of the bitmap granularity of pool "+pool_cfg.name };
+            state = 100;
+            return;
+        }
+        if (from_snap != "" && !force && !parent->get_inode_cfg(image_name+"@"+from_snap))
+        {
+            result = (cli_result_t){ .err = ENOENT, .text = "Snapshot "+image_name+"@"+from_snap+
+                " does not exist, the diff may only be applied on top of it. Use --force to apply it anyway" };
+            state = 100;
+            return;
+        }
+        if (to_snap != "" && parent->get_inode_cfg(image_name+"@"+to_snap))
+        {
+            result = (cli_result_t){ .err = EEXIST, .text = "Snapshot "+image_name+"@"+to_snap+" already exists" };
+            state = 100;
+            return;
+        }
+    }
+
+    void loop()
+    {
+        if (state == 1)
+            goto resume_1;
+        else if (state == 2)
+            goto resume_2;
+        else if (state == 3)
+            goto resume_3;
+        else if (state == 100)
+            return;
+        read_header();
+        if (state == 100)
+            return;
+        check_target();
+        if (state == 100)
+            return;
+        state = 1;
+    resume_1:
+        // Read records and write them in parallel
+        while (inflight < parent->iodepth*parent->parallel_osds && !eof && !error.size())
+        {
+            read_record();
+        }
+        if (inflight > 0)
+        {
+            return;
+        }
+        if (error.size())
+        {
+            result = (cli_result_t){ .err = EIO, .text = error };
+            state = 100;
+            return;
+        }
+        {
+            // Sync written data
+            cluster_op_t *op = new cluster_op_t;
+            op->opcode = OSD_OP_SYNC;
+            op->callback = [this](cluster_op_t *op)
+            {
+                if (op->retval != 0 && !error.size())
+                {
+                    error = std::string("Error syncing image: ")+strerror(-op->retval);
+                }
+                delete op;
+                inflight--;
+                parent->ringloop->wakeup();
+            };
+            inflight++;
+            parent->cli->execute(op);
+        }
+        state = 2;
+    resume_2:
+        if (inflight > 0)
+        {
+            return;
+        }
+        if (error.size())
+        {
+            result = (cli_result_t){ .err = EIO, .text = error };
+            state = 100;
+            return;
+        }
+        if (parent->progress)
+        {
+            fprintf(stderr, parent->color ? "\rImported blocks: %ju\n" : "Imported blocks: %ju\n", imported_blocks);
+        }
+        if (to_snap != "")
+        {
+            // Create the <to> snapshot so that the next diff may be applied on top of it
+            create_cb = parent->start_create(json11::Json::object {
+                { "image", image_name },
+                { "snapshot", to_snap },
+            });
+        resume_3:
+            while (!create_cb(result))
+            {
+                state = 3;
+                return;
+            }
+            create_cb = NULL;
+            if (result.err)
+            {
+                state = 100;
+                return;
+            }
+        }
+        result = (cli_result_t){
+            .text = "Imported "+std::to_string(imported_blocks)+" changed blocks ("+std::to_string(imported_bytes)+" bytes)"+
+                (to_snap != "" ? " and created snapshot "+image_name+"@"+to_snap : ""),
+            .data = json11::Json::object {
+                { "image", image_name },
+                { "from", from_snap },
+                { "to", to_snap },
+                { "blocks", imported_blocks },
+                { "bytes", imported_bytes },
+            },
+        };
+        state = 100;
+    }
+
+    void read_record()
+    {
+        vitastor_diff_record_t rec;
+        if (diff_read(in_fd, &rec, sizeof(rec)) != sizeof(rec))
+        {
+            error = "Diff is truncated, "+std::to_string(imported_blocks)+
+                " blocks were imported, importing the same diff again is safe";
+            return;
+        }
+        if (rec.offset == VITASTOR_DIFF_END)
+        {
+            if (rec.bitmap_len || rec.data_len || diff_record_crc(rec, NULL, NULL) != rec.crc32c)
+                error = "Diff end record is corrupted";
+            eof = true;
+            return;
+        }
+        if (rec.bitmap_len != bitmap_size || rec.data_len > block_size ||
+            (rec.offset % block_size) || rec.offset >= diff_size)
+        {
+            char buf[256];
+            snprintf(buf, sizeof(buf), "Diff record at offset %jx is corrupted", rec.offset);
+            error = buf;
+            return;
+        }
+        diff_import_rec_t *irec = new diff_import_rec_t;
+        irec->offset = rec.offset;
+        irec->buf = (uint8_t*)malloc_or_die(rec.bitmap_len + rec.data_len);
+        uint8_t *bitmap = irec->buf, *data = irec->buf + rec.bitmap_len;
+        if (diff_read(in_fd, irec->buf, rec.bitmap_len + rec.data_len) != rec.bitmap_len + rec.data_len ||
+            diff_record_crc(rec, bitmap, data) != rec.crc32c ||
+            count_granules(bitmap)*bitmap_granularity != rec.data_len)
+        {
+            char buf[256];
+            snprintf(buf, sizeof(buf), "Diff record at offset %jx is corrupted or truncated", rec.offset);
+            error = buf;
+            free(irec->buf);
+            delete irec;
+            return;
+        }
+        // Write every run of changed granules
+        uint32_t bits = block_size/bitmap_granularity, start = 0, pos = 0;
+        irec->inflight = 1;
+        while (true)
+        {
+            while (start < bits && !(bitmap[start >> 3] & (1 << (start & 7))))
+                start++;
+            if (start >= bits)
+                break;
+            uint32_t end = start;
+            while (end < bits && (bitmap[end >> 3] & (1 << (end & 7))))
+                end++;
+            cluster_op_t *op = new cluster_op_t;
+            op->opcode = OSD_OP_WRITE;
+            op->inode = target_inode;
+            op->offset = rec.offset + (uint64_t)start*bitmap_granularity;
+            op->len = (end-start)*bitmap_granularity;
+            op->iov.push_back(data + pos, op->len);
+            op->callback = [this, irec](cluster_op_t *op)
+            {
+                if (op->retval != op->len && !error.size())
+                {
+                    char buf[1024];
+                    snprintf(buf, 1024, "Error writing image at offset %jx: %s", op->offset,
+                        strerror(op->retval < 0 ? -op->retval : EIO));
+                    error = buf;
+                }
+                delete op;
+                inflight--;
+                finish_record(irec);
+                parent->ringloop->wakeup();
+            };
+            pos += op->len;
+            irec->inflight++;
+            inflight++;
+            parent->cli->execute(op);
+            start = end;
+        }
+        imported_blocks++;
+        imported_bytes += rec.data_len;
+        if (parent->progress && !(imported_blocks % 128))
+        {
+            fprintf(stderr, parent->color ? "\rImported blocks: %ju" : "Imported blocks: %ju\n", imported_blocks);
+        }
+        finish_record(irec);
+    }
+
+    uint32_t count_granules(uint8_t *bitmap)
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < block_size/bitmap_granularity; i++)
+        {
+            if (bitmap[i >> 3] & (1 << (i & 7)))
+                n++;
+        }
+        return n;
+    }
+
+    void finish_record(diff_import_rec_t *irec)
+    {
+        irec->inflight--;
+        if (!irec->inflight)
+        {
+            free(irec->buf);
+            delete irec;
+        }
+    }
+};
+
+std::function<bool(cli_result_t &)> cli_tool_t::start_import_diff(json11::Json cfg)
+{
+    auto importer = new snap_diff_importer_t();
+    importer->parent = this;
+    importer->input_file = cfg["input"].string_value();
+    importer->image_name = cfg["image"].string_value();
+    importer->force = json_is_true(cfg["force"]);
+    return [importer](cli_result_t & result)
+    {
+        importer->loop();
+        if (importer->is_done())
+        {
+            result = importer->result;
+            delete importer;
+            return true;
+        }
+        return false;
+    };
+}
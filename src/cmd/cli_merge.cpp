@@ -3,8 +3,13 @@
 
 #include "cli.h"
 #include "cluster_client.h"
+#include "epoll_manager.h"
+#include "pg_states.h"
 #include "cpp-btree/safe_btree_set.h"
 
+// Maximum number of offsets grouped by PG and waiting to be sent for server-side merge
+#define MAX_MERGE_QUEUE 65536
+
 struct snap_rw_op_t
 {
     uint64_t offset = 0;
@@ -22,6 +27,9 @@ struct snap_rw_op_t
 //    and rename the parent to the child
 // 2) Delete snapshot "down" = merge parent layer into the child layer and remove the parent
 // 3) Flatten image = merge parent layers into the child layer and break the connection
+//
+// When all layers are in the same pool, data is merged by primary OSDs of each PG
+// (OSD_OP_MERGE) instead of being read and written back through the client.
 struct snap_merger_t
 {
     cli_tool_t *parent;
@@ -39,6 +47,8 @@ struct snap_merger_t
     bool check_delete_source = false;
     // interval between fsyncs
     int fsync_interval = 128;
+    // merge data inside OSDs
+    bool server_merge = false;
 
     // -- STATE --
     inode_t target, to_num;
@@ -60,9 +70,24 @@ struct snap_merger_t
     int deleted_unsynced = 0;
     uint64_t processed = 0, to_process = 0;
     std::string rwo_error;
+    // server-side merge: offsets waiting to be sent, grouped by PG
+    std::map<pg_num_t, std::vector<uint64_t>> pg_batches;
+    uint64_t batched = 0;
+    // server-side merge: offsets not merged yet (batched or in flight)
+    btree::safe_btree_set<uint64_t> unmerged;
+    int retry_timer_id = -1;
 
     cli_result_t result;
 
+    ~snap_merger_t()
+    {
+        if (retry_timer_id >= 0)
+        {
+            parent->epmgr->tfd->clear_timer(retry_timer_id);
+            retry_timer_id = -1;
+        }
+    }
+
     void start_merge()
     {
         if (from_name == "" || to_name == "")
@@ -199,12 +224,21 @@ struct snap_merger_t
             use_cas = 0;
         }
         sources.erase(target);
+        // Server-side merge uses chained reads, they only work inside one pool
+        for (auto & sp: sources)
+        {
+            if (INODE_POOL(sp.first) != INODE_POOL(target))
+            {
+                server_merge = false;
+            }
+        }
         if (parent->progress)
         {
             printf(
-                "Merging %zd layer(s) into target %s%s (inode %ju in pool %u)\n",
+                "Merging %zd layer(s) into target %s%s%s (inode %ju in pool %u)\n",
                 sources.size(), target_cfg->name.c_str(),
-                use_cas ? " online (with CAS)" : "", INODE_NO_POOL(target), INODE_POOL(target)
+                use_cas ? " online (with CAS)" : "", server_merge ? " inside OSDs" : "",
+                INODE_NO_POOL(target), INODE_POOL(target)
             );
         }
         target_block_size = get_block_size(target, &target_bitmap_granularity);
@@ -308,25 +342,33 @@ struct snap_merger_t
         to_process = merge_offsets.size();
         oit = merge_offsets.begin();
     resume_5:
-        // Now read, overwrite and optionally delete offsets one by one
-        continue_rwo2.swap(continue_rwo);
-        for (auto rwo: continue_rwo2)
+        if (server_merge)
         {
-            next_write(rwo);
+            // Let primary OSDs merge data of their PGs
+            submit_merge_batches();
         }
-        continue_rwo2.clear();
-        while (in_flight < parent->iodepth*parent->parallel_osds &&
-            oit != merge_offsets.end() && !rwo_error.size())
+        else
         {
-            in_flight++;
-            read_and_write(*oit);
-            oit++;
-            processed++;
-            if (parent->progress && !(processed % 128))
+            // Now read, overwrite and optionally delete offsets one by one
+            continue_rwo2.swap(continue_rwo);
+            for (auto rwo: continue_rwo2)
             {
-                fprintf(stderr, parent->color
-                    ? "\rOverwriting blocks: %ju/%ju"
-                    : "Overwriting blocks: %ju/%ju\n", processed, to_process);
+                next_write(rwo);
+            }
+            continue_rwo2.clear();
+            while (in_flight < parent->iodepth*parent->parallel_osds &&
+                oit != merge_offsets.end() && !rwo_error.size())
+            {
+                in_flight++;
+                read_and_write(*oit);
+                oit++;
+                processed++;
+                if (parent->progress && !(processed % 128))
+                {
+                    fprintf(stderr, parent->color
+                        ? "\rOverwriting blocks: %ju/%ju"
+                        : "Overwriting blocks: %ju/%ju\n", processed, to_process);
+                }
             }
         }
         if (in_flight == 0 && rwo_error.size())
@@ -338,7 +380,7 @@ struct snap_merger_t
             state = 100;
             return;
         }
-        if (in_flight > 0 || oit != merge_offsets.end())
+        if (in_flight > 0 || oit != merge_offsets.end() || batched > 0)
         {
             // Wait until overwrites finish
             return;
@@ -597,6 +639,206 @@ struct snap_merger_t
         parent->cli->execute(subop);
     }
 
+    // Sync and delete source data below <to>
+    void sync_and_delete(uint64_t to)
+    {
+        deleted_unsynced = 0;
+        cluster_op_t *subop = new cluster_op_t;
+        subop->opcode = OSD_OP_SYNC;
+        subop->callback = [this, to](cluster_op_t *subop)
+        {
+            delete subop;
+            // We can now delete source data between <from> and <to>
+            // But to do this we have to keep all object lists in memory :-(
+            for (auto & lp: layer_list_pos)
+            {
+                auto & layer_list = layer_lists.at(lp.first);
+                uint64_t layer_block = layer_block_size.at(lp.first);
+                int cur_pos = lp.second;
+                while (cur_pos < layer_list.size() && layer_list[cur_pos]+layer_block < to)
+                {
+                    delete_offset(lp.first, layer_list[cur_pos]);
+                    cur_pos++;
+                }
+                lp.second = cur_pos;
+            }
+        };
+        parent->cli->execute(subop);
+    }
+
+    // Group offsets by PG and send them to primary OSDs in batches of <iodepth> objects
+    void submit_merge_batches()
+    {
+        auto & pool_cfg = parent->cli->st_cli.pool_config.at(INODE_POOL(target));
+        while (oit != merge_offsets.end() && batched < MAX_MERGE_QUEUE && !rwo_error.size())
+        {
+            uint64_t offset = *oit;
+            pg_num_t pg_num = (offset/pool_cfg.pg_stripe_size) % pool_cfg.real_pg_count + 1; // like map_to_pg()
+            pg_batches[pg_num].push_back(offset);
+            unmerged.insert(offset);
+            batched++;
+            oit++;
+        }
+        // Send full batches, or any batches if no more offsets can be queued
+        bool send_all = oit == merge_offsets.end() || batched >= MAX_MERGE_QUEUE;
+        auto it = pg_batches.begin();
+        while (it != pg_batches.end() && in_flight < parent->parallel_osds &&
+            retry_timer_id < 0 && !rwo_error.size())
+        {
+            if (it->second.size() < parent->iodepth && !send_all)
+            {
+                it++;
+                continue;
+            }
+            auto pg_it = pool_cfg.pg_config.find(it->first);
+            if (pg_it == pool_cfg.pg_config.end() || !pg_it->second.cur_primary ||
+                !(pg_it->second.cur_state & PG_ACTIVE))
+            {
+                // PG is inactive, retry later
+                it++;
+                continue;
+            }
+            std::vector<uint64_t> offsets;
+            if (it->second.size() > parent->iodepth)
+            {
+                offsets.assign(it->second.begin(), it->second.begin()+parent->iodepth);
+                it->second.erase(it->second.begin(), it->second.begin()+parent->iodepth);
+            }
+            else
+            {
+                offsets.swap(it->second);
+            }
+            batched -= offsets.size();
+            submit_merge_op(pg_it->second.cur_primary, it->first, offsets);
+            if (!it->second.size())
+                pg_batches.erase(it++);
+        }
+        if (in_flight == 0 && batched > 0 && retry_timer_id < 0 && !rwo_error.size())
+        {
+            // All remaining PGs are inactive
+            retry_merge_later();
+        }
+    }
+
+    void submit_merge_op(osd_num_t primary_osd, pg_num_t pg_num, const std::vector<uint64_t> & offsets)
+    {
+        parent->cli->init_msgr();
+        osd_op_t *op = new osd_op_t;
+        op->req = (osd_any_op_t){
+            .merge = (osd_op_merge_t){
+                .header = (osd_op_header_t){
+                    .magic = SECONDARY_OSD_OP_MAGIC,
+                    .id = parent->cli->next_op_id(),
+                    .opcode = OSD_OP_MERGE,
+                },
+                .source_inode = to_num,
+                .target_inode = target,
+                .meta_revision = parent->cli->st_cli.inode_config.at(to_num).mod_revision,
+                .len = offsets.size()*sizeof(uint64_t),
+                .pool_id = INODE_POOL(target),
+                .pg_num = pg_num,
+                .flags = use_cas && to_num == target ? OSD_MERGE_CAS : 0,
+            },
+        };
+        op->buf = malloc_or_die(op->req.merge.len);
+        memcpy(op->buf, offsets.data(), op->req.merge.len);
+        op->iov.push_back(op->buf, op->req.merge.len);
+        op->callback = [this, pg_num, primary_osd](osd_op_t *op)
+        {
+            uint64_t *offsets = (uint64_t*)op->buf;
+            int count = op->req.merge.len/sizeof(uint64_t);
+            if (!server_merge && op->reply.hdr.retval < 0)
+            {
+                // Already switched to the client-side merge which also covers these offsets
+            }
+            else if (op->reply.hdr.retval == -EPIPE)
+            {
+                // PG is moved, peering or metadata is changed, retry later
+                auto & batch = pg_batches[pg_num];
+                batch.insert(batch.begin(), offsets, offsets+count);
+                batched += count;
+                retry_merge_later();
+            }
+            else if (op->reply.hdr.retval == -EINVAL)
+            {
+                // OSDs without OSD_OP_MERGE reject it, merge through the client
+                fprintf(stderr, "OSD %ju doesn't support merging layers inside OSDs, merging through the client\n", primary_osd);
+                fallback_to_client_merge();
+            }
+            else if (op->reply.hdr.retval < 0)
+            {
+                char buf[1024];
+                snprintf(buf, 1024, "Error merging layers at offset %jx: %s",
+                    op->reply.merge.error_offset, strerror(-op->reply.hdr.retval));
+                rwo_error = std::string(buf);
+            }
+            else
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    unmerged.erase(offsets[i]);
+                }
+                processed += count;
+                if (parent->progress && (processed/128) != ((processed-count)/128))
+                {
+                    fprintf(stderr, parent->color
+                        ? "\rOverwriting blocks: %ju/%ju"
+                        : "Overwriting blocks: %ju/%ju\n", processed, to_process);
+                }
+                if (delete_source && server_merge)
+                {
+                    deleted_unsynced += count;
+                    if (deleted_unsynced >= fsync_interval)
+                    {
+                        // Everything below the first unmerged offset is merged
+                        sync_and_delete(unmerged.size() ? *unmerged.begin()
+                            : (oit != merge_offsets.end() ? *oit : UINT64_MAX));
+                    }
+                }
+            }
+            delete op;
+            in_flight--;
+            continue_merge_reent();
+        };
+        in_flight++;
+        parent->cli->execute_raw(primary_osd, op);
+    }
+
+    void fallback_to_client_merge()
+    {
+        if (!server_merge)
+        {
+            return;
+        }
+        server_merge = false;
+        // Everything before the first unmerged offset is already merged,
+        // offsets after it may be merged again, it's harmless
+        if (unmerged.size())
+        {
+            oit = merge_offsets.find(*unmerged.begin());
+        }
+        pg_batches.clear();
+        batched = 0;
+        processed = 0;
+        for (auto it = merge_offsets.begin(); it != oit; it++)
+        {
+            processed++;
+        }
+    }
+
+    void retry_merge_later()
+    {
+        if (retry_timer_id >= 0)
+        {
+            return;
+        }
+        retry_timer_id = parent->epmgr->tfd->set_timer(1000, false, [this](int timer_id)
+        {
+            retry_timer_id = -1;
+            continue_merge_reent();
+        });
+    }
+
     void autofree_op(snap_rw_op_t *rwo)
     {
         if (!rwo->todo)
@@ -611,28 +853,7 @@ struct snap_merger_t
                 deleted_unsynced++;
                 if (deleted_unsynced >= fsync_interval)
                 {
-                    uint64_t to = last_written_offset;
-                    cluster_op_t *subop = new cluster_op_t;
-                    subop->opcode = OSD_OP_SYNC;
-                    subop->callback = [this, to](cluster_op_t *subop)
-                    {
-                        delete subop;
-                        // We can now delete source data between <from> and <to>
-                        // But to do this we have to keep all object lists in memory :-(
-                        for (auto & lp: layer_list_pos)
-                        {
-                            auto & layer_list = layer_lists.at(lp.first);
-                            uint64_t layer_block = layer_block_size.at(lp.first);
-                            int cur_pos = lp.second;
-                            while (cur_pos < layer_list.size() && layer_list[cur_pos]+layer_block < to)
-                            {
-                                delete_offset(lp.first, layer_list[cur_pos]);
-                                cur_pos++;
-                            }
-                            lp.second = cur_pos;
-                        }
-                    };
-                    parent->cli->execute(subop);
+                    sync_and_delete(last_written_offset);
                 }
             }
             free(rwo->buf);
@@ -658,6 +879,7 @@ std::function<bool(cli_result_t &)> cli_tool_t::start_merge(json11::Json cfg)
     merger->to_name = cfg["to"].string_value();
     merger->target_name = cfg["target"].string_value();
     merger->delete_source = cfg["delete_source"].string_value() != "";
+    merger->server_merge = server_merge;
     merger->fsync_interval = cfg["fsync_interval"].uint64_value();
     if (!merger->fsync_interval)
         merger->fsync_interval = 128;
@@ -5,7 +5,7 @@
 #include "cluster_client.h"
 #include "str_util.h"
 
-// Rename, resize image (and purge extra data on shrink) or change its readonly status
+// Rename, resize image (and purge extra data on shrink), change its readonly status or I/O limits
 struct image_changer_t
 {
     cli_tool_t *parent;
@@ -16,11 +16,14 @@ struct image_changer_t
     bool force_size = false, inc_size = false;
     bool set_readonly = false, set_readwrite = false, force = false;
     bool down_ok = false;
+    // qos_iops, qos_bps, qos_burst_iops, qos_burst_bps, "0" removes the limit
+    std::map<std::string, std::string> set_qos;
     // interval between fsyncs
     int fsync_interval = 128;
 
     uint64_t inode_num = 0;
     inode_config_t cfg;
+    qos_limits_t new_qos;
     json11::Json::array checks, success;
     bool has_children = false;
 
@@ -72,6 +75,26 @@ struct image_changer_t
             state = 100;
             return;
         }
+        new_qos = cfg.qos;
+        for (auto & kv: set_qos)
+        {
+            bool ok = false;
+            uint64_t value = parse_size(kv.second, &ok);
+            if (!ok)
+            {
+                result = (cli_result_t){ .err = EINVAL, .text = kv.first+" must be a non-negative integer with or without size suffix (K/M/G/T)" };
+                state = 100;
+                return;
+            }
+            if (kv.first == "qos_iops")
+                new_qos.iops = value;
+            else if (kv.first == "qos_bps")
+                new_qos.bps = value;
+            else if (kv.first == "qos_burst_iops")
+                new_qos.burst_iops = value;
+            else
+                new_qos.burst_bps = value;
+        }
         for (auto & ic: parent->cli->st_cli.inode_config)
         {
             if (ic.second.parent_id == inode_num)
@@ -83,7 +106,8 @@ struct image_changer_t
         if ((!set_readwrite || !cfg.readonly) &&
             (!set_readonly || cfg.readonly) &&
             (!new_size && !force_size || cfg.size == new_size || cfg.size >= new_size && inc_size) &&
-            (new_name == "" || new_name == image_name))
+            (new_name == "" || new_name == image_name) &&
+            !(new_qos != cfg.qos))
         {
             result = (cli_result_t){ .err = 0, .text = "No change", .data = json11::Json::object {
                 { "error_code", 0 },
@@ -145,6 +169,7 @@ resume_1:
         {
             cfg.name = new_name;
         }
+        cfg.qos = new_qos;
         {
             std::string cur_cfg_key = base64_encode(parent->cli->st_cli.etcd_prefix+
                 "/config/inode/"+std::to_string(INODE_POOL(inode_num))+
@@ -255,6 +280,11 @@ std::function<bool(cli_result_t &)> cli_tool_t::start_modify(json11::Json cfg)
     if (!changer->fsync_interval)
         changer->fsync_interval = 128;
     changer->down_ok = cfg["down_ok"].bool_value();
+    for (auto key: { "qos_iops", "qos_bps", "qos_burst_iops", "qos_burst_bps" })
+    {
+        if (!cfg[key].is_null())
+            changer->set_qos[key] = cfg[key].as_string();
+    }
     // FIXME Check that the image doesn't have children when shrinking
     return [changer](cli_result_t & result)
     {
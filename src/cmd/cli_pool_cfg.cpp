@@ -81,6 +81,17 @@ std::string validate_pool_config(json11::Json::object & new_cfg, json11::Json ol
             }
             value = value.uint64_value();
         }
+        else if (key == "qos_iops" || key == "qos_bps" || key == "qos_burst_iops" || key == "qos_burst_bps")
+        {
+            bool ok = true;
+            if (value.is_string())
+                value = parse_size(value.string_value(), &ok);
+            if (!ok || !value.is_number() || value.uint64_value() != value.number_value())
+            {
+                return key+" must be a non-negative integer with or without size suffix (K/M/G/T)";
+            }
+            value = value.uint64_value();
+        }
         else if (key == "block_size")
         {
             uint64_t block_size = value.is_string() ? parse_size(value.string_value()) : value.uint64_value();
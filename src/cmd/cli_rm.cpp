@@ -95,6 +95,8 @@ struct snap_remover_t
             goto resume_7;
         else if (state == 8)
             goto resume_8;
+        else if (state == 9)
+            goto resume_9;
         else if (state == 100)
             goto resume_100;
         assert(!state);
@@ -181,6 +183,19 @@ resume_4:
             }
             else if (parent->progress)
                 printf("%s\n", result.text.c_str());
+            // Chains including the "inverse" parent may have its granules cached as owned by
+            // lower layers, which is wrong after deleting child data, so invalidate them first
+            parent->bump_inode_revision(inverse_parent, &result);
+            state = 9;
+resume_9:
+            if (parent->waiting > 0)
+                return;
+            if (result.err)
+            {
+                result.data = my_result(result.data);
+                state = 100;
+                return;
+            }
             // Delete "inverse" child data
             start_delete_source(inverse_child);
             if (state == 100)
@@ -6,6 +6,7 @@
 #include "str_util.h"
 #include "pg_states.h"
 #include "http_client.h"
+#include "latency_hist.h"
 
 static const char *obj_states[] = { "clean", "misplaced", "degraded", "incomplete" };
 
@@ -13,6 +14,7 @@ static const char *obj_states[] = { "clean", "misplaced", "degraded", "incomplet
 // etcd, mon, osd states
 // raw/used space, object states, pool states, pg states
 // client io, recovery io, rebalance io, scrub io
+// client, replication and blockstore latency percentiles
 struct status_printer_t
 {
     cli_tool_t *parent;
@@ -22,6 +24,70 @@ struct status_printer_t
     json11::Json agg_stats;
     std::map<pool_id_t, json11::Json::object> pool_stats;
     json11::Json::array etcd_states;
+    // Latency histograms of all up OSDs merged together: section => name => histogram
+    std::map<std::string, std::map<std::string, latency_hist_t>> latency_hists;
+
+    latency_hist_t merge_latency(const std::string & section, std::vector<std::string> names)
+    {
+        latency_hist_t sum;
+        auto sec_it = latency_hists.find(section);
+        if (sec_it == latency_hists.end())
+            return sum;
+        for (auto & name: names)
+        {
+            auto it = sec_it->second.find(name);
+            if (it == sec_it->second.end())
+                continue;
+            sum.add(it->second);
+        }
+        return sum;
+    }
+
+    std::string format_latency()
+    {
+        const struct { const char *title, *section; std::vector<std::string> names; } rows[] = {
+            { "client read:  ", "op", { "primary_read" } },
+            { "client write: ", "op", { "primary_write" } },
+            { "client sync:  ", "op", { "primary_sync" } },
+            { "replication:  ", "subop", { "write", "write_stable" } },
+            { "queue wait:   ", "blockstore", { "queue_read", "queue_write", "queue_write_stable", "queue_delete" } },
+            { "journal:      ", "blockstore", { "journal" } },
+            { "disk sync:    ", "blockstore", { "sync" } },
+        };
+        std::string str;
+        for (auto & row: rows)
+        {
+            auto hist = merge_latency(row.section, row.names);
+            if (!hist.count)
+                continue;
+            str += std::string("    ")+row.title+format_lat(hist.percentile(0.5))+" / "+
+                format_lat(hist.percentile(0.99))+" / "+format_lat(hist.percentile(0.999))+"\n";
+        }
+        if (str != "")
+            str = "  \n  latency (p50 / p99 / p99.9):\n"+str;
+        return str;
+    }
+
+    json11::Json latency_json()
+    {
+        json11::Json::object res;
+        for (auto & sec: latency_hists)
+        {
+            json11::Json::object sec_res;
+            for (auto & kv: sec.second)
+            {
+                sec_res[kv.first] = json11::Json::object {
+                    { "count", kv.second.count },
+                    { "lat", kv.second.sum / kv.second.count },
+                    { "p50", kv.second.percentile(0.5) },
+                    { "p99", kv.second.percentile(0.99) },
+                    { "p999", kv.second.percentile(0.999) },
+                };
+            }
+            res[sec.first] = sec_res;
+        }
+        return res;
+    }
 
     bool is_done()
     {
@@ -152,6 +218,14 @@ resume_2:
             if (peer_it != parent->cli->st_cli.peer_states.end())
             {
                 osd_up++;
+                // Histograms of down OSDs are stale, skip them
+                for (auto & sec: value["latency"].object_items())
+                {
+                    for (auto & kv: sec.second.object_items())
+                    {
+                        latency_hists[sec.first][kv.first].add_json(kv.second);
+                    }
+                }
             }
             else
             {
@@ -229,6 +303,7 @@ resume_2:
                 { "op_stats", agg_stats["op_stats"] },
                 { "recovery_stats", agg_stats["recovery_stats"] },
                 { "object_counts", agg_stats["object_counts"] },
+                { "latency", latency_json() },
             };
             for (int i = 0; i < sizeof(obj_states)/sizeof(obj_states[0]); i++)
             {
@@ -318,6 +393,7 @@ resume_2:
             "  \n"
             "  io%s:\n"
             "    client:%s %s/s rd, %s op/s rd, %s/s wr, %s op/s wr\n"
+            "%s"
             "%s",
             etcd_alive, etcd_states.size(), format_size(etcd_db_size).c_str(),
             mon_count, mon_master == "" ? "" : (", master "+mon_master).c_str(),
@@ -335,7 +411,8 @@ resume_2:
             format_size(agg_stats["op_stats"]["primary_read"]["iops"].uint64_value(), true).c_str(),
             format_size(agg_stats["op_stats"]["primary_write"]["bps"].uint64_value()).c_str(),
             format_size(agg_stats["op_stats"]["primary_write"]["iops"].uint64_value(), true).c_str(),
-            recovery_io.c_str()
+            recovery_io.c_str(),
+            format_latency().c_str()
         );
         state = 100;
     }
@@ -44,10 +44,25 @@ osd_t::osd_t(const json11::Json & config, ring_loop_t *ringloop)
     // FIXME: Use timerfd_interval based directly on io_uring
     this->tfd = epmgr->tfd;
 
+    if (peering_threads > 0)
+    {
+        peering_pool = new worker_pool_t(peering_threads, [this](int fd, bool wr, std::function<void(int, int)> handler)
+        {
+            epmgr->set_fd_handler(fd, wr, handler);
+        });
+    }
+
     if (!json_is_true(this->config["disable_blockstore"]))
     {
         auto bs_cfg = json_to_bs(this->config);
-        this->bs = new blockstore_t(bs_cfg, ringloop, tfd);
+        bs_ringloop = ringloop;
+        if (json_is_true(this->config["ring_iopoll"]))
+        {
+            // IOPOLL rings can't serve sockets, so the blockstore gets its own ring driven by the main one
+            bs_ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE, IORING_SETUP_IOPOLL);
+            ringloop->attach_ring(bs_ringloop);
+        }
+        this->bs = new blockstore_t(bs_cfg, bs_ringloop, tfd);
         // Wait for blockstore initialisation before actually starting OSD logic
         // to prevent peering timeouts during restart with filled databases
         while (!bs->is_started())
@@ -96,6 +111,7 @@ osd_t::osd_t(const json11::Json & config, ring_loop_t *ringloop)
     msgr.tfd = this->tfd;
     msgr.ringloop = this->ringloop;
     msgr.exec_op = [this](osd_op_t *op) { exec_op(op); };
+    msgr.latency_hists = &latency_hists;
     msgr.repeer_pgs = [this](osd_num_t peer_osd) { repeer_pgs(peer_osd); };
     msgr.check_config_hook = [this](osd_client_t *cl, json11::Json conf) { return check_peer_config(cl, conf); };
     msgr.init();
@@ -128,10 +144,22 @@ osd_t::~osd_t()
         tfd->clear_timer(autosync_timer_id);
         autosync_timer_id = -1;
     }
+    if (qos_timer_id >= 0)
+    {
+        tfd->clear_timer(qos_timer_id);
+        qos_timer_id = -1;
+    }
     ringloop->unregister_consumer(&consumer);
+    if (peering_pool)
+        delete peering_pool;
     delete epmgr;
     if (bs)
         delete bs;
+    if (bs_ringloop && bs_ringloop != ringloop)
+    {
+        ringloop->attach_ring(NULL);
+        delete bs_ringloop;
+    }
     close(listen_fd);
     free(zero_buffer);
 }
@@ -186,6 +214,7 @@ void osd_t::parse_config(bool init)
             etcd_stats_interval = 30;
         readonly = json_is_true(config["readonly"]);
         run_primary = !json_is_false(config["run_primary"]);
+        peering_threads = config["peering_threads"].is_null() ? 4 : config["peering_threads"].uint64_value();
         allow_test_ops = json_is_true(config["allow_test_ops"]);
     }
     log_level = config["log_level"].uint64_value();
@@ -219,6 +248,9 @@ void osd_t::parse_config(bool init)
     if (recovery_queue_depth < 1 || recovery_queue_depth > MAX_RECOVERY_QUEUE)
         recovery_queue_depth = DEFAULT_RECOVERY_QUEUE;
     recovery_sleep_us = config["recovery_sleep_us"].uint64_value();
+    recovery_delta = !json_is_false(config["recovery_delta"]);
+    peering_log_size = config["peering_log_size"].is_null()
+        ? 65536 : config["peering_log_size"].uint64_value();
     recovery_tune_util_low = config["recovery_tune_util_low"].is_null()
         ? 0.1 : config["recovery_tune_util_low"].number_value();
     if (recovery_tune_util_low < 0.01)
@@ -247,6 +279,9 @@ void osd_t::parse_config(bool init)
     recovery_pg_switch = config["recovery_pg_switch"].uint64_value();
     if (recovery_pg_switch < 1)
         recovery_pg_switch = DEFAULT_RECOVERY_PG_SWITCH;
+    recovery_osd_queue_depth = config["recovery_osd_queue_depth"].is_null()
+        ? DEFAULT_RECOVERY_OSD_QUEUE : config["recovery_osd_queue_depth"].uint64_value();
+    recovery_order_dirty = true;
     recovery_sync_batch = config["recovery_sync_batch"].uint64_value();
     if (recovery_sync_batch < 1 || recovery_sync_batch > MAX_RECOVERY_QUEUE)
         recovery_sync_batch = DEFAULT_RECOVERY_BATCH;
@@ -273,6 +308,7 @@ void osd_t::parse_config(bool init)
     scrub_ec_max_bruteforce = config["scrub_ec_max_bruteforce"].uint64_value();
     if (scrub_ec_max_bruteforce < 1)
         scrub_ec_max_bruteforce = 100;
+    scrub_digests = !json_is_false(config["scrub_digests"]);
     scrub_sleep_ms = config["scrub_sleep"].uint64_value();
     scrub_list_limit = config["scrub_list_limit"].uint64_value();
     if (!scrub_list_limit)
@@ -293,6 +329,10 @@ void osd_t::parse_config(bool init)
             schedule_scrub(pgp.second);
         }
     }
+    if (old_no_rebalance != no_rebalance || old_no_recovery != no_recovery)
+    {
+        recovery_candidates_dirty = true;
+    }
     if ((old_no_rebalance && !no_rebalance || old_no_recovery && !no_recovery) &&
         !(peering_state & (OSD_RECOVERING | OSD_FLUSHING_PGS)))
     {
@@ -405,6 +445,11 @@ void osd_t::exec_op(osd_op_t *cur_op)
             (cur_op->req.sec_rw.len > OSD_RW_MAX ||
             cur_op->req.sec_rw.len % bs_bitmap_granularity ||
             cur_op->req.sec_rw.offset % bs_bitmap_granularity)) ||
+        (cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST &&
+            (cur_op->req.sec_rw.len > OSD_RW_MAX ||
+            cur_op->req.sec_rw.len % bs_bitmap_granularity ||
+            cur_op->req.sec_rw.len % OSD_DIGEST_LANES ||
+            cur_op->req.sec_rw.offset % bs_bitmap_granularity)) ||
         ((cur_op->req.hdr.opcode == OSD_OP_READ ||
             cur_op->req.hdr.opcode == OSD_OP_WRITE ||
             cur_op->req.hdr.opcode == OSD_OP_DELETE) &&
@@ -424,6 +469,7 @@ void osd_t::exec_op(osd_op_t *cur_op)
     }
     if (readonly &&
         cur_op->req.hdr.opcode != OSD_OP_SEC_READ &&
+        cur_op->req.hdr.opcode != OSD_OP_SEC_READ_DIGEST &&
         cur_op->req.hdr.opcode != OSD_OP_SEC_LIST &&
         cur_op->req.hdr.opcode != OSD_OP_READ &&
         cur_op->req.hdr.opcode != OSD_OP_SEC_READ_BMP &&
@@ -435,6 +481,16 @@ void osd_t::exec_op(osd_op_t *cur_op)
         finish_op(cur_op, -EROFS);
         return;
     }
+    if (qos_throttle(cur_op))
+    {
+        // Delayed by QoS limits, dispatched later
+        return;
+    }
+    dispatch_op(cur_op);
+}
+
+void osd_t::dispatch_op(osd_op_t *cur_op)
+{
     if (cur_op->req.hdr.opcode == OSD_OP_TEST_SYNC_STAB_ALL)
     {
         exec_sync_stab_all(cur_op);
@@ -467,6 +523,10 @@ void osd_t::exec_op(osd_op_t *cur_op)
     {
         continue_primary_describe(cur_op);
     }
+    else if (cur_op->req.hdr.opcode == OSD_OP_MERGE)
+    {
+        continue_primary_merge(cur_op);
+    }
     else
     {
         exec_secondary(cur_op);
@@ -524,6 +584,16 @@ void osd_t::print_stats()
         }
     }
     memcpy(recovery_print_prev, recovery_stat, sizeof(recovery_stat));
+    auto & pool = mem_pool_t::local();
+    if (pool.alloc_count != prev_pool_alloc_count)
+    {
+        printf(
+            "[OSD %ju] op allocations: %ju, %ju of them from malloc, %ju in use\n", osd_num,
+            pool.alloc_count - prev_pool_alloc_count, pool.sys_alloc_count - prev_pool_sys_alloc_count, pool.in_use
+        );
+        prev_pool_alloc_count = pool.alloc_count;
+        prev_pool_sys_alloc_count = pool.sys_alloc_count;
+    }
     if (corrupted_objects > 0)
     {
         printf("[OSD %ju] %ju object(s) corrupted\n", osd_num, corrupted_objects);
@@ -568,7 +638,8 @@ void osd_t::print_slow()
                 }
                 bufprintf(": %s id=%ju", osd_op_names[op->req.hdr.opcode], op->req.hdr.id);
                 if (op->req.hdr.opcode == OSD_OP_SEC_READ || op->req.hdr.opcode == OSD_OP_SEC_WRITE ||
-                    op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE || op->req.hdr.opcode == OSD_OP_SEC_DELETE)
+                    op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE || op->req.hdr.opcode == OSD_OP_SEC_DELETE ||
+                    op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST)
                 {
                     bufprintf(" %jx:%jx v", op->req.sec_rw.oid.inode, op->req.sec_rw.oid.stripe);
                     if (op->req.sec_rw.version == UINT64_MAX)
@@ -613,6 +684,7 @@ void osd_t::print_slow()
                 }
                 if (op->req.hdr.opcode == OSD_OP_SEC_READ || op->req.hdr.opcode == OSD_OP_SEC_WRITE ||
                     op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE || op->req.hdr.opcode == OSD_OP_SEC_DELETE ||
+                    op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST ||
                     op->req.hdr.opcode == OSD_OP_SEC_SYNC || op->req.hdr.opcode == OSD_OP_SEC_LIST ||
                     op->req.hdr.opcode == OSD_OP_SEC_STABILIZE || op->req.hdr.opcode == OSD_OP_SEC_ROLLBACK ||
                     op->req.hdr.opcode == OSD_OP_SEC_READ_BMP)
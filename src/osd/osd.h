@@ -20,6 +20,7 @@
 #include "ringloop.h"
 #include "timerfd_manager.h"
 #include "epoll_manager.h"
+#include "worker_pool.h"
 #include "osd_peering_pg.h"
 #include "messenger.h"
 #include "etcd_state_client.h"
@@ -36,6 +37,7 @@
 #define MAX_RECOVERY_QUEUE 2048
 #define DEFAULT_RECOVERY_QUEUE 1
 #define DEFAULT_RECOVERY_PG_SWITCH 128
+#define DEFAULT_RECOVERY_OSD_QUEUE 4
 #define DEFAULT_RECOVERY_BATCH 16
 
 //#define OSD_STUB
@@ -52,6 +54,25 @@ struct osd_recovery_op_t
     bool degraded = false;
     object_id oid = { 0 };
     osd_op_t *osd_op = NULL;
+    // OSDs receiving recovered data
+    std::vector<osd_num_t> targets;
+};
+
+struct recovery_candidate_t
+{
+    pool_pg_num_t pg_id;
+    pg_t *pg;
+    pg_osd_set_state_t *state;
+    bool degraded;
+    // number of surviving copies (parts for EC) above the minimum required to read the object
+    int margin;
+    // max number of recovery operations running on target OSDs
+    int load;
+    // target OSDs already run recovery_osd_queue_depth recovery operations
+    bool full;
+    // 0 for the current PG and PGs after it, to switch PGs after recovery_pg_switch operations
+    int pg_order;
+    std::vector<osd_num_t> targets;
 };
 
 // Posted as /osd/inodestats/$osd, then accumulated by the monitor
@@ -63,6 +84,21 @@ struct inode_stats_t
     uint64_t op_sum[3] = { 0 };
     uint64_t op_count[3] = { 0 };
     uint64_t op_bytes[3] = { 0 };
+    // Operations delayed by QoS limits and the total delay
+    uint64_t qos_count = 0, qos_usec = 0;
+};
+
+// Client operations waiting for QoS tokens of an inode or a pool
+struct osd_qos_wait_t
+{
+    osd_op_t *op;
+    uint64_t since_us;
+};
+
+struct osd_qos_queue_t
+{
+    qos_bucket_t bucket;
+    std::deque<osd_qos_wait_t> ops;
 };
 
 struct bitmap_request_t
@@ -86,6 +122,8 @@ struct osd_chain_read_t
 };
 
 struct osd_rmw_stripe_t;
+struct osd_merge_op_t;
+struct osd_merge_obj_t;
 
 struct recovery_stat_t
 {
@@ -118,6 +156,9 @@ class osd_t
     int autosync_writes = DEFAULT_AUTOSYNC_WRITES;
     uint64_t recovery_queue_depth = 1;
     uint64_t recovery_sleep_us = 0;
+    bool recovery_delta = true;
+    uint64_t peering_log_size = 65536;
+    int peering_threads = 4;
     double recovery_tune_util_low = 0.1;
     double recovery_tune_client_util_low = 0;
     double recovery_tune_util_high = 1.0;
@@ -127,6 +168,7 @@ class osd_t
     int recovery_tune_sleep_min_us = 10;
     int recovery_tune_sleep_cutoff_us = 10000000;
     int recovery_pg_switch = DEFAULT_RECOVERY_PG_SWITCH;
+    int recovery_osd_queue_depth = DEFAULT_RECOVERY_OSD_QUEUE;
     int recovery_sync_batch = DEFAULT_RECOVERY_BATCH;
     int inode_vanish_time = 60;
     int log_level = 0;
@@ -137,6 +179,7 @@ class osd_t
     uint32_t scrub_list_limit = 1000;
     bool scrub_find_best = true;
     uint64_t scrub_ec_max_bruteforce = 100;
+    bool scrub_digests = true;
 
     // cluster state
 
@@ -161,12 +204,17 @@ class osd_t
     int copies_to_delete_after_sync_count = 0;
     uint64_t misplaced_objects = 0, degraded_objects = 0, incomplete_objects = 0, inconsistent_objects = 0, corrupted_objects = 0;
     int peering_state = 0;
+    worker_pool_t *peering_pool = NULL;
+    uint64_t peering_calc_id = 0;
     std::map<object_id, osd_recovery_op_t> recovery_ops;
     std::map<object_id, osd_op_t*> scrub_ops;
-    bool recovery_last_degraded = true;
+    std::map<osd_num_t, int> recovery_target_ops;
     pool_pg_num_t recovery_last_pg;
     object_id recovery_last_oid;
     int recovery_pg_done = 0, recovery_done = 0;
+    // Recovery candidates are rebuilt after PG state changes and resorted after recovery_target_ops changes
+    std::vector<recovery_candidate_t> recovery_candidates;
+    bool recovery_candidates_dirty = true, recovery_order_dirty = true;
     osd_op_t *autosync_op = NULL;
 
     // Scrubbing
@@ -182,6 +230,15 @@ class osd_t
     std::map<osd_object_id_t, uint64_t> unstable_writes;
     std::deque<osd_op_t*> syncs_in_progress;
 
+    // QoS
+    std::map<inode_t, osd_qos_queue_t> inode_qos;
+    std::map<pool_id_t, osd_qos_queue_t> pool_qos;
+    std::set<inode_t> qos_waiting_inodes;
+    std::set<pool_id_t> qos_waiting_pools;
+    int qos_timer_id = -1;
+    uint64_t qos_timer_us = 0;
+    uint64_t qos_queued_ops = 0, qos_delayed_count = 0, qos_delayed_usec = 0;
+
     // client & peer I/O
 
     bool stopping = false;
@@ -191,6 +248,8 @@ class osd_t
     uint64_t zero_buffer_size = 0;
     uint32_t bs_block_size, bs_bitmap_granularity, clean_entry_bitmap_size;
     ring_loop_t *ringloop;
+    // Separate polled ring for the blockstore, or the same as ringloop
+    ring_loop_t *bs_ringloop = NULL;
     timerfd_manager_t *tfd = NULL;
     epoll_manager_t *epmgr = NULL;
 
@@ -200,6 +259,9 @@ class osd_t
 
     // op statistics
     osd_op_stats_t prev_stats, prev_report_stats;
+    // latency histograms since the previous statistics report
+    osd_latency_hists_t latency_hists;
+    uint64_t prev_pool_alloc_count = 0, prev_pool_sys_alloc_count = 0;
     timespec report_stats_ts;
     std::map<uint64_t, inode_stats_t> inode_stats;
     std::map<uint64_t, timespec> vanishing_inodes;
@@ -238,6 +300,7 @@ class osd_t
     void apply_recovery_tune_interval();
     void print_slow();
     json11::Json get_statistics();
+    json11::Json get_latency_stats();
     void report_statistics();
     void report_pg_state(pg_t & pg);
     void report_pg_states();
@@ -251,11 +314,17 @@ class osd_t
     // peer handling (primary OSD logic)
     void parse_test_peer(std::string peer);
     void handle_peers();
+    void calc_pg_object_states(pg_t & pg);
+    void finish_pg_peering(pg_t & pg);
     bool check_peer_config(osd_client_t *cl, json11::Json conf);
     void repeer_pgs(osd_num_t osd_num);
     void start_pg_peering(pg_t & pg);
     void drop_dirty_pg_connections(pool_pg_num_t pg);
     void submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps);
+    bool can_peer_incrementally(pg_t & pg);
+    void submit_changed_list_subop(osd_num_t role_osd, pg_peering_state_t *ps);
+    void log_pg_change(pg_t & pg, object_id oid, bool existed);
+    void trim_pg_change_log(pg_t & pg);
     void discard_list_subop(osd_op_t *list_op);
     bool stop_pg(pg_t & pg);
     void reset_pg(pg_t & pg);
@@ -265,6 +334,10 @@ class osd_t
     void submit_pg_flush_ops(pg_t & pg);
     void handle_flush_op(bool rollback, pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t *fb, osd_num_t peer_osd, int retval);
     bool submit_flush_op(pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t *fb, bool rollback, osd_num_t peer_osd, int count, obj_ver_id *data);
+    bool find_recovery_object(pg_obj_state_map_t & src, pg_obj_state_map_t::iterator it, object_id *stop,
+        pg_osd_set_state_t *state, object_id & oid);
+    void build_recovery_candidates();
+    void sort_recovery_candidates();
     bool pick_next_recovery(osd_recovery_op_t &op);
     void submit_recovery_op(osd_recovery_op_t *op);
     void finish_recovery_op(osd_recovery_op_t *op);
@@ -281,8 +354,17 @@ class osd_t
 
     // op execution
     void exec_op(osd_op_t *cur_op);
+    void dispatch_op(osd_op_t *cur_op);
     void finish_op(osd_op_t *cur_op, int retval);
 
+    // QoS
+    bool qos_throttle(osd_op_t *cur_op);
+    bool qos_enqueue(osd_qos_queue_t & q, osd_op_t *cur_op, bool delayed, uint64_t now);
+    bool qos_pool_stage(osd_op_t *cur_op, bool delayed, uint64_t now);
+    uint64_t run_qos_queue(osd_qos_queue_t & q, const qos_limits_t & limits, bool pool_stage, uint64_t now);
+    void run_qos_queues();
+    void schedule_qos_timer(uint64_t at_us, uint64_t now);
+
     // secondary ops
     void exec_sync_stab_all(osd_op_t *cur_op);
     void exec_show_config(osd_op_t *cur_op);
@@ -295,8 +377,16 @@ class osd_t
     bool prepare_primary_rw(osd_op_t *cur_op);
     void continue_primary_read(osd_op_t *cur_op);
     void continue_primary_scrub(osd_op_t *cur_op);
+    void submit_scrub_subops(osd_op_t *cur_op, int submit_type);
+    bool check_scrub_digests(osd_op_t *cur_op);
     void continue_primary_describe(osd_op_t *cur_op);
+    void continue_primary_merge(osd_op_t *cur_op);
+    void submit_merge_read(osd_merge_op_t *mop, osd_merge_obj_t *obj);
+    void continue_merge_write(osd_merge_op_t *mop, osd_merge_obj_t *obj);
+    void finish_merge_object(osd_merge_op_t *mop, osd_merge_obj_t *obj, int retval);
     void continue_primary_write(osd_op_t *cur_op);
+    bool submit_recovery_digests(osd_op_t *cur_op, pg_t & pg);
+    void calc_recovery_delta(osd_op_t *cur_op, pg_t & pg);
     void cancel_primary_write(osd_op_t *cur_op);
     void continue_primary_sync(osd_op_t *cur_op);
     void continue_primary_del(osd_op_t *cur_op);
@@ -194,6 +194,18 @@ json11::Json osd_t::get_statistics()
         st["blockstore_ready"] = bs->is_started();
         st["size"] = bs->get_block_count() * bs->get_block_size();
         st["free"] = bs->get_free_block_count() * bs->get_block_size();
+        auto & fl = bs->get_flush_stats();
+        st["flush_stats"] = json11::Json::object {
+            { "count", fl.flushed_objects },
+            { "versions", fl.flushed_versions },
+            { "rewrites", fl.queued_rewrites },
+            { "delayed", fl.delayed },
+            { "trimmed_bytes", fl.trimmed_bytes },
+            { "versions_per_flush", fl.flushed_objects ? (double)fl.flushed_versions / fl.flushed_objects : 0.0 },
+            { "trimmed_per_flush", fl.flushed_objects ? fl.trimmed_bytes / fl.flushed_objects : 0 },
+            { "meta_writes", fl.meta_writes },
+            { "entries_per_meta_write", fl.meta_writes ? (double)fl.meta_write_entries / fl.meta_writes : 0.0 },
+        };
     }
     st["data_block_size"] = (uint64_t)bs_block_size;
     st["bitmap_granularity"] = (uint64_t)bs_bitmap_granularity;
@@ -224,6 +236,11 @@ json11::Json osd_t::get_statistics()
     }
     st["op_stats"] = op_stats;
     st["subop_stats"] = subop_stats;
+    st["qos_stats"] = json11::Json::object {
+        { "count", qos_delayed_count },
+        { "usec", qos_delayed_usec },
+        { "queued", qos_queued_ops },
+    };
     auto n0 = recovery_stat[0].count - recovery_report_prev[0].count;
     auto n1 = recovery_stat[1].count - recovery_report_prev[1].count;
     st["recovery_stats"] = json11::Json::object {
@@ -244,11 +261,51 @@ json11::Json osd_t::get_statistics()
             { "iops", n1 / ts_diff },
         } },
     };
+    st["latency"] = get_latency_stats();
     prev_report_stats = msgr.stats;
     memcpy(recovery_report_prev, recovery_stat, sizeof(recovery_stat));
     return st;
 }
 
+static const char* bs_op_names[] = {
+    "", "read", "write", "write_stable", "sync", "stable", "delete", "list", "rollback", "sync_stab_all",
+};
+
+// Latency histograms collected since the previous report. Histograms are reset after
+// reporting, so they describe the same time window as "lat", "bps" and "iops" values
+json11::Json osd_t::get_latency_stats()
+{
+    json11::Json::object op_hist, subop_hist, bs_hist;
+    for (int i = OSD_OP_MIN; i <= OSD_OP_MAX; i++)
+    {
+        if (latency_hists.op[i].count)
+            op_hist[osd_op_names[i]] = latency_hists.op[i].to_json();
+        if (latency_hists.subop[i].count)
+            subop_hist[osd_op_names[i]] = latency_hists.subop[i].to_json();
+        latency_hists.op[i].reset();
+        latency_hists.subop[i].reset();
+    }
+    if (bs)
+    {
+        auto & bs_lat = bs->get_latency_stats();
+        for (int i = BS_OP_MIN; i <= BS_OP_MAX; i++)
+        {
+            if (bs_lat.queue[i].count)
+                bs_hist[std::string("queue_")+bs_op_names[i]] = bs_lat.queue[i].to_json();
+        }
+        if (bs_lat.journal.count)
+            bs_hist["journal"] = bs_lat.journal.to_json();
+        if (bs_lat.sync.count)
+            bs_hist["sync"] = bs_lat.sync.to_json();
+        bs_lat.reset();
+    }
+    return json11::Json::object {
+        { "op", op_hist },
+        { "subop", subop_hist },
+        { "blockstore", bs_hist },
+    };
+}
+
 void osd_t::report_statistics()
 {
     if (etcd_reporting_stats)
@@ -327,6 +384,10 @@ void osd_t::report_statistics()
                 { "usec", kv.second.op_sum[INODE_STATS_DELETE] },
                 { "bytes", kv.second.op_bytes[INODE_STATS_DELETE] },
             } },
+            { "qos", json11::Json::object {
+                { "count", kv.second.qos_count },
+                { "usec", kv.second.qos_usec },
+            } },
         };
         st_it++;
     }
@@ -416,6 +477,11 @@ void osd_t::on_change_etcd_state_hook(std::map<std::string, etcd_kv_t> & changes
     {
         apply_no_inode_stats();
     }
+    if (qos_waiting_inodes.size() || qos_waiting_pools.size())
+    {
+        // Limits may have been changed or removed
+        run_qos_queues();
+    }
     if (run_primary)
     {
         bool pgs = changes.find(st_cli.etcd_prefix+"/config/pgs") != changes.end();
@@ -0,0 +1,324 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+#include <galois.h>
+#ifdef WITH_ISAL
+#include <isa-l/erasure_code.h>
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EC_X86 1
+#endif
+
+// Reed-Solomon encoding kernels over GF(2^8) with the polynomial 0x11d
+// (the same field as jerasure with w=8 and ISA-L use, so all kernels
+// produce identical chunks).
+//
+// Encoding and decoding are both a multiplication of <k> source buffers by
+// a <rows> x <k> coefficient matrix. The matrix is first expanded with
+// ec_make_tables() into 32-byte tables per coefficient (products of the
+// coefficient and all low nibbles, then all high nibbles - the same layout
+// as ISA-L ec_init_tables() produces). Kernels don't have any alignment
+// requirements for source and destination buffers.
+//
+// ec_encode() picks the fastest implementation supported by the CPU at runtime,
+// other functions are exposed for tests and benchmarks.
+
+typedef void (*ec_encode_fn_t)(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst);
+
+struct ec_kernel_t
+{
+    const char *name;
+    ec_encode_fn_t encode;
+};
+
+struct gf256_tables_t
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    gf256_tables_t()
+    {
+        int x = 1;
+        for (int i = 0; i < 255; i++)
+        {
+            exp[i] = exp[i+255] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100)
+                x ^= 0x11d;
+        }
+        exp[510] = exp[511] = 0;
+        log[0] = 0;
+    }
+};
+
+inline const gf256_tables_t & gf256()
+{
+    static const gf256_tables_t t;
+    return t;
+}
+
+inline uint8_t gf256_mul(uint8_t a, uint8_t b)
+{
+    if (!a || !b)
+        return 0;
+    auto & t = gf256();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+inline uint8_t gf256_inv(uint8_t a)
+{
+    auto & t = gf256();
+    return t.exp[255 - t.log[a]];
+}
+
+// Expand <rows> x <k> coefficient matrix into 32*k*rows bytes of tables
+inline void ec_make_tables(int k, int rows, const uint8_t *matrix, uint8_t *tables)
+{
+    for (int i = 0; i < k*rows; i++)
+    {
+        for (int j = 0; j < 16; j++)
+        {
+            tables[32*i + j] = gf256_mul(matrix[i], j);
+            tables[32*i + 16 + j] = gf256_mul(matrix[i], j << 4);
+        }
+    }
+}
+
+// Invert <n> x <n> matrix <in> into <out>, <in> is destroyed. Returns false if it's singular
+inline bool ec_invert_matrix(uint8_t *in, uint8_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+            out[i*n + j] = (i == j);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (!in[i*n + i])
+        {
+            // Find a row with non-zero i-th element and swap
+            int j = i+1;
+            while (j < n && !in[j*n + i])
+                j++;
+            if (j >= n)
+                return false;
+            for (int c = 0; c < n; c++)
+            {
+                uint8_t t = in[i*n + c];
+                in[i*n + c] = in[j*n + c];
+                in[j*n + c] = t;
+                t = out[i*n + c];
+                out[i*n + c] = out[j*n + c];
+                out[j*n + c] = t;
+            }
+        }
+        uint8_t inv = gf256_inv(in[i*n + i]);
+        for (int c = 0; c < n; c++)
+        {
+            in[i*n + c] = gf256_mul(in[i*n + c], inv);
+            out[i*n + c] = gf256_mul(out[i*n + c], inv);
+        }
+        for (int j = 0; j < n; j++)
+        {
+            uint8_t f = in[j*n + i];
+            if (j != i && f)
+            {
+                for (int c = 0; c < n; c++)
+                {
+                    in[j*n + c] ^= gf256_mul(f, in[i*n + c]);
+                    out[j*n + c] ^= gf256_mul(f, out[i*n + c]);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// dst (^)= src * coefficient of <table>
+inline void ec_mul_generic(const uint8_t *table, const uint8_t *src, uint8_t *dst, int len, bool add)
+{
+    uint8_t full[256];
+    for (int x = 0; x < 256; x++)
+        full[x] = table[x & 0x0f] ^ table[16 + (x >> 4)];
+    if (add)
+    {
+        for (int i = 0; i < len; i++)
+            dst[i] ^= full[src[i]];
+    }
+    else
+    {
+        for (int i = 0; i < len; i++)
+            dst[i] = full[src[i]];
+    }
+}
+
+// Portable table-driven implementation
+inline void ec_encode_generic(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        for (int j = 0; j < k; j++)
+        {
+            ec_mul_generic(tables + 32*(r*k + j), src[j], dst[r], len, j > 0);
+        }
+    }
+}
+
+// jerasure (gf-complete) region multiplication. gf-complete SIMD code requires
+// source and destination to have the same alignment, so other buffer pairs are
+// multiplied with the portable code instead of copying them into aligned buffers
+inline void ec_encode_jerasure(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        for (int j = 0; j < k; j++)
+        {
+            const uint8_t *table = tables + 32*(r*k + j);
+            if ((((uintptr_t)src[j]) ^ ((uintptr_t)dst[r])) % 16)
+                ec_mul_generic(table, src[j], dst[r], len, j > 0);
+            else
+                // table[1] is the coefficient itself
+                galois_w08_region_multiply((char*)src[j], table[1], len, (char*)dst[r], j > 0);
+        }
+    }
+}
+
+#ifdef EC_X86
+
+// Split-nibble table lookup with PSHUFB, 32 bytes at a time
+__attribute__((target("avx2")))
+inline void ec_encode_avx2(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    int i = 0;
+    for (; i+32 <= len; i += 32)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            __m256i acc = _mm256_setzero_si256();
+            for (int j = 0; j < k; j++)
+            {
+                const uint8_t *table = tables + 32*(r*k + j);
+                __m256i lo_t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table));
+                __m256i hi_t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table+16)));
+                __m256i s = _mm256_loadu_si256((const __m256i*)(src[j]+i));
+                __m256i lo = _mm256_and_si256(s, mask);
+                __m256i hi = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+                acc = _mm256_xor_si256(acc, _mm256_shuffle_epi8(lo_t, lo));
+                acc = _mm256_xor_si256(acc, _mm256_shuffle_epi8(hi_t, hi));
+            }
+            _mm256_storeu_si256((__m256i*)(dst[r]+i), acc);
+        }
+    }
+    if (i < len)
+    {
+        uint8_t *src_tail[k], *dst_tail[rows];
+        for (int j = 0; j < k; j++)
+            src_tail[j] = src[j]+i;
+        for (int r = 0; r < rows; r++)
+            dst_tail[r] = dst[r]+i;
+        ec_encode_generic(len-i, k, rows, tables, src_tail, dst_tail);
+    }
+}
+
+// Multiplication by a constant is a linear transform over GF(2), so it's done
+// with one GF2P8AFFINEQB per 64 bytes. GF2P8MULB can't be used because it's
+// bound to the AES polynomial 0x11b
+__attribute__((target("avx512f,avx512bw,gfni,bmi2")))
+inline void ec_encode_gfni(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    // Affine matrix byte (7-i) is the bit row i: bit j of it is bit i of the product of the coefficient and (1 << j)
+    uint64_t affine[rows*k];
+    for (int c = 0; c < rows*k; c++)
+    {
+        const uint8_t *table = tables + 32*c;
+        uint64_t a = 0;
+        for (int in_bit = 0; in_bit < 8; in_bit++)
+        {
+            uint8_t prod = in_bit < 4 ? table[1 << in_bit] : table[16 + (1 << (in_bit-4))];
+            a |= _pdep_u64(prod, 0x0101010101010101ull << in_bit);
+        }
+        affine[c] = __builtin_bswap64(a);
+    }
+    int i = 0;
+    for (; i+64 <= len; i += 64)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            __m512i acc = _mm512_setzero_si512();
+            for (int j = 0; j < k; j++)
+            {
+                __m512i s = _mm512_loadu_si512((const void*)(src[j]+i));
+                acc = _mm512_xor_si512(acc, _mm512_gf2p8affine_epi64_epi8(s, _mm512_set1_epi64(affine[r*k + j]), 0));
+            }
+            _mm512_storeu_si512((void*)(dst[r]+i), acc);
+        }
+    }
+    if (i < len)
+    {
+        uint8_t *src_tail[k], *dst_tail[rows];
+        for (int j = 0; j < k; j++)
+            src_tail[j] = src[j]+i;
+        for (int r = 0; r < rows; r++)
+            dst_tail[r] = dst[r]+i;
+        ec_encode_avx2(len-i, k, rows, tables, src_tail, dst_tail);
+    }
+}
+
+#endif
+
+#ifdef WITH_ISAL
+// ISA-L has its own runtime dispatch, including AVX-512 and GFNI versions
+inline void ec_encode_isal(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    ::ec_encode_data(len, k, rows, (uint8_t*)tables, src, dst);
+}
+#endif
+
+// Returns all kernels supported by the current CPU, the best one is the last one
+inline int ec_list_kernels(ec_kernel_t *list)
+{
+    int n = 0;
+    list[n++] = (ec_kernel_t){ "generic", ec_encode_generic };
+    list[n++] = (ec_kernel_t){ "jerasure", ec_encode_jerasure };
+#ifdef EC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        list[n++] = (ec_kernel_t){ "avx2", ec_encode_avx2 };
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("gfni") && __builtin_cpu_supports("bmi2"))
+        list[n++] = (ec_kernel_t){ "gfni", ec_encode_gfni };
+#endif
+#ifdef WITH_ISAL
+    list[n++] = (ec_kernel_t){ "isal", ec_encode_isal };
+#endif
+    return n;
+}
+
+#define EC_MAX_KERNELS 5
+
+inline const ec_kernel_t & ec_best_kernel()
+{
+    static const ec_kernel_t best = []()
+    {
+        ec_kernel_t list[EC_MAX_KERNELS];
+        int n = ec_list_kernels(list);
+        return list[n-1];
+    }();
+    return best;
+}
+
+inline void ec_encode(int len, int k, int rows, const uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    ec_best_kernel().encode(len, k, rows, tables, src, dst);
+}
@@ -236,53 +236,189 @@ bool osd_t::submit_flush_op(pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t
     return true;
 }
 
-bool osd_t::pick_next_recovery(osd_recovery_op_t &op)
+static bool operator < (const recovery_candidate_t & a, const recovery_candidate_t & b)
+{
+    // ORDER BY margin ASC, degraded DESC, load ASC, pg_order ASC, pg_id ASC
+    return a.margin < b.margin || a.margin == b.margin && (
+        a.degraded > b.degraded || a.degraded == b.degraded && (
+            a.load < b.load || a.load == b.load && (
+                a.pg_order < b.pg_order || a.pg_order == b.pg_order && a.pg_id < b.pg_id
+            )
+        )
+    );
+}
+
+// Find an object in <state> which isn't being recovered yet, starting from <it> and until <stop>
+bool osd_t::find_recovery_object(pg_obj_state_map_t & src, pg_obj_state_map_t::iterator it, object_id *stop,
+    pg_osd_set_state_t *state, object_id & oid)
 {
-    if (!pgs.size())
+    while (it != src.end() && (!stop || it->first < *stop))
     {
-        return false;
+        if (it->second != state)
+        {
+            it.next_range();
+        }
+        else if (recovery_ops.find(it->first) != recovery_ops.end())
+        {
+            it++;
+        }
+        else
+        {
+            oid = it->first;
+            return true;
+        }
     }
-    // Restart scanning from the same degraded/misplaced status as the last time
-    for (int tried_degraded = 0; tried_degraded < 2; tried_degraded++)
+    return false;
+}
+
+// Collect PG object states which may be recovered. Only done after PG state changes,
+// picks just resort the list when recovery operation counts on target OSDs change
+void osd_t::build_recovery_candidates()
+{
+    recovery_candidates.clear();
+    for (auto & pg_pair: pgs)
     {
-        if (recovery_last_degraded ? !no_recovery : !no_rebalance)
+        auto & pg = pg_pair.second;
+        bool recover_degraded = !no_recovery &&
+            (pg.state & (PG_ACTIVE | PG_HAS_DEGRADED)) == (PG_ACTIVE | PG_HAS_DEGRADED);
+        // Don't try to "recover" misplaced objects if "recovery" would make them degraded
+        bool recover_misplaced = !no_rebalance &&
+            (pg.state & (PG_ACTIVE | PG_DEGRADED | PG_HAS_MISPLACED)) == (PG_ACTIVE | PG_HAS_MISPLACED);
+        if (!recover_degraded && !recover_misplaced)
+        {
+            continue;
+        }
+        for (auto & st_pair: pg.state_dict)
         {
-            // Don't try to "recover" misplaced objects if "recovery" would make them degraded
-            auto mask = recovery_last_degraded ? (PG_ACTIVE | PG_HAS_DEGRADED) : (PG_ACTIVE | PG_DEGRADED | PG_HAS_MISPLACED);
-            auto check = recovery_last_degraded ? (PG_ACTIVE | PG_HAS_DEGRADED) : (PG_ACTIVE | PG_HAS_MISPLACED);
-            // Restart scanning from the same PG as the last time
-            for (auto pg_it = pgs.lower_bound(recovery_last_pg); pg_it != pgs.end(); pg_it++)
+            auto & st = st_pair.second;
+            // States without objects are kept because they may get objects again
+            if (st.state & (OBJ_INCONSISTENT | OBJ_INCOMPLETE))
+            {
+                continue;
+            }
+            bool degraded = (st.state & OBJ_DEGRADED);
+            if (degraded ? !recover_degraded : !recover_misplaced)
+            {
+                continue;
+            }
+            recovery_candidate_t c = {
+                .pg_id = pg_pair.first,
+                .pg = &pg,
+                .state = &st,
+                .degraded = degraded,
+            };
+            uint64_t has_roles = 0;
+            for (auto & loc: st.osd_set)
             {
-                if ((pg_it->second.state & mask) == check)
+                if (!(loc.loc_bad & (LOC_OUTDATED | LOC_CORRUPTED)) &&
+                    (pg.scheme == POOL_SCHEME_REPLICATED || !(has_roles & (1ul << loc.role))))
                 {
-                    auto & src = recovery_last_degraded ? pg_it->second.degraded_objects : pg_it->second.misplaced_objects;
-                    assert(src.size() > 0);
-                    // Restart scanning from the next object
-                    for (auto obj_it = src.upper_bound(recovery_last_oid); obj_it != src.end(); obj_it++)
+                    has_roles |= (1ul << loc.role);
+                    c.margin++;
+                }
+            }
+            c.margin -= pg.pg_data_size;
+            // Recovered data is written to current OSDs which don't have a good copy of the object
+            for (uint64_t role = 0; role < pg.cur_set.size(); role++)
+            {
+                osd_num_t target = pg.cur_set[role];
+                if (!target)
+                {
+                    continue;
+                }
+                bool has = false;
+                for (auto & loc: st.osd_set)
+                {
+                    if (loc.osd_num == target && !(loc.loc_bad & (LOC_OUTDATED | LOC_CORRUPTED)) &&
+                        (pg.scheme == POOL_SCHEME_REPLICATED || loc.role == role))
                     {
-                        if (recovery_ops.find(obj_it->first) == recovery_ops.end())
-                        {
-                            op.degraded = recovery_last_degraded;
-                            recovery_last_oid = op.oid = obj_it->first;
-                            recovery_pg_done++;
-                            // Switch to another PG after recovery_pg_switch operations
-                            // to always mix all PGs during recovery but still benefit
-                            // from recovery queue depth greater than 1
-                            if (recovery_pg_done >= recovery_pg_switch)
-                            {
-                                recovery_pg_done = 0;
-                                recovery_last_pg.pg_num++;
-                                recovery_last_oid = {};
-                            }
-                            return true;
-                        }
+                        has = true;
+                        break;
                     }
                 }
+                if (!has)
+                {
+                    c.targets.push_back(target);
+                }
             }
+            recovery_candidates.push_back(std::move(c));
+        }
+    }
+    recovery_candidates_dirty = false;
+    recovery_order_dirty = true;
+}
+
+void osd_t::sort_recovery_candidates()
+{
+    for (auto & c: recovery_candidates)
+    {
+        c.load = 0;
+        c.full = false;
+        for (auto target: c.targets)
+        {
+            auto load_it = recovery_target_ops.find(target);
+            int load = load_it != recovery_target_ops.end() ? load_it->second : 0;
+            if (recovery_osd_queue_depth > 0 && load >= recovery_osd_queue_depth)
+                c.full = true;
+            else if (c.load < load)
+                c.load = load;
+        }
+        c.pg_order = (recovery_last_pg < c.pg_id ||
+            recovery_last_pg == c.pg_id && recovery_pg_done < recovery_pg_switch) ? 0 : 1;
+    }
+    std::sort(recovery_candidates.begin(), recovery_candidates.end());
+    recovery_order_dirty = false;
+}
+
+// Pick the next object to recover by risk: objects with the fewest surviving copies first,
+// then degraded before misplaced, then those whose target OSDs are the least loaded.
+// OSDs already running recovery_osd_queue_depth recovery operations are skipped.
+bool osd_t::pick_next_recovery(osd_recovery_op_t &op)
+{
+    if (recovery_candidates_dirty)
+    {
+        build_recovery_candidates();
+    }
+    if (recovery_order_dirty)
+    {
+        sort_recovery_candidates();
+    }
+    for (auto & c: recovery_candidates)
+    {
+        if (c.full || !c.state->object_count)
+        {
+            continue;
+        }
+        auto & src = c.degraded ? c.pg->degraded_objects : c.pg->misplaced_objects;
+        // Continue from the last recovered object of the current PG and then wrap around
+        auto first = c.pg_id == recovery_last_pg ? src.upper_bound(recovery_last_oid) : src.begin();
+        object_id stop = first != src.end() ? first->first : (object_id){};
+        if (!find_recovery_object(src, first, NULL, c.state, op.oid) &&
+            (first == src.begin() || !find_recovery_object(src, src.begin(), first != src.end() ? &stop : NULL, c.state, op.oid)))
+        {
+            continue;
         }
-        recovery_last_degraded = !recovery_last_degraded;
-        recovery_last_pg = {};
-        recovery_last_oid = {};
+        op.degraded = c.degraded;
+        op.targets = c.targets;
+        if (recovery_last_pg != c.pg_id)
+        {
+            recovery_last_pg = c.pg_id;
+            recovery_pg_done = 0;
+            recovery_order_dirty = true;
+        }
+        recovery_last_oid = op.oid;
+        recovery_pg_done++;
+        // Switch to another PG after recovery_pg_switch operations
+        // to always mix all PGs during recovery but still benefit
+        // from recovery queue depth greater than 1
+        if (recovery_pg_done >= recovery_pg_switch)
+        {
+            recovery_pg_done = 0;
+            recovery_last_pg.pg_num++;
+            recovery_last_oid = {};
+            recovery_order_dirty = true;
+        }
+        return true;
     }
     return false;
 }
@@ -355,6 +491,13 @@ void osd_t::finish_recovery_op(osd_recovery_op_t *op)
     // CAREFUL! op = &recovery_ops[op->oid]. Don't access op->* after recovery_ops.erase()
     delete op->osd_op;
     op->osd_op = NULL;
+    for (auto target: op->targets)
+    {
+        auto load_it = recovery_target_ops.find(target);
+        if (load_it != recovery_target_ops.end() && !--load_it->second)
+            recovery_target_ops.erase(load_it);
+    }
+    recovery_order_dirty = true;
     recovery_ops.erase(op->oid);
     if (immediate_commit != IMMEDIATE_ALL)
     {
@@ -460,6 +603,11 @@ bool osd_t::continue_recovery()
         osd_recovery_op_t op;
         if (pick_next_recovery(op))
         {
+            for (auto target: op.targets)
+            {
+                recovery_target_ops[target]++;
+            }
+            recovery_order_dirty = true;
             recovery_ops[op.oid] = op;
             submit_recovery_op(&recovery_ops[op.oid]);
         }
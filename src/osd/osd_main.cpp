@@ -2,6 +2,7 @@
 // License: VNPL-1.1 (see README.md for details)
 
 #include "osd.h"
+#include "http_client.h"
 
 #include <signal.h>
 
@@ -27,6 +28,16 @@ static const char* help_text =
     "Manual usage: vitastor-osd [--option value] ...\n"
 ;
 
+// The main (socket) ring may use a kernel SQ polling thread
+static ring_loop_t *create_ringloop(json11::Json::object & config)
+{
+    unsigned flags = 0;
+    if (json_is_true(config["ring_sqpoll"]))
+        flags |= IORING_SETUP_SQPOLL;
+    int sq_cpu = config["ring_sqpoll_cpu"].string_value() != "" ? config["ring_sqpoll_cpu"].int64_value() : -1;
+    return new ring_loop_t(RINGLOOP_DEFAULT_SIZE, flags, sq_cpu, config["ring_sqpoll_idle"].uint64_value());
+}
+
 int main(int narg, char *args[])
 {
     setvbuf(stdout, NULL, _IONBF, 0);
@@ -58,7 +69,7 @@ int main(int narg, char *args[])
     }
     signal(SIGINT, handle_sigint);
     signal(SIGTERM, handle_sigint);
-    ring_loop_t *ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE);
+    ring_loop_t *ringloop = create_ringloop(config);
     osd = new osd_t(config, ringloop);
     while (1)
     {
@@ -0,0 +1,93 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "osd_peering_pg.h"
+
+static bool ver_id_less(const obj_ver_role & a, const obj_ver_role & b)
+{
+    return a.oid < b.oid || a.oid == b.oid && a.version < b.version;
+}
+
+// Generate listings like the ones returned by OSDs: a sorted stable part and a sorted
+// unstable part per OSD, merge them and compare the result with a plain std::sort
+static void test_random(int seed, bool ec)
+{
+    srand(seed);
+    std::vector<obj_ver_role> list;
+    std::vector<uint64_t> runs;
+    int osd_count = 1 + rand() % 4;
+    for (int osd_num = 1; osd_num <= osd_count; osd_num++)
+    {
+        for (int part = 0; part < 2; part++)
+        {
+            std::vector<obj_ver_role> run;
+            int n = rand() % 200;
+            for (int i = 0; i < n; i++)
+            {
+                run.push_back((obj_ver_role){
+                    .oid = {
+                        .inode = 1 + (uint64_t)rand() % 3,
+                        .stripe = ((uint64_t)(rand() % 32) << 17) | (ec ? (uint64_t)(osd_num-1) : 0),
+                    },
+                    .version = 1 + (uint64_t)rand() % 4,
+                    .osd_num = (uint64_t)osd_num,
+                    .is_stable = part == 0,
+                });
+            }
+            std::sort(run.begin(), run.end(), ver_id_less);
+            if (run.size())
+            {
+                runs.push_back(list.size());
+                list.insert(list.end(), run.begin(), run.end());
+            }
+        }
+    }
+    std::vector<obj_ver_role> ref = list;
+    std::sort(ref.begin(), ref.end());
+    if (!runs.size())
+    {
+        runs.push_back(0);
+    }
+    merge_object_lists(list, runs);
+    assert(list.size() == ref.size());
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        // Order of fully equal entries doesn't matter
+        assert(!(list[i] < ref[i]) && !(ref[i] < list[i]));
+        if (i > 0)
+            assert(!(list[i] < list[i-1]));
+    }
+}
+
+// Versions of the same object are reordered inside a run: higher versions go first
+static void test_versions()
+{
+    std::vector<obj_ver_role> list = {
+        { .oid = { .inode = 1, .stripe = 0 }, .version = 1, .osd_num = 1, .is_stable = true },
+        { .oid = { .inode = 1, .stripe = 0 }, .version = 2, .osd_num = 1, .is_stable = true },
+        { .oid = { .inode = 1, .stripe = 1 << 17 }, .version = 1, .osd_num = 1, .is_stable = true },
+        { .oid = { .inode = 1, .stripe = 0 }, .version = 3, .osd_num = 2, .is_stable = false },
+    };
+    std::vector<uint64_t> runs = { 0, 3 };
+    merge_object_lists(list, runs);
+    assert(list.size() == 4);
+    assert(list[0].version == 3 && list[0].osd_num == 2);
+    assert(list[1].version == 2 && list[1].osd_num == 1);
+    assert(list[2].version == 1 && list[2].oid.stripe == 0);
+    assert(list[3].oid.stripe == 1 << 17);
+}
+
+int main(int narg, char *args[])
+{
+    test_versions();
+    for (int i = 0; i < 500; i++)
+    {
+        test_random(i, i % 2);
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -21,29 +21,16 @@ void osd_t::handle_peers()
         {
             if (p.second.state == PG_PEERING)
             {
-                if (!p.second.peering_state->list_ops.size())
+                if (!p.second.peering_state->list_ops.size() && !p.second.peering_state->calc_id)
                 {
-                    p.second.calc_object_states(log_level);
-                    report_pg_state(p.second);
-                    schedule_scrub(p.second);
-                    incomplete_objects += p.second.incomplete_objects.size();
-                    misplaced_objects += p.second.misplaced_objects.size();
-                    // FIXME: degraded objects may currently include misplaced, too! Report them separately?
-                    degraded_objects += p.second.degraded_objects.size();
-                    if (p.second.state & PG_HAS_UNCLEAN)
-                        peering_state = peering_state | OSD_FLUSHING_PGS;
-                    else if (p.second.state & (PG_HAS_DEGRADED | PG_HAS_MISPLACED))
+                    if (peering_pool)
                     {
-                        peering_state = peering_state | OSD_RECOVERING;
-                        if (p.second.state & PG_HAS_DEGRADED)
-                        {
-                            // Restart recovery from degraded objects
-                            recovery_last_degraded = true;
-                            recovery_last_pg = {};
-                            recovery_last_oid = {};
-                        }
+                        calc_pg_object_states(p.second);
+                        still = true;
+                        continue;
                     }
-                    ringloop->wakeup();
+                    p.second.calc_object_states(log_level);
+                    finish_pg_peering(p.second);
                     return;
                 }
                 else
@@ -165,7 +152,11 @@ void osd_t::reset_pg(pg_t & pg)
         else
             it++;
     }
-    dirty_pgs.erase({ .pool_id = pg.pool_id, .pg_num = pg.pg_num });
+    if (dirty_pgs.erase({ .pool_id = pg.pool_id, .pg_num = pg.pg_num }))
+    {
+        // Writes of this PG won't be synced before the next write, so the change log can't be restarted
+        pg.change_log.unsynced = true;
+    }
 }
 
 // Drop connections of clients who have this PG in dirty_pgs
@@ -188,6 +179,76 @@ void osd_t::drop_dirty_pg_connections(pool_pg_num_t pg)
     }
 }
 
+// Calculate object states in a worker thread so that the event loop isn't blocked by large PGs
+void osd_t::calc_pg_object_states(pg_t & pg)
+{
+    auto ps = pg.peering_state;
+    ps->calc_id = ++peering_calc_id;
+    // The copy only gets parameters used by calc_object_states() and the object lists
+    pg_t *calc = new pg_t;
+    calc->state = pg.state;
+    calc->scheme = pg.scheme;
+    calc->pg_cursize = pg.pg_cursize;
+    calc->pg_size = pg.pg_size;
+    calc->pg_minsize = pg.pg_minsize;
+    calc->pg_data_size = pg.pg_data_size;
+    calc->pool_id = pg.pool_id;
+    calc->pg_num = pg.pg_num;
+    calc->all_peers = pg.all_peers;
+    calc->cur_peers = pg.cur_peers;
+    calc->target_set = pg.target_set;
+    calc->cur_set = pg.cur_set;
+    calc->peering_state = new pg_peering_state_t();
+    calc->peering_state->base_count = ps->base_count;
+    calc->peering_state->base_epoch = ps->base_epoch;
+    calc->peering_state->list_results.swap(ps->list_results);
+    pool_pg_num_t pg_id = { .pool_id = pg.pool_id, .pg_num = pg.pg_num };
+    uint64_t calc_id = ps->calc_id;
+    int calc_log_level = log_level;
+    peering_pool->submit([calc, calc_log_level]()
+    {
+        calc->calc_object_states(calc_log_level);
+    }, [this, calc, pg_id, calc_id]()
+    {
+        auto pg_it = pgs.find(pg_id);
+        // Results are dropped if the PG was restarted or stopped during calculation
+        if (pg_it != pgs.end() && pg_it->second.state == PG_PEERING && pg_it->second.peering_state &&
+            pg_it->second.peering_state->calc_id == calc_id)
+        {
+            pg_it->second.peering_state->calc_id = 0;
+            pg_it->second.apply_object_states(*calc);
+            finish_pg_peering(pg_it->second);
+        }
+        delete calc->peering_state;
+        delete calc;
+    }, [calc]()
+    {
+        // Object lists are only freed by calc_object_states()
+        for (auto & lr: calc->peering_state->list_results)
+        {
+            if (lr.second.buf)
+                free(lr.second.buf);
+        }
+        delete calc->peering_state;
+        delete calc;
+    });
+}
+
+void osd_t::finish_pg_peering(pg_t & pg)
+{
+    report_pg_state(pg);
+    schedule_scrub(pg);
+    incomplete_objects += pg.incomplete_objects.size();
+    misplaced_objects += pg.misplaced_objects.size();
+    // FIXME: degraded objects may currently include misplaced, too! Report them separately?
+    degraded_objects += pg.degraded_objects.size();
+    if (pg.state & PG_HAS_UNCLEAN)
+        peering_state = peering_state | OSD_FLUSHING_PGS;
+    else if (pg.state & (PG_HAS_DEGRADED | PG_HAS_MISPLACED))
+        peering_state = peering_state | OSD_RECOVERING;
+    ringloop->wakeup();
+}
+
 // Repeer on each connect/disconnect peer event
 void osd_t::start_pg_peering(pg_t & pg)
 {
@@ -272,10 +333,14 @@ void osd_t::start_pg_peering(pg_t & pg)
     pg.cur_peers.insert(pg.cur_peers.begin(), cur_peers.begin(), cur_peers.end());
     if (pg.peering_state)
     {
+        // Drop results of object state calculation if it's still running
+        pg.peering_state->calc_id = 0;
+        // Restart listing from scratch if the change log isn't sufficient anymore
+        bool relist = pg.peering_state->incremental && !can_peer_incrementally(pg);
         // Adjust the peering operation that's still in progress - discard unneeded results
         for (auto it = pg.peering_state->list_ops.begin(); it != pg.peering_state->list_ops.end();)
         {
-            if (pg.state == PG_INCOMPLETE || cur_peers.find(it->first) == cur_peers.end())
+            if (pg.state == PG_INCOMPLETE || relist || cur_peers.find(it->first) == cur_peers.end())
             {
                 // Discard the result after completion, which, chances are, will be unsuccessful
                 discard_list_subop(it->second);
@@ -286,7 +351,7 @@ void osd_t::start_pg_peering(pg_t & pg)
         }
         for (auto it = pg.peering_state->list_results.begin(); it != pg.peering_state->list_results.end();)
         {
-            if (pg.state == PG_INCOMPLETE || cur_peers.find(it->first) == cur_peers.end())
+            if (pg.state == PG_INCOMPLETE || relist || cur_peers.find(it->first) == cur_peers.end())
             {
                 if (it->second.buf)
                 {
@@ -313,18 +378,166 @@ void osd_t::start_pg_peering(pg_t & pg)
         pg.peering_state->pool_id = pg.pool_id;
         pg.peering_state->pg_num = pg.pg_num;
     }
+    auto ps = pg.peering_state;
+    if (!ps->list_ops.size() && !ps->list_results.size())
+    {
+        // Only list changed objects if the PG change log covers everything since the last clean state
+        ps->incremental = can_peer_incrementally(pg);
+        ps->base_count = ps->base_epoch = 0;
+        ps->changed_objects.clear();
+        if (ps->incremental)
+        {
+            pg.list_changed_objects();
+            printf(
+                "[PG %u/%u] Peering incrementally, %zu objects changed since the last clean state\n",
+                pg.pool_id, pg.pg_num, ps->changed_objects.size()
+            );
+        }
+    }
     for (osd_num_t peer_osd: cur_peers)
     {
-        if (pg.peering_state->list_ops.find(peer_osd) != pg.peering_state->list_ops.end() ||
-            pg.peering_state->list_results.find(peer_osd) != pg.peering_state->list_results.end())
+        if (ps->list_ops.find(peer_osd) != ps->list_ops.end() ||
+            ps->list_results.find(peer_osd) != ps->list_results.end())
         {
             continue;
         }
-        submit_list_subop(peer_osd, pg.peering_state);
+        if (ps->incremental)
+            submit_changed_list_subop(peer_osd, ps);
+        else
+            submit_list_subop(peer_osd, ps);
     }
     ringloop->wakeup();
 }
 
+bool osd_t::can_peer_incrementally(pg_t & pg)
+{
+    return peering_log_size && pg.can_peer_incrementally();
+}
+
+// Build a listing of changed objects from their {version, stable_version} pairs.
+// Like in full listings, stable versions go first and unstable versions follow them
+static pg_list_result_t make_changed_list(const std::vector<obj_ver_id> & objects, const uint64_t *vers)
+{
+    uint64_t n = objects.size();
+    obj_ver_id *buf = (obj_ver_id*)malloc_or_die(sizeof(obj_ver_id) * (n ? 2*n : 1));
+    uint64_t stable_count = 0, total_count = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (vers[2*i+1])
+            buf[stable_count++] = { .oid = objects[i].oid, .version = vers[2*i+1] };
+    }
+    total_count = stable_count;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (vers[2*i] > vers[2*i+1])
+            buf[total_count++] = { .oid = objects[i].oid, .version = vers[2*i] };
+    }
+    return (pg_list_result_t){
+        .buf = buf,
+        .total_count = total_count,
+        .stable_count = stable_count,
+    };
+}
+
+// Get current versions of objects from the change log, it's the same as a listing of just these objects
+void osd_t::submit_changed_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
+{
+    uint64_t n = ps->changed_objects.size();
+    if (role_osd == this->osd_num || !n)
+    {
+        // Read versions synchronously from the local metadata
+        std::vector<uint64_t> vers(2*n);
+        for (uint64_t i = 0; role_osd == this->osd_num && i < n; i++)
+        {
+            bs->read_bitmap(ps->changed_objects[i].oid, UINT64_MAX, NULL, &vers[2*i]);
+            vers[2*i+1] = bs->read_stable_version(ps->changed_objects[i].oid);
+        }
+        auto & res = ps->list_results[role_osd];
+        res = make_changed_list(ps->changed_objects, vers.data());
+        printf(
+            "[PG %u/%u] Got %ju of %ju changed objects (%ju unstable) from OSD %ju%s\n",
+            ps->pool_id, ps->pg_num, res.total_count, n, res.total_count-res.stable_count,
+            role_osd, role_osd == this->osd_num ? " (local)" : ""
+        );
+        return;
+    }
+    osd_op_t *op = new osd_op_t();
+    op->op_type = OSD_OP_OUT;
+    op->peer_fd = msgr.osd_peer_fds.at(role_osd);
+    op->buf = malloc_or_die(sizeof(obj_ver_id) * n);
+    memcpy(op->buf, ps->changed_objects.data(), sizeof(obj_ver_id) * n);
+    op->req = (osd_any_op_t){
+        .sec_read_bmp = {
+            .header = {
+                .magic = SECONDARY_OSD_OP_MAGIC,
+                .id = msgr.next_subop_id++,
+                .opcode = OSD_OP_SEC_READ_BMP,
+            },
+            .len = sizeof(obj_ver_id) * n,
+            .flags = OSD_SEC_READ_BMP_STABLE,
+        },
+    };
+    op->callback = [this, ps, role_osd](osd_op_t *op)
+    {
+        uint64_t n = op->req.sec_read_bmp.len / sizeof(obj_ver_id);
+        if (op->reply.hdr.retval != n * (16 + clean_entry_bitmap_size))
+        {
+            if (op->reply.hdr.retval == n * (8 + clean_entry_bitmap_size))
+            {
+                // The peer doesn't report stable versions, list everything on the next peering
+                printf("OSD %ju doesn't report stable object versions, disabling incremental peering of PG %u/%u\n", role_osd, ps->pool_id, ps->pg_num);
+                auto pg_it = pgs.find({ .pool_id = ps->pool_id, .pg_num = ps->pg_num });
+                if (pg_it != pgs.end())
+                {
+                    pg_it->second.change_log.valid = false;
+                    pg_it->second.change_log.objects.clear();
+                }
+            }
+            else
+                printf("Failed to get changed object versions from OSD %ju (retval=%jd), disconnecting peer\n", role_osd, op->reply.hdr.retval);
+            int fail_fd = op->peer_fd;
+            ps->list_ops.erase(role_osd);
+            delete op;
+            msgr.stop_client(fail_fd);
+            return;
+        }
+        // Reply is {version, stable_version, bitmap}[], versions are 0 for missing objects
+        std::vector<uint64_t> vers(2*n);
+        for (uint64_t i = 0; i < n; i++)
+        {
+            memcpy(&vers[2*i], (uint8_t*)op->buf + i*(16 + clean_entry_bitmap_size), 16);
+        }
+        auto & res = ps->list_results[role_osd];
+        res = make_changed_list(ps->changed_objects, vers.data());
+        printf(
+            "[PG %u/%u] Got %ju of %ju changed objects (%ju unstable) from OSD %ju\n",
+            ps->pool_id, ps->pg_num, res.total_count, n, res.total_count-res.stable_count, role_osd
+        );
+        ps->list_ops.erase(role_osd);
+        delete op;
+    };
+    ps->list_ops[role_osd] = op;
+    msgr.outbox_push(op);
+}
+
+// Remember a change of an object for the next peering
+void osd_t::log_pg_change(pg_t & pg, object_id oid, bool existed)
+{
+    pg.change_log.log_change(oid, existed, peering_log_size);
+}
+
+// Restart the change log when all objects are clean and all writes are synced
+void osd_t::trim_pg_change_log(pg_t & pg)
+{
+    if (!peering_log_size || pg.scheme != POOL_SCHEME_REPLICATED || pg.state != PG_ACTIVE ||
+        pg.inflight > 0 || pg.change_log.unsynced ||
+        dirty_pgs.find({ .pool_id = pg.pool_id, .pg_num = pg.pg_num }) != dirty_pgs.end())
+    {
+        return;
+    }
+    pg.change_log.restart(pg.target_set, pg.total_count, pg.epoch);
+}
+
 void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
 {
     if (role_osd == this->osd_num)
@@ -487,12 +700,15 @@ void osd_t::finish_stop_pg(pg_t & pg)
 {
     pg.state = PG_OFFLINE;
     reset_pg(pg);
+    // PG may be started on another primary OSD, forget the change log
+    pg.change_log = pg_change_log_t();
     report_pg_state(pg);
 }
 
 void osd_t::report_pg_state(pg_t & pg)
 {
     pg.print_state();
+    recovery_candidates_dirty = true;
     this->pg_state_dirty.insert({ .pool_id = pg.pool_id, .pg_num = pg.pg_num });
     if (pg.state & PG_ACTIVE)
     {
@@ -553,6 +769,7 @@ void osd_t::report_pg_state(pg_t & pg)
         pg_cfg.target_history = pg.target_history;
         pg_cfg.all_peers = pg.all_peers;
     }
+    trim_pg_change_log(pg);
     if (pg.state == PG_OFFLINE && !this->pg_config_applied)
     {
         apply_pg_config();
@@ -4,29 +4,6 @@
 #include <unordered_map>
 #include "osd_peering_pg.h"
 
-struct obj_ver_role
-{
-    object_id oid;
-    uint64_t version;
-    uint64_t osd_num;
-    bool is_stable;
-};
-
-inline bool operator < (const obj_ver_role & a, const obj_ver_role & b)
-{
-    // ORDER BY inode ASC, stripe & ~STRIPE_MASK ASC, version DESC, role ASC, osd_num ASC
-    return a.oid.inode < b.oid.inode || a.oid.inode == b.oid.inode && (
-        (a.oid.stripe & ~STRIPE_MASK) < (b.oid.stripe & ~STRIPE_MASK) ||
-        (a.oid.stripe & ~STRIPE_MASK) == (b.oid.stripe & ~STRIPE_MASK) && (
-            a.version > b.version ||
-            a.version == b.version && (
-                a.oid.stripe < b.oid.stripe ||
-                a.oid.stripe == b.oid.stripe && a.osd_num < b.osd_num
-            )
-        )
-    );
-}
-
 struct obj_piece_ver_t
 {
     uint64_t max_ver = 0;
@@ -48,6 +25,7 @@ struct pg_obj_state_check_t
     uint64_t n_copies = 0, has_roles = 0, n_roles = 0, n_stable = 0, n_mismatched = 0;
     uint64_t n_unstable = 0, n_invalid = 0;
     pg_osd_set_t osd_set;
+    uint64_t base_count = 0;
     int log_level;
 
     void walk();
@@ -58,8 +36,9 @@ struct pg_obj_state_check_t
 
 void pg_obj_state_check_t::walk()
 {
-    pg->clean_count = 0;
-    pg->total_count = 0;
+    // Objects not included into an incremental listing are clean
+    pg->clean_count = base_count;
+    pg->total_count = base_count;
     pg->state = 0;
     for (list_pos = 0; list_pos < list.size(); list_pos++)
     {
@@ -376,24 +355,66 @@ pg_osd_set_state_t* pg_t::add_object_to_state(const object_id oid, const uint64_
     }
     if (state & OBJ_INCONSISTENT)
     {
-        inconsistent_objects[oid] = &it->second;
+        inconsistent_objects.set(oid, &it->second);
     }
     else if (state & OBJ_INCOMPLETE)
     {
-        incomplete_objects[oid] = &it->second;
+        incomplete_objects.set(oid, &it->second);
     }
     else if (state & OBJ_DEGRADED)
     {
-        degraded_objects[oid] = &it->second;
+        degraded_objects.set(oid, &it->second);
     }
     else
     {
-        misplaced_objects[oid] = &it->second;
+        misplaced_objects.set(oid, &it->second);
     }
     return &it->second;
 }
 
-// FIXME: Write at least some tests for this function
+// Sort the combined listing in walk() order. Each OSD returns a few runs sorted
+// by obj_ver_id (clean, dirty stable and unstable objects), and they only differ
+// from walk() order by versions of the same object, so runs are fixed up in place
+// and then merged instead of sorting everything.
+void merge_object_lists(std::vector<obj_ver_role> & list, std::vector<uint64_t> & runs)
+{
+    runs.push_back(list.size());
+    for (int r = 0; r < runs.size()-1; r++)
+    {
+        for (uint64_t i = runs[r], j; i < runs[r+1]; i = j)
+        {
+            for (j = i+1; j < runs[r+1] && list[j].oid.inode == list[i].oid.inode &&
+                (list[j].oid.stripe & ~STRIPE_MASK) == (list[i].oid.stripe & ~STRIPE_MASK); j++) {}
+            if (j > i+1)
+            {
+                std::sort(list.begin()+i, list.begin()+j);
+            }
+        }
+    }
+    // Bottom-up merge of adjacent runs
+    std::vector<obj_ver_role> tmp;
+    while (runs.size() > 2)
+    {
+        tmp.resize(list.size());
+        int n = 0;
+        for (int r = 0; r < runs.size()-1; r += 2)
+        {
+            if (r+2 < runs.size())
+            {
+                std::merge(list.begin()+runs[r], list.begin()+runs[r+1], list.begin()+runs[r+1], list.begin()+runs[r+2], tmp.begin()+runs[r]);
+            }
+            else
+            {
+                std::copy(list.begin()+runs[r], list.begin()+runs[r+1], tmp.begin()+runs[r]);
+            }
+            runs[n++] = runs[r];
+        }
+        runs[n++] = list.size();
+        runs.resize(n);
+        list.swap(tmp);
+    }
+}
+
 void pg_t::calc_object_states(int log_level)
 {
     // Copy all object lists into one array
@@ -402,14 +423,22 @@ void pg_t::calc_object_states(int log_level)
     st.pg = this;
     st.replicated = (this->scheme == POOL_SCHEME_REPLICATED);
     auto ps = peering_state;
-    epoch = 0;
+    st.base_count = ps->base_count;
+    epoch = ps->base_epoch;
+    uint64_t total = 0;
+    for (auto & it: ps->list_results)
+    {
+        total += it.second.total_count;
+    }
+    st.list.resize(total);
+    std::vector<uint64_t> runs;
+    total = 0;
     for (auto it: ps->list_results)
     {
         auto nstab = it.second.stable_count;
         auto n = it.second.total_count;
         auto osd_num = it.first;
-        uint64_t start = st.list.size();
-        st.list.resize(start + n);
+        uint64_t start = total;
         obj_ver_id *ov = it.second.buf;
         for (uint64_t i = 0; i < n; i++, ov++)
         {
@@ -417,6 +446,10 @@ void pg_t::calc_object_states(int log_level)
             {
                 epoch = (ov->version >> (64-PG_EPOCH_BITS));
             }
+            if (i == 0 || i == nstab || *ov < *(ov-1))
+            {
+                runs.push_back(start+i);
+            }
             st.list[start+i] = {
                 .oid = ov->oid,
                 .version = ov->version,
@@ -424,12 +457,13 @@ void pg_t::calc_object_states(int log_level)
                 .is_stable = i < nstab,
             };
         }
+        total += n;
         free(it.second.buf);
         it.second.buf = NULL;
     }
     ps->list_results.clear();
     // Sort
-    std::sort(st.list.begin(), st.list.end());
+    merge_object_lists(st.list, runs);
     // Walk over it and check object states
     st.walk();
     if (this->state != PG_ACTIVE)
@@ -465,6 +499,89 @@ void pg_t::calc_object_states(int log_level)
     }
 }
 
+// Take results of calc_object_states() run on a copy of this PG in another thread
+void pg_t::apply_object_states(pg_t & calc)
+{
+    state = calc.state;
+    epoch = calc.epoch;
+    clean_count = calc.clean_count;
+    total_count = calc.total_count;
+    // Moving std::map keeps its nodes, so object maps still point to correct state_dict entries
+    state_dict = std::move(calc.state_dict);
+    inconsistent_objects = std::move(calc.inconsistent_objects);
+    incomplete_objects = std::move(calc.incomplete_objects);
+    misplaced_objects = std::move(calc.misplaced_objects);
+    degraded_objects = std::move(calc.degraded_objects);
+    flush_actions = std::move(calc.flush_actions);
+    ver_override = std::move(calc.ver_override);
+}
+
+// Remember a change of an object for the next peering
+void pg_change_log_t::log_change(object_id oid, bool existed, uint64_t max_size)
+{
+    if (!valid || objects.find(oid) != objects.end())
+    {
+        return;
+    }
+    if (objects.size() >= max_size)
+    {
+        // Too many changes, the next peering will list all objects
+        valid = false;
+        objects.clear();
+        return;
+    }
+    objects[oid] = existed;
+}
+
+// Start a new log when <count> objects are clean on <set>
+void pg_change_log_t::restart(const std::vector<osd_num_t> & set, uint64_t count, uint64_t epoch)
+{
+    valid = true;
+    objects.clear();
+    base_set = set;
+    base_count = count;
+    base_epoch = epoch;
+}
+
+// Check if the change log covers everything changed since the last clean state
+bool pg_t::can_peer_incrementally()
+{
+    auto & log = change_log;
+    // Only for replicated pools, and not after unsynced writes, because their versions may be lost
+    if (!log.valid || log.unsynced || scheme != POOL_SCHEME_REPLICATED || log.base_set != target_set)
+    {
+        return false;
+    }
+    // Other OSDs may have any objects
+    for (auto peer_osd: all_peers)
+    {
+        if (std::find(log.base_set.begin(), log.base_set.end(), peer_osd) == log.base_set.end())
+        {
+            return false;
+        }
+    }
+    uint64_t base_changed = 0;
+    for (auto & lp: log.objects)
+    {
+        base_changed += lp.second ? 1 : 0;
+    }
+    return base_changed <= log.base_count;
+}
+
+// Only list objects from the change log, all other objects of the base state are clean
+void pg_t::list_changed_objects()
+{
+    auto ps = peering_state;
+    ps->base_count = change_log.base_count;
+    ps->base_epoch = change_log.base_epoch;
+    ps->changed_objects.clear();
+    for (auto & lp: change_log.objects)
+    {
+        ps->base_count -= lp.second ? 1 : 0;
+        ps->changed_objects.push_back((obj_ver_id){ .oid = lp.first, .version = UINT64_MAX });
+    }
+}
+
 void pg_t::print_state()
 {
     printf(
@@ -8,11 +8,35 @@
 #include "cpp-btree/btree_map.h"
 
 #include "object_id.h"
+#include "osd_state_map.h"
 #include "osd_ops.h"
 #include "pg_states.h"
 
 #define PG_EPOCH_BITS 48
 
+struct obj_ver_role
+{
+    object_id oid;
+    uint64_t version;
+    uint64_t osd_num;
+    bool is_stable;
+};
+
+inline bool operator < (const obj_ver_role & a, const obj_ver_role & b)
+{
+    // ORDER BY inode ASC, stripe & ~STRIPE_MASK ASC, version DESC, role ASC, osd_num ASC
+    return a.oid.inode < b.oid.inode || a.oid.inode == b.oid.inode && (
+        (a.oid.stripe & ~STRIPE_MASK) < (b.oid.stripe & ~STRIPE_MASK) ||
+        (a.oid.stripe & ~STRIPE_MASK) == (b.oid.stripe & ~STRIPE_MASK) && (
+            a.version > b.version ||
+            a.version == b.version && (
+                a.oid.stripe < b.oid.stripe ||
+                a.oid.stripe == b.oid.stripe && a.osd_num < b.osd_num
+            )
+        )
+    );
+}
+
 struct pg_obj_loc_t
 {
     uint64_t role;
@@ -49,6 +73,30 @@ struct pg_peering_state_t
     std::map<osd_num_t, pg_list_result_t> list_results;
     pool_id_t pool_id = 0;
     pg_num_t pg_num = 0;
+    // incremental peering: only objects from the change log are listed, all other objects are clean
+    bool incremental = false;
+    uint64_t base_count = 0, base_epoch = 0;
+    std::vector<obj_ver_id> changed_objects;
+    // non-zero while object states are calculated in a worker thread
+    uint64_t calc_id = 0;
+};
+
+// Objects changed since the PG was last active+clean with all writes synced.
+// All other objects are known to be clean on <base_set>, so the next peering
+// may only check versions of logged objects instead of listing all objects
+struct pg_change_log_t
+{
+    // false if the log overflowed or the PG wasn't clean since it was started
+    bool valid = false;
+    // true if the PG was reset with unsynced writes
+    bool unsynced = false;
+    std::vector<osd_num_t> base_set;
+    uint64_t base_count = 0, base_epoch = 0;
+    // object -> it existed in the base state
+    btree::btree_map<object_id, bool> objects;
+
+    void log_change(object_id oid, bool existed, uint64_t max_size);
+    void restart(const std::vector<osd_num_t> & set, uint64_t count, uint64_t epoch);
 };
 
 struct obj_piece_id_t
@@ -106,22 +154,28 @@ struct pg_t
     pg_osd_set_t cur_loc_set;
     // moved object map. by default, each object is considered to reside on cur_set.
     // this map stores all objects that differ.
-    // it may consume up to ~ (raw storage / object size) * 24 bytes in the worst case scenario
-    // which is up to ~192 MB per 1 TB in the worst case scenario
+    // object maps are run-length encoded, so objects of the PG which share the same state
+    // (for example, all objects degraded by one failed OSD) take one entry per range of
+    // consecutive stripes. the worst case (all objects in different states) is still up to
+    // ~ (raw storage / object size) * 40 bytes, but it's hardly reachable in practice
     std::map<pg_osd_set_t, pg_osd_set_state_t> state_dict;
     uint64_t corrupted_count;
-    btree::btree_map<object_id, pg_osd_set_state_t*> inconsistent_objects, incomplete_objects, misplaced_objects, degraded_objects;
+    pg_obj_state_map_t inconsistent_objects, incomplete_objects, misplaced_objects, degraded_objects;
     std::map<obj_piece_id_t, flush_action_t> flush_actions;
     std::vector<obj_ver_osd_t> copies_to_delete_after_sync;
     btree::btree_map<object_id, uint64_t> ver_override;
     pg_peering_state_t *peering_state = NULL;
     pg_flush_batch_t *flush_batch = NULL;
+    pg_change_log_t change_log;
 
     int inflight = 0; // including write_queue
     std::multimap<object_id, osd_op_t*> write_queue;
 
     pg_osd_set_state_t* add_object_to_state(const object_id oid, const uint64_t state, const pg_osd_set_t & osd_set);
     void calc_object_states(int log_level);
+    void apply_object_states(pg_t & calc);
+    bool can_peer_incrementally();
+    void list_changed_objects();
     void print_state();
 };
 
@@ -142,6 +196,9 @@ inline bool operator < (const obj_piece_id_t & a, const obj_piece_id_t & b)
     return a.oid < b.oid || a.oid == b.oid && a.osd_num < b.osd_num;
 }
 
+// Sort the combined listing of several OSDs, <runs> are start offsets of presorted runs
+void merge_object_lists(std::vector<obj_ver_role> & list, std::vector<uint64_t> & runs);
+
 namespace std
 {
     template<> struct hash<pg_osd_set_t>
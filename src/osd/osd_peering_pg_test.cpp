@@ -3,9 +3,12 @@
 
 #define _LARGEFILE64_SOURCE
 
+#include <assert.h>
+#include <string.h>
 #include "malloc_or_die.h"
 #include "osd_peering_pg.h"
 #define STRIPE_SHIFT 12
+#define OBJ_SHIFT 17
 
 /**
  * TODO tests for object & pg state calculation.
@@ -20,7 +23,7 @@
  *    v1=1s,2s,6s -> misplaced
  * 2) ...
  */
-int main(int argc, char *argv[])
+void test_big_listing()
 {
     pg_t pg = {
         .state = PG_PEERING,
@@ -55,5 +58,203 @@ int main(int argc, char *argv[])
         printf("dev: state=%jx\n", it.second.state);
     }
     delete pg.peering_state;
+}
+
+static pg_t make_pg()
+{
+    return (pg_t){
+        .state = PG_PEERING,
+        .scheme = POOL_SCHEME_REPLICATED,
+        .pg_cursize = 3,
+        .pg_size = 3,
+        .pg_minsize = 2,
+        .pg_data_size = 1,
+        .pool_id = 1,
+        .pg_num = 1,
+        .all_peers = { 1, 2, 3 },
+        .cur_peers = { 1, 2, 3 },
+        .target_set = { 1, 2, 3 },
+        .cur_set = { 1, 2, 3 },
+    };
+}
+
+static object_id test_oid(uint64_t i)
+{
+    return (object_id){ .inode = 1, .stripe = i << OBJ_SHIFT };
+}
+
+static void set_listing(pg_t & pg, osd_num_t osd_num, const std::vector<obj_ver_id> & objs)
+{
+    pg_list_result_t r = {
+        .buf = (obj_ver_id*)malloc_or_die(sizeof(obj_ver_id) * (objs.size() ? objs.size() : 1)),
+        .total_count = objs.size(),
+        .stable_count = objs.size(),
+    };
+    if (objs.size())
+        memcpy(r.buf, objs.data(), sizeof(obj_ver_id) * objs.size());
+    pg.peering_state->list_results[osd_num] = r;
+}
+
+static void finish_peering(pg_t & pg)
+{
+    for (auto & lr: pg.peering_state->list_results)
+        free(lr.second.buf);
+    delete pg.peering_state;
+    pg.peering_state = NULL;
+}
+
+// Objects 0..999 were clean with version 1. Then 10..14 were overwritten (14 isn't written to OSD 3),
+// 20 and 21 were deleted and 1000..1002 were created
+static uint64_t changed_version(osd_num_t osd_num, uint64_t i)
+{
+    if (i >= 10 && i <= 14)
+        return osd_num == 3 && i == 14 ? 1 : 2;
+    if (i == 20 || i == 21)
+        return 0;
+    return i < 1003 ? 1 : 0;
+}
+
+static void log_test_changes(pg_change_log_t & log, uint64_t max_size)
+{
+    for (uint64_t i = 10; i <= 14; i++)
+        log.log_change(test_oid(i), true, max_size);
+    log.log_change(test_oid(20), true, max_size);
+    log.log_change(test_oid(21), true, max_size);
+    for (uint64_t i = 1000; i < 1003; i++)
+        log.log_change(test_oid(i), false, max_size);
+    // Repeated changes take one entry
+    log.log_change(test_oid(10), true, max_size);
+    log.log_change(test_oid(1000), true, max_size);
+}
+
+// Incremental peering of changed objects gives the same PG state as a full listing
+void test_incremental_listing()
+{
+    pg_t full = make_pg();
+    full.peering_state = new pg_peering_state_t();
+    for (osd_num_t osd_num = 1; osd_num <= 3; osd_num++)
+    {
+        std::vector<obj_ver_id> objs;
+        for (uint64_t i = 0; i < 1003; i++)
+        {
+            uint64_t ver = changed_version(osd_num, i);
+            if (ver)
+                objs.push_back((obj_ver_id){ .oid = test_oid(i), .version = ver });
+        }
+        set_listing(full, osd_num, objs);
+    }
+    full.calc_object_states(0);
+    finish_peering(full);
+
+    pg_t inc = make_pg();
+    inc.change_log.restart(inc.target_set, 1000, 5);
+    log_test_changes(inc.change_log, 100);
+    assert(inc.change_log.valid && inc.change_log.objects.size() == 10);
+    assert(inc.can_peer_incrementally());
+    inc.peering_state = new pg_peering_state_t();
+    inc.list_changed_objects();
+    // 7 of 1000 base objects are changed and listed
+    assert(inc.peering_state->changed_objects.size() == 10);
+    assert(inc.peering_state->base_count == 993);
+    assert(inc.peering_state->base_epoch == 5);
+    for (osd_num_t osd_num = 1; osd_num <= 3; osd_num++)
+    {
+        std::vector<obj_ver_id> objs;
+        for (auto & ov: inc.peering_state->changed_objects)
+        {
+            uint64_t ver = changed_version(osd_num, ov.oid.stripe >> OBJ_SHIFT);
+            if (ver)
+                objs.push_back((obj_ver_id){ .oid = ov.oid, .version = ver });
+        }
+        set_listing(inc, osd_num, objs);
+    }
+    inc.calc_object_states(0);
+    finish_peering(inc);
+
+    assert(full.total_count == 1001 && full.clean_count == 1000);
+    assert(inc.total_count == full.total_count && inc.clean_count == full.clean_count);
+    assert(full.state == (PG_ACTIVE | PG_HAS_DEGRADED) && inc.state == full.state);
+    // Degraded activation increments the base epoch
+    assert(inc.epoch == 6);
+    assert(full.degraded_objects.size() == 1 && full.degraded_objects.get(test_oid(14)));
+    assert(inc.degraded_objects.size() == 1 && inc.degraded_objects.get(test_oid(14)));
+    assert(inc.state_dict.size() == full.state_dict.size());
+    for (auto & sp: full.state_dict)
+    {
+        auto it = inc.state_dict.find(sp.first);
+        assert(it != inc.state_dict.end());
+        assert(it->second.state == sp.second.state && it->second.object_count == sp.second.object_count);
+    }
+    assert(inc.ver_override == full.ver_override);
+    printf("[ok] incremental listing\n");
+}
+
+// The log is restarted in the clean state and dropped on overflow
+void test_change_log_trim()
+{
+    pg_t pg = make_pg();
+    // Not valid before the PG is clean for the first time
+    assert(!pg.can_peer_incrementally());
+    pg.change_log.log_change(test_oid(1), true, 100);
+    assert(!pg.change_log.objects.size());
+    pg.change_log.restart(pg.target_set, 1000, 1);
+    assert(pg.can_peer_incrementally());
+    log_test_changes(pg.change_log, 10);
+    assert(pg.change_log.valid && pg.change_log.objects.size() == 10);
+    assert(pg.can_peer_incrementally());
+    // Trimming starts a new log from the current clean state
+    pg.change_log.restart(pg.target_set, 1001, 2);
+    assert(pg.change_log.valid && !pg.change_log.objects.size());
+    assert(pg.change_log.base_count == 1001 && pg.change_log.base_epoch == 2);
+    assert(pg.can_peer_incrementally());
+    // Overflow drops the log, and it stays invalid until the next restart
+    log_test_changes(pg.change_log, 9);
+    assert(!pg.change_log.valid && !pg.change_log.objects.size());
+    assert(!pg.can_peer_incrementally());
+    pg.change_log.log_change(test_oid(1), true, 100);
+    assert(!pg.change_log.valid && !pg.change_log.objects.size());
+    pg.change_log.restart(pg.target_set, 1001, 3);
+    assert(pg.can_peer_incrementally());
+    printf("[ok] change log trim\n");
+}
+
+// Full listing is used when the log doesn't describe the current OSD set
+void test_change_log_fallback()
+{
+    pg_t pg = make_pg();
+    pg.change_log.restart(pg.target_set, 2, 1);
+    pg.change_log.log_change(test_oid(1), true, 100);
+    assert(pg.can_peer_incrementally());
+    // OSD set changed
+    pg.target_set = { 1, 2, 4 };
+    assert(!pg.can_peer_incrementally());
+    pg.target_set = { 1, 2, 3 };
+    // Other OSDs may have any objects
+    pg.all_peers.push_back(4);
+    assert(!pg.can_peer_incrementally());
+    pg.all_peers.pop_back();
+    // Writes were lost during reset
+    pg.change_log.unsynced = true;
+    assert(!pg.can_peer_incrementally());
+    pg.change_log.unsynced = false;
+    // EC listings are required to get unstable versions
+    pg.scheme = POOL_SCHEME_EC;
+    assert(!pg.can_peer_incrementally());
+    pg.scheme = POOL_SCHEME_REPLICATED;
+    assert(pg.can_peer_incrementally());
+    // More changed base objects than there were objects
+    pg.change_log.log_change(test_oid(2), true, 100);
+    assert(pg.can_peer_incrementally());
+    pg.change_log.log_change(test_oid(3), true, 100);
+    assert(!pg.can_peer_incrementally());
+    printf("[ok] change log fallback\n");
+}
+
+int main(int argc, char *argv[])
+{
+    test_big_listing();
+    test_incremental_listing();
+    test_change_log_trim();
+    test_change_log_fallback();
     return 0;
 }
@@ -4,6 +4,8 @@
 #include "osd_primary.h"
 #include "allocator.h"
 
+#define SELF_FD -1
+
 // read: read directly or read paired stripe(s), reconstruct, return
 // write: read paired stripe(s), reconstruct, modify, calculate parity, write
 //
@@ -53,8 +55,10 @@ bool osd_t::prepare_primary_rw(osd_op_t *cur_op)
         return false;
     }
     // Scrub is similar to r/w, so it's also handled here
+    // Recovery writes to replicated pools may send different ranges to different OSDs
     int stripe_count = (pool_cfg.scheme == POOL_SCHEME_REPLICATED
-        && cur_op->req.hdr.opcode != OSD_OP_SCRUB ? 1 : pg_it->second.pg_size);
+        && cur_op->req.hdr.opcode != OSD_OP_SCRUB
+        && !is_recovery_write(cur_op) ? 1 : pg_it->second.pg_size);
     int chain_size = 0;
     if (cur_op->req.hdr.opcode == OSD_OP_READ && cur_op->req.rw.meta_revision > 0)
     {
@@ -155,26 +159,13 @@ uint64_t* osd_t::get_object_osd_set(pg_t &pg, object_id &oid, pg_osd_set_state_t
         *object_state = NULL;
         return pg.cur_set.data();
     }
-    auto st_it = pg.incomplete_objects.find(oid);
-    if (st_it != pg.incomplete_objects.end())
-    {
-        *object_state = st_it->second;
-        return st_it->second->read_target.data();
-    }
-    st_it = pg.degraded_objects.find(oid);
-    if (st_it != pg.degraded_objects.end())
-    {
-        *object_state = st_it->second;
-        return st_it->second->read_target.data();
-    }
-    st_it = pg.misplaced_objects.find(oid);
-    if (st_it != pg.misplaced_objects.end())
-    {
-        *object_state = st_it->second;
-        return st_it->second->read_target.data();
-    }
-    *object_state = NULL;
-    return pg.cur_set.data();
+    pg_osd_set_state_t *st = pg.incomplete_objects.get(oid);
+    if (!st)
+        st = pg.degraded_objects.get(oid);
+    if (!st)
+        st = pg.misplaced_objects.get(oid);
+    *object_state = st;
+    return st ? st->read_target.data() : pg.cur_set.data();
 }
 
 void osd_t::continue_primary_read(osd_op_t *cur_op)
@@ -552,14 +543,8 @@ pg_osd_set_state_t* osd_t::add_object_to_set(pg_t & pg, const object_id oid, con
         if ((pg.state & (PG_HAS_DEGRADED | PG_HAS_MISPLACED)) !=
             (old_pg_state & (PG_HAS_DEGRADED | PG_HAS_MISPLACED)))
         {
+            // Recovery picks objects by priority, so degraded objects will be recovered first
             peering_state = peering_state | OSD_RECOVERING;
-            if ((pg.state & PG_HAS_DEGRADED) != (old_pg_state & PG_HAS_DEGRADED))
-            {
-                // Restart recovery from degraded objects
-                recovery_last_degraded = true;
-                recovery_last_pg = {};
-                recovery_last_oid = {};
-            }
             ringloop->wakeup();
         }
     }
@@ -568,6 +553,11 @@ pg_osd_set_state_t* osd_t::add_object_to_set(pg_t & pg, const object_id oid, con
         // Object is clean
         return NULL;
     }
+    if (pg.state_dict.find(osd_set) == pg.state_dict.end())
+    {
+        // New object state, recovery candidates should include it
+        recovery_candidates_dirty = true;
+    }
     // Insert object into the new state and retry
     return pg.add_object_to_state(oid, obj_state, osd_set);
 }
@@ -663,6 +653,7 @@ void osd_t::deref_object_state(pg_t & pg, pg_osd_set_state_t **object_state, boo
         {
             pg.state_dict.erase((*object_state)->osd_set);
             *object_state = NULL;
+            recovery_candidates_dirty = true;
         }
     }
 }
@@ -713,6 +704,7 @@ resume_3:
         cur_op->reply.rw.version = op_data->fact_ver;
         goto continue_others;
     }
+    log_pg_change(pg, op_data->oid, op_data->fact_ver != 0);
     // Save version override for parallel reads
     pg.ver_override[op_data->oid] = op_data->fact_ver;
     // Submit deletes
@@ -772,6 +764,7 @@ continue_others:
             next_op = next_it->second;
     }
     finish_op(cur_op, cur_op->reply.hdr.retval);
+    trim_pg_change_log(pg);
     if (next_op)
     {
         // Continue next write to the same object
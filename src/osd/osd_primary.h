@@ -10,6 +10,14 @@
 #define SUBMIT_RMW_READ 1
 #define SUBMIT_WRITE 2
 #define SUBMIT_SCRUB_READ 3
+#define SUBMIT_SCRUB_DIGEST 4
+
+// Recovery writes are internal zero-length writes which rewrite the object with its current data.
+// Other internal writes (layer merge) carry their own data and must be written fully
+static inline bool is_recovery_write(osd_op_t *cur_op)
+{
+    return cur_op->peer_fd == -1 && cur_op->req.hdr.opcode == OSD_OP_WRITE && !cur_op->req.rw.len;
+}
 
 struct unstable_osd_num_t
 {
@@ -31,6 +39,9 @@ struct osd_primary_op_data_t
     osd_op_t *subops = NULL;
     uint64_t *prev_set = NULL;
     pg_osd_set_state_t *object_state = NULL;
+    // Replicated recovery: every OSD receives its own write range from stripes[role]
+    bool delta_recovery = false;
+    uint8_t *delta_buf = NULL;
 
     union
     {
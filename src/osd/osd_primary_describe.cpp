@@ -6,7 +6,7 @@
 
 struct unclean_list_t
 {
-    btree::btree_map<object_id, pg_osd_set_state_t*>::iterator it, end;
+    pg_obj_state_map_t::iterator it, end;
     uint64_t state_mask, state;
 };
 
@@ -17,7 +17,7 @@ struct desc_item_list_t
 };
 
 static void include_list(std::vector<unclean_list_t> & lists,
-    btree::btree_map<object_id, pg_osd_set_state_t*> & from,
+    pg_obj_state_map_t & from,
     osd_op_describe_t & desc, uint64_t state_mask, uint64_t state)
 {
     auto it = desc.min_inode || desc.min_offset ? from.lower_bound((object_id){
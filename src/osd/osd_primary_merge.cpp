@@ -0,0 +1,218 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include "osd_primary.h"
+
+#define SELF_FD -1
+
+// Server-side layer merge: read objects of <source_inode> with all its parents
+// from the same pool and write their non-empty parts into <target_inode>, so
+// that merged data doesn't travel through the client.
+// Objects of one request are processed in parallel, writes to each object are
+// submitted one by one (CAS writes require it anyway).
+
+struct osd_merge_obj_t
+{
+    uint64_t offset;
+    uint64_t version = 0;
+    uint32_t start = 0, end = 0;
+    uint8_t *bitmap = NULL;
+    uint8_t *buf = NULL;
+};
+
+struct osd_merge_op_t
+{
+    osd_op_t *cur_op;
+    uint64_t block_size;
+    int inflight = 0;
+    int errcode = 0;
+    uint64_t error_offset = 0;
+    uint64_t written_bytes = 0;
+    osd_merge_obj_t *objs = NULL;
+};
+
+void osd_t::continue_primary_merge(osd_op_t *cur_op)
+{
+    auto & req = cur_op->req.merge;
+    pool_id_t pool_id = INODE_POOL(req.source_inode);
+    auto pool_cfg_it = st_cli.pool_config.find(pool_id);
+    if (pool_cfg_it == st_cli.pool_config.end())
+    {
+        finish_op(cur_op, -EPIPE);
+        return;
+    }
+    auto & pool_cfg = pool_cfg_it->second;
+    if (INODE_POOL(req.target_inode) != pool_id || req.pool_id != pool_id ||
+        (req.len % sizeof(uint64_t)) != 0 || !req.len)
+    {
+        finish_op(cur_op, -EINVAL);
+        return;
+    }
+    auto pg_it = pgs.find({ .pool_id = pool_id, .pg_num = req.pg_num });
+    auto inode_it = st_cli.inode_config.find(req.source_inode);
+    if (pg_it == pgs.end() || !(pg_it->second.state & PG_ACTIVE) ||
+        inode_it == st_cli.inode_config.end() || inode_it->second.mod_revision != req.meta_revision)
+    {
+        // PG is inactive or moved to another OSD, or the client's view of the metadata is outdated
+        finish_op(cur_op, -EPIPE);
+        return;
+    }
+    uint64_t pg_data_size = (pool_cfg.scheme == POOL_SCHEME_REPLICATED ? 1 : pool_cfg.pg_size-pool_cfg.parity_chunks);
+    uint64_t block_size = bs_block_size * pg_data_size;
+    uint64_t *offsets = (uint64_t*)cur_op->buf;
+    int count = req.len / sizeof(uint64_t);
+    for (int i = 0; i < count; i++)
+    {
+        if ((offsets[i] % block_size) != 0 ||
+            map_to_pg((object_id){ .inode = req.source_inode, .stripe = offsets[i] }, pool_cfg.pg_stripe_size) != req.pg_num)
+        {
+            finish_op(cur_op, -EINVAL);
+            return;
+        }
+    }
+    osd_merge_op_t *mop = new osd_merge_op_t;
+    mop->cur_op = cur_op;
+    mop->block_size = block_size;
+    mop->objs = new osd_merge_obj_t[count];
+    mop->inflight = count;
+    for (int i = 0; i < count; i++)
+    {
+        mop->objs[i].offset = offsets[i];
+        submit_merge_read(mop, &mop->objs[i]);
+    }
+}
+
+void osd_t::submit_merge_read(osd_merge_op_t *mop, osd_merge_obj_t *obj)
+{
+    auto & req = mop->cur_op->req.merge;
+    osd_op_t *op = new osd_op_t();
+    op->op_type = OSD_OP_OUT;
+    op->peer_fd = SELF_FD;
+    op->req = (osd_any_op_t){
+        .rw = {
+            .header = {
+                .magic = SECONDARY_OSD_OP_MAGIC,
+                .id = 1,
+                .opcode = OSD_OP_READ,
+            },
+            .inode = req.source_inode,
+            .offset = obj->offset,
+            .len = (uint32_t)mop->block_size,
+            // Non-zero meta_revision enables chained read
+            .meta_revision = req.meta_revision,
+        },
+    };
+    op->callback = [this, mop, obj](osd_op_t *op)
+    {
+        if (op->reply.hdr.retval != op->req.rw.len)
+        {
+            int retval = op->reply.hdr.retval < 0 ? op->reply.hdr.retval : -EIO;
+            delete op;
+            finish_merge_object(mop, obj, retval);
+            return;
+        }
+        obj->version = op->reply.rw.version;
+        if (!obj->buf)
+        {
+            obj->bitmap = (uint8_t*)malloc_or_die(op->reply.rw.bitmap_len);
+            obj->buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, mop->block_size);
+        }
+        // Reply is composed of the bitmap and data parts, gather them
+        memcpy(obj->bitmap, op->iov.buf[0].iov_base, op->reply.rw.bitmap_len);
+        uint64_t pos = 0;
+        for (int i = 1; i < op->iov.count; i++)
+        {
+            memcpy(obj->buf + pos, op->iov.buf[i].iov_base, op->iov.buf[i].iov_len);
+            pos += op->iov.buf[i].iov_len;
+        }
+        assert(pos == mop->block_size);
+        delete op;
+        obj->start = obj->end = 0;
+        continue_merge_write(mop, obj);
+    };
+    exec_op(op);
+}
+
+void osd_t::continue_merge_write(osd_merge_op_t *mop, osd_merge_obj_t *obj)
+{
+    auto & req = mop->cur_op->req.merge;
+    // Find the next non-empty range
+    uint32_t bit_count = mop->block_size / bs_bitmap_granularity;
+    obj->start = obj->end;
+    while (obj->start < bit_count && !(obj->bitmap[obj->start >> 3] & (1 << (obj->start & 7))))
+        obj->start++;
+    obj->end = obj->start;
+    while (obj->end < bit_count && (obj->bitmap[obj->end >> 3] & (1 << (obj->end & 7))))
+        obj->end++;
+    if (obj->start >= bit_count)
+    {
+        finish_merge_object(mop, obj, 0);
+        return;
+    }
+    uint32_t start = obj->start * bs_bitmap_granularity;
+    uint32_t len = (obj->end - obj->start) * bs_bitmap_granularity;
+    osd_op_t *op = new osd_op_t();
+    op->op_type = OSD_OP_OUT;
+    op->peer_fd = SELF_FD;
+    op->req = (osd_any_op_t){
+        .rw = {
+            .header = {
+                .magic = SECONDARY_OSD_OP_MAGIC,
+                .id = 1,
+                .opcode = OSD_OP_WRITE,
+            },
+            .inode = req.target_inode,
+            .offset = obj->offset + start,
+            .len = len,
+            .version = (req.flags & OSD_MERGE_CAS) ? obj->version+1 : 0,
+        },
+    };
+    op->buf = memalign_or_die(MEM_ALIGNMENT, len);
+    memcpy(op->buf, obj->buf + start, len);
+    op->callback = [this, mop, obj](osd_op_t *op)
+    {
+        int retval = op->reply.hdr.retval;
+        if (retval == -EINTR && (mop->cur_op->req.merge.flags & OSD_MERGE_CAS))
+        {
+            // Object was modified in between - reread and repeat
+            delete op;
+            submit_merge_read(mop, obj);
+            return;
+        }
+        if (retval != op->req.rw.len)
+        {
+            delete op;
+            finish_merge_object(mop, obj, retval < 0 ? retval : -EIO);
+            return;
+        }
+        mop->written_bytes += op->req.rw.len;
+        obj->version = op->reply.rw.version;
+        delete op;
+        continue_merge_write(mop, obj);
+    };
+    exec_op(op);
+}
+
+void osd_t::finish_merge_object(osd_merge_op_t *mop, osd_merge_obj_t *obj, int retval)
+{
+    if (retval < 0 && (!mop->errcode || obj->offset < mop->error_offset))
+    {
+        mop->errcode = retval;
+        mop->error_offset = obj->offset;
+    }
+    free(obj->bitmap);
+    obj->bitmap = NULL;
+    free(obj->buf);
+    obj->buf = NULL;
+    mop->inflight--;
+    if (!mop->inflight)
+    {
+        osd_op_t *cur_op = mop->cur_op;
+        cur_op->reply.merge.error_offset = mop->error_offset;
+        cur_op->reply.merge.written_bytes = mop->written_bytes;
+        int retval = mop->errcode;
+        delete[] mop->objs;
+        delete mop;
+        finish_op(cur_op, retval);
+    }
+}
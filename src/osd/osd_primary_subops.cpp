@@ -144,19 +144,20 @@ int osd_t::submit_primary_subop_batch(int submit_type, inode_t inode, uint64_t o
     osd_rmw_stripe_t *stripes, const uint64_t* osd_set, osd_op_t *cur_op, int subop_idx, int zero_read)
 {
     bool wr = submit_type == SUBMIT_WRITE;
+    bool scrub = submit_type == SUBMIT_SCRUB_READ || submit_type == SUBMIT_SCRUB_DIGEST;
     osd_primary_op_data_t *op_data = cur_op->op_data;
     bool rep = op_data->scheme == POOL_SCHEME_REPLICATED;
     int i = subop_idx;
     for (int role = 0; role < op_data->pg_size; role++)
     {
         // We always submit zero-length writes to all replicas, even if the stripe is not modified
-        if (!(wr || !rep && stripes[role].read_end != 0 || zero_read == role || submit_type == SUBMIT_SCRUB_READ))
+        if (!(wr || !rep && stripes[role].read_end != 0 || zero_read == role || scrub))
         {
             continue;
         }
         osd_num_t role_osd_num = osd_set[role];
         int stripe_num = rep ? 0 : role;
-        osd_rmw_stripe_t *si = stripes + (submit_type == SUBMIT_SCRUB_READ ? role : stripe_num);
+        osd_rmw_stripe_t *si = stripes + (scrub || op_data->delta_recovery ? role : stripe_num);
         if (role_osd_num != 0)
         {
             osd_op_t *subop = op_data->subops + i;
@@ -206,12 +207,15 @@ int osd_t::submit_primary_subop_batch(int submit_type, inode_t inode, uint64_t o
             }
             else
             {
+                // Remote chunks are only hashed for scrub, full data is read only if digests don't match
+                bool digest = submit_type == SUBMIT_SCRUB_DIGEST;
                 subop->op_type = OSD_OP_OUT;
                 subop->req.sec_rw = {
                     .header = {
                         .magic = SECONDARY_OSD_OP_MAGIC,
                         .id = msgr.next_subop_id++,
-                        .opcode = (uint64_t)(wr ? (rep ? OSD_OP_SEC_WRITE_STABLE : OSD_OP_SEC_WRITE) : OSD_OP_SEC_READ),
+                        .opcode = (uint64_t)(wr ? (rep ? OSD_OP_SEC_WRITE_STABLE : OSD_OP_SEC_WRITE)
+                            : (digest ? OSD_OP_SEC_READ_DIGEST : OSD_OP_SEC_READ)),
                     },
                     .oid = {
                         .inode = inode,
@@ -241,7 +245,7 @@ int osd_t::submit_primary_subop_batch(int submit_type, inode_t inode, uint64_t o
                 {
                     if (subop_len > 0)
                     {
-                        subop->iov.push_back(si->read_buf, subop_len);
+                        subop->iov.push_back(si->read_buf, digest ? subop_len/OSD_DIGEST_LANES : subop_len);
                     }
                 }
                 subop->callback = [cur_op, this](osd_op_t *subop)
@@ -336,7 +340,8 @@ void osd_t::add_bs_subop_stats(osd_op_t *subop, bool recovery_related)
     clock_gettime(CLOCK_REALTIME, &tv_end);
     uint64_t len = (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_WRITE)
         ? subop->bs_op->len : 0;
-    msgr.inc_op_stats(msgr.stats, opcode, subop->tv_begin, tv_end, len);
+    uint64_t usecs = msgr.inc_op_stats(msgr.stats, opcode, subop->tv_begin, tv_end, len);
+    latency_hists.op[opcode].add(usecs);
     if (recovery_related)
     {
         // It is OSD_OP_RECOVERY_RELATED
@@ -351,26 +356,29 @@ void osd_t::handle_primary_subop(osd_op_t *subop, osd_op_t *cur_op)
     int expected;
     if (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_WRITE || opcode == OSD_OP_SEC_WRITE_STABLE)
         expected = subop->req.sec_rw.len;
+    else if (opcode == OSD_OP_SEC_READ_DIGEST)
+        expected = subop->req.sec_rw.len / OSD_DIGEST_LANES;
     else if (opcode == OSD_OP_SEC_READ_BMP)
         expected = subop->req.sec_read_bmp.len / sizeof(obj_ver_id) * (8 + clean_entry_bitmap_size);
     else
         expected = 0;
     osd_primary_op_data_t *op_data = cur_op->op_data;
-    if (retval == -ENOENT && opcode == OSD_OP_SEC_READ)
+    if (retval == -ENOENT && (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_READ_DIGEST))
     {
         // ENOENT is not an error for almost all reads, except scrub
         retval = expected;
         memset(((osd_rmw_stripe_t*)subop->rmw_buf)->read_buf, 0, expected);
         ((osd_rmw_stripe_t*)subop->rmw_buf)->not_exists = true;
     }
-    if (opcode == OSD_OP_SEC_READ && (retval == -EIO || retval == -EDOM) ||
+    if ((opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_READ_DIGEST) && (retval == -EIO || retval == -EDOM) ||
         opcode == OSD_OP_SEC_WRITE && retval != expected)
     {
         // We'll retry reads from other replica(s) on EIO/EDOM and mark object as corrupted
         // And we'll mark write as failed
         ((osd_rmw_stripe_t*)subop->rmw_buf)->read_error = true;
     }
-    if (retval == expected && (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_WRITE || opcode == OSD_OP_SEC_WRITE_STABLE))
+    if (retval == expected && (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_READ_DIGEST ||
+        opcode == OSD_OP_SEC_WRITE || opcode == OSD_OP_SEC_WRITE_STABLE))
     {
         uint64_t version = subop->reply.sec_rw.version;
 #ifdef OSD_DEBUG
@@ -394,7 +402,8 @@ void osd_t::handle_primary_subop(osd_op_t *subop, osd_op_t *cur_op)
     }
     if (retval != expected)
     {
-        if (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_WRITE || opcode == OSD_OP_SEC_WRITE_STABLE)
+        if (opcode == OSD_OP_SEC_READ || opcode == OSD_OP_SEC_READ_DIGEST ||
+            opcode == OSD_OP_SEC_WRITE || opcode == OSD_OP_SEC_WRITE_STABLE)
         {
             printf(
                 subop->peer_fd >= 0
@@ -422,9 +431,11 @@ void osd_t::handle_primary_subop(osd_op_t *subop, osd_op_t *cur_op)
             op_data->errcode = retval;
         }
         op_data->errors++;
+        // Peers which don't support digests return EINVAL, scrub then falls back to full reads
         if (subop->peer_fd >= 0 && retval != -EDOM && retval != -ERANGE &&
             (retval != -ENOSPC || opcode != OSD_OP_SEC_WRITE && opcode != OSD_OP_SEC_WRITE_STABLE) &&
-            (retval != -EIO || opcode != OSD_OP_SEC_READ))
+            (retval != -EIO || opcode != OSD_OP_SEC_READ && opcode != OSD_OP_SEC_READ_DIGEST) &&
+            (retval != -EINVAL || opcode != OSD_OP_SEC_READ_DIGEST))
         {
             // Drop connection on unexpected errors
             op_data->drops++;
@@ -226,6 +226,12 @@ resume_8:
         {
             start_pg_peering(pg);
         }
+        else if (!op_data->errors)
+        {
+            // Writes to this PG made before its last repeer are now also synced
+            pg.change_log.unsynced = false;
+            trim_pg_change_log(pg);
+        }
     }
     // FIXME: Free those in the destructor?
     free(op_data->dirty_pgs);
@@ -4,6 +4,8 @@
 #include "osd_primary.h"
 #include "allocator.h"
 
+#define SELF_FD -1
+
 bool osd_t::check_write_queue(osd_op_t *cur_op, pg_t & pg)
 {
     osd_primary_op_data_t *op_data = cur_op->op_data;
@@ -51,6 +53,8 @@ void osd_t::continue_primary_write(osd_op_t *cur_op)
     else if (op_data->st == 10) goto resume_10;
     else if (op_data->st == 11) goto resume_11;
     else if (op_data->st == 12) goto resume_12;
+    else if (op_data->st == 13) goto resume_13;
+    else if (op_data->st == 14) goto resume_14;
     assert(op_data->st == 0);
     if (!check_write_queue(cur_op, pg))
     {
@@ -166,6 +170,7 @@ resume_3:
         cur_op->reply.rw.version = op_data->fact_ver;
         goto continue_others;
     }
+    log_pg_change(pg, op_data->oid, op_data->fact_ver != 0);
     if (op_data->scheme == POOL_SCHEME_REPLICATED)
     {
         // Set bitmap bits
@@ -184,6 +189,27 @@ resume_3:
             op_data->stripes[0].write_start = 0;
             op_data->stripes[0].write_end = bs_block_size;
         }
+        if (op_data->object_state && is_recovery_write(cur_op) && recovery_delta)
+        {
+            // Recovery: don't rewrite the whole object on OSDs which already have its copy
+            if (submit_recovery_digests(cur_op, pg))
+            {
+resume_13:
+                op_data->st = 13;
+                return;
+            }
+resume_14:
+            if (op_data->errcode == -EPIPE || op_data->drops > 0 || (pg.state & (PG_STOPPING|PG_REPEERING)))
+            {
+                // A peer is gone or the PG is restarting, don't write anything
+                free(op_data->delta_buf);
+                op_data->delta_buf = NULL;
+                deref_object_state(pg, &op_data->object_state, true);
+                pg_cancel_write_queue(pg, cur_op, op_data->oid, -EPIPE);
+                return;
+            }
+            calc_recovery_delta(cur_op, pg);
+        }
     }
     else
     {
@@ -321,7 +347,7 @@ resume_7:
                 memset(&recovery_stat[recovery_type], 0, sizeof(recovery_stat[recovery_type]));
                 recovery_stat[recovery_type].count++;
             }
-            for (int role = 0; role < (op_data->scheme == POOL_SCHEME_REPLICATED ? 1 : pg.pg_size); role++)
+            for (int role = 0; role < (op_data->scheme == POOL_SCHEME_REPLICATED && !op_data->delta_recovery ? 1 : pg.pg_size); role++)
             {
                 recovery_stat[recovery_type].bytes += op_data->stripes[role].write_end - op_data->stripes[role].write_start;
             }
@@ -394,6 +420,7 @@ continue_others:
     }
     // finish_op would invalidate next_it if it cleared pg.write_queue, but it doesn't do that :)
     finish_op(cur_op, cur_op->reply.hdr.retval);
+    trim_pg_change_log(pg);
     if (unstable_write_count >= autosync_writes)
     {
         unstable_write_count = 0;
@@ -406,6 +433,152 @@ continue_others:
     }
 }
 
+// Recovery of replicated objects: OSDs which have an outdated copy of the object
+// first return digests of their data, then they only receive changed blocks.
+// Returns false if there are no such OSDs
+bool osd_t::submit_recovery_digests(osd_op_t *cur_op, pg_t & pg)
+{
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    osd_num_t digest_set[op_data->pg_size];
+    uint32_t buf_size = clean_entry_bitmap_size;
+    int n_subops = 0;
+    for (int role = 0; role < op_data->pg_size; role++)
+    {
+        digest_set[role] = 0;
+        op_data->stripes[role].not_exists = false;
+        for (auto & loc: op_data->object_state->osd_set)
+        {
+            if (pg.cur_set[role] != 0 && loc.osd_num == pg.cur_set[role] && loc.loc_bad == LOC_OUTDATED)
+            {
+                digest_set[role] = loc.osd_num;
+                // Local chunk is read fully and hashed here
+                buf_size += loc.osd_num == this->osd_num ? bs_block_size : bs_block_size/OSD_DIGEST_LANES;
+                n_subops++;
+                break;
+            }
+        }
+    }
+    if (!n_subops)
+    {
+        return false;
+    }
+    // Digest replies overwrite bitmaps, so save the current one
+    op_data->delta_buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, buf_size);
+    memcpy(op_data->delta_buf, op_data->stripes[0].bmp_buf, clean_entry_bitmap_size);
+    uint8_t *buf = op_data->delta_buf + clean_entry_bitmap_size;
+    for (int role = 0; role < op_data->pg_size; role++)
+    {
+        if (digest_set[role])
+        {
+            op_data->stripes[role].read_start = 0;
+            op_data->stripes[role].read_end = bs_block_size;
+            op_data->stripes[role].read_buf = buf;
+            buf += digest_set[role] == this->osd_num ? bs_block_size : bs_block_size/OSD_DIGEST_LANES;
+        }
+        else
+            op_data->stripes[role].read_start = op_data->stripes[role].read_end = 0;
+    }
+    // Outdated copies have other versions, so don't check them
+    op_data->orig_ver = op_data->fact_ver;
+    op_data->fact_ver = UINT64_MAX;
+    op_data->done = op_data->errors = op_data->drops = op_data->errcode = 0;
+    op_data->n_subops = n_subops;
+    op_data->subops = new osd_op_t[n_subops];
+    int sent = submit_primary_subop_batch(SUBMIT_SCRUB_DIGEST, op_data->oid.inode, UINT64_MAX,
+        op_data->stripes, digest_set, cur_op, 0, -1);
+    assert(sent == n_subops);
+    return true;
+}
+
+// Calculate write ranges for every OSD of the current set:
+// - OSDs with the current version get a zero-length write which just bumps the version
+// - OSDs with an outdated copy get blocks which differ from the current version
+// - others get the full object
+void osd_t::calc_recovery_delta(osd_op_t *cur_op, pg_t & pg)
+{
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    osd_rmw_stripe_t *stripes = op_data->stripes;
+    uint8_t *data = (uint8_t*)stripes[0].write_buf;
+    uint32_t digest_size = bs_block_size/OSD_DIGEST_LANES;
+    uint8_t *cur_digest = NULL;
+    if (op_data->delta_buf)
+    {
+        op_data->fact_ver = op_data->orig_ver;
+        memcpy(stripes[0].bmp_buf, op_data->delta_buf, clean_entry_bitmap_size);
+        cur_digest = (uint8_t*)malloc_or_die(2*digest_size);
+        calc_chunk_digest(data, bs_block_size, cur_digest);
+    }
+    for (int role = 0; role < op_data->pg_size; role++)
+    {
+        osd_rmw_stripe_t & si = stripes[role];
+        uint32_t start = 0, end = bs_block_size;
+        if (!pg.cur_set[role])
+        {
+            end = 0;
+        }
+        else if (si.read_end != 0)
+        {
+            // Fall back to the full copy if the digest can't be read or the object is already deleted
+            if (!op_data->errors && !si.not_exists)
+            {
+                uint8_t *digest = (uint8_t*)si.read_buf;
+                if (pg.cur_set[role] == this->osd_num)
+                {
+                    digest = cur_digest + digest_size;
+                    calc_chunk_digest((uint8_t*)si.read_buf, bs_block_size, digest);
+                }
+                start = bs_block_size;
+                end = 0;
+                for (uint32_t pos = 0; pos < bs_block_size; pos += OSD_DIGEST_BLOCK)
+                {
+                    if (memcmp(cur_digest + pos/OSD_DIGEST_LANES, digest + pos/OSD_DIGEST_LANES, OSD_DIGEST_BLOCK/OSD_DIGEST_LANES) != 0)
+                    {
+                        start = start < pos ? start : pos;
+                        end = pos + OSD_DIGEST_BLOCK;
+                    }
+                }
+                if (start >= end)
+                {
+                    start = end = 0;
+                }
+                else
+                {
+                    start -= start % bs_bitmap_granularity;
+                    end += (bs_bitmap_granularity - end % bs_bitmap_granularity) % bs_bitmap_granularity;
+                    end = end < bs_block_size ? end : bs_block_size;
+                }
+            }
+            si.read_start = si.read_end = 0;
+        }
+        else
+        {
+            for (auto & loc: op_data->object_state->osd_set)
+            {
+                if (loc.osd_num == pg.cur_set[role] && !loc.loc_bad)
+                {
+                    end = 0;
+                    break;
+                }
+            }
+        }
+        si.write_start = start;
+        si.write_end = end;
+        si.write_buf = data + start;
+        if (role > 0)
+        {
+            // The whole bitmap of the current version is sent with every write
+            memcpy(si.bmp_buf, stripes[0].bmp_buf, clean_entry_bitmap_size);
+        }
+    }
+    if (op_data->delta_buf)
+    {
+        free(cur_digest);
+        free(op_data->delta_buf);
+        op_data->delta_buf = NULL;
+    }
+    op_data->delta_recovery = true;
+}
+
 void osd_t::on_change_pg_history_hook(pool_id_t pool_id, pg_num_t pg_num)
 {
     auto pg_it = pgs.find({
@@ -0,0 +1,182 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include "osd.h"
+
+// Client I/O limits (qos_iops, qos_bps, qos_burst_iops, qos_burst_bps of inodes and pools).
+// Every client read, write or delete first waits for tokens of its inode, then for tokens
+// of its pool. Waiting operations are kept in FIFO queues so that a throttled image
+// doesn't delay other images. Limits are enforced by every primary OSD separately.
+
+bool osd_t::qos_throttle(osd_op_t *cur_op)
+{
+    if (cur_op->peer_fd < 0 ||
+        cur_op->req.hdr.opcode != OSD_OP_READ &&
+        cur_op->req.hdr.opcode != OSD_OP_WRITE &&
+        cur_op->req.hdr.opcode != OSD_OP_DELETE)
+    {
+        return false;
+    }
+    uint64_t now = 0;
+    inode_t inode = cur_op->req.rw.inode;
+    auto ino_it = st_cli.inode_config.find(inode);
+    bool limited = ino_it != st_cli.inode_config.end() && ino_it->second.qos.is_set();
+    auto q_it = inode_qos.find(inode);
+    if (limited && q_it == inode_qos.end())
+    {
+        q_it = inode_qos.emplace(inode, osd_qos_queue_t()).first;
+    }
+    if (q_it != inode_qos.end())
+    {
+        now = qos_now_us();
+        q_it->second.bucket.set_limits(limited ? ino_it->second.qos : qos_limits_t(), now);
+        if (qos_enqueue(q_it->second, cur_op, false, now))
+        {
+            qos_waiting_inodes.insert(inode);
+            return true;
+        }
+        if (!limited)
+        {
+            // Limits were removed and the queue is empty
+            inode_qos.erase(q_it);
+        }
+    }
+    return qos_pool_stage(cur_op, false, now);
+}
+
+// <delayed> means that the operation already waited at the inode stage and is already counted
+bool osd_t::qos_pool_stage(osd_op_t *cur_op, bool delayed, uint64_t now)
+{
+    pool_id_t pool_id = INODE_POOL(cur_op->req.rw.inode);
+    auto pool_it = st_cli.pool_config.find(pool_id);
+    bool limited = pool_it != st_cli.pool_config.end() && pool_it->second.qos.is_set();
+    auto q_it = pool_qos.find(pool_id);
+    if (limited && q_it == pool_qos.end())
+    {
+        q_it = pool_qos.emplace(pool_id, osd_qos_queue_t()).first;
+    }
+    if (q_it != pool_qos.end())
+    {
+        if (!now)
+            now = qos_now_us();
+        q_it->second.bucket.set_limits(limited ? pool_it->second.qos : qos_limits_t(), now);
+        if (qos_enqueue(q_it->second, cur_op, delayed, now))
+        {
+            qos_waiting_pools.insert(pool_id);
+            return true;
+        }
+        if (!limited)
+        {
+            pool_qos.erase(q_it);
+        }
+    }
+    return false;
+}
+
+bool osd_t::qos_enqueue(osd_qos_queue_t & q, osd_op_t *cur_op, bool delayed, uint64_t now)
+{
+    if (!q.ops.size())
+    {
+        uint64_t wait_us = q.bucket.take(cur_op->req.rw.len, now);
+        if (!wait_us)
+        {
+            return false;
+        }
+        schedule_qos_timer(now + wait_us, now);
+    }
+    q.ops.push_back((osd_qos_wait_t){ .op = cur_op, .since_us = now });
+    qos_queued_ops++;
+    if (!delayed)
+    {
+        qos_delayed_count++;
+        inode_stats[cur_op->req.rw.inode].qos_count++;
+    }
+    return true;
+}
+
+// Dispatch queued operations while there are enough tokens.
+// Returns the time when the next operation may be dispatched or 0 if the queue is empty
+uint64_t osd_t::run_qos_queue(osd_qos_queue_t & q, const qos_limits_t & limits, bool pool_stage, uint64_t now)
+{
+    q.bucket.set_limits(limits, now);
+    while (q.ops.size())
+    {
+        auto w = q.ops.front();
+        uint64_t wait_us = q.bucket.take(w.op->req.rw.len, now);
+        if (wait_us)
+        {
+            return now+wait_us;
+        }
+        q.ops.pop_front();
+        qos_queued_ops--;
+        qos_delayed_usec += now-w.since_us;
+        inode_stats[w.op->req.rw.inode].qos_usec += now-w.since_us;
+        if (pool_stage || !qos_pool_stage(w.op, true, now))
+        {
+            dispatch_op(w.op);
+        }
+    }
+    return 0;
+}
+
+void osd_t::run_qos_queues()
+{
+    uint64_t now = qos_now_us();
+    uint64_t next_us = 0;
+    for (auto it = qos_waiting_inodes.begin(); it != qos_waiting_inodes.end(); )
+    {
+        auto ino_it = st_cli.inode_config.find(*it);
+        auto limits = ino_it != st_cli.inode_config.end() ? ino_it->second.qos : qos_limits_t();
+        uint64_t at = run_qos_queue(inode_qos.at(*it), limits, false, now);
+        if (at)
+        {
+            if (!next_us || next_us > at)
+                next_us = at;
+            it++;
+            continue;
+        }
+        if (!limits.is_set())
+            inode_qos.erase(*it);
+        qos_waiting_inodes.erase(it++);
+    }
+    for (auto it = qos_waiting_pools.begin(); it != qos_waiting_pools.end(); )
+    {
+        auto pool_it = st_cli.pool_config.find(*it);
+        auto limits = pool_it != st_cli.pool_config.end() ? pool_it->second.qos : qos_limits_t();
+        uint64_t at = run_qos_queue(pool_qos.at(*it), limits, true, now);
+        if (at)
+        {
+            if (!next_us || next_us > at)
+                next_us = at;
+            it++;
+            continue;
+        }
+        if (!limits.is_set())
+            pool_qos.erase(*it);
+        qos_waiting_pools.erase(it++);
+    }
+    if (next_us)
+    {
+        schedule_qos_timer(next_us, now);
+    }
+}
+
+void osd_t::schedule_qos_timer(uint64_t at_us, uint64_t now)
+{
+    if (qos_timer_id >= 0)
+    {
+        if (qos_timer_us <= at_us)
+        {
+            return;
+        }
+        tfd->clear_timer(qos_timer_id);
+    }
+    qos_timer_us = at_us;
+    qos_timer_id = tfd->set_timer_us(at_us > now ? at_us-now : 1, false, [this](int timer_id)
+    {
+        qos_timer_id = -1;
+        qos_timer_us = 0;
+        run_qos_queues();
+        ringloop->wakeup();
+    });
+}
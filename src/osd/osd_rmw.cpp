@@ -6,14 +6,12 @@
 #include <assert.h>
 extern "C" {
 #include <reed_sol.h>
-#include <jerasure.h>
-#ifdef WITH_ISAL
-#include <isa-l/erasure_code.h>
-#endif
 }
 #include <map>
 #include "allocator.h"
 #include "xor.h"
+#include "osd_ec.h"
+#include "osd_ops.h"
 #include "osd_rmw.h"
 #include "malloc_or_die.h"
 
@@ -95,46 +93,27 @@ void reconstruct_stripes_xor(osd_rmw_stripe_t *stripes, int pg_size, uint32_t bi
     {
         if (stripes[role].read_end != 0 && stripes[role].missing)
         {
-            // Reconstruct missing stripe (XOR k+1)
-            int prev = -2;
+            // Reconstruct missing stripe (XOR k+1) in one pass over all other stripes
+            const void *data_srcs[pg_size], *bmp_srcs[pg_size];
+            int n = 0;
             for (int other = 0; other < pg_size; other++)
             {
                 if (other != role)
                 {
-                    if (prev == -2)
+                    if (stripes[role].read_end != UINT32_MAX)
                     {
-                        prev = other;
-                    }
-                    else if (prev >= 0)
-                    {
-                        if (stripes[role].read_end != UINT32_MAX)
-                        {
-                            assert(stripes[role].read_start >= stripes[prev].read_start &&
-                                stripes[role].read_start >= stripes[other].read_start);
-                            memxor(
-                                (uint8_t*)stripes[prev].read_buf + (stripes[role].read_start - stripes[prev].read_start),
-                                (uint8_t*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start),
-                                stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start
-                            );
-                        }
-                        memxor(stripes[prev].bmp_buf, stripes[other].bmp_buf, stripes[role].bmp_buf, bitmap_size);
-                        prev = -1;
-                    }
-                    else
-                    {
-                        if (stripes[role].read_end != UINT32_MAX)
-                        {
-                            assert(stripes[role].read_start >= stripes[other].read_start);
-                            memxor(
-                                stripes[role].read_buf,
-                                (uint8_t*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start),
-                                stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start
-                            );
-                        }
-                        memxor(stripes[role].bmp_buf, stripes[other].bmp_buf, stripes[role].bmp_buf, bitmap_size);
+                        assert(stripes[role].read_start >= stripes[other].read_start);
+                        data_srcs[n] = (uint8_t*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start);
                     }
+                    bmp_srcs[n] = stripes[other].bmp_buf;
+                    n++;
                 }
             }
+            if (stripes[role].read_end != UINT32_MAX)
+            {
+                memxor_multi(data_srcs, n, stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start);
+            }
+            memxor_multi(bmp_srcs, n, stripes[role].bmp_buf, bitmap_size);
         }
     }
 }
@@ -160,8 +139,9 @@ inline bool operator < (const reed_sol_erased_t &a, const reed_sol_erased_t &b)
 struct reed_sol_matrix_t
 {
     int refs = 0;
-    int *je_data;
-    uint8_t *isal_data;
+    // (pg_size-pg_minsize) x pg_minsize coding matrix and its ec_encode() tables
+    uint8_t *data;
+    uint8_t *tables;
     // 32 bytes = 256/8 = max pg_size/8
     std::map<std::array<uint8_t, 32>, void*> subdata;
     std::map<reed_sol_erased_t, void*> decodings;
@@ -179,31 +159,28 @@ void use_ec(int pg_size, int pg_minsize, bool use)
         {
             return;
         }
-        int *matrix = reed_sol_vandermonde_coding_matrix(pg_minsize, pg_size-pg_minsize, OSD_JERASURE_W);
-        uint8_t *isal_table = NULL;
-#ifdef WITH_ISAL
-        uint8_t *isal_matrix = (uint8_t*)malloc_or_die(pg_minsize*(pg_size-pg_minsize));
+        // The matrix is still generated by jerasure to stay compatible with existing data
+        int *je_matrix = reed_sol_vandermonde_coding_matrix(pg_minsize, pg_size-pg_minsize, OSD_JERASURE_W);
+        uint8_t *matrix = (uint8_t*)malloc_or_die(pg_minsize*(pg_size-pg_minsize));
         for (int i = 0; i < pg_minsize*(pg_size-pg_minsize); i++)
         {
-            isal_matrix[i] = matrix[i];
+            matrix[i] = je_matrix[i];
         }
-        isal_table = (uint8_t*)malloc_or_die(pg_minsize*(pg_size-pg_minsize)*32);
-        ec_init_tables(pg_minsize, pg_size-pg_minsize, isal_matrix, isal_table);
-        free(isal_matrix);
-#endif
+        free(je_matrix);
+        uint8_t *tables = (uint8_t*)malloc_or_die(pg_minsize*(pg_size-pg_minsize)*32);
+        ec_make_tables(pg_minsize, pg_size-pg_minsize, matrix, tables);
         matrices[key] = (reed_sol_matrix_t){
             .refs = 0,
-            .je_data = matrix,
-            .isal_data = isal_table,
+            .data = matrix,
+            .tables = tables,
         };
         rs_it = matrices.find(key);
     }
     rs_it->second.refs += (!use ? -1 : 1);
     if (rs_it->second.refs <= 0)
     {
-        free(rs_it->second.je_data);
-        if (rs_it->second.isal_data)
-            free(rs_it->second.isal_data);
+        free(rs_it->second.data);
+        free(rs_it->second.tables);
         for (auto sub_it = rs_it->second.subdata.begin(); sub_it != rs_it->second.subdata.end();)
         {
             void *data = sub_it->second;
@@ -226,16 +203,14 @@ static reed_sol_matrix_t* get_ec_matrix(int pg_size, int pg_minsize)
     auto rs_it = matrices.find(key);
     if (rs_it == matrices.end())
     {
-        throw std::runtime_error("jerasure matrix not initialized");
+        throw std::runtime_error("EC matrix not initialized");
     }
     return &rs_it->second;
 }
 
-// jerasure_matrix_decode() decodes all chunks at once and tries to reencode all missing coding chunks.
-// we don't need it. also it makes an extra allocation of int *erased on every call and doesn't cache
-// the decoding matrix.
-// all these flaws are fixed in this function:
-static void* get_jerasure_decoding_matrix(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize)
+// Decoding is the same ec_encode() with rows of the inverted matrix for missing data chunks.
+// Tables are cached for every combination of missing chunks.
+static uint8_t* get_ec_decoding_tables(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize)
 {
     int edd = 0;
     int erased[pg_size];
@@ -251,7 +226,6 @@ static void* get_jerasure_decoding_matrix(osd_rmw_stripe_t *stripes, int pg_size
     auto dec_it = matrix->decodings.find((reed_sol_erased_t){ .data = erased, .size = pg_size });
     if (dec_it == matrix->decodings.end())
     {
-#ifdef WITH_ISAL
         int smrow = 0;
         uint8_t *submatrix = (uint8_t*)malloc_or_die(pg_minsize*pg_minsize*2);
         for (int i = 0; i < pg_size && smrow < pg_minsize; i++)
@@ -266,17 +240,16 @@ static void* get_jerasure_decoding_matrix(osd_rmw_stripe_t *stripes, int pg_size
                 else
                 {
                     for (int j = 0; j < pg_minsize; j++)
-                        submatrix[smrow*pg_minsize + j] = (uint8_t)matrix->je_data[(i-pg_minsize)*pg_minsize + j];
+                        submatrix[smrow*pg_minsize + j] = matrix->data[(i-pg_minsize)*pg_minsize + j];
                 }
                 smrow++;
             }
         }
-        if (smrow < pg_minsize)
+        if (smrow < pg_minsize || !ec_invert_matrix(submatrix, submatrix + pg_minsize*pg_minsize, pg_minsize))
         {
             free(submatrix);
             throw std::runtime_error("failed to make an invertible submatrix");
         }
-        gf_invert_matrix(submatrix, submatrix + pg_minsize*pg_minsize, pg_minsize);
         smrow = 0;
         for (int i = 0; i < pg_minsize; i++)
         {
@@ -287,75 +260,19 @@ static void* get_jerasure_decoding_matrix(osd_rmw_stripe_t *stripes, int pg_size
             }
         }
         uint8_t *rectable = (uint8_t*)malloc_or_die(32*smrow*pg_minsize + pg_size*sizeof(int));
-        ec_init_tables(pg_minsize, smrow, submatrix, rectable);
+        ec_make_tables(pg_minsize, smrow, submatrix, rectable);
         free(submatrix);
         int *erased_copy = (int*)(rectable + 32*smrow*pg_minsize);
         memcpy(erased_copy, erased, pg_size*sizeof(int));
         matrix->decodings.emplace((reed_sol_erased_t){ .data = erased_copy, .size = pg_size }, rectable);
         return rectable;
-#else
-        int *dm_ids = (int*)malloc_or_die(sizeof(int)*(pg_minsize + pg_minsize*pg_minsize + pg_size));
-        int *decoding_matrix = dm_ids + pg_minsize;
-        // we always use row_k_ones=1 and w=8 (OSD_JERASURE_W)
-        if (jerasure_make_decoding_matrix(pg_minsize, pg_size-pg_minsize, OSD_JERASURE_W, matrix->je_data, erased, decoding_matrix, dm_ids) < 0)
-        {
-            free(dm_ids);
-            throw std::runtime_error("jerasure_make_decoding_matrix() failed");
-        }
-        int *erased_copy = dm_ids + pg_minsize + pg_minsize*pg_minsize;
-        memcpy(erased_copy, erased, pg_size*sizeof(int));
-        matrix->decodings.emplace((reed_sol_erased_t){ .data = erased_copy, .size = pg_size }, dm_ids);
-        return dm_ids;
-#endif
-    }
-    return dec_it->second;
-}
-
-#ifndef WITH_ISAL
-#define JERASURE_ALIGNMENT 16
-
-// jerasure requires 16-byte alignment for SSE...
-// FIXME: jerasure/gf-complete should probably be patched to automatically choose non-sse version for unaligned buffers
-static void jerasure_matrix_encode_unaligned(int k, int m, int w, int *matrix, char **data_ptrs, char **coding_ptrs, int size)
-{
-    bool unaligned = false;
-    for (int i = 0; i < k; i++)
-        if (((unsigned long)data_ptrs[i]) % JERASURE_ALIGNMENT)
-            unaligned = true;
-    for (int i = 0; i < m; i++)
-        if (((unsigned long)coding_ptrs[i]) % JERASURE_ALIGNMENT)
-            unaligned = true;
-    if (!unaligned)
-    {
-        jerasure_matrix_encode(k, m, w, matrix, data_ptrs, coding_ptrs, size);
-        return;
-    }
-    int aligned_size = ((size+JERASURE_ALIGNMENT-1)/JERASURE_ALIGNMENT)*JERASURE_ALIGNMENT;
-    int copy_size = aligned_size*(k+m);
-    char local_data[copy_size > 4096 ? 0 : copy_size];
-    char *data_copy = copy_size > 4096 || (unsigned long)local_data % JERASURE_ALIGNMENT
-        ? (char*)memalign_or_die(JERASURE_ALIGNMENT, aligned_size*(k+m))
-        : local_data;
-    char *aligned_ptrs[k+m];
-    for (int i = 0; i < k; i++)
-    {
-        memcpy(data_copy + i*aligned_size, data_ptrs[i], size);
-        aligned_ptrs[i] = data_copy + i*aligned_size;
     }
-    for (int i = 0; i < m; i++)
-        aligned_ptrs[k+i] = data_copy + (k+i)*aligned_size;
-    jerasure_matrix_encode(k, m, w, matrix, aligned_ptrs, aligned_ptrs+k, size);
-    for (int i = 0; i < m; i++)
-        memcpy(coding_ptrs[i], aligned_ptrs[k+i], size);
-    if (copy_size > 4096 || (unsigned long)local_data % JERASURE_ALIGNMENT)
-        free(data_copy);
+    return (uint8_t*)dec_it->second;
 }
-#endif
 
-#ifdef WITH_ISAL
 void reconstruct_stripes_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize, uint32_t bitmap_size)
 {
-    uint8_t *dectable = (uint8_t*)get_jerasure_decoding_matrix(stripes, pg_size, pg_minsize);
+    uint8_t *dectable = get_ec_decoding_tables(stripes, pg_size, pg_minsize);
     if (!dectable)
     {
         return;
@@ -377,7 +294,7 @@ void reconstruct_stripes_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsi
                     data_ptrs[orig++] = (uint8_t*)stripes[other].read_buf + (read_start - stripes[other].read_start);
                 }
             }
-            ec_encode_data(
+            ec_encode(
                 read_end-read_start, pg_minsize, wanted, dectable + wanted_base*32*pg_minsize,
                 data_ptrs, data_ptrs + pg_minsize
             );
@@ -423,113 +340,13 @@ void reconstruct_stripes_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsi
                     data_ptrs[orig++] = (uint8_t*)stripes[other].bmp_buf;
                 }
             }
-            ec_encode_data(
+            ec_encode(
                 bitmap_size, pg_minsize, wanted, dectable,
                 data_ptrs, data_ptrs + pg_minsize
             );
         }
     }
 }
-#else
-void reconstruct_stripes_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize, uint32_t bitmap_size)
-{
-    int *dm_ids = (int*)get_jerasure_decoding_matrix(stripes, pg_size, pg_minsize);
-    if (!dm_ids)
-    {
-        return;
-    }
-    int *decoding_matrix = dm_ids + pg_minsize;
-    char *data_ptrs[pg_size];
-    for (int role = 0; role < pg_size; role++)
-    {
-        data_ptrs[role] = NULL;
-    }
-    bool recovered = false;
-    for (int role = 0; role < pg_minsize; role++)
-    {
-        if (stripes[role].read_end != 0 && stripes[role].missing)
-        {
-            recovered = true;
-            if (stripes[role].read_end > stripes[role].read_start &&
-                stripes[role].read_end != UINT32_MAX)
-            {
-                for (int other = 0; other < pg_size; other++)
-                {
-                    if (stripes[other].read_end != 0 && !stripes[other].missing)
-                    {
-                        assert(stripes[other].read_start <= stripes[role].read_start);
-                        assert(stripes[other].read_end >= stripes[role].read_end);
-                        data_ptrs[other] = (char*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start);
-                    }
-                }
-                data_ptrs[role] = (char*)stripes[role].read_buf;
-                jerasure_matrix_dotprod(
-                    pg_minsize, OSD_JERASURE_W, decoding_matrix+(role*pg_minsize), dm_ids, role,
-                    data_ptrs, data_ptrs+pg_minsize, stripes[role].read_end - stripes[role].read_start
-                );
-            }
-        }
-    }
-    if (recovered && bitmap_size > 0)
-    {
-        bool unaligned = false;
-        for (int role = 0; role < pg_size; role++)
-        {
-            if (stripes[role].read_end != 0)
-            {
-                data_ptrs[role] = (char*)stripes[role].bmp_buf;
-                if (((unsigned long)stripes[role].bmp_buf) % JERASURE_ALIGNMENT)
-                    unaligned = true;
-            }
-        }
-        if (!unaligned)
-        {
-            for (int role = 0; role < pg_minsize; role++)
-            {
-                if (stripes[role].read_end != 0 && stripes[role].missing)
-                {
-                    jerasure_matrix_dotprod(
-                        pg_minsize, OSD_JERASURE_W, decoding_matrix+(role*pg_minsize), dm_ids, role,
-                        data_ptrs, data_ptrs+pg_minsize, bitmap_size
-                    );
-                }
-            }
-        }
-        else
-        {
-            // jerasure_matrix_dotprod requires 16-byte alignment for SSE...
-            int aligned_size = ((bitmap_size+JERASURE_ALIGNMENT-1)/JERASURE_ALIGNMENT)*JERASURE_ALIGNMENT;
-            int copy_size = aligned_size*pg_size;
-            char local_data[copy_size > 4096 ? 0 : copy_size];
-            bool alloc_copy = copy_size > 4096 || (unsigned long)local_data % JERASURE_ALIGNMENT;
-            char *data_copy = alloc_copy
-                ? (char*)memalign_or_die(JERASURE_ALIGNMENT, copy_size)
-                : local_data;
-            for (int role = 0; role < pg_size; role++)
-            {
-                if (stripes[role].read_end != 0)
-                {
-                    data_ptrs[role] = data_copy + role*aligned_size;
-                    memcpy(data_ptrs[role], stripes[role].bmp_buf, bitmap_size);
-                }
-            }
-            for (int role = 0; role < pg_size; role++)
-            {
-                if (stripes[role].read_end != 0 && stripes[role].missing)
-                {
-                    jerasure_matrix_dotprod(
-                        pg_minsize, OSD_JERASURE_W, decoding_matrix+(role*pg_minsize), dm_ids, role,
-                        data_ptrs, data_ptrs+pg_minsize, bitmap_size
-                    );
-                    memcpy(stripes[role].bmp_buf, data_ptrs[role], bitmap_size);
-                }
-            }
-            if (alloc_copy)
-                free(data_copy);
-        }
-    }
-}
-#endif
 
 int extend_missing_stripes(osd_rmw_stripe_t *stripes, osd_num_t *osd_set, int pg_minsize, int pg_size)
 {
@@ -764,34 +581,40 @@ static void get_old_new_buffers(osd_rmw_stripe_t & stripe, uint32_t wr_start, ui
     }
 }
 
-static void xor_multiple_buffers(buf_len_t *xor1, int n1, buf_len_t *xor2, int n2, void *dest, uint32_t len)
+static void xor_multiple_buffers(buf_len_t **bufs, int *nbufs, int n, void *dest, uint32_t len)
 {
-    assert(n1 > 0 && n2 > 0);
-    int i1 = 0, i2 = 0;
-    uint32_t start1 = 0, start2 = 0, end1 = xor1[0].len, end2 = xor2[0].len;
+    // Every source is a list of buffers of the same total length, XOR them all in one pass
+    int idx[n];
+    uint32_t starts[n], ends[n];
+    const void *srcs[n];
+    for (int i = 0; i < n; i++)
+    {
+        assert(nbufs[i] > 0);
+        idx[i] = 0;
+        starts[i] = 0;
+        ends[i] = bufs[i][0].len;
+    }
     uint32_t pos = 0;
     while (pos < len)
     {
         // We know for sure that ranges overlap
-        uint32_t end = std::min(end1, end2);
-        memxor((uint8_t*)xor1[i1].buf + pos-start1, (uint8_t*)xor2[i2].buf + pos-start2, (uint8_t*)dest+pos, end-pos);
+        uint32_t end = len;
+        for (int i = 0; i < n; i++)
+        {
+            if (end > ends[i])
+                end = ends[i];
+            srcs[i] = (uint8_t*)bufs[i][idx[i]].buf + pos-starts[i];
+        }
+        memxor_multi(srcs, n, (uint8_t*)dest+pos, end-pos);
         pos = end;
-        if (pos >= end1)
+        for (int i = 0; i < n; i++)
         {
-            i1++;
-            if (i1 >= n1)
+            if (pos >= ends[i] && idx[i] < nbufs[i]-1)
             {
-                assert(pos >= end2);
-                return;
+                idx[i]++;
+                starts[i] = ends[i];
+                ends[i] += bufs[i][idx[i]].len;
             }
-            start1 = end1;
-            end1 += xor1[i1].len;
-        }
-        if (pos >= end2)
-        {
-            i2++;
-            start2 = end2;
-            end2 += xor2[i2].len;
         }
     }
 }
@@ -907,33 +730,21 @@ void calc_rmw_parity_xor(osd_rmw_stripe_t *stripes, int pg_size, uint64_t *read_
     calc_rmw_parity_copy_mod(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, bitmap_granularity, start, end);
     if (write_osd_set[pg_minsize] != 0 && end != 0)
     {
-        // Calculate new parity (XOR k+1)
-        int parity = pg_minsize, prev = -2;
+        // Calculate new parity (XOR k+1) in one pass over all data stripes
+        int parity = pg_minsize;
+        buf_len_t xor_bufs[pg_minsize][3];
+        buf_len_t *xor_lists[pg_minsize];
+        int xor_counts[pg_minsize];
+        const void *bmp_srcs[pg_minsize];
         for (int other = 0; other < pg_minsize; other++)
         {
-            if (prev == -2)
-            {
-                prev = other;
-            }
-            else
-            {
-                int n1 = 0, n2 = 0;
-                buf_len_t xor1[3], xor2[3];
-                if (prev == -1)
-                {
-                    xor1[n1++] = { .buf = stripes[parity].write_buf, .len = end-start };
-                    memxor(stripes[parity].bmp_buf, stripes[other].bmp_buf, stripes[parity].bmp_buf, bitmap_size);
-                }
-                else
-                {
-                    memxor(stripes[prev].bmp_buf, stripes[other].bmp_buf, stripes[parity].bmp_buf, bitmap_size);
-                    get_old_new_buffers(stripes[prev], start, end, xor1, n1);
-                    prev = -1;
-                }
-                get_old_new_buffers(stripes[other], start, end, xor2, n2);
-                xor_multiple_buffers(xor1, n1, xor2, n2, stripes[parity].write_buf, end-start);
-            }
+            xor_counts[other] = 0;
+            xor_lists[other] = xor_bufs[other];
+            get_old_new_buffers(stripes[other], start, end, xor_bufs[other], xor_counts[other]);
+            bmp_srcs[other] = stripes[other].bmp_buf;
         }
+        memxor_multi(bmp_srcs, pg_minsize, stripes[parity].bmp_buf, bitmap_size);
+        xor_multiple_buffers(xor_lists, xor_counts, pg_minsize, stripes[parity].write_buf, end-start);
     }
     calc_rmw_parity_copy_parity(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, start, end);
 }
@@ -960,12 +771,7 @@ void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
         if (write_parity > 0)
         {
             // First get the coding matrix or sub-matrix
-            void *matrix_data =
-#ifdef WITH_ISAL
-                matrix->isal_data;
-#else
-                matrix->je_data;
-#endif
+            uint8_t *matrix_data = matrix->tables;
             if (!is_seq)
             {
                 // We need a coding sub-matrix
@@ -978,18 +784,13 @@ void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
                 auto sub_it = matrix->subdata.find(missing_parity);
                 if (sub_it == matrix->subdata.end())
                 {
-                    int item_size =
-#ifdef WITH_ISAL
-                        32;
-#else
-                        sizeof(int);
-#endif
-                    void *subm = malloc_or_die(item_size * write_parity * pg_minsize);
+                    int item_size = 32;
+                    uint8_t *subm = (uint8_t*)malloc_or_die(item_size * write_parity * pg_minsize);
                     for (int i = pg_minsize, j = 0; i < pg_size; i++)
                     {
                         if (write_osd_set[i])
                         {
-                            memcpy((uint8_t*)subm + item_size*pg_minsize*j, (uint8_t*)matrix_data + item_size*pg_minsize*(i-pg_minsize), item_size*pg_minsize);
+                            memcpy(subm + item_size*pg_minsize*j, matrix_data + item_size*pg_minsize*(i-pg_minsize), item_size*pg_minsize);
                             j++;
                         }
                     }
@@ -997,7 +798,7 @@ void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
                     matrix_data = subm;
                 }
                 else
-                    matrix_data = sub_it->second;
+                    matrix_data = (uint8_t*)sub_it->second;
             }
             // Calculate new coding chunks
             buf_len_t bufs[pg_size][3];
@@ -1052,17 +853,10 @@ void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
                         }
                     }
                 }
-#ifdef WITH_ISAL
-                ec_encode_data(
-                    next_end-pos, pg_minsize, write_parity, (uint8_t*)matrix_data,
+                ec_encode(
+                    next_end-pos, pg_minsize, write_parity, matrix_data,
                     (uint8_t**)data_ptrs, (uint8_t**)data_ptrs+pg_minsize
                 );
-#else
-                jerasure_matrix_encode(
-                    pg_minsize, write_parity, OSD_JERASURE_W, (int*)matrix_data,
-                    (char**)data_ptrs, (char**)data_ptrs+pg_minsize, next_end-pos
-                );
-#endif
                 pos = next_end;
             }
             for (int i = 0, j = 0; i < pg_size; i++)
@@ -1070,17 +864,10 @@ void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
                 if (i < pg_minsize || write_osd_set[i] != 0)
                     data_ptrs[j++] = stripes[i].bmp_buf;
             }
-#ifdef WITH_ISAL
-            ec_encode_data(
-                bitmap_size, pg_minsize, write_parity, (uint8_t*)matrix_data,
+            ec_encode(
+                bitmap_size, pg_minsize, write_parity, matrix_data,
                 (uint8_t**)data_ptrs, (uint8_t**)data_ptrs+pg_minsize
             );
-#else
-            jerasure_matrix_encode_unaligned(
-                pg_minsize, write_parity, OSD_JERASURE_W, (int*)matrix_data,
-                (char**)data_ptrs, (char**)data_ptrs+pg_minsize, bitmap_size
-            );
-#endif
         }
     }
     calc_rmw_parity_copy_parity(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, start, end);
@@ -1128,6 +915,30 @@ static int c_n_k(int n, int k)
     return c;
 }
 
+// Lane <i> of every block is multiplied by alpha^i and all lanes are XORed together.
+// Any single corrupted byte changes the digest, and it's as fast as EC encoding
+void calc_chunk_digest(uint8_t *buf, uint32_t len, uint8_t *digest)
+{
+    static const uint8_t *tables = []()
+    {
+        uint8_t coefs[OSD_DIGEST_LANES];
+        for (int i = 0; i < OSD_DIGEST_LANES; i++)
+            coefs[i] = gf256().exp[i];
+        uint8_t *t = (uint8_t*)malloc_or_die(32*OSD_DIGEST_LANES);
+        ec_make_tables(OSD_DIGEST_LANES, 1, coefs, t);
+        return t;
+    }();
+    uint8_t *lanes[OSD_DIGEST_LANES];
+    for (uint32_t pos = 0; pos < len; pos += OSD_DIGEST_BLOCK)
+    {
+        uint32_t lane_size = (len-pos < OSD_DIGEST_BLOCK ? len-pos : OSD_DIGEST_BLOCK) / OSD_DIGEST_LANES;
+        for (int i = 0; i < OSD_DIGEST_LANES; i++)
+            lanes[i] = buf + pos + i*lane_size;
+        uint8_t *block_digest = digest + pos/OSD_DIGEST_LANES;
+        ec_encode(lane_size, OSD_DIGEST_LANES, 1, tables, lanes, &block_digest);
+    }
+}
+
 std::vector<int> ec_find_good(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize, bool is_xor,
     uint32_t chunk_size, uint32_t bitmap_size, int max_bruteforce)
 {
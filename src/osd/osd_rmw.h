@@ -57,5 +57,10 @@ void reconstruct_stripes_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsi
 void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
     uint64_t *read_osd_set, uint64_t *write_osd_set, uint32_t chunk_size, uint32_t bitmap_size);
 
+// Digest of <len> bytes is <len>/OSD_DIGEST_LANES bytes long. It's linear over GF(2^8),
+// so digests of EC parity chunks may be checked in the same way as chunks themselves.
+// Each OSD_DIGEST_BLOCK of data is hashed separately so changed blocks may be located
+void calc_chunk_digest(uint8_t *buf, uint32_t len, uint8_t *digest);
+
 std::vector<int> ec_find_good(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize, bool is_xor,
     uint32_t chunk_size, uint32_t bitmap_size, int max_bruteforce);
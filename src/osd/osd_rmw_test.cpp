@@ -31,6 +31,9 @@ void test_recover_22_d2();
 void test_ec43_error_bruteforce();
 void test_recover_53_d5();
 void test_recover_22();
+void test_xor_kernels();
+void test_ec_kernels();
+void test_ec43_digests();
 
 int main(int narg, char *args[])
 {
@@ -73,6 +76,12 @@ int main(int narg, char *args[])
     test_recover_53_d5();
     // Test 20
     test_recover_22();
+    // XOR kernels
+    test_xor_kernels();
+    // EC kernels
+    test_ec_kernels();
+    // Scrub digests
+    test_ec43_digests();
     // End
     printf("all ok\n");
     return 0;
@@ -1343,3 +1352,190 @@ void test_recover_22()
     free(write_buf);
     use_ec(4, 2, false);
 }
+
+void test_xor_kernels()
+{
+    const int max_len = 4096+77, n_src = 5;
+    uint8_t *bufs[n_src], *expected = (uint8_t*)malloc_or_die(max_len), *res = (uint8_t*)malloc_or_die(max_len+1);
+    for (int i = 0; i < n_src; i++)
+    {
+        bufs[i] = (uint8_t*)malloc_or_die(max_len+1);
+        for (int j = 0; j < max_len+1; j++)
+            bufs[i][j] = (uint8_t)(j*(i+3) + (j >> 8)*7 + i);
+    }
+    memxor_kernel_t kernels[MEMXOR_MAX_KERNELS];
+    int n_kernels = memxor_list_kernels(kernels);
+    for (int k = 0; k < n_kernels; k++)
+    {
+        printf("checking %s XOR kernel\n", kernels[k].name);
+        // Check different lengths and unaligned buffers
+        for (int len: { 0, 1, 7, 8, 15, 16, 31, 33, 64, 100, 128, 255, 1000, 4096, max_len })
+        {
+            for (int misalign = 0; misalign < 2; misalign++)
+            {
+                if (len+misalign > max_len+1)
+                    continue;
+                const void *srcs[n_src];
+                for (int i = 0; i < n_src; i++)
+                    srcs[i] = bufs[i]+misalign;
+                memxor_bytewise(srcs[0], srcs[1], expected, len);
+                kernels[k].xor2(srcs[0], srcs[1], res+misalign, len);
+                assert(!memcmp(expected, res+misalign, len));
+                for (int n = 2; n <= n_src; n++)
+                {
+                    memxor_multi_bytewise(srcs, n, expected, len);
+                    kernels[k].xor_multi(srcs, n, res+misalign, len);
+                    assert(!memcmp(expected, res+misalign, len));
+                }
+            }
+        }
+        // In-place operation
+        memcpy(res, bufs[0], max_len);
+        memxor_bytewise(bufs[0], bufs[1], expected, max_len);
+        kernels[k].xor2(res, bufs[1], res, max_len);
+        assert(!memcmp(expected, res, max_len));
+    }
+    for (int i = 0; i < n_src; i++)
+        free(bufs[i]);
+    free(expected);
+    free(res);
+}
+
+void test_ec_kernels()
+{
+    const int max_len = 4096+77, k = 4, rows = 3;
+    uint8_t matrix[k*rows], tables[32*k*rows];
+    for (int i = 0; i < k*rows; i++)
+        matrix[i] = (uint8_t)(i*37 + 1);
+    matrix[1] = 0;
+    ec_make_tables(k, rows, matrix, tables);
+    uint8_t *bufs[k], *expected[rows], *res[rows];
+    for (int i = 0; i < k; i++)
+    {
+        bufs[i] = (uint8_t*)malloc_or_die(max_len+1);
+        for (int j = 0; j < max_len+1; j++)
+            bufs[i][j] = (uint8_t)(j*(i+3) + (j >> 8)*7 + i);
+    }
+    for (int r = 0; r < rows; r++)
+    {
+        expected[r] = (uint8_t*)malloc_or_die(max_len);
+        res[r] = (uint8_t*)malloc_or_die(max_len+1);
+    }
+    ec_kernel_t kernels[EC_MAX_KERNELS];
+    int n_kernels = ec_list_kernels(kernels);
+    for (int n = 0; n < n_kernels; n++)
+    {
+        printf("checking %s EC kernel\n", kernels[n].name);
+        // Check different lengths and unaligned buffers against the multiplication by definition
+        for (int len: { 0, 1, 15, 16, 31, 33, 64, 100, 255, 1000, 4096, max_len })
+        {
+            for (int misalign = 0; misalign < 2; misalign++)
+            {
+                if (len+misalign > max_len+1)
+                    continue;
+                uint8_t *srcs[k], *dsts[rows];
+                for (int i = 0; i < k; i++)
+                    srcs[i] = bufs[i]+misalign;
+                for (int r = 0; r < rows; r++)
+                {
+                    dsts[r] = res[r] + (r == 1 ? 1-misalign : misalign);
+                    for (int j = 0; j < len; j++)
+                    {
+                        uint8_t v = 0;
+                        for (int i = 0; i < k; i++)
+                            v ^= gf256_mul(matrix[r*k + i], srcs[i][j]);
+                        expected[r][j] = v;
+                    }
+                }
+                kernels[n].encode(len, k, rows, tables, srcs, dsts);
+                for (int r = 0; r < rows; r++)
+                    assert(!memcmp(expected[r], dsts[r], len));
+            }
+        }
+    }
+    // Inverted matrix must give the identity when multiplied by the original one
+    uint8_t sq[k*k], sq_copy[k*k], inv[k*k];
+    for (int i = 0; i < k*k; i++)
+        sq[i] = sq_copy[i] = (uint8_t)(i*i*13 + i + 1);
+    assert(ec_invert_matrix(sq_copy, inv, k));
+    for (int i = 0; i < k; i++)
+    {
+        for (int j = 0; j < k; j++)
+        {
+            uint8_t v = 0;
+            for (int l = 0; l < k; l++)
+                v ^= gf256_mul(sq[i*k + l], inv[l*k + j]);
+            assert(v == (i == j));
+        }
+    }
+    for (int i = 0; i < k; i++)
+        free(bufs[i]);
+    for (int r = 0; r < rows; r++)
+    {
+        free(expected[r]);
+        free(res[r]);
+    }
+}
+
+void test_ec43_digests()
+{
+    use_ec(7, 4, true);
+    osd_num_t osd_set[7] = { 1, 2, 3, 4, 5, 6, 7 };
+    osd_rmw_stripe_t stripes[7] = {};
+    split_stripes(4, 4096, 0, 4096 * 4, stripes);
+    uint8_t *write_buf = (uint8_t*)malloc_or_die(4096 * 7);
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4096; j++)
+            write_buf[i*4096 + j] = (uint8_t)(j*(i+3) + (j >> 8)*7 + i);
+    uint8_t *rmw_buf = (uint8_t*)calc_rmw(write_buf, stripes, osd_set, 7, 4, 7, osd_set, 4096, 0);
+    calc_rmw_parity_ec(stripes, 7, 4, osd_set, osd_set, 4096, 0);
+    for (int i = 4; i < 7; i++)
+        memcpy(write_buf+i*4096, stripes[i].write_buf, 4096);
+    // Parity chunk digests must match data chunk digests
+    const int digest_size = 4096/OSD_DIGEST_LANES;
+    uint8_t digests[7*digest_size];
+    uint8_t bitmaps[7] = {};
+    memset(stripes, 0, sizeof(stripes));
+    for (int i = 0; i < 7; i++)
+    {
+        calc_chunk_digest(write_buf+i*4096, 4096, digests+i*digest_size);
+        stripes[i].bmp_buf = bitmaps+i;
+        stripes[i].read_start = 0;
+        stripes[i].read_end = digest_size;
+        stripes[i].read_buf = digests+i*digest_size;
+        stripes[i].write_buf = NULL;
+    }
+    auto res = ec_find_good(stripes, 7, 4, false, digest_size, 0, 100);
+    assert_eq_vec(res, std::vector<int>({0, 1, 2, 3, 4, 5, 6}));
+    // Any changed byte changes the digest
+    for (int pos: { 0, 1, 4095 })
+    {
+        write_buf[2*4096 + pos] ^= 0x40;
+        calc_chunk_digest(write_buf+2*4096, 4096, digests+2*digest_size);
+        res = ec_find_good(stripes, 7, 4, false, digest_size, 0, 100);
+        assert_eq_vec(res, std::vector<int>({0, 1, 3, 4, 5, 6}));
+        write_buf[2*4096 + pos] ^= 0x40;
+    }
+    calc_chunk_digest(write_buf+2*4096, 4096, digests+2*digest_size);
+    // Swapped lanes too
+    const int lane_size = 4096/OSD_DIGEST_LANES;
+    uint8_t tmp[lane_size];
+    memcpy(tmp, write_buf+3*4096, lane_size);
+    memcpy(write_buf+3*4096, write_buf+3*4096+lane_size, lane_size);
+    memcpy(write_buf+3*4096+lane_size, tmp, lane_size);
+    calc_chunk_digest(write_buf+3*4096, 4096, digests+3*digest_size);
+    res = ec_find_good(stripes, 7, 4, false, digest_size, 0, 100);
+    assert_eq_vec(res, std::vector<int>({0, 1, 2, 4, 5, 6}));
+    // Blocks are hashed separately, so a change only affects the digest of its block
+    uint8_t block_digests[2][4*digest_size];
+    calc_chunk_digest(write_buf, 4*4096, block_digests[0]);
+    write_buf[2*4096+100] ^= 1;
+    calc_chunk_digest(write_buf, 4*4096, block_digests[1]);
+    write_buf[2*4096+100] ^= 1;
+    for (int i = 0; i < 4; i++)
+        assert((memcmp(block_digests[0]+i*digest_size, block_digests[1]+i*digest_size, digest_size) != 0) == (i == 2));
+    // Done
+    free(rmw_buf);
+    free(write_buf);
+    use_ec(7, 4, false);
+}
@@ -369,6 +369,94 @@ void osd_t::schedule_scrub(pg_t & pg)
     }
 }
 
+void osd_t::submit_scrub_subops(osd_op_t *cur_op, int submit_type)
+{
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    int n_copies = 0;
+    for (int role = 0; role < op_data->pg_size; role++)
+    {
+        op_data->stripes[role].not_exists = false;
+        if (op_data->prev_set[role] != 0)
+            n_copies++;
+    }
+    osd_op_t *subops = new osd_op_t[n_copies];
+    op_data->fact_ver = 0;
+    op_data->done = op_data->errors = op_data->errcode = 0;
+    op_data->n_subops = n_copies;
+    op_data->subops = subops;
+    int sent = submit_primary_subop_batch(submit_type, op_data->oid.inode, op_data->target_ver,
+        op_data->stripes, op_data->prev_set, cur_op, 0, -1);
+    assert(sent == n_copies);
+}
+
+// Check digests returned by SUBMIT_SCRUB_DIGEST. Returns true if all chunks were read
+// successfully and match each other, false if full data should be compared
+bool osd_t::check_scrub_digests(osd_op_t *cur_op)
+{
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    if (op_data->errors > 0)
+    {
+        return false;
+    }
+    uint32_t digest_size = bs_block_size / OSD_DIGEST_LANES;
+    osd_rmw_stripe_t digest_stripes[op_data->pg_size];
+    uint8_t *local_digest = NULL;
+    int total = 0;
+    for (int role = 0; role < op_data->pg_size; role++)
+    {
+        if (!op_data->stripes[role].missing && op_data->stripes[role].not_exists)
+        {
+            return false;
+        }
+    }
+    for (int role = 0; role < op_data->pg_size; role++)
+    {
+        osd_rmw_stripe_t & si = op_data->stripes[role];
+        digest_stripes[role] = si;
+        if (si.missing)
+        {
+            continue;
+        }
+        total++;
+        if (si.osd_num == this->osd_num)
+        {
+            // The local chunk is read fully
+            local_digest = (uint8_t*)malloc_or_die(digest_size);
+            calc_chunk_digest((uint8_t*)si.read_buf, bs_block_size, local_digest);
+            digest_stripes[role].read_buf = local_digest;
+        }
+        digest_stripes[role].read_end = digest_size;
+    }
+    bool match = true;
+    if (op_data->scheme == POOL_SCHEME_REPLICATED)
+    {
+        int first = -1;
+        for (int role = 0; role < op_data->pg_size && match; role++)
+        {
+            if (digest_stripes[role].missing)
+                continue;
+            if (first < 0)
+                first = role;
+            else if (memcmp(digest_stripes[role].read_buf, digest_stripes[first].read_buf, digest_size) != 0)
+                match = false;
+        }
+    }
+    else
+    {
+        // Digests are linear, so parity chunk digests are checked just like chunks
+        auto good_subset = ec_find_good(
+            digest_stripes, op_data->pg_size, op_data->pg_data_size, op_data->scheme == POOL_SCHEME_XOR,
+            digest_size, 0, scrub_ec_max_bruteforce
+        );
+        match = good_subset.size() == total;
+    }
+    if (local_digest)
+    {
+        free(local_digest);
+    }
+    return match;
+}
+
 void osd_t::continue_primary_scrub(osd_op_t *cur_op)
 {
     if (!cur_op->op_data && !prepare_primary_rw(cur_op))
@@ -378,6 +466,10 @@ void osd_t::continue_primary_scrub(osd_op_t *cur_op)
         goto resume_1;
     else if (op_data->st == 2)
         goto resume_2;
+    else if (op_data->st == 3)
+        goto resume_3;
+    else if (op_data->st == 4)
+        goto resume_4;
     {
         auto & pg = pgs.at({ .pool_id = INODE_POOL(op_data->oid.inode), .pg_num = op_data->pg_num });
         cur_op->req.rw.len = bs_block_size * pg.pg_data_size;
@@ -414,18 +506,28 @@ void osd_t::continue_primary_scrub(osd_op_t *cur_op)
             return;
         }
         cur_op->buf = alloc_read_buffer(op_data->stripes, op_data->pg_size, 0);
-        // Submit reads
-        osd_op_t *subops = new osd_op_t[n_copies];
-        op_data->fact_ver = 0;
-        op_data->done = op_data->errors = op_data->errcode = 0;
-        op_data->n_subops = n_copies;
-        op_data->subops = subops;
-        int sent = submit_primary_subop_batch(SUBMIT_SCRUB_READ, op_data->oid.inode, op_data->target_ver,
-            op_data->stripes, op_data->prev_set, cur_op, 0, -1);
-        assert(sent == n_copies);
+        if (scrub_digests)
+        {
+            // Compare chunk digests first to not transfer all data over the network
+            submit_scrub_subops(cur_op, SUBMIT_SCRUB_DIGEST);
+            op_data->st = 3;
+            return;
+        }
+        submit_scrub_subops(cur_op, SUBMIT_SCRUB_READ);
         op_data->st = 1;
     }
 resume_1:
+resume_3:
+    return;
+resume_4:
+    if (check_scrub_digests(cur_op))
+    {
+        finish_op(cur_op, 0);
+        return;
+    }
+    // Digests don't match or some chunks are unreadable, read and compare full data
+    submit_scrub_subops(cur_op, SUBMIT_SCRUB_READ);
+    op_data->st = 1;
     return;
 resume_2:
     if (op_data->errors > 0)
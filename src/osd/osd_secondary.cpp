@@ -2,6 +2,7 @@
 // License: VNPL-1.1 (see README.md for details)
 
 #include "osd.h"
+#include "osd_rmw.h"
 #ifdef WITH_RDMA
 #include "msgr_rdma.h"
 #endif
@@ -11,6 +12,7 @@
 void osd_t::secondary_op_callback(osd_op_t *op)
 {
     if (op->req.hdr.opcode == OSD_OP_SEC_READ ||
+        op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST ||
         op->req.hdr.opcode == OSD_OP_SEC_WRITE ||
         op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE)
     {
@@ -29,6 +31,24 @@ void osd_t::secondary_op_callback(osd_op_t *op)
         if (op->bs_op->retval > 0)
             op->iov.push_back(op->buf, op->bs_op->retval);
     }
+    else if (op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST)
+    {
+        if (op->bs_op->retval >= 0)
+            op->reply.sec_rw.attr_len = clean_entry_bitmap_size;
+        else
+            op->reply.sec_rw.attr_len = 0;
+        if (op->bs_op->retval > 0)
+        {
+            // Send the digest instead of data
+            uint32_t digest_size = op->bs_op->retval / OSD_DIGEST_LANES;
+            void *digest = malloc_or_die(digest_size);
+            calc_chunk_digest((uint8_t*)op->buf, op->bs_op->retval, (uint8_t*)digest);
+            free(op->buf);
+            op->buf = digest;
+            op->bs_op->retval = digest_size;
+            op->iov.push_back(op->buf, digest_size);
+        }
+    }
     else if (op->req.hdr.opcode == OSD_OP_SEC_LIST)
     {
         // allocated by blockstore
@@ -84,25 +104,30 @@ void osd_t::exec_secondary_real(osd_op_t *cur_op)
     if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ_BMP)
     {
         int n = cur_op->req.sec_read_bmp.len / sizeof(obj_ver_id);
+        bool with_stable = (cur_op->req.sec_read_bmp.flags & OSD_SEC_READ_BMP_STABLE);
+        int entry_size = (with_stable ? 16 : 8) + clean_entry_bitmap_size;
         if (n > 0)
         {
             obj_ver_id *ov = (obj_ver_id*)cur_op->buf;
-            void *reply_buf = malloc_or_die(n * (8 + clean_entry_bitmap_size));
+            void *reply_buf = malloc_or_die(n * entry_size);
             void *cur_buf = reply_buf;
             for (int i = 0; i < n; i++)
             {
-                bs->read_bitmap(ov[i].oid, ov[i].version, (uint8_t*)cur_buf + sizeof(uint64_t), (uint64_t*)cur_buf);
-                cur_buf = (uint8_t*)cur_buf + (8 + clean_entry_bitmap_size);
+                bs->read_bitmap(ov[i].oid, ov[i].version, (uint8_t*)cur_buf + (with_stable ? 16 : 8), (uint64_t*)cur_buf);
+                if (with_stable)
+                    *((uint64_t*)cur_buf + 1) = bs->read_stable_version(ov[i].oid);
+                cur_buf = (uint8_t*)cur_buf + entry_size;
             }
             free(cur_op->buf);
             cur_op->buf = reply_buf;
         }
-        finish_op(cur_op, n * (8 + clean_entry_bitmap_size));
+        finish_op(cur_op, n * entry_size);
         return;
     }
     cur_op->bs_op = new blockstore_op_t();
     cur_op->bs_op->callback = [this, cur_op](blockstore_op_t* bs_op) { secondary_op_callback(cur_op); };
-    cur_op->bs_op->opcode = (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ? BS_OP_READ
+    cur_op->bs_op->opcode = (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST ? BS_OP_READ
         : (cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE ? BS_OP_WRITE
         : (cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE ? BS_OP_WRITE_STABLE
         : (cur_op->req.hdr.opcode == OSD_OP_SEC_SYNC ? BS_OP_SYNC
@@ -112,10 +137,12 @@ void osd_t::exec_secondary_real(osd_op_t *cur_op)
         : (cur_op->req.hdr.opcode == OSD_OP_SEC_LIST ? BS_OP_LIST
         : -1))))))));
     if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE)
     {
-        if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ)
+        if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
+            cur_op->req.hdr.opcode == OSD_OP_SEC_READ_DIGEST)
         {
             // Allocate memory for the read operation
             if (clean_entry_bitmap_size > sizeof(unsigned))
@@ -0,0 +1,271 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <utility>
+
+#include "cpp-btree/btree_map.h"
+
+#include "object_id.h"
+
+struct pg_osd_set_state_t;
+
+// <count> objects of one inode with stripes <start>, <start>+<step>, ... sharing one state
+struct pg_obj_state_range_t
+{
+    uint64_t count;
+    uint64_t step;
+    pg_osd_set_state_t *state;
+};
+
+// Map of unclean PG objects to their states, stored as run-length ranges.
+//
+// Objects of one PG are spread over the inode with a fixed step (pg_count stripes,
+// or 1 stripe inside a pg_stripe_size block), and after an OSD failure all of them
+// usually get the same state. So a range of such objects takes one entry instead
+// of one entry per object. Ranges never overlap: an object inserted between two
+// objects of a range splits it.
+class pg_obj_state_map_t
+{
+    typedef btree::btree_map<object_id, pg_obj_state_range_t> range_map_t;
+
+    range_map_t ranges;
+    uint64_t total = 0;
+
+    // Find the range containing <oid> and the index of <oid> in it
+    bool locate(const object_id & oid, range_map_t::iterator & rit, uint64_t & idx)
+    {
+        rit = ranges.upper_bound(oid);
+        if (rit == ranges.begin())
+            return false;
+        rit--;
+        if (rit->first.inode != oid.inode)
+            return false;
+        uint64_t diff = oid.stripe - rit->first.stripe;
+        if (rit->second.count == 1 || diff % rit->second.step)
+        {
+            idx = 0;
+            return diff == 0;
+        }
+        idx = diff / rit->second.step;
+        return idx < rit->second.count;
+    }
+
+    // Find the first object after <oid> (or starting from <oid> if <inclusive>)
+    void seek(const object_id & oid, bool inclusive, range_map_t::iterator & rit, uint64_t & idx)
+    {
+        rit = ranges.upper_bound(oid);
+        idx = 0;
+        if (rit != ranges.begin())
+        {
+            auto prev = std::prev(rit);
+            if (prev->first.inode == oid.inode)
+            {
+                uint64_t diff = oid.stripe - prev->first.stripe;
+                uint64_t i = prev->second.count == 1
+                    ? (diff == 0 && inclusive ? 0 : 1)
+                    : (inclusive ? (diff + prev->second.step - 1) / prev->second.step : diff / prev->second.step + 1);
+                if (i < prev->second.count)
+                {
+                    rit = prev;
+                    idx = i;
+                }
+            }
+        }
+    }
+
+public:
+    class iterator
+    {
+        friend class pg_obj_state_map_t;
+        range_map_t::iterator rit, end;
+        uint64_t idx = 0;
+        std::pair<object_id, pg_osd_set_state_t*> cur;
+
+        iterator(range_map_t::iterator rit, range_map_t::iterator end, uint64_t idx): rit(rit), end(end), idx(idx)
+        {
+            fill();
+        }
+
+        void fill()
+        {
+            if (rit != end)
+            {
+                cur.first = { .inode = rit->first.inode, .stripe = rit->first.stripe + idx*rit->second.step };
+                cur.second = rit->second.state;
+            }
+        }
+
+    public:
+        iterator() {}
+
+        const std::pair<object_id, pg_osd_set_state_t*> & operator * () const { return cur; }
+        const std::pair<object_id, pg_osd_set_state_t*> * operator -> () const { return &cur; }
+        bool operator == (const iterator & other) const { return rit == other.rit && idx == other.idx; }
+        bool operator != (const iterator & other) const { return rit != other.rit || idx != other.idx; }
+
+        iterator & operator ++ ()
+        {
+            if (++idx >= rit->second.count)
+            {
+                rit++;
+                idx = 0;
+            }
+            fill();
+            return *this;
+        }
+
+        iterator operator ++ (int)
+        {
+            iterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+
+        // Skip remaining objects of the current range, they all have the same state
+        void next_range()
+        {
+            rit++;
+            idx = 0;
+            fill();
+        }
+    };
+
+    uint64_t size() const
+    {
+        return total;
+    }
+
+    // Number of stored ranges, for memory usage estimation
+    uint64_t range_count() const
+    {
+        return ranges.size();
+    }
+
+    void clear()
+    {
+        ranges.clear();
+        total = 0;
+    }
+
+    iterator begin()
+    {
+        return iterator(ranges.begin(), ranges.end(), 0);
+    }
+
+    iterator end()
+    {
+        return iterator(ranges.end(), ranges.end(), 0);
+    }
+
+    iterator lower_bound(const object_id & oid)
+    {
+        range_map_t::iterator rit;
+        uint64_t idx;
+        seek(oid, true, rit, idx);
+        return iterator(rit, ranges.end(), idx);
+    }
+
+    iterator upper_bound(const object_id & oid)
+    {
+        range_map_t::iterator rit;
+        uint64_t idx;
+        seek(oid, false, rit, idx);
+        return iterator(rit, ranges.end(), idx);
+    }
+
+    // Returns the state of <oid> or NULL if it's not in the map
+    pg_osd_set_state_t *get(const object_id & oid)
+    {
+        range_map_t::iterator rit;
+        uint64_t idx;
+        return locate(oid, rit, idx) ? rit->second.state : NULL;
+    }
+
+    bool erase(const object_id & oid)
+    {
+        range_map_t::iterator rit;
+        uint64_t idx;
+        if (!locate(oid, rit, idx))
+            return false;
+        total--;
+        object_id start = rit->first;
+        pg_obj_state_range_t r = rit->second;
+        if (r.count == 1)
+        {
+            ranges.erase(rit);
+        }
+        else if (idx == 0)
+        {
+            ranges.erase(rit);
+            start.stripe += r.step;
+            r.count--;
+            ranges[start] = r;
+        }
+        else if (idx == r.count-1)
+        {
+            rit->second.count--;
+        }
+        else
+        {
+            // Split the range
+            rit->second.count = idx;
+            start.stripe += (idx+1)*r.step;
+            r.count -= idx+1;
+            ranges[start] = r;
+        }
+        return true;
+    }
+
+    void set(const object_id & oid, pg_osd_set_state_t *state)
+    {
+        erase(oid);
+        total++;
+        auto next = ranges.upper_bound(oid);
+        if (next != ranges.begin())
+        {
+            auto prev = std::prev(next);
+            auto & r = prev->second;
+            if (prev->first.inode == oid.inode)
+            {
+                uint64_t last = prev->first.stripe + (r.count-1)*r.step;
+                if (oid.stripe < last)
+                {
+                    // <oid> is between objects of the range, split it
+                    uint64_t idx = (oid.stripe - prev->first.stripe) / r.step + 1;
+                    pg_obj_state_range_t tail = { .count = r.count-idx, .step = r.step, .state = r.state };
+                    r.count = idx;
+                    ranges[(object_id){ .inode = oid.inode, .stripe = prev->first.stripe + idx*tail.step }] = tail;
+                }
+                else if (r.state == state && (r.count == 1 || oid.stripe == last + r.step))
+                {
+                    // Append to the previous range and join it with the next one if possible
+                    if (r.count == 1)
+                        r.step = oid.stripe - prev->first.stripe;
+                    r.count++;
+                    if (next != ranges.end() && next->first.inode == oid.inode && next->second.state == state &&
+                        next->first.stripe == oid.stripe + r.step && (next->second.count == 1 || next->second.step == r.step))
+                    {
+                        r.count += next->second.count;
+                        ranges.erase(next);
+                    }
+                    return;
+                }
+            }
+        }
+        next = ranges.upper_bound(oid);
+        if (next != ranges.end() && next->first.inode == oid.inode && next->second.state == state &&
+            (next->second.count == 1 || next->first.stripe - oid.stripe == next->second.step))
+        {
+            // Prepend to the next range
+            pg_obj_state_range_t r = next->second;
+            r.step = next->first.stripe - oid.stripe;
+            r.count++;
+            ranges.erase(next);
+            ranges[oid] = r;
+            return;
+        }
+        ranges[oid] = (pg_obj_state_range_t){ .count = 1, .step = 0, .state = state };
+    }
+};
@@ -0,0 +1,69 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+
+#include "osd_state_map.h"
+
+// Compare pg_obj_state_map_t with a plain map after random insertions and deletions
+static void check(pg_obj_state_map_t & m, std::map<object_id, pg_osd_set_state_t*> & ref)
+{
+    assert(m.size() == ref.size());
+    auto it = m.begin();
+    for (auto & p: ref)
+    {
+        assert(it != m.end());
+        assert(it->first == p.first && it->second == p.second);
+        assert(m.get(p.first) == p.second);
+        it++;
+    }
+    assert(it == m.end());
+}
+
+int main(int narg, char *args[])
+{
+    pg_osd_set_state_t *states[3] = { (pg_osd_set_state_t*)8, (pg_osd_set_state_t*)16, (pg_osd_set_state_t*)24 };
+    srand(1);
+    for (int test = 0; test < 200; test++)
+    {
+        pg_obj_state_map_t m;
+        std::map<object_id, pg_osd_set_state_t*> ref;
+        for (int i = 0; i < 500; i++)
+        {
+            object_id oid = { .inode = 1 + (uint64_t)rand() % 2, .stripe = (uint64_t)(rand() % 64) * 4096 * (test % 2 ? 1 : 3) };
+            if (rand() % 3 == 0)
+            {
+                assert(m.erase(oid) == (ref.erase(oid) > 0));
+            }
+            else
+            {
+                auto st = states[test % 4 == 0 ? 0 : rand() % 3];
+                m.set(oid, st);
+                ref[oid] = st;
+            }
+            assert(m.get(oid) == (ref.find(oid) != ref.end() ? ref[oid] : NULL));
+            auto lb = m.lower_bound(oid);
+            auto ref_lb = ref.lower_bound(oid);
+            assert(ref_lb == ref.end() ? lb == m.end() : lb->first == ref_lb->first);
+            auto ub = m.upper_bound(oid);
+            auto ref_ub = ref.upper_bound(oid);
+            assert(ref_ub == ref.end() ? ub == m.end() : ub->first == ref_ub->first);
+        }
+        check(m, ref);
+    }
+    // Objects of one PG with the same state take a single range
+    pg_obj_state_map_t m;
+    for (uint64_t i = 0; i < 100000; i++)
+    {
+        m.set((object_id){ .inode = 1, .stripe = i*256*131072 }, states[0]);
+    }
+    assert(m.size() == 100000 && m.range_count() == 1);
+    m.erase((object_id){ .inode = 1, .stripe = 500ul*256*131072 });
+    assert(m.size() == 99999 && m.range_count() == 2);
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+/**
+ * dirty_db microbenchmark: std::map vs obj_ver_map_t under a small-write pattern
+ * Usage: dirty_db_bench [objects] [writes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "blockstore_dirty_db.h"
+
+// Same size as dirty_entry
+struct __attribute__((__packed__)) bench_entry_t
+{
+    uint32_t state;
+    uint32_t flags;
+    uint64_t location;
+    uint32_t offset;
+    uint32_t len;
+    uint64_t journal_sector;
+    void* dyn_data;
+};
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1000000000.0;
+}
+
+static std::map<obj_ver_id, bench_entry_t>::iterator find_last(std::map<obj_ver_id, bench_entry_t> & db, const object_id & oid)
+{
+    auto it = db.upper_bound((obj_ver_id){ .oid = oid, .version = UINT64_MAX });
+    if (it == db.begin())
+        return db.end();
+    it--;
+    return it->first.oid == oid ? it : db.end();
+}
+
+static obj_ver_map_t<bench_entry_t>::iterator find_last(obj_ver_map_t<bench_entry_t> & db, const object_id & oid)
+{
+    return db.find_last(oid);
+}
+
+template<class T> void bench(const char *name, uint64_t objects, uint64_t writes)
+{
+    size_t mem_before = mallinfo2().uordblks;
+    T *db = new T;
+    for (uint64_t i = 0; i < objects; i++)
+    {
+        // Objects are spread over inodes like in a real cluster
+        object_id oid = { .inode = (i*0x9E3779B97F4A7C15) >> 16, .stripe = (i % 1024) << 17 };
+        db->emplace((obj_ver_id){ .oid = oid, .version = 1 }, (bench_entry_t){ .state = 1 });
+    }
+    size_t mem_after = mallinfo2().uordblks;
+    // Small write: look up the latest version, add the next one,
+    // and drop the oldest one like the flusher does
+    uint64_t seed = 1;
+    double start = now();
+    for (uint64_t w = 0; w < writes; w++)
+    {
+        seed = seed*6364136223846793005 + 1442695040888963407;
+        uint64_t i = (seed >> 33) % objects;
+        object_id oid = { .inode = (i*0x9E3779B97F4A7C15) >> 16, .stripe = (i % 1024) << 17 };
+        auto it = find_last(*db, oid);
+        uint64_t version = it->first.version;
+        it = db->emplace((obj_ver_id){ .oid = oid, .version = version+1 }, (bench_entry_t){ .state = 1 }).first;
+        if (version > 1)
+            db->erase(std::prev(std::prev(it)));
+    }
+    double elapsed = now()-start;
+    printf("%-16s: %.2f M writes/s, %ju bytes per entry\n", name, writes/elapsed/1000000,
+        (mem_after-mem_before)/objects);
+    delete db;
+}
+
+int main(int narg, char *args[])
+{
+    uint64_t objects = narg > 1 ? strtoull(args[1], NULL, 10) : 1000000;
+    uint64_t writes = narg > 2 ? strtoull(args[2], NULL, 10) : 10000000;
+    if (!objects)
+    {
+        fprintf(stderr, "Usage: %s [objects] [writes]\n", args[0]);
+        return 1;
+    }
+    bench<std::map<obj_ver_id, bench_entry_t>>("std::map", objects, writes);
+    bench<obj_ver_map_t<bench_entry_t>>("obj_ver_map_t", objects, writes);
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+/**
+ * Reed-Solomon EC kernel microbenchmark
+ * Usage: ec_bench [chunk_size] [total_mb]
+ *
+ * For every pg_size/pg_minsize combination and every kernel supported by the CPU measures:
+ * - full stripe encode (all parity chunks from all data chunks)
+ * - 4 KB partial stripe encode, like calc_rmw_parity_ec() does for small writes
+ * - reconstruction of pg_size-pg_minsize lost data chunks
+ * Speed is given in GB/s of source data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+extern "C" {
+#include <reed_sol.h>
+}
+
+#include "malloc_or_die.h"
+#include "osd_ec.h"
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1000000000.0;
+}
+
+static double bench(const ec_kernel_t & kernel, uint64_t total, int len, int k, int rows, uint8_t *tables, uint8_t **src, uint8_t **dst)
+{
+    uint64_t iters = total / len / k;
+    if (kernel.encode == ec_encode_generic)
+        iters = (iters+15)/16;
+    if (!iters)
+        iters = 1;
+    double start = now();
+    for (uint64_t it = 0; it < iters; it++)
+    {
+        kernel.encode(len, k, rows, tables, src, dst);
+    }
+    return (double)iters*k*len/1024/1024/1024 / (now()-start);
+}
+
+int main(int narg, char *args[])
+{
+    uint64_t chunk_size = narg > 1 ? strtoull(args[1], NULL, 10) : 128*1024;
+    uint64_t total = (narg > 2 ? strtoull(args[2], NULL, 10) : 4096) * 1024*1024;
+    if (!chunk_size)
+    {
+        fprintf(stderr, "Usage: %s [chunk_size] [total_mb]\n", args[0]);
+        return 1;
+    }
+    const int schemes[][2] = { { 3, 2 }, { 4, 2 }, { 6, 4 }, { 7, 4 }, { 10, 8 } };
+    ec_kernel_t kernels[EC_MAX_KERNELS];
+    int n_kernels = ec_list_kernels(kernels);
+    printf("chunk size %ju, default kernel: %s\n", chunk_size, ec_best_kernel().name);
+    for (auto & scheme: schemes)
+    {
+        int pg_size = scheme[0], pg_minsize = scheme[1], m = pg_size-pg_minsize;
+        uint8_t *bufs[pg_size];
+        for (int i = 0; i < pg_size; i++)
+        {
+            bufs[i] = (uint8_t*)memalign_or_die(64, chunk_size);
+            for (uint64_t j = 0; j < chunk_size; j++)
+                bufs[i][j] = (uint8_t)(j*(i+1));
+        }
+        // Encoding tables, same as in use_ec()
+        int *je_matrix = reed_sol_vandermonde_coding_matrix(pg_minsize, m, 8);
+        uint8_t matrix[pg_minsize*m];
+        for (int i = 0; i < pg_minsize*m; i++)
+            matrix[i] = je_matrix[i];
+        free(je_matrix);
+        uint8_t enc_tables[32*pg_minsize*m];
+        ec_make_tables(pg_minsize, m, matrix, enc_tables);
+        // Decoding tables for the first <m> data chunks lost
+        uint8_t submatrix[pg_minsize*pg_minsize], inverted[pg_minsize*pg_minsize];
+        for (int i = 0; i < pg_minsize; i++)
+        {
+            for (int j = 0; j < pg_minsize; j++)
+                submatrix[i*pg_minsize + j] = i < pg_minsize-m ? (j == i+m) : matrix[(i-pg_minsize+m)*pg_minsize + j];
+        }
+        if (!ec_invert_matrix(submatrix, inverted, pg_minsize))
+        {
+            fprintf(stderr, "failed to invert matrix for %d/%d\n", pg_size, pg_minsize);
+            return 1;
+        }
+        uint8_t dec_tables[32*pg_minsize*m];
+        ec_make_tables(pg_minsize, m, inverted, dec_tables);
+        uint8_t *dec_src[pg_minsize];
+        for (int i = 0; i < pg_minsize; i++)
+            dec_src[i] = bufs[i+m];
+        for (int n = 0; n < n_kernels; n++)
+        {
+            double encode = bench(kernels[n], total, chunk_size, pg_minsize, m, enc_tables, bufs, bufs+pg_minsize);
+            double small = bench(kernels[n], total/16, chunk_size < 4096 ? chunk_size : 4096, pg_minsize, m, enc_tables, bufs, bufs+pg_minsize);
+            double decode = bench(kernels[n], total, chunk_size, pg_minsize, m, dec_tables, dec_src, bufs);
+            printf("EC %d+%d, %-8s: encode %8.2f GB/s, 4k rmw encode %8.2f GB/s, decode %8.2f GB/s\n",
+                pg_minsize, m, kernels[n].name, encode, small, decode);
+        }
+        for (int i = 0; i < pg_size; i++)
+            free(bufs[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+/**
+ * Blockstore startup benchmark: fills metadata of a file-backed blockstore with
+ * entries of random objects and measures the time to load it.
+ * Files are only created and filled if they don't exist yet, so the same metadata is loaded
+ * by subsequent runs. Drop page cache (echo 3 > /proc/sys/vm/drop_caches) between runs
+ * to measure cold starts.
+ * Usage: meta_load_bench <dir> [blocks] [meta_load_threads] [inmemory_metadata]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#include "blockstore_impl.h"
+#include "epoll_manager.h"
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1000000000.0;
+}
+
+static bool file_exists(const std::string & path, uint64_t size)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && st.st_size == size;
+}
+
+static void create_file(const std::string & path, uint64_t size)
+{
+    int fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0)
+    {
+        perror(path.c_str());
+        exit(1);
+    }
+    close(fd);
+}
+
+static void fill_metadata(blockstore_config_t config, uint64_t blocks)
+{
+    blockstore_disk_t dsk;
+    dsk.parse_config(config);
+    dsk.open_data();
+    dsk.open_meta();
+    dsk.open_journal();
+    dsk.calc_lengths();
+    uint64_t buf_size = 4*1024*1024;
+    uint8_t *buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, buf_size);
+    memset(buf, 0, dsk.meta_block_size);
+    blockstore_meta_header_v2_t *hdr = (blockstore_meta_header_v2_t *)buf;
+    hdr->zero = 0;
+    hdr->magic = BLOCKSTORE_META_MAGIC_V1;
+    hdr->version = BLOCKSTORE_META_FORMAT_V2;
+    hdr->meta_block_size = dsk.meta_block_size;
+    hdr->data_block_size = dsk.data_block_size;
+    hdr->bitmap_granularity = dsk.bitmap_granularity;
+    hdr->data_csum_type = dsk.data_csum_type;
+    hdr->csum_block_size = dsk.csum_block_size;
+    hdr->header_csum = 0;
+    hdr->header_csum = crc32c(0, hdr, sizeof(*hdr));
+    if (pwrite(dsk.meta_fd, buf, dsk.meta_block_size, dsk.meta_offset) != dsk.meta_block_size)
+    {
+        perror("write metadata header");
+        exit(1);
+    }
+    uint64_t entries_per_block = dsk.meta_block_size / dsk.clean_entry_size;
+    uint64_t block_num = 0;
+    for (uint64_t pos = dsk.meta_block_size; pos < dsk.meta_len && block_num < blocks; pos += buf_size)
+    {
+        uint64_t len = dsk.meta_len-pos < buf_size ? dsk.meta_len-pos : buf_size;
+        memset(buf, 0, len);
+        for (uint64_t sector = 0; sector < len; sector += dsk.meta_block_size)
+        {
+            for (uint64_t i = 0; i < entries_per_block && block_num < blocks; i++, block_num++)
+            {
+                clean_disk_entry *entry = (clean_disk_entry*)(buf + sector + i*dsk.clean_entry_size);
+                // Objects are spread over inodes like in a real cluster
+                entry->oid = { .inode = 1 + ((block_num*0x9E3779B97F4A7C15) >> 60), .stripe = ((block_num*0x9E3779B97F4A7C15) >> 20) << 17 };
+                entry->version = 1;
+                memset(entry->bitmap, 0xff, 2*dsk.clean_entry_bitmap_size);
+                *(uint32_t*)((uint8_t*)entry + dsk.clean_entry_size - 4) = crc32c(0, entry, dsk.clean_entry_size - 4);
+            }
+        }
+        if (pwrite(dsk.meta_fd, buf, len, dsk.meta_offset + pos) != len)
+        {
+            perror("write metadata");
+            exit(1);
+        }
+    }
+    fsync(dsk.meta_fd);
+    free(buf);
+    dsk.close_all();
+}
+
+int main(int narg, char *args[])
+{
+    if (narg < 2)
+    {
+        fprintf(stderr, "Usage: %s <dir> [blocks] [meta_load_threads] [inmemory_metadata]\n", args[0]);
+        return 1;
+    }
+    std::string dir = args[1];
+    uint64_t blocks = narg > 2 ? strtoull(args[2], NULL, 10) : 1024*1024;
+    blockstore_config_t config;
+    config["data_device"] = dir+"/bench_data.bin";
+    config["meta_device"] = dir+"/bench_meta.bin";
+    config["journal_device"] = dir+"/bench_journal.bin";
+    config["meta_load_threads"] = narg > 3 ? args[3] : "0";
+    config["inmemory_metadata"] = narg > 4 ? args[4] : "true";
+    config["disable_data_fsync"] = "true";
+    config["disable_meta_fsync"] = "true";
+    config["disable_journal_fsync"] = "true";
+    if (!file_exists(config["data_device"], blocks*128*1024) ||
+        !file_exists(config["meta_device"], 4096 + blocks*64) ||
+        !file_exists(config["journal_device"], 16*1024*1024))
+    {
+        create_file(config["data_device"], blocks*128*1024);
+        create_file(config["meta_device"], 4096 + blocks*64);
+        create_file(config["journal_device"], 16*1024*1024);
+        fill_metadata(config, blocks);
+    }
+    ring_loop_t *ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE);
+    epoll_manager_t *epmgr = new epoll_manager_t(ringloop);
+    double start = now();
+    blockstore_t *bs = new blockstore_t(config, ringloop, epmgr->tfd);
+    while (!bs->is_started())
+    {
+        ringloop->loop();
+        if (!bs->is_started())
+            ringloop->wait();
+    }
+    printf("Loaded %ju metadata entries with %s threads in %.3f s\n", blocks, config["meta_load_threads"].c_str(), now()-start);
+    delete bs;
+    delete epmgr;
+    delete ringloop;
+    return 0;
+}
@@ -152,7 +152,8 @@ void check_op_count(cluster_client_t *cli, osd_num_t osd_num, int ops)
     }
 }
 
-osd_op_t *find_op(cluster_client_t *cli, osd_num_t osd_num, uint64_t opcode, uint64_t offset, uint64_t len)
+osd_op_t *find_op(cluster_client_t *cli, osd_num_t osd_num, uint64_t opcode, uint64_t offset, uint64_t len,
+    inode_t inode = 0x1000000000001)
 {
     int peer_fd = cli->msgr.osd_peer_fds.at(osd_num);
     auto op_it = cli->msgr.clients[peer_fd]->sent_ops.begin();
@@ -160,7 +161,7 @@ osd_op_t *find_op(cluster_client_t *cli, osd_num_t osd_num, uint64_t opcode, uin
     {
         auto op = op_it->second;
         if (op->req.hdr.opcode == opcode && (opcode == OSD_OP_SYNC ||
-            op->req.rw.inode == 0x1000000000001 && op->req.rw.offset == offset && op->req.rw.len == len))
+            op->req.rw.inode == inode && op->req.rw.offset == offset && op->req.rw.len == len))
         {
             return op;
         }
@@ -192,6 +193,43 @@ void pretend_op_completed(cluster_client_t *cli, osd_op_t *op, int64_t retval)
     std::function<void(osd_op_t*)>(op->callback)(op);
 }
 
+// <bitmap> is the first byte of the object bitmap, data is filled with <fill>
+void pretend_read_completed(cluster_client_t *cli, osd_op_t *op, uint8_t bitmap, uint8_t fill)
+{
+    assert(op);
+    memset(op->bitmap, 0, op->bitmap_len);
+    *(uint8_t*)op->bitmap = bitmap;
+    for (int i = 0; i < op->iov.count; i++)
+    {
+        memset(op->iov.buf[i].iov_base, fill, op->iov.buf[i].iov_len);
+    }
+    pretend_op_completed(cli, op, 0);
+}
+
+int *test_read(cluster_client_t *cli, inode_t inode, uint64_t offset, uint64_t len, uint8_t *buf)
+{
+    printf("Post read %jx+%jx\n", offset, len);
+    int *r = new int;
+    *r = -1;
+    cluster_op_t *op = new cluster_op_t();
+    op->opcode = OSD_OP_READ;
+    op->inode = inode;
+    op->offset = offset;
+    op->len = len;
+    op->iov.push_back(buf, len);
+    op->callback = [r](cluster_op_t *op)
+    {
+        if (*r == -1)
+            printf("Error: Not allowed to complete yet\n");
+        assert(*r != -1);
+        *r = op->retval == op->len ? 1 : 0;
+        printf("Done read %jx+%jx r=%d\n", op->offset, op->len, op->retval);
+        delete op;
+    };
+    cli->execute(op);
+    return r;
+}
+
 void test1()
 {
     json11::Json config;
@@ -480,10 +518,89 @@ void test_writeback()
     printf("[ok] writeback test\n");
 }
 
+// Chain cache must not trust ownership of granules which the owning layer doesn't have anymore
+// (layer data is changed by vitastor-cli rm before the metadata)
+void test_chain_cache()
+{
+    json11::Json config;
+    timerfd_manager_t *tfd = new timerfd_manager_t([](int fd, bool wr, std::function<void(int, int)> callback){});
+    cluster_client_t *cli = new cluster_client_t(NULL, tfd, config);
+    const inode_t base = 0x1000000000002, snap = 0x1000000000003, img = 0x1000000000004;
+
+    configure_single_pg_pool(cli);
+    cli->st_cli.parse_state((etcd_kv_t){
+        .key = "/config/inode/1/2",
+        .value = json11::Json::object { { "name", "base" }, { "size", 1024*1024 }, { "readonly", true } },
+        .mod_revision = 10,
+    });
+    cli->st_cli.parse_state((etcd_kv_t){
+        .key = "/config/inode/1/3",
+        .value = json11::Json::object { { "name", "snap" }, { "size", 1024*1024 }, { "readonly", true }, { "parent_id", 2 } },
+        .mod_revision = 11,
+    });
+    cli->st_cli.parse_state((etcd_kv_t){
+        .key = "/config/inode/1/4",
+        .value = json11::Json::object { { "name", "img" }, { "size", 1024*1024 }, { "parent_id", 3 } },
+        .mod_revision = 12,
+    });
+    pretend_connected(cli, 1);
+    uint8_t *buf = (uint8_t*)malloc_or_die(8192);
+
+    // The first read fills the cache: granule 0 is owned by snap, granule 1 by base
+    int *r1 = test_read(cli, img, 0, 8192, buf);
+    check_op_count(cli, 1, 3);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 0, snap), 0x01, 0);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 0, base), 0x03, 0);
+    can_complete(r1);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 8192, img), 0x03, 0x44);
+    check_completed(r1);
+    check_op_count(cli, 1, 0);
+
+    // The second read goes directly to the owners
+    r1 = test_read(cli, img, 0, 8192, buf);
+    check_op_count(cli, 1, 3);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 8192, img), 0, 0);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 4096, snap), 0x01, 0x33);
+    can_complete(r1);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 4096, 4096, base), 0x02, 0x22);
+    check_completed(r1);
+    assert(buf[0] == 0x33 && buf[4095] == 0x33 && buf[4096] == 0x22 && buf[8191] == 0x22);
+
+    // snap's data is deleted (merged into the child), but its metadata isn't changed yet:
+    // the read must be repeated in the usual way and the cached block must be dropped
+    r1 = test_read(cli, img, 0, 8192, buf);
+    check_op_count(cli, 1, 3);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 8192, img), 0, 0);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 4096, 4096, base), 0x02, 0x22);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 4096, snap), 0, 0);
+    check_op_count(cli, 1, 1);
+    can_complete(r1);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 8192, img), 0x03, 0x55);
+    check_completed(r1);
+    assert(buf[0] == 0x55 && buf[8191] == 0x55);
+
+    // The next read refills the block instead of using the stale one
+    r1 = test_read(cli, img, 0, 8192, buf);
+    check_op_count(cli, 1, 3);
+    assert(find_op(cli, 1, OSD_OP_READ, 0, 0, snap) != NULL);
+    assert(find_op(cli, 1, OSD_OP_READ, 0, 0, base) != NULL);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 0, snap), 0, 0);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 0, base), 0x02, 0);
+    can_complete(r1);
+    pretend_read_completed(cli, find_op(cli, 1, OSD_OP_READ, 0, 8192, img), 0x03, 0x55);
+    check_completed(r1);
+
+    free(buf);
+    delete cli;
+    delete tfd;
+    printf("[ok] chain cache test\n");
+}
+
 int main(int narg, char *args[])
 {
     test1();
     test2();
     test_writeback();
+    test_chain_cache();
     return 0;
 }
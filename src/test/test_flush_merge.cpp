@@ -0,0 +1,250 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+/**
+ * Flusher test: objects whose metadata entries are in two metadata blocks are rewritten
+ * in interleaved order, so that neighbouring journal entries always belong to different
+ * blocks. The flusher should still group them by metadata block and share block writes,
+ * and the resulting metadata should be the same as without merging.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "blockstore_impl.h"
+#include "epoll_manager.h"
+
+#define TEST_BLOCK_SIZE (128*1024)
+#define BIG_WRITE_LEN (64*1024)
+#define SMALL_WRITE_OFFSET (96*1024)
+#define SMALL_WRITE_LEN 4096
+
+static ring_loop_t *ringloop;
+static blockstore_t *bs;
+
+static void exec_op(blockstore_op_t *op)
+{
+    bool done = false;
+    op->callback = [&](blockstore_op_t *op)
+    {
+        done = true;
+    };
+    bs->enqueue_op(op);
+    while (!done)
+    {
+        ringloop->loop();
+        if (!done)
+            ringloop->wait();
+    }
+    assert(op->retval >= 0);
+}
+
+static uint64_t write_object(object_id oid, uint32_t offset, uint32_t len, uint8_t *buf)
+{
+    blockstore_op_t op;
+    op.opcode = BS_OP_WRITE;
+    op.oid = oid;
+    op.version = 0;
+    op.offset = offset;
+    op.len = len;
+    op.buf = buf;
+    op.bitmap = NULL;
+    exec_op(&op);
+    return op.version;
+}
+
+// Sync and stabilize written versions, then wait until the flusher writes them to metadata.
+// Flushers stop when less than min_flusher_count objects are queued, so a padding object
+// is written after the checked ones. It's allocated last, so it's also flushed last, and
+// it's flushed with the next batch
+static uint64_t pad_count = 0;
+
+static void commit_and_flush(std::vector<obj_ver_id> & versions, uint8_t *buf)
+{
+    uint64_t wait_count = versions.size() + (pad_count > 0 ? 1 : 0);
+    uint64_t flushed = bs->get_flush_stats().flushed_objects;
+    object_id pad_oid = { .inode = 2, .stripe = (pad_count++) << 17 };
+    memset(buf, 0xff, BIG_WRITE_LEN);
+    versions.push_back((obj_ver_id){ .oid = pad_oid, .version = write_object(pad_oid, 0, BIG_WRITE_LEN, buf) });
+    blockstore_op_t op;
+    op.opcode = BS_OP_SYNC;
+    exec_op(&op);
+    op.opcode = BS_OP_STABLE;
+    op.len = versions.size();
+    op.buf = versions.data();
+    exec_op(&op);
+    versions.pop_back();
+    while (bs->get_flush_stats().flushed_objects < flushed + wait_count)
+    {
+        ringloop->loop();
+        if (bs->get_flush_stats().flushed_objects < flushed + wait_count)
+            ringloop->wait();
+    }
+}
+
+static void create_file(const std::string & path, uint64_t size)
+{
+    int fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0)
+    {
+        perror(path.c_str());
+        exit(1);
+    }
+    close(fd);
+}
+
+static uint8_t fill_byte(object_id oid, bool small)
+{
+    return (uint8_t)(oid.stripe >> 17) + (small ? 0x80 : 1);
+}
+
+int main(int narg, char *args[])
+{
+    char tmpdir[] = "/tmp/test_flush_merge.XXXXXX";
+    if (!mkdtemp(tmpdir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = tmpdir;
+    blockstore_config_t config;
+    config["data_device"] = dir+"/data.bin";
+    config["meta_device"] = dir+"/meta.bin";
+    config["journal_device"] = dir+"/journal.bin";
+    config["block_size"] = std::to_string(TEST_BLOCK_SIZE);
+    // Two flushers in parallel never get objects of the same metadata block without grouping.
+    // Data fsyncs are left enabled: flushers wait for the same fsync batch and then modify
+    // metadata in the same loop iteration
+    config["min_flusher_count"] = "2";
+    config["max_flusher_count"] = "2";
+    config["flusher_hot_delay_us"] = "0";
+    config["disable_meta_fsync"] = "true";
+    config["disable_journal_fsync"] = "true";
+    create_file(config["data_device"], 64*1024*1024);
+    create_file(config["meta_device"], 1024*1024);
+    create_file(config["journal_device"], 16*1024*1024);
+    blockstore_disk_t dsk;
+    dsk.parse_config(config);
+    dsk.open_data();
+    dsk.open_meta();
+    dsk.open_journal();
+    dsk.calc_lengths();
+    dsk.close_all();
+    uint64_t per_block = dsk.meta_block_size / dsk.clean_entry_size;
+
+    ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE);
+    epoll_manager_t *epmgr = new epoll_manager_t(ringloop);
+    bs = new blockstore_t(config, ringloop, epmgr->tfd);
+    while (!bs->is_started())
+    {
+        ringloop->loop();
+        if (!bs->is_started())
+            ringloop->wait();
+    }
+
+    // Create objects filling two metadata blocks with partial (redirected) writes
+    uint8_t *buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, TEST_BLOCK_SIZE);
+    std::vector<object_id> objects;
+    std::vector<obj_ver_id> versions;
+    for (uint64_t i = 0; i < 2*per_block; i++)
+    {
+        object_id oid = { .inode = 1, .stripe = i << 17 };
+        memset(buf, fill_byte(oid, false), BIG_WRITE_LEN);
+        versions.push_back((obj_ver_id){ .oid = oid, .version = write_object(oid, 0, BIG_WRITE_LEN, buf) });
+        objects.push_back(oid);
+    }
+    commit_and_flush(versions, buf);
+    printf("[ok] %zu objects created\n", objects.size());
+
+    // Rewrite them in the order 0, N, 1, N+1, ... which alternates metadata blocks
+    // if objects are allocated in order, and stays random if they aren't
+    std::map<object_id, uint64_t> small_versions;
+    versions.clear();
+    for (uint64_t i = 0; i < per_block; i++)
+    {
+        for (uint64_t j = i; j < 2*per_block; j += per_block)
+        {
+            object_id oid = objects[j];
+            memset(buf, fill_byte(oid, true), SMALL_WRITE_LEN);
+            uint64_t version = write_object(oid, SMALL_WRITE_OFFSET, SMALL_WRITE_LEN, buf);
+            versions.push_back((obj_ver_id){ .oid = oid, .version = version });
+            small_versions[oid] = version;
+        }
+    }
+    auto prev_stats = bs->get_flush_stats();
+    commit_and_flush(versions, buf);
+    auto & stats = bs->get_flush_stats();
+    uint64_t meta_writes = stats.meta_writes - prev_stats.meta_writes;
+    uint64_t meta_entries = stats.meta_write_entries - prev_stats.meta_write_entries;
+    printf("%zu objects flushed with %ju metadata block writes\n", versions.size(), meta_writes);
+    // In-place flushes update one entry each, plus the previous padding object
+    assert(meta_entries == versions.size()+1);
+    // Objects are grouped by metadata block, so both flushers share most block writes
+    assert(meta_writes <= versions.size()*3/4);
+    printf("[ok] metadata writes merged\n");
+
+    // Check data
+    for (auto oid: objects)
+    {
+        blockstore_op_t op;
+        op.opcode = BS_OP_READ;
+        op.oid = oid;
+        op.version = UINT64_MAX;
+        op.offset = 0;
+        op.len = TEST_BLOCK_SIZE;
+        op.buf = buf;
+        op.bitmap = NULL;
+        exec_op(&op);
+        assert(op.version == small_versions[oid]);
+        for (uint64_t pos = 0; pos < TEST_BLOCK_SIZE; pos++)
+        {
+            uint8_t expected = pos < BIG_WRITE_LEN ? fill_byte(oid, false)
+                : (pos >= SMALL_WRITE_OFFSET && pos < SMALL_WRITE_OFFSET+SMALL_WRITE_LEN ? fill_byte(oid, true) : 0);
+            assert(buf[pos] == expected);
+        }
+    }
+    printf("[ok] data\n");
+    delete bs;
+    delete epmgr;
+    delete ringloop;
+
+    // Check metadata entries on disk
+    uint8_t *meta = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, dsk.meta_len);
+    int meta_fd = open(config["meta_device"].c_str(), O_RDONLY);
+    assert(meta_fd >= 0);
+    assert(pread(meta_fd, meta, dsk.meta_len, dsk.meta_offset) == dsk.meta_len);
+    close(meta_fd);
+    uint64_t found = 0;
+    for (uint64_t block = 0; block < dsk.block_count; block++)
+    {
+        clean_disk_entry *entry = (clean_disk_entry*)(meta + dsk.meta_block_size +
+            block/per_block*dsk.meta_block_size + block%per_block*dsk.clean_entry_size);
+        if (!entry->oid.inode || entry->oid.inode == 2)
+        {
+            continue;
+        }
+        auto sv_it = small_versions.find(entry->oid);
+        assert(sv_it != small_versions.end());
+        assert(entry->version == sv_it->second);
+        assert(*(uint32_t*)((uint8_t*)entry + dsk.clean_entry_size - 4) == crc32c(0, entry, dsk.clean_entry_size - 4));
+        // Internal bitmap has both the big write and the small write
+        for (uint64_t g = 0; g < TEST_BLOCK_SIZE/dsk.bitmap_granularity; g++)
+        {
+            uint64_t pos = g*dsk.bitmap_granularity;
+            bool expected = pos < BIG_WRITE_LEN || pos >= SMALL_WRITE_OFFSET && pos < SMALL_WRITE_OFFSET+SMALL_WRITE_LEN;
+            assert(((entry->bitmap[g/8] >> (g%8)) & 1) == expected);
+        }
+        found++;
+    }
+    assert(found == objects.size());
+    printf("[ok] metadata\n");
+    free(meta);
+    free(buf);
+    unlink(config["data_device"].c_str());
+    unlink(config["meta_device"].c_str());
+    unlink(config["journal_device"].c_str());
+    rmdir(tmpdir);
+    return 0;
+}
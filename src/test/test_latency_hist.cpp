@@ -0,0 +1,107 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include "latency_hist.h"
+
+// Every bucket starts right after the previous one, and values map to the bucket they're in
+void test_buckets()
+{
+    for (int v = 0; v < LAT_HIST_SUB; v++)
+    {
+        assert(latency_hist_t::bucket_of(v) == v);
+        assert(latency_hist_t::bucket_min(v) == (uint64_t)v);
+    }
+    assert(latency_hist_t::bucket_of(16) == 16);
+    assert(latency_hist_t::bucket_of(31) == 31);
+    assert(latency_hist_t::bucket_of(32) == 32);
+    assert(latency_hist_t::bucket_of(33) == 32);
+    assert(latency_hist_t::bucket_of(34) == 33);
+    assert(latency_hist_t::bucket_min(33) == 34);
+    for (int b = 1; b < LAT_HIST_BUCKETS; b++)
+    {
+        uint64_t min = latency_hist_t::bucket_min(b);
+        assert(min > latency_hist_t::bucket_min(b-1));
+        assert(latency_hist_t::bucket_of(min) == b);
+        assert(latency_hist_t::bucket_of(min-1) == b-1);
+        // Relative error is at most 1/LAT_HIST_SUB
+        if (b < LAT_HIST_OVERFLOW && b >= LAT_HIST_SUB)
+            assert((latency_hist_t::bucket_min(b+1) - min) * LAT_HIST_SUB <= min);
+    }
+    // Values from 2^LAT_HIST_MAX_BITS only go to the overflow bucket
+    assert(latency_hist_t::bucket_of(((uint64_t)1 << LAT_HIST_MAX_BITS) - 1) == LAT_HIST_OVERFLOW-1);
+    assert(latency_hist_t::bucket_of((uint64_t)1 << LAT_HIST_MAX_BITS) == LAT_HIST_OVERFLOW);
+    assert(latency_hist_t::bucket_of(UINT64_MAX) == LAT_HIST_OVERFLOW);
+    assert(latency_hist_t::bucket_min(LAT_HIST_OVERFLOW) == (uint64_t)1 << LAT_HIST_MAX_BITS);
+    printf("[ok] buckets\n");
+}
+
+void test_percentile()
+{
+    latency_hist_t h;
+    assert(h.percentile(0.5) == 0);
+    // 1..1000 us, 1000 values
+    for (uint64_t v = 1; v <= 1000; v++)
+        h.add(v);
+    assert(h.count == 1000 && h.sum == 500500);
+    // Percentiles are upper bounds of buckets containing the exact values
+    uint64_t p50 = h.percentile(0.5), p99 = h.percentile(0.99), p100 = h.percentile(1);
+    assert(p50 >= 500 && p50 < 500 + 500/LAT_HIST_SUB);
+    assert(p99 >= 990 && p99 < 990 + 990/LAT_HIST_SUB);
+    assert(p100 >= 1000 && p100 < 1000 + 1000/LAT_HIST_SUB);
+    assert(latency_hist_t::bucket_of(p50) == latency_hist_t::bucket_of(500));
+    assert(latency_hist_t::bucket_of(p99) == latency_hist_t::bucket_of(990));
+    // Small values are exact
+    latency_hist_t s;
+    for (int i = 0; i < 90; i++)
+        s.add(3);
+    for (int i = 0; i < 10; i++)
+        s.add(7);
+    assert(s.percentile(0.5) == 3);
+    assert(s.percentile(0.9) == 3);
+    assert(s.percentile(0.91) == 7);
+    // Overflowed values don't get mixed with the largest regular ones
+    latency_hist_t o;
+    o.add(((uint64_t)1 << LAT_HIST_MAX_BITS) - 1);
+    o.add((uint64_t)100 << LAT_HIST_MAX_BITS);
+    assert(o.percentile(0.5) == ((uint64_t)1 << LAT_HIST_MAX_BITS) - 1);
+    assert(o.percentile(1) == (uint64_t)1 << LAT_HIST_MAX_BITS);
+    printf("[ok] percentile\n");
+}
+
+// Histograms of different OSDs are sent as JSON and merged
+void test_json()
+{
+    latency_hist_t a, b;
+    for (uint64_t v = 1; v < 100000; v = v*3/2+1)
+        a.add(v);
+    a.add((uint64_t)5 << LAT_HIST_MAX_BITS);
+    for (uint64_t v = 7; v < 5000; v += 13)
+        b.add(v);
+    std::string err;
+    latency_hist_t a2;
+    a2.add_json(json11::Json::parse(a.to_json().dump(), err));
+    assert(err == "");
+    assert(a2.count == a.count && a2.sum == a.sum);
+    for (int i = 0; i < LAT_HIST_BUCKETS; i++)
+        assert(a2.buckets[i] == a.buckets[i]);
+    assert(a2.buckets[LAT_HIST_OVERFLOW] == 1);
+    latency_hist_t sum;
+    sum.add_json(a.to_json());
+    sum.add_json(b.to_json());
+    latency_hist_t sum2 = a;
+    sum2.add(b);
+    assert(sum.count == a.count+b.count && sum.sum == a.sum+b.sum);
+    for (int i = 0; i < LAT_HIST_BUCKETS; i++)
+        assert(sum.buckets[i] == a.buckets[i]+b.buckets[i] && sum2.buckets[i] == sum.buckets[i]);
+    printf("[ok] json\n");
+}
+
+int main(int narg, char *args[])
+{
+    test_buckets();
+    test_percentile();
+    test_json();
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include "qos.h"
+
+// The bucket starts full, allows a burst and then refills at the configured rate
+void test_iops()
+{
+    qos_bucket_t b;
+    qos_limits_t l;
+    l.iops = 100;
+    l.burst_iops = 10;
+    uint64_t now = 1000000;
+    b.set_limits(l, now);
+    for (int i = 0; i < 10; i++)
+    {
+        assert(b.take(4096, now) == 0);
+    }
+    // 1 token per 10 ms
+    uint64_t wait_us = b.take(4096, now);
+    assert(wait_us > 0 && wait_us <= 10001);
+    assert(b.take(4096, now+5000) > 0);
+    assert(b.take(4096, now+wait_us) == 0);
+    assert(b.take(4096, now+wait_us) > 0);
+    // Tokens don't accumulate over the burst
+    now += 10000000;
+    for (int i = 0; i < 10; i++)
+    {
+        assert(b.take(4096, now) == 0);
+    }
+    assert(b.take(4096, now) > 0);
+    printf("[ok] iops\n");
+}
+
+// Operations larger than the burst pass when the bucket is full and then the debt is repaid
+void test_bps()
+{
+    qos_bucket_t b;
+    qos_limits_t l;
+    l.bps = 1024*1024;
+    uint64_t now = 1000000;
+    b.set_limits(l, now);
+    assert(b.take(4*1024*1024, now) == 0);
+    // 3 MB of debt is repaid in 3 seconds
+    uint64_t wait_us = b.take(4096, now);
+    assert(wait_us >= 3000000 && wait_us <= 3000001);
+    assert(b.take(4096, now+2999000) > 0);
+    assert(b.take(4096, now+wait_us) == 0);
+    printf("[ok] bps\n");
+}
+
+// The default burst is 1 second worth of the limit, and a change of limits refills the bucket
+void test_defaults()
+{
+    qos_bucket_t b;
+    qos_limits_t l;
+    l.iops = 5;
+    uint64_t now = 1000000;
+    b.set_limits(l, now);
+    for (int i = 0; i < 5; i++)
+    {
+        assert(b.take(0, now) == 0);
+    }
+    assert(b.take(0, now) > 0);
+    // Same limits don't reset the bucket
+    b.set_limits(l, now);
+    assert(b.take(0, now) > 0);
+    l.iops = 10;
+    b.set_limits(l, now);
+    for (int i = 0; i < 10; i++)
+    {
+        assert(b.take(0, now) == 0);
+    }
+    assert(b.take(0, now) > 0);
+    // Time going backwards doesn't add tokens
+    assert(b.take(0, now-500000) > 0);
+    // Without limits everything passes
+    b.set_limits(qos_limits_t(), now);
+    for (int i = 0; i < 1000; i++)
+    {
+        assert(b.take(1024*1024, now) == 0);
+    }
+    printf("[ok] defaults\n");
+}
+
+int main(int narg, char *args[])
+{
+    test_iops();
+    test_bps();
+    test_defaults();
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+/**
+ * XOR kernel microbenchmark
+ * Usage: xor_bench [chunk_size] [max_sources] [total_mb]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "malloc_or_die.h"
+#include "xor.h"
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1000000000.0;
+}
+
+int main(int narg, char *args[])
+{
+    uint64_t chunk_size = narg > 1 ? strtoull(args[1], NULL, 10) : 128*1024;
+    int max_src = narg > 2 ? atoi(args[2]) : 8;
+    uint64_t total = (narg > 3 ? strtoull(args[3], NULL, 10) : 4096) * 1024*1024;
+    if (!chunk_size || max_src < 2)
+    {
+        fprintf(stderr, "Usage: %s [chunk_size] [max_sources] [total_mb]\n", args[0]);
+        return 1;
+    }
+    const void *srcs[max_src];
+    for (int i = 0; i < max_src; i++)
+    {
+        uint8_t *buf = (uint8_t*)memalign_or_die(64, chunk_size);
+        for (uint64_t j = 0; j < chunk_size; j++)
+            buf[j] = (uint8_t)(j*(i+1));
+        srcs[i] = buf;
+    }
+    void *res = memalign_or_die(64, chunk_size);
+    memxor_kernel_t kernels[MEMXOR_MAX_KERNELS];
+    int n_kernels = memxor_list_kernels(kernels);
+    printf("chunk size %ju, default kernel: %s\n", chunk_size, memxor_best_kernel().name);
+    for (int n = 2; n <= max_src; n++)
+    {
+        // Sources processed per iteration, the bytewise kernel is too slow for large totals
+        uint64_t iters = total / chunk_size / n;
+        if (!iters)
+            iters = 1;
+        for (int k = 0; k < n_kernels; k++)
+        {
+            uint64_t k_iters = k == 0 ? (iters+15)/16 : iters;
+            double start = now();
+            // K-1 passes with the 2-source kernel, like the old reconstruct_stripes_xor()
+            for (uint64_t it = 0; it < k_iters; it++)
+            {
+                kernels[k].xor2(srcs[0], srcs[1], res, chunk_size);
+                for (int i = 2; i < n; i++)
+                    kernels[k].xor2(res, srcs[i], res, chunk_size);
+            }
+            double pairwise = now()-start;
+            start = now();
+            for (uint64_t it = 0; it < k_iters; it++)
+            {
+                kernels[k].xor_multi(srcs, n, res, chunk_size);
+            }
+            double multi = now()-start;
+            double gb = (double)k_iters*n*chunk_size/1024/1024/1024;
+            printf("%d sources, %-8s: pairwise %8.2f GB/s, multi-source %8.2f GB/s\n",
+                n, kernels[k].name, gb/pairwise, gb/multi);
+        }
+    }
+    for (int i = 0; i < max_src; i++)
+        free((void*)srcs[i]);
+    free(res);
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "json11/json11.hpp"
+
+// Log-linear latency histogram (HDR-style) with fixed buckets.
+// Values below LAT_HIST_SUB are stored exactly, then every power of 2 is split
+// into LAT_HIST_SUB linear sub-buckets, so the relative error is at most 1/LAT_HIST_SUB.
+// Values are microseconds, everything from 2^LAT_HIST_MAX_BITS goes into a separate overflow bucket.
+// Bucket boundaries are the same everywhere, so histograms from different OSDs are merged
+// just by adding bucket counters.
+#define LAT_HIST_SUB_BITS 4
+#define LAT_HIST_SUB (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_BITS 32
+#define LAT_HIST_OVERFLOW ((LAT_HIST_MAX_BITS-LAT_HIST_SUB_BITS+1)*LAT_HIST_SUB)
+#define LAT_HIST_BUCKETS (LAT_HIST_OVERFLOW+1)
+
+static inline uint64_t latency_now_us()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec*1000000 + tv.tv_nsec/1000;
+}
+
+struct latency_hist_t
+{
+    uint64_t buckets[LAT_HIST_BUCKETS] = { 0 };
+    uint64_t count = 0, sum = 0;
+
+    static int bucket_of(uint64_t usec)
+    {
+        if (usec < LAT_HIST_SUB)
+            return usec;
+        int msb = 63 - __builtin_clzll(usec);
+        if (msb >= LAT_HIST_MAX_BITS)
+            return LAT_HIST_OVERFLOW;
+        return (msb-LAT_HIST_SUB_BITS+1)*LAT_HIST_SUB + ((usec >> (msb-LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB-1));
+    }
+
+    // Lowest value which falls into bucket <b>, 2^LAT_HIST_MAX_BITS for the overflow bucket
+    static uint64_t bucket_min(int b)
+    {
+        if (b < LAT_HIST_SUB)
+            return b;
+        return (uint64_t)(LAT_HIST_SUB + b % LAT_HIST_SUB) << (b / LAT_HIST_SUB - 1);
+    }
+
+    void add(uint64_t usec)
+    {
+        buckets[bucket_of(usec)]++;
+        count++;
+        sum += usec;
+    }
+
+    void add(const latency_hist_t & other)
+    {
+        for (int b = 0; b < LAT_HIST_BUCKETS; b++)
+            buckets[b] += other.buckets[b];
+        count += other.count;
+        sum += other.sum;
+    }
+
+    void reset()
+    {
+        memset(buckets, 0, sizeof(buckets));
+        count = sum = 0;
+    }
+
+    // Upper bound of the bucket containing the <q> quantile (0 < q <= 1),
+    // the lower bound for the overflow bucket as it has no upper bound
+    uint64_t percentile(double q) const
+    {
+        if (!count)
+            return 0;
+        uint64_t target = (uint64_t)(q*count + 0.5);
+        if (target < 1)
+            target = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < LAT_HIST_BUCKETS; b++)
+        {
+            seen += buckets[b];
+            if (seen >= target)
+                return b < LAT_HIST_OVERFLOW ? bucket_min(b+1)-1 : bucket_min(b);
+        }
+        return bucket_min(LAT_HIST_OVERFLOW);
+    }
+
+    // { count, usec, buckets: [ [ lowest value, count ], ... ] } with only non-empty buckets
+    json11::Json to_json() const
+    {
+        json11::Json::array nonempty;
+        for (int b = 0; b < LAT_HIST_BUCKETS; b++)
+        {
+            if (buckets[b])
+                nonempty.push_back(json11::Json::array { bucket_min(b), buckets[b] });
+        }
+        return json11::Json::object {
+            { "count", count },
+            { "usec", sum },
+            { "buckets", nonempty },
+        };
+    }
+
+    // Merge a histogram previously serialized with to_json()
+    void add_json(const json11::Json & hist)
+    {
+        for (auto & pair: hist["buckets"].array_items())
+        {
+            buckets[bucket_of(pair[0].uint64_value())] += pair[1].uint64_value();
+        }
+        count += hist["count"].uint64_value();
+        sum += hist["usec"].uint64_value();
+    }
+};
@@ -0,0 +1,93 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "malloc_or_die.h"
+
+#define MEM_POOL_CLASS_SIZE 64
+#define MEM_POOL_MAX_SIZE 32768
+
+// Per-thread free lists for small fixed-size objects which are created and
+// destroyed for every I/O operation (osd_op_t, blockstore_op_t, subop arrays).
+// Blocks are grouped into 64-byte size classes; larger blocks go straight to malloc.
+// Every event loop runs in its own thread so no locking is needed. A block freed
+// by another thread just migrates to that thread's pool. Memory isn't returned
+// to the system until the thread exits, the pool stays at its high watermark.
+class mem_pool_t
+{
+    void *free_lists[MEM_POOL_MAX_SIZE/MEM_POOL_CLASS_SIZE + 1] = {};
+
+public:
+    // Total number of allocations
+    uint64_t alloc_count = 0;
+    // Allocations which had to go to malloc, stops growing in the steady state
+    uint64_t sys_alloc_count = 0;
+    // Currently allocated blocks
+    uint64_t in_use = 0;
+
+    ~mem_pool_t()
+    {
+        for (auto & list: free_lists)
+        {
+            while (list)
+            {
+                void *next = *(void**)list;
+                ::free(list);
+                list = next;
+            }
+        }
+    }
+
+    void *alloc(size_t size)
+    {
+        alloc_count++;
+        in_use++;
+        size_t cls = (size + MEM_POOL_CLASS_SIZE - 1) / MEM_POOL_CLASS_SIZE;
+        if (cls >= sizeof(free_lists)/sizeof(free_lists[0]))
+        {
+            sys_alloc_count++;
+            return malloc_or_die(size);
+        }
+        void *r = free_lists[cls];
+        if (r)
+        {
+            free_lists[cls] = *(void**)r;
+            return r;
+        }
+        sys_alloc_count++;
+        return malloc_or_die(cls * MEM_POOL_CLASS_SIZE);
+    }
+
+    void free(void *ptr, size_t size)
+    {
+        if (!ptr)
+            return;
+        in_use--;
+        size_t cls = (size + MEM_POOL_CLASS_SIZE - 1) / MEM_POOL_CLASS_SIZE;
+        if (cls >= sizeof(free_lists)/sizeof(free_lists[0]))
+        {
+            ::free(ptr);
+            return;
+        }
+        *(void**)ptr = free_lists[cls];
+        free_lists[cls] = ptr;
+    }
+
+    static mem_pool_t & local()
+    {
+        static thread_local mem_pool_t pool;
+        return pool;
+    }
+};
+
+// Add to a class to allocate its instances and arrays from the per-thread pool.
+// Sized delete receives the same size as new, including the array cookie.
+#define MEM_POOL_OPERATORS \
+    static void *operator new(size_t size) { return mem_pool_t::local().alloc(size); } \
+    static void *operator new[](size_t size) { return mem_pool_t::local().alloc(size); } \
+    static void operator delete(void *ptr, size_t size) { mem_pool_t::local().free(ptr, size); } \
+    static void operator delete[](void *ptr, size_t size) { mem_pool_t::local().free(ptr, size); }
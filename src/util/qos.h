@@ -0,0 +1,124 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "json11/json11.hpp"
+
+// IOPS and bandwidth limits of an image or a pool. 0 means "unlimited"
+struct qos_limits_t
+{
+    uint64_t iops = 0, bps = 0;
+    // Maximum number of operations/bytes which may be executed at once after an idle period.
+    // 0 means "1 second worth of the limit"
+    uint64_t burst_iops = 0, burst_bps = 0;
+
+    bool is_set() const
+    {
+        return iops || bps;
+    }
+
+    bool operator != (const qos_limits_t & other) const
+    {
+        return iops != other.iops || bps != other.bps ||
+            burst_iops != other.burst_iops || burst_bps != other.burst_bps;
+    }
+
+    // Parse qos_* keys of an inode or a pool configuration
+    static qos_limits_t parse(const json11::Json & cfg)
+    {
+        qos_limits_t l;
+        l.iops = cfg["qos_iops"].uint64_value();
+        l.bps = cfg["qos_bps"].uint64_value();
+        l.burst_iops = cfg["qos_burst_iops"].uint64_value();
+        l.burst_bps = cfg["qos_burst_bps"].uint64_value();
+        return l;
+    }
+};
+
+static inline uint64_t qos_now_us()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec*1000000 + tv.tv_nsec/1000;
+}
+
+// Token bucket for qos_limits_t.
+// Bandwidth tokens may go negative so that an operation larger than the burst still
+// passes when the bucket is full, the next operations then wait until the debt is repaid
+struct qos_bucket_t
+{
+    qos_limits_t limits;
+    double iops_tokens = 0, bps_tokens = 0;
+    uint64_t last_us = 0;
+
+    void set_limits(const qos_limits_t & new_limits, uint64_t now_us)
+    {
+        if (!last_us || limits != new_limits)
+        {
+            limits = new_limits;
+            iops_tokens = burst_iops();
+            bps_tokens = burst_bps();
+            last_us = now_us;
+        }
+    }
+
+    double burst_iops() const
+    {
+        return limits.burst_iops ? limits.burst_iops : (limits.iops > 0 ? limits.iops : 1);
+    }
+
+    double burst_bps() const
+    {
+        return limits.burst_bps ? limits.burst_bps : limits.bps;
+    }
+
+    void refill(uint64_t now_us)
+    {
+        if (now_us <= last_us)
+            return;
+        double dt = (now_us - last_us) / 1000000.0;
+        last_us = now_us;
+        if (limits.iops)
+        {
+            iops_tokens += dt*limits.iops;
+            if (iops_tokens > burst_iops())
+                iops_tokens = burst_iops();
+        }
+        if (limits.bps)
+        {
+            bps_tokens += dt*limits.bps;
+            if (bps_tokens > burst_bps())
+                bps_tokens = burst_bps();
+        }
+    }
+
+    // Returns 0 and consumes tokens if an operation of <bytes> may be executed now,
+    // otherwise returns the number of microseconds to wait before retrying
+    uint64_t take(uint64_t bytes, uint64_t now_us)
+    {
+        refill(now_us);
+        uint64_t wait_us = 0;
+        if (limits.iops && iops_tokens < 1)
+        {
+            wait_us = (uint64_t)((1-iops_tokens)*1000000 / limits.iops) + 1;
+        }
+        if (limits.bps && bps_tokens <= 0)
+        {
+            uint64_t bps_wait = (uint64_t)(-bps_tokens*1000000 / limits.bps) + 1;
+            if (wait_us < bps_wait)
+                wait_us = bps_wait;
+        }
+        if (!wait_us)
+        {
+            if (limits.iops)
+                iops_tokens -= 1;
+            if (limits.bps)
+                bps_tokens -= bytes;
+        }
+        return wait_us;
+    }
+};
@@ -10,13 +10,26 @@
 
 #include "ringloop.h"
 
-ring_loop_t::ring_loop_t(int qd)
+ring_loop_t::ring_loop_t(int qd, unsigned flags, int sq_thread_cpu, unsigned sq_thread_idle)
 {
-    int ret = io_uring_queue_init(qd, &ring, 0);
+    struct io_uring_params params = { 0 };
+    params.flags = flags;
+    if ((flags & IORING_SETUP_SQPOLL) && sq_thread_cpu >= 0)
+    {
+        // Pin the kernel submission queue polling thread
+        params.flags |= IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = sq_thread_cpu;
+    }
+    if (flags & IORING_SETUP_SQPOLL)
+    {
+        params.sq_thread_idle = sq_thread_idle;
+    }
+    int ret = io_uring_queue_init_params(qd, &ring, &params);
     if (ret < 0)
     {
         throw std::runtime_error(std::string("io_uring_queue_init: ") + strerror(-ret));
     }
+    ring_flags = params.flags;
     free_ring_data_ptr = *ring.sq.kring_entries;
     ring_datas = (struct ring_data_t*)calloc(free_ring_data_ptr, sizeof(ring_data_t));
     free_ring_data = (int*)malloc(sizeof(int) * free_ring_data_ptr);
@@ -41,6 +54,11 @@ ring_loop_t::~ring_loop_t()
     }
 }
 
+void ring_loop_t::attach_ring(ring_loop_t *other)
+{
+    attached_ring = other;
+}
+
 void ring_loop_t::register_consumer(ring_consumer_t *consumer)
 {
     unregister_consumer(consumer);
@@ -80,6 +98,18 @@ void ring_loop_t::loop()
     while (!io_uring_peek_cqe(&ring, &cqe))
     {
         struct ring_data_t *d = (struct ring_data_t*)cqe->user_data;
+#ifdef IORING_CQE_F_MORE
+        if (cqe->flags & IORING_CQE_F_MORE)
+        {
+            // More CQEs will follow for the same SQE (zero-copy send notification),
+            // so keep the ring_data item and its callback
+            d->res = cqe->res;
+            d->flags = cqe->flags;
+            if (d->callback)
+                d->callback(d);
+        }
+        else
+#endif
         if (d->callback)
         {
             // First free ring_data item, then call the callback
@@ -88,6 +118,7 @@ void ring_loop_t::loop()
             struct ring_data_t dl;
             dl.iov = d->iov;
             dl.res = cqe->res;
+            dl.flags = cqe->flags;
             dl.callback.swap(d->callback);
             free_ring_data[free_ring_data_ptr++] = d - ring_datas;
             dl.callback(&dl);
@@ -113,6 +144,11 @@ void ring_loop_t::loop()
                 immediate_queue2.clear();
             }
         }
+        if (attached_ring)
+        {
+            // The attached ring is driven by this one: reap its completions and run its consumers
+            attached_ring->loop();
+        }
     } while (loop_again);
 }
 
@@ -165,3 +201,23 @@ int ring_loop_t::register_eventfd()
     }
     return ring_eventfd;
 }
+
+int ring_loop_t::register_buffers(const std::vector<iovec> & bufs)
+{
+    return io_uring_register_buffers(&ring, bufs.data(), bufs.size());
+}
+
+void ring_loop_t::unregister_buffers()
+{
+    io_uring_unregister_buffers(&ring);
+}
+
+int ring_loop_t::register_files(const std::vector<int> & fds)
+{
+    return io_uring_register_files(&ring, fds.data(), fds.size());
+}
+
+void ring_loop_t::unregister_files()
+{
+    io_uring_unregister_files(&ring);
+}
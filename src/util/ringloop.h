@@ -61,6 +61,16 @@ static inline void my_uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const
     sqe->msg_flags = flags;
 }
 
+#ifdef IORING_CQE_F_NOTIF
+static inline void my_uring_prep_sendmsg_zc(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, unsigned flags)
+{
+    // Zero-copy sendmsg posts 2 CQEs: the result (with IORING_CQE_F_MORE) and then
+    // the notification (with IORING_CQE_F_NOTIF) when buffers may be reused
+    my_uring_prep_rw(IORING_OP_SENDMSG_ZC, sqe, fd, msg, 1, 0);
+    sqe->msg_flags = flags;
+}
+#endif
+
 static inline void my_uring_prep_poll_add(struct io_uring_sqe *sqe, int fd, short poll_mask)
 {
     my_uring_prep_rw(IORING_OP_POLL_ADD, sqe, fd, NULL, 0, 0);
@@ -111,6 +121,7 @@ struct ring_data_t
 {
     struct iovec iov; // for single-entry read/write operations
     int res;
+    unsigned flags; // CQE flags
     std::function<void(ring_data_t*)> callback;
 };
 
@@ -129,12 +140,19 @@ class ring_loop_t
     bool loop_again;
     struct io_uring ring;
     int ring_eventfd = -1;
+    unsigned ring_flags = 0;
+    ring_loop_t *attached_ring = NULL;
 public:
-    ring_loop_t(int qd);
+    ring_loop_t(int qd, unsigned flags = 0, int sq_thread_cpu = -1, unsigned sq_thread_idle = 0);
     ~ring_loop_t();
     void register_consumer(ring_consumer_t *consumer);
     void unregister_consumer(ring_consumer_t *consumer);
     int register_eventfd();
+    void attach_ring(ring_loop_t *other);
+    int register_buffers(const std::vector<iovec> & bufs);
+    void unregister_buffers();
+    int register_files(const std::vector<int> & fds);
+    void unregister_files();
 
     inline struct io_uring_sqe* get_sqe()
     {
@@ -156,9 +174,22 @@ public:
     }
     inline int wait()
     {
+        if (attached_ring && attached_ring->in_flight() > 0)
+        {
+            // Completions of a polled ring only arrive when we poll it, so don't sleep
+            return 0;
+        }
         struct io_uring_cqe *cqe;
         return io_uring_wait_cqe(&ring, &cqe);
     }
+    inline unsigned in_flight()
+    {
+        return *ring.sq.kring_entries - free_ring_data_ptr;
+    }
+    inline bool is_iopoll()
+    {
+        return ring_flags & IORING_SETUP_IOPOLL;
+    }
     int sqes_left();
     inline unsigned space_left()
     {
@@ -0,0 +1,109 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <stdexcept>
+#include "worker_pool.h"
+
+worker_pool_t::worker_pool_t(int thread_count, std::function<void(int, bool, std::function<void(int, int)>)> set_fd_handler)
+{
+    this->set_fd_handler = set_fd_handler;
+    eventfd = ::eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (eventfd < 0)
+    {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+    set_fd_handler(eventfd, false, [this](int fd, int events)
+    {
+        handle_readable();
+    });
+    for (int i = 0; i < thread_count; i++)
+    {
+        threads.push_back(std::thread(&worker_pool_t::run_worker, this));
+    }
+}
+
+worker_pool_t::~worker_pool_t()
+{
+    {
+        std::unique_lock<std::mutex> lock(mu);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto & t: threads)
+    {
+        t.join();
+    }
+    set_fd_handler(eventfd, false, NULL);
+    close(eventfd);
+    // Jobs may own data which is normally freed by their completion callbacks
+    for (auto & job: queue)
+    {
+        if (job.cancel)
+            job.cancel();
+    }
+    for (auto & job: done_queue)
+    {
+        if (job.cancel)
+            job.cancel();
+    }
+    queue.clear();
+    done_queue.clear();
+}
+
+void worker_pool_t::submit(std::function<void()> work, std::function<void()> done, std::function<void()> cancel)
+{
+    {
+        std::unique_lock<std::mutex> lock(mu);
+        queue.push_back((worker_job_t){ .work = std::move(work), .done = std::move(done), .cancel = std::move(cancel) });
+    }
+    cv.notify_one();
+}
+
+void worker_pool_t::run_worker()
+{
+    std::unique_lock<std::mutex> lock(mu);
+    while (true)
+    {
+        cv.wait(lock, [this]() { return stopping || queue.size() > 0; });
+        if (stopping)
+        {
+            break;
+        }
+        worker_job_t job = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        job.work();
+        lock.lock();
+        done_queue.push_back(std::move(job));
+        uint64_t n = 1;
+        if (write(eventfd, &n, sizeof(n)) < 0)
+        {
+            fprintf(stderr, "Error signaling worker job completion: %s\n", strerror(errno));
+        }
+    }
+}
+
+void worker_pool_t::handle_readable()
+{
+    uint64_t n = 0;
+    if (read(eventfd, &n, sizeof(n)) < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        fprintf(stderr, "Error reading worker pool eventfd: %s\n", strerror(errno));
+    }
+    std::deque<worker_job_t> done;
+    {
+        std::unique_lock<std::mutex> lock(mu);
+        done.swap(done_queue);
+    }
+    // Callbacks may submit new jobs
+    for (auto & job: done)
+    {
+        job.done();
+    }
+}
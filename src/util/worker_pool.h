@@ -0,0 +1,43 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+
+struct worker_job_t
+{
+    std::function<void()> work;
+    std::function<void()> done;
+    // Called instead of <done> if the pool is destroyed before the job completes
+    std::function<void()> cancel;
+};
+
+// Runs CPU-heavy jobs in background threads and then their completion callbacks
+// in the event loop thread. Completions are signaled through an eventfd which is
+// registered with the same set_fd_handler() as timerfd_manager_t uses.
+// Jobs must not touch event loop data, only their own input and output.
+class worker_pool_t
+{
+    std::vector<std::thread> threads;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<worker_job_t> queue, done_queue;
+    bool stopping = false;
+    int eventfd = -1;
+
+    void run_worker();
+    void handle_readable();
+public:
+    std::function<void(int, bool, std::function<void(int, int)>)> set_fd_handler;
+
+    worker_pool_t(int thread_count, std::function<void(int, bool, std::function<void(int, int)>)> set_fd_handler);
+    // Waits for running jobs, then cancels pending jobs and undelivered completions
+    ~worker_pool_t();
+    void submit(std::function<void()> work, std::function<void()> done, std::function<void()> cancel = NULL);
+};
@@ -4,8 +4,32 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
 
-inline void memxor(const void *r1, const void *r2, void *res, unsigned int len)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XOR_X86 1
+#endif
+
+// XOR kernels. memxor() and memxor_multi() pick the fastest implementation
+// supported by the CPU at runtime, other functions are exposed for tests and benchmarks.
+//
+// memxor(r1, r2, res, len): res = r1 ^ r2
+// memxor_multi(srcs, n, res, len): res = srcs[0] ^ srcs[1] ^ ... ^ srcs[n-1] in one pass
+// res may be equal to any of the sources, but must not partially overlap with them.
+
+typedef void (*memxor_fn_t)(const void *r1, const void *r2, void *res, unsigned int len);
+typedef void (*memxor_multi_fn_t)(const void **srcs, int n, void *res, unsigned int len);
+
+struct memxor_kernel_t
+{
+    const char *name;
+    memxor_fn_t xor2;
+    memxor_multi_fn_t xor_multi;
+};
+
+// Byte-by-byte reference implementation
+inline void memxor_bytewise(const void *r1, const void *r2, void *res, unsigned int len)
 {
     unsigned int i;
     for (i = 0; i < len; ++i)
@@ -13,3 +37,262 @@ inline void memxor(const void *r1, const void *r2, void *res, unsigned int len)
         ((uint8_t*)res)[i] = ((uint8_t*)r1)[i] ^ ((uint8_t*)r2)[i];
     }
 }
+
+inline void memxor_multi_bytewise(const void **srcs, int n, void *res, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; ++i)
+    {
+        uint8_t v = ((uint8_t*)srcs[0])[i];
+        for (int j = 1; j < n; j++)
+            v ^= ((uint8_t*)srcs[j])[i];
+        ((uint8_t*)res)[i] = v;
+    }
+}
+
+// Portable 64-bit word implementation
+inline void memxor_generic(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+8 <= len; i += 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, (uint8_t*)r1+i, 8);
+        memcpy(&b, (uint8_t*)r2+i, 8);
+        a ^= b;
+        memcpy((uint8_t*)res+i, &a, 8);
+    }
+    for (; i < len; i++)
+    {
+        ((uint8_t*)res)[i] = ((uint8_t*)r1)[i] ^ ((uint8_t*)r2)[i];
+    }
+}
+
+inline void memxor_multi_generic(const void **srcs, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+8 <= len; i += 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, (uint8_t*)srcs[0]+i, 8);
+        for (int j = 1; j < n; j++)
+        {
+            memcpy(&b, (uint8_t*)srcs[j]+i, 8);
+            a ^= b;
+        }
+        memcpy((uint8_t*)res+i, &a, 8);
+    }
+    for (; i < len; i++)
+    {
+        uint8_t v = ((uint8_t*)srcs[0])[i];
+        for (int j = 1; j < n; j++)
+            v ^= ((uint8_t*)srcs[j])[i];
+        ((uint8_t*)res)[i] = v;
+    }
+}
+
+#ifdef XOR_X86
+
+__attribute__((target("sse2")))
+inline void memxor_sse2(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+64 <= len; i += 64)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)((uint8_t*)r1+i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)((uint8_t*)r1+i+16));
+        __m128i a2 = _mm_loadu_si128((const __m128i*)((uint8_t*)r1+i+32));
+        __m128i a3 = _mm_loadu_si128((const __m128i*)((uint8_t*)r1+i+48));
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*)((uint8_t*)r2+i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i*)((uint8_t*)r2+i+16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i*)((uint8_t*)r2+i+32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i*)((uint8_t*)r2+i+48)));
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i), a0);
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i+16), a1);
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i+32), a2);
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i+48), a3);
+    }
+    for (; i+16 <= len; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)((uint8_t*)r1+i));
+        a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)((uint8_t*)r2+i)));
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i), a);
+    }
+    if (i < len)
+        memxor_generic((uint8_t*)r1+i, (uint8_t*)r2+i, (uint8_t*)res+i, len-i);
+}
+
+__attribute__((target("sse2")))
+inline void memxor_multi_sse2(const void **srcs, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+32 <= len; i += 32)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)((uint8_t*)srcs[0]+i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)((uint8_t*)srcs[0]+i+16));
+        for (int j = 1; j < n; j++)
+        {
+            a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*)((uint8_t*)srcs[j]+i)));
+            a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i*)((uint8_t*)srcs[j]+i+16)));
+        }
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i), a0);
+        _mm_storeu_si128((__m128i*)((uint8_t*)res+i+16), a1);
+    }
+    if (i < len)
+    {
+        const void *tail[n];
+        for (int j = 0; j < n; j++)
+            tail[j] = (uint8_t*)srcs[j]+i;
+        memxor_multi_generic(tail, n, (uint8_t*)res+i, len-i);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void memxor_avx2(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+128 <= len; i += 128)
+    {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)((uint8_t*)r1+i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)((uint8_t*)r1+i+32));
+        __m256i a2 = _mm256_loadu_si256((const __m256i*)((uint8_t*)r1+i+64));
+        __m256i a3 = _mm256_loadu_si256((const __m256i*)((uint8_t*)r1+i+96));
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i*)((uint8_t*)r2+i)));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i*)((uint8_t*)r2+i+32)));
+        a2 = _mm256_xor_si256(a2, _mm256_loadu_si256((const __m256i*)((uint8_t*)r2+i+64)));
+        a3 = _mm256_xor_si256(a3, _mm256_loadu_si256((const __m256i*)((uint8_t*)r2+i+96)));
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i), a0);
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i+32), a1);
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i+64), a2);
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i+96), a3);
+    }
+    for (; i+32 <= len; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)((uint8_t*)r1+i));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)((uint8_t*)r2+i)));
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i), a);
+    }
+    if (i < len)
+        memxor_sse2((uint8_t*)r1+i, (uint8_t*)r2+i, (uint8_t*)res+i, len-i);
+}
+
+__attribute__((target("avx2")))
+inline void memxor_multi_avx2(const void **srcs, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+64 <= len; i += 64)
+    {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)((uint8_t*)srcs[0]+i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)((uint8_t*)srcs[0]+i+32));
+        for (int j = 1; j < n; j++)
+        {
+            a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i*)((uint8_t*)srcs[j]+i)));
+            a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i*)((uint8_t*)srcs[j]+i+32)));
+        }
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i), a0);
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res+i+32), a1);
+    }
+    if (i < len)
+    {
+        const void *tail[n];
+        for (int j = 0; j < n; j++)
+            tail[j] = (uint8_t*)srcs[j]+i;
+        memxor_multi_sse2(tail, n, (uint8_t*)res+i, len-i);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void memxor_avx512(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+128 <= len; i += 128)
+    {
+        __m512i a0 = _mm512_loadu_si512((const void*)((uint8_t*)r1+i));
+        __m512i a1 = _mm512_loadu_si512((const void*)((uint8_t*)r1+i+64));
+        a0 = _mm512_xor_si512(a0, _mm512_loadu_si512((const void*)((uint8_t*)r2+i)));
+        a1 = _mm512_xor_si512(a1, _mm512_loadu_si512((const void*)((uint8_t*)r2+i+64)));
+        _mm512_storeu_si512((void*)((uint8_t*)res+i), a0);
+        _mm512_storeu_si512((void*)((uint8_t*)res+i+64), a1);
+    }
+    if (i < len)
+        memxor_avx2((uint8_t*)r1+i, (uint8_t*)r2+i, (uint8_t*)res+i, len-i);
+}
+
+__attribute__((target("avx512f")))
+inline void memxor_multi_avx512(const void **srcs, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+128 <= len; i += 128)
+    {
+        __m512i a0 = _mm512_loadu_si512((const void*)((uint8_t*)srcs[0]+i));
+        __m512i a1 = _mm512_loadu_si512((const void*)((uint8_t*)srcs[0]+i+64));
+        for (int j = 1; j < n; j++)
+        {
+            a0 = _mm512_xor_si512(a0, _mm512_loadu_si512((const void*)((uint8_t*)srcs[j]+i)));
+            a1 = _mm512_xor_si512(a1, _mm512_loadu_si512((const void*)((uint8_t*)srcs[j]+i+64)));
+        }
+        _mm512_storeu_si512((void*)((uint8_t*)res+i), a0);
+        _mm512_storeu_si512((void*)((uint8_t*)res+i+64), a1);
+    }
+    if (i < len)
+    {
+        const void *tail[n];
+        for (int j = 0; j < n; j++)
+            tail[j] = (uint8_t*)srcs[j]+i;
+        memxor_multi_avx2(tail, n, (uint8_t*)res+i, len-i);
+    }
+}
+
+#endif
+
+// Returns all kernels supported by the current CPU, the best one is the last one
+inline int memxor_list_kernels(memxor_kernel_t *list)
+{
+    int n = 0;
+    list[n++] = (memxor_kernel_t){ "bytewise", memxor_bytewise, memxor_multi_bytewise };
+    list[n++] = (memxor_kernel_t){ "generic", memxor_generic, memxor_multi_generic };
+#ifdef XOR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        list[n++] = (memxor_kernel_t){ "sse2", memxor_sse2, memxor_multi_sse2 };
+    if (__builtin_cpu_supports("avx2"))
+        list[n++] = (memxor_kernel_t){ "avx2", memxor_avx2, memxor_multi_avx2 };
+    if (__builtin_cpu_supports("avx512f"))
+        list[n++] = (memxor_kernel_t){ "avx512", memxor_avx512, memxor_multi_avx512 };
+#endif
+    return n;
+}
+
+#define MEMXOR_MAX_KERNELS 5
+
+inline const memxor_kernel_t & memxor_best_kernel()
+{
+    static const memxor_kernel_t best = []()
+    {
+        memxor_kernel_t list[MEMXOR_MAX_KERNELS];
+        int n = memxor_list_kernels(list);
+        return list[n-1];
+    }();
+    return best;
+}
+
+inline void memxor(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    memxor_best_kernel().xor2(r1, r2, res, len);
+}
+
+inline void memxor_multi(const void **srcs, int n, void *res, unsigned int len)
+{
+    if (n == 1)
+    {
+        if (res != srcs[0])
+            memcpy(res, srcs[0], len);
+        return;
+    }
+    if (n == 2)
+    {
+        // The most common case (2 data chunks), the 2-source kernel is about 2x faster
+        memxor_best_kernel().xor2(srcs[0], srcs[1], res, len);
+        return;
+    }
+    memxor_best_kernel().xor_multi(srcs, n, res, len);
+}
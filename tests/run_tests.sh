@@ -38,6 +38,11 @@ SCHEME=ec ./test_snapshot_chain.sh
 ./test_snapshot_down.sh
 SCHEME=ec ./test_snapshot_down.sh
 
+./test_server_merge_degraded.sh
+
+./test_export_diff.sh
+SCHEME=ec ./test_export_diff.sh
+
 ./test_splitbrain.sh
 
 ./test_rebalance_verify.sh
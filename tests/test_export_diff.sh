@@ -0,0 +1,57 @@
+#!/bin/bash -ex
+
+. `dirname $0`/run_3osds.sh
+check_qemu
+
+# Test incremental export and import of a snapshot chain
+
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL create -s 32M testchain
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL create -s 32M testcopy
+
+LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+    fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4M -direct=1 -iodepth=1 -fsync=1 -rw=write \
+        -etcd=$ETCD_URL -image=testchain -mirror_file=./testdata/mirror.bin
+
+prev=
+for i in {1..4}; do
+    build/src/cmd/vitastor-cli --etcd_address $ETCD_URL snap-create testchain@$i
+    # Export changes since the previous snapshot and apply them to the copy
+    build/src/cmd/vitastor-cli --etcd_address $ETCD_URL export-diff testchain ${prev:+--from-snap $prev} \
+        --to-snap $i --output ./testdata/diff$i.bin
+    build/src/cmd/vitastor-cli --etcd_address $ETCD_URL import-diff ./testdata/diff$i.bin testcopy
+    qemu-img convert -p \
+        -f raw "vitastor:etcd_host=127.0.0.1\:$ETCD_PORT/v3:image=testcopy@$i" \
+        -O raw ./testdata/check.bin
+    cmp ./testdata/check.bin ./testdata/mirror.bin
+    # Write something to the image
+    LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+    fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bsrange=4k-64k -blockalign=4k -direct=1 -iodepth=4 -fsync=32 \
+        -rw=randwrite -randrepeat=0 -buffer_pattern=0x$((10+i))$((10+i))$((10+i))$((10+i)) \
+        -etcd=$ETCD_URL -image=testchain -number_ios=512 -mirror_file=./testdata/mirror.bin
+    prev=$i
+done
+
+# Incremental diffs only contain changed data
+[[ $(stat -c %s ./testdata/diff4.bin) -lt $(stat -c %s ./testdata/diff1.bin) ]]
+
+# Export changes of the image itself (without a target snapshot)
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL export-diff testchain --from-snap 4 --output ./testdata/diff5.bin
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL import-diff ./testdata/diff5.bin testcopy
+qemu-img convert -p \
+    -f raw "vitastor:etcd_host=127.0.0.1\:$ETCD_PORT/v3:image=testcopy" \
+    -O raw ./testdata/check.bin
+cmp ./testdata/check.bin ./testdata/mirror.bin
+
+# Resume an interrupted export: cut the diff in the middle of a record and continue it
+cp ./testdata/diff5.bin ./testdata/diff5_full.bin
+truncate -s $(($(stat -c %s ./testdata/diff5.bin) / 2 + 123)) ./testdata/diff5.bin
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL export-diff testchain --from-snap 4 --output ./testdata/diff5.bin --resume
+cmp ./testdata/diff5.bin ./testdata/diff5_full.bin
+
+# A truncated diff is rejected
+truncate -s $(($(stat -c %s ./testdata/diff5.bin) - 100)) ./testdata/diff5.bin
+if build/src/cmd/vitastor-cli --etcd_address $ETCD_URL import-diff ./testdata/diff5.bin testcopy; then
+    format_error "Truncated diff was imported"
+fi
+
+format_green OK
@@ -0,0 +1,55 @@
+#!/bin/bash -ex
+
+# Test merging layers inside OSDs when the target image has degraded objects
+
+PG_COUNT=${PG_COUNT:-16}
+PG_SIZE=${PG_SIZE:-3}
+PG_MINSIZE=${PG_MINSIZE:-2}
+GLOBAL_CONFIG=',"no_recovery":true'
+
+. `dirname $0`/run_3osds.sh
+check_qemu
+
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL create -s 128M testchain
+
+LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+    fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4M -direct=1 -iodepth=1 -fsync=1 -rw=write \
+        -etcd=$ETCD_URL -image=testchain -mirror_file=./testdata/mirror.bin
+
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL snap-create testchain@0
+
+# Stop one OSD and write to the child, so the OSD has outdated copies of objects when it returns
+kill -INT $OSD3_PID
+$ETCDCTL del /vitastor/osd/state/3
+wait_finish_rebalance 60 '(.state | contains(["active"]))'
+
+LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4k -direct=1 -iodepth=16 -fsync=32 -rw=randwrite \
+    -randrepeat=0 -etcd=$ETCD_URL -image=testchain -number_ios=2048 -mirror_file=./testdata/mirror.bin
+
+# Return the OSD, recovery is disabled, so objects of the target stay degraded during the merge
+start_osd 3
+wait_finish_rebalance 60 '(.state | contains(["active", "has_degraded"]))'
+
+# Delete the snapshot, merging layers inside OSDs
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL rm testchain@0 --server_merge 1
+
+qemu-img convert -p \
+    -f raw "vitastor:etcd_host=127.0.0.1\:$ETCD_PORT/v3:image=testchain" \
+    -O raw ./testdata/layer1.bin
+cmp ./testdata/layer1.bin ./testdata/mirror.bin
+
+# Enable recovery, wait until everything is clean and check that recovered copies are correct
+$ETCDCTL put /vitastor/config/global "$($ETCDCTL get --print-value-only /vitastor/config/global | jq -c '.no_recovery = false')"
+wait_finish_rebalance 120
+
+kill -INT $OSD1_PID
+$ETCDCTL del /vitastor/osd/state/1
+wait_finish_rebalance 60 '(.state | contains(["active"]))'
+
+qemu-img convert -p \
+    -f raw "vitastor:etcd_host=127.0.0.1\:$ETCD_PORT/v3:image=testchain" \
+    -O raw ./testdata/layer1.bin
+cmp ./testdata/layer1.bin ./testdata/mirror.bin
+
+format_green OK